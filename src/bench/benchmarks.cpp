@@ -0,0 +1,1004 @@
+// Benchmarks for the asset loader, GPU upload and CPU kernels of the viewer.
+//
+// Runs without a display: the optional OpenGL benchmarks use a headless
+// context (e.g. Mesa llvmpipe through EGL).
+//
+
+#include "cg_bench.h"
+#include "synthetic_assets.h"
+#include "gltf_io.h"
+#include "gltf_scene.h"
+#include "gltf_render.h"
+#include "gltf_occlusion.h"
+#include "gltf_software_render.h"
+#include "gltf_ambient_occlusion.h"
+#include "gltf_dedup.h"
+#include "gltf_scene_loader.h"
+#include "gltf_texture_arrays.h"
+#include "gltf_texture_compression.h"
+#include "gltf_frame_prep.h"
+#include "gltf_multi_draw.h"
+#include "cg_headless.h"
+#include "cg_jobs.h"
+#include "cg_upload.h"
+#include "cg_mipmap.h"
+#include "cg_parallel.h"
+#include "cg_utils.h"
+
+#include <GL/gl3w.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rapidjson/document.h>
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+    std::vector<std::string> assets = {"bunny.gltf", "armadillo.gltf", "gargo.gltf", "teapot.gltf",
+                                       "lpshead.gltf"};
+    std::vector<size_t> triangles = {1000000, 10000000, 100000000};
+    std::vector<size_t> nodes = {10000, 100000, 1000000};
+    std::vector<size_t> largeBuffers = {1000, 4000};  // In MB (10^6 bytes), uploaded with --gl
+    std::vector<size_t> threads;  // Of the job system (default 1, 2, 4, ... up to all)
+    bool gl = false;
+    bool allowEGL = true;
+    std::string jsonPath;
+    std::string tmpDir = "/tmp/";
+};
+
+std::string assets_dir()
+{
+    std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
+#ifdef MODEL_VIEWER_DEFAULT_ROOT
+    if (rootDir.empty()) rootDir = MODEL_VIEWER_DEFAULT_ROOT;
+#endif
+    return rootDir + "/assets/gltf/";
+}
+
+// Parses a list of counts such as "10k,1M"
+bool parse_counts(const char *text, std::vector<size_t> &counts)
+{
+    counts.clear();
+    std::string list(text);
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        char *suffix = nullptr;
+        double value = std::strtod(list.c_str() + start, &suffix);
+        if (*suffix == 'k' || *suffix == 'K') value *= 1e3;
+        if (*suffix == 'm' || *suffix == 'M') value *= 1e6;
+        if (value < 0.0) return false;
+        if (value >= 1.0) counts.push_back(size_t(value));
+        start = end + 1;
+    }
+    return true;
+}
+
+// Synthetic assets are expensive to create, so filters that name another
+// synthetic asset skip them. Filters for a stage (e.g. "parse_json") do not.
+bool synthetic_asset_enabled(const cg::BenchSuite &suite, const std::string &name)
+{
+    const std::string &filter = suite.settings.filter;
+    return filter.find("synthetic") == std::string::npos || name.find(filter) != std::string::npos ||
+           filter.find(name) != std::string::npos;
+}
+
+std::string count_label(size_t count)
+{
+    char label[32];
+    if (count >= 1000000 && count % 1000000 == 0) std::snprintf(label, sizeof(label), "%zuM", count / 1000000);
+    else if (count >= 1000 && count % 1000 == 0) std::snprintf(label, sizeof(label), "%zuk", count / 1000);
+    else std::snprintf(label, sizeof(label), "%zu", count);
+    return label;
+}
+
+size_t count_triangles(const gltf::GLTFAsset &asset)
+{
+    size_t triangles = 0;
+    for (const gltf::Mesh &mesh : asset.meshes) {
+        gltf::ArrayView<const gltf::Primitive> primitives = gltf::get_mesh_primitives(asset, mesh);
+        if (!primitives.empty()) triangles += size_t(asset.accessors[primitives[0].indices].count / 3);
+    }
+    return triangles;
+}
+
+size_t count_buffer_bytes(const gltf::GLTFAsset &asset)
+{
+    size_t bytes = 0;
+    for (const gltf::Buffer &buffer : asset.buffers) bytes += buffer.data.size();
+    return bytes;
+}
+
+// A camera that frames the whole asset, with one model matrix per node
+void frame_asset(const gltf::GLTFAsset &asset, glm::mat4 &viewProjection,
+                 std::vector<glm::mat4> &modelMatrices)
+{
+    modelMatrices = gltf::compute_node_world_matrices(asset);
+    std::vector<gltf::Bounds> meshBounds = gltf::compute_mesh_bounds(asset);
+    glm::vec3 min(INFINITY), max(-INFINITY);
+    for (size_t i = 0; i < asset.nodes.size(); ++i) {
+        if (asset.nodes[i].mesh < 0) continue;
+        const gltf::Bounds &b = meshBounds[asset.nodes[i].mesh];
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 p(corner & 1 ? b.max.x : b.min.x, corner & 2 ? b.max.y : b.min.y,
+                        corner & 4 ? b.max.z : b.min.z);
+            p = glm::vec3(modelMatrices[i] * glm::vec4(p, 1.0f));
+            min = glm::min(min, p), max = glm::max(max, p);
+        }
+    }
+    glm::vec3 center = 0.5f * (min + max);
+    float radius = std::max(0.5f * glm::length(max - min), 1e-6f);
+    glm::mat4 normalize = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / radius)) *
+                          glm::translate(glm::mat4(1.0f), -center);
+    for (glm::mat4 &matrix : modelMatrices) matrix = normalize * matrix;
+    viewProjection = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 10.0f) *
+                     glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// Benchmarks every stage of load_gltf_asset() for one file
+void bench_loader_stages(cg::BenchSuite &suite, const std::string &prefix, const std::string &dir,
+                         const std::string &filename)
+{
+    std::vector<char> text;
+    gltf::GLTFAsset asset;
+    if (!gltf::load_file_to_bytebuffer(dir + filename, text) ||
+        !gltf::create_gltf_asset_from_json(text.data(), text.size(), asset)) {
+        std::cerr << "Skipping " << filename << std::endl;
+        return;
+    }
+    gltf::load_gltf_buffers(dir, asset);
+    const double bytes = double(count_buffer_bytes(asset));
+    for (gltf::Buffer &buffer : asset.buffers) std::vector<char>().swap(buffer.data);
+
+    cg::bench_run(suite, prefix + "/read_json", [&] {
+        std::vector<char> buffer;
+        gltf::load_file_to_bytebuffer(dir + filename, buffer);
+    }, double(text.size()), "B");
+    cg::bench_run(suite, prefix + "/parse_json", [&] {
+        rapidjson::Document root;
+        root.Parse(text.data(), text.size());
+    }, double(text.size()), "B");
+    cg::bench_run(suite, prefix + "/create_from_json", [&] {
+        gltf::GLTFAsset scene;
+        gltf::create_gltf_asset_from_json(text.data(), text.size(), scene);
+    }, double(asset.nodes.size()), "nodes");
+
+    // The scene description is copied outside the timed region
+    gltf::GLTFAsset scene;
+    cg::bench_run(suite, prefix + "/load_buffers", [&] {
+        gltf::load_gltf_buffers(dir, scene);
+    }, bytes, "B", [&] { scene = asset; });
+
+    // Only decode images if they can all be found, to avoid repeated errors
+    scene = asset;
+    if (!asset.images.empty() && gltf::load_gltf_images(dir, scene)) {
+        cg::bench_run(suite, prefix + "/decode_images", [&] {
+            gltf::load_gltf_images(dir, scene);
+        }, double(asset.images.size()), "images", [&] { scene = asset; });
+    }
+    cg::bench_run(suite, prefix + "/load_gltf_asset", [&] {
+        gltf::GLTFAsset scene;
+        gltf::load_gltf_asset(filename, dir, scene);
+    }, bytes + text.size(), "B");
+    cg::bench_run(suite, prefix + "/load_default_scene", [&] {
+        gltf::GLTFAsset scene;
+        gltf::load_gltf_scene(filename, dir, -1, scene);
+    }, bytes + text.size(), "B");
+}
+
+// Walks the node hierarchy depth first, as an inspector or exporter would,
+// and reads the name, mesh and attributes of every node
+size_t traverse_nodes(const gltf::GLTFAsset &asset)
+{
+    size_t sum = 0;
+    std::vector<int> stack;
+    if (!asset.scenes.empty()) {
+        for (int node : gltf::get_scene_nodes(asset, asset.scenes[0])) stack.push_back(node);
+    } else if (!asset.nodes.empty()) {
+        stack.push_back(0);  // The root of synthetic assets
+    }
+    while (!stack.empty()) {
+        const gltf::Node &node = asset.nodes[stack.back()];
+        stack.pop_back();
+        sum += std::strlen(gltf::get_string(asset, node.name));
+        if (node.mesh >= 0) {
+            for (const gltf::Primitive &primitive : gltf::get_mesh_primitives(asset, asset.meshes[node.mesh])) {
+                const gltf::Attribute *position = gltf::find_attribute(asset, primitive, gltf::ATTRIBUTE_POSITION);
+                if (position) sum += size_t(asset.accessors[position->index].count);
+            }
+        }
+        for (int child : gltf::get_node_children(asset, node)) stack.push_back(child);
+    }
+    return sum;
+}
+
+// Benchmarks the CPU kernels of the viewer on a loaded asset
+void bench_kernels(cg::BenchSuite &suite, const std::string &prefix, const gltf::GLTFAsset &asset,
+                   bool heavy)
+{
+    const double triangles = double(count_triangles(asset));
+    if (cg::bench_enabled(suite, prefix + "/scene_memory")) {
+        const size_t sceneBytes = gltf::compute_scene_memory(asset);
+        std::printf("%-48s %10.3f MB\n", (prefix + "/scene_memory").c_str(), sceneBytes / 1e6);
+        suite.info.push_back(std::make_pair(prefix + "/scene_memory_bytes", std::to_string(sceneBytes)));
+    }
+    cg::bench_run(suite, prefix + "/traverse_nodes", [&] {
+        volatile size_t n = traverse_nodes(asset);
+        (void)n;
+    }, double(asset.nodes.size()), "nodes");
+    cg::bench_run(suite, prefix + "/mesh_bounds", [&] {
+        volatile size_t n = gltf::compute_mesh_bounds(asset).size();
+        (void)n;
+    }, triangles, "tris");
+    cg::bench_run(suite, prefix + "/world_matrices", [&] {
+        volatile size_t n = gltf::compute_node_world_matrices(asset).size();
+        (void)n;
+    }, double(asset.nodes.size()), "nodes");
+    if (!heavy) return;
+
+    // The asset is copied outside the timed region
+    gltf::GLTFAsset deduplicated;
+    gltf::DedupStats dedupStats;
+    cg::bench_run(suite, prefix + "/deduplicate", [&] {
+        gltf::deduplicate_gltf_asset(deduplicated, dedupStats);
+    }, double(count_buffer_bytes(asset)), "B", [&] { deduplicated = asset; });
+    if (cg::bench_enabled(suite, prefix + "/deduplicate")) {
+        const std::pair<const char *, size_t> saved[] = {
+            {"vertex", dedupStats.vertexBytesSaved}, {"mesh", dedupStats.meshBytesSaved},
+            {"buffer", dedupStats.bufferBytesSaved}, {"unreferenced", dedupStats.unreferencedBytes},
+            {"image", dedupStats.imageBytesSaved}};
+        for (const auto &it : saved) {
+            std::printf("%-48s %10.3f MB\n", (prefix + "/dedup_" + it.first + "_saved").c_str(), it.second / 1e6);
+            suite.info.push_back(
+                std::make_pair(prefix + "/dedup_" + it.first + "_bytes_saved", std::to_string(it.second)));
+        }
+    }
+
+    glm::mat4 viewProjection;
+    std::vector<glm::mat4> modelMatrices;
+    frame_asset(asset, viewProjection, modelMatrices);
+
+    gltf::OcclusionCuller culler;
+    gltf::occlusion_init(culler, asset);
+    cg::bench_run(suite, prefix + "/occlusion_culling", [&] {
+        gltf::occlusion_begin(culler, asset, viewProjection, glm::mat4(1.0f), &modelMatrices);
+        gltf::occlusion_end(culler);
+    }, double(asset.nodes.size()), "nodes");
+
+    gltf::SoftwareShading shading;
+    shading.projection = viewProjection;
+    shading.modelMatrices = modelMatrices;
+    gltf::SoftwareFramebuffer framebuffer;
+    cg::bench_run(suite, prefix + "/software_render_1024x512", [&] {
+        gltf::software_render(asset, shading, 1024, 512, 0, framebuffer);
+    }, triangles, "tris");
+
+    gltf::AOBakeSettings settings;
+    settings.raysPerVertex = 8;
+    cg::bench_run(suite, prefix + "/ao_bake_8_rays", [&] {
+        gltf::VertexOcclusion occlusion;
+        gltf::bake_ambient_occlusion(asset, settings, occlusion);
+    }, triangles, "tris");
+}
+
+// Benchmarks the upload of meshes and textures to OpenGL
+void bench_upload(cg::BenchSuite &suite, const std::string &prefix, const gltf::GLTFAsset &asset)
+{
+    gltf::DrawableList drawables;
+    cg::bench_run(suite, prefix + "/upload_drawables", [&] {
+        gltf::create_drawables_from_gltf_asset(drawables, asset);
+        glFinish();
+    }, double(count_buffer_bytes(asset)), "B", [&] {
+        gltf::destroy_drawables(drawables);
+        glFinish();
+    });
+    gltf::destroy_drawables(drawables);
+
+    if (asset.textures.empty()) return;
+    gltf::TextureList textures;
+    size_t texels = 0;
+    for (const gltf::Texture &texture : asset.textures) {
+        texels += size_t(asset.images[texture.source].width) * asset.images[texture.source].height;
+    }
+    cg::bench_run(suite, prefix + "/upload_textures", [&] {
+        gltf::create_textures_from_gltf_asset(textures, asset);
+        glFinish();
+    }, double(texels), "texels", [&] {
+        gltf::destroy_textures(textures);
+        glFinish();
+    });
+    gltf::destroy_textures(textures);
+}
+
+// Returns a memory field of the process (e.g. "VmHWM" for the peak resident
+// memory) in bytes, or 0 where /proc is not available
+size_t process_memory_bytes(const std::string &field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0)
+            return size_t(std::strtoull(line.c_str() + field.size() + 1, nullptr, 10)) << 10;
+    }
+    return 0;
+}
+
+// Resets the peak resident memory of the process to the current one
+void reset_peak_memory()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+}
+
+// Runs an upload benchmark and reports how much the resident memory of the
+// process grew over baseline while it ran, at the peak
+void bench_upload_memory(cg::BenchSuite &suite, const std::string &name, size_t baseline,
+                         const std::function<void()> &fn, double bytes, const std::function<void()> &setup)
+{
+    if (!cg::bench_enabled(suite, name)) return;
+    reset_peak_memory();
+    cg::bench_run(suite, name, fn, bytes, "B", setup);
+    size_t peak = process_memory_bytes("VmHWM");
+    if (!peak) return;
+    double growth = double(peak > baseline ? peak - baseline : 0);
+    std::printf("  peak memory: +%.0f MB (%.2fx the buffer)\n", growth / (1 << 20), growth / bytes);
+    suite.info.push_back(std::make_pair(name + "/peak_rss_bytes", std::to_string(size_t(growth))));
+}
+
+// Benchmarks the upload of a synthetic mesh file of the given size, streamed
+// from the file in chunks, and (up to 1 GB) loaded into memory first and
+// uploaded with glBufferData() or in chunks, for comparison. The peak memory
+// includes the GL buffer where the driver keeps it in host memory (as
+// llvmpipe does), which is the size of the mesh. Note that Mesa limits
+// buffers to 4 GiB.
+void bench_large_buffer(cg::BenchSuite &suite, const std::string &dir, size_t megabytes)
+{
+    std::string name = "synthetic_" + std::to_string(megabytes) + "_MB";
+    if (!synthetic_asset_enabled(suite, name)) return;
+    if (!gltf::write_synthetic_mesh_file(dir, name, megabytes * 1000000)) return;
+    const std::string prefix = "gl/" + name;
+    cg::StagingPool staging;
+    cg::staging_pool_init(staging);
+    gltf::DrawableList drawables;
+    auto destroy = [&] {
+        gltf::destroy_drawables(drawables);
+        glFinish();
+    };
+
+    size_t baseline = process_memory_bytes("VmRSS");
+    gltf::GLTFAsset asset;
+    if (gltf::load_gltf_scene(name + ".gltf", dir, -1, asset, 0)) {
+        double bytes = double(asset.buffers[0].byteLength);
+        bench_upload_memory(suite, prefix + "/upload_streamed", baseline, [&] {
+            gltf::create_drawables_from_gltf_asset(drawables, asset, &staging);
+            glFinish();
+        }, bytes, destroy);
+        destroy();
+    }
+
+    if (megabytes <= 1000) {
+        asset = gltf::GLTFAsset();
+        baseline = process_memory_bytes("VmRSS");
+        if (gltf::load_gltf_asset(name + ".gltf", dir, asset)) {
+            const gltf::Buffer &buffer = asset.buffers[0];
+            double bytes = double(buffer.data.size());
+            GLuint glBuffer = 0;
+            bench_upload_memory(suite, prefix + "/upload_resident_buffer_data", baseline, [&] {
+                glGenBuffers(1, &glBuffer);
+                glBindBuffer(GL_ARRAY_BUFFER, glBuffer);
+                glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(buffer.data.size()), buffer.data.data(),
+                             GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glFinish();
+            }, bytes, [&] {
+                glDeleteBuffers(1, &glBuffer);
+                glFinish();
+            });
+            glDeleteBuffers(1, &glBuffer);
+            bench_upload_memory(suite, prefix + "/upload_resident_chunked", baseline, [&] {
+                gltf::create_drawables_from_gltf_asset(drawables, asset, &staging);
+                glFinish();
+            }, bytes, destroy);
+            destroy();
+        }
+    }
+    cg::staging_pool_destroy(staging);
+    std::remove((dir + name + ".gltf").c_str());
+    std::remove((dir + name + ".bin").c_str());
+}
+
+// The images of an asset, for mip generation
+std::vector<cg::MipChain> image_mip_chains(const gltf::GLTFAsset &asset, size_t &texels)
+{
+    std::vector<bool> srgb = gltf::srgb_images(asset);
+    std::vector<cg::MipChain> chains;
+    texels = 0;
+    for (size_t i = 0; i < asset.images.size(); ++i) {
+        const gltf::Image &image = asset.images[i];
+        if (image.data.empty() || image.width <= 0 || image.height <= 0) continue;
+        cg::MipChain chain;
+        chain.rgba = reinterpret_cast<const uint8_t *>(image.data.data());
+        chain.width = image.width;
+        chain.height = image.height;
+        chain.srgb = srgb[i];
+        chains.push_back(chain);
+        texels += size_t(image.width) * image.height;
+    }
+    return chains;
+}
+
+// Benchmarks the CPU mip generation of all images of an asset
+void bench_mipmaps(cg::BenchSuite &suite, const std::string &prefix, const gltf::GLTFAsset &asset)
+{
+    size_t texels = 0;
+    std::vector<cg::MipChain> chains = image_mip_chains(asset, texels);
+    if (chains.empty()) return;
+    const char *names[] = {"box", "kaiser"};
+    for (int filter = 0; filter < 2; ++filter) {
+        cg::MipSettings settings;
+        settings.filter = cg::MipFilter(filter);
+        cg::bench_run(suite, prefix + "/mipmaps_" + names[filter], [&] {
+            cg::generate_mip_chains(chains, settings);
+        }, double(texels), "texels");
+        settings.threads = 1;
+        cg::bench_run(suite, prefix + "/mipmaps_" + names[filter] + "_1_thread", [&] {
+            cg::generate_mip_chains(chains, settings);
+        }, double(texels), "texels");
+    }
+}
+
+// Benchmarks glGenerateMipmap against uploading the levels generated on the
+// CPU (with and without the time to generate them)
+void bench_mipmap_upload(cg::BenchSuite &suite, const std::string &prefix, const gltf::GLTFAsset &asset)
+{
+    size_t texels = 0;
+    std::vector<cg::MipChain> chains = image_mip_chains(asset, texels);
+    if (chains.empty()) return;
+    gltf::TextureList textures;
+    auto upload = [&](bool generate, bool uploadLevels) {
+        textures.resize(chains.size());
+        glGenTextures(GLsizei(textures.size()), textures.data());
+        for (size_t i = 0; i < chains.size(); ++i) {
+            const cg::MipChain &chain = chains[i];
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, chain.width, chain.height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, chain.rgba);
+            if (generate) glGenerateMipmap(GL_TEXTURE_2D);
+            int width = chain.width, height = chain.height;
+            for (size_t level = 0; uploadLevels && level < chain.levels.size(); ++level) {
+                width = std::max(1, width / 2), height = std::max(1, height / 2);
+                glTexImage2D(GL_TEXTURE_2D, GLint(level + 1), GL_RGBA8, width, height, 0, GL_RGBA,
+                             GL_UNSIGNED_BYTE, chain.levels[level].data());
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFinish();
+    };
+    auto destroy = [&] {
+        gltf::destroy_textures(textures);
+        glFinish();
+    };
+    cg::bench_run(suite, prefix + "/mipmaps_glGenerateMipmap", [&] { upload(true, false); },
+                  double(texels), "texels", destroy);
+    destroy();
+    cg::bench_run(suite, prefix + "/mipmaps_cpu_generate_and_upload", [&] {
+        cg::generate_mip_chains(chains);
+        upload(false, true);
+    }, double(texels), "texels", destroy);
+    destroy();
+    cg::generate_mip_chains(chains);
+    cg::bench_run(suite, prefix + "/mipmaps_cpu_upload_only", [&] { upload(false, true); },
+                  double(texels), "texels", destroy);
+    destroy();
+}
+
+// Benchmarks the block encoders on the first image of an asset, and records
+// the PSNR of each format and quality
+void bench_texture_compression(cg::BenchSuite &suite, const std::string &prefix,
+                               const gltf::GLTFAsset &asset)
+{
+    const gltf::Image *image = nullptr;
+    for (const gltf::Image &candidate : asset.images) {
+        if (!candidate.data.empty() && candidate.width > 0 && candidate.height > 0) {
+            image = &candidate;
+            break;
+        }
+    }
+    if (!image) return;
+    const uint8_t *rgba = reinterpret_cast<const uint8_t *>(image->data.data());
+    const double pixels = double(image->width) * image->height;
+    std::vector<uint8_t> decoded(size_t(image->width) * image->height * 4);
+    const gltf::TextureFormat formats[] = {gltf::TEXTURE_BC1, gltf::TEXTURE_BC3, gltf::TEXTURE_BC5,
+                                           gltf::TEXTURE_BC7};
+    const char *qualities[] = {"fast", "high"};
+    for (gltf::TextureFormat format : formats) {
+        std::vector<uint8_t> blocks(gltf::texture_level_size(format, image->width, image->height));
+        for (int q = 0; q < 2; ++q) {
+            std::string name = prefix + "/encode_" + gltf::texture_format_name(format) + "_" +
+                               qualities[q];
+            if (!cg::bench_enabled(suite, name)) continue;
+            gltf::CompressionQuality quality = gltf::CompressionQuality(q);
+            cg::bench_run(suite, name, [&] {
+                gltf::encode_texture_blocks(format, rgba, image->width, image->height, quality,
+                                            blocks.data());
+            }, pixels, "pixels");
+            gltf::decode_texture_blocks(format, blocks.data(), image->width, image->height,
+                                        decoded.data());
+            double psnr =
+                gltf::texture_psnr(format, rgba, decoded.data(), image->width, image->height);
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.2f", psnr);
+            suite.info.push_back(std::make_pair(name + "/psnr_db", std::string(text)));
+        }
+    }
+}
+
+// Upload all levels of the packed texture arrays of an asset, either as they
+// are or compressed
+void upload_texture_arrays(gltf::TextureList &textures, const gltf::GLTFAsset &asset,
+                           const gltf::TexturePacking &packing,
+                           const std::vector<gltf::ArrayLevels> &levels)
+{
+    textures.resize(packing.arrays.size());
+    glGenTextures(GLsizei(textures.size()), textures.data());
+    for (size_t i = 0; i < packing.arrays.size(); ++i) {
+        const gltf::PackedArray &array = packing.arrays[i];
+        const GLsizei layers = GLsizei(array.images.size());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        for (int level = 0; level < int(levels[i].levels.size()); ++level) {
+            int width = std::max(1, array.width >> level);
+            int height = std::max(1, array.height >> level);
+            const uint8_t *data = gltf::array_level_data(asset, array, levels[i], level);
+            if (levels[i].format == GL_RGBA8) {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, layers, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, data);
+            } else {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, levels[i].format, width, height,
+                                       layers, 0, GLsizei(levels[i].levels[level].size()), data);
+            }
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Benchmarks the upload of the texture arrays of an asset as RGBA8 and block
+// compressed, and records the memory of both
+void bench_texture_array_upload(cg::BenchSuite &suite, const std::string &prefix,
+                                const gltf::GLTFAsset &asset)
+{
+    gltf::TexturePacking packing = gltf::pack_textures(asset);
+    if (packing.arrays.empty()) return;
+    gltf::TextureCompressionSettings settings;
+    settings.enabled = true;
+    settings.quality = gltf::COMPRESSION_FAST;
+    gltf::TextureCompressionStats stats;
+    std::vector<gltf::ArrayLevels> compressed =
+        gltf::compress_texture_arrays(asset, packing, settings, "", &stats);
+    settings.enabled = false;
+    std::vector<gltf::ArrayLevels> uncompressed =
+        gltf::compress_texture_arrays(asset, packing, settings, "");
+
+    gltf::TextureList textures;
+    cg::bench_run(suite, prefix + "/upload_texture_arrays_rgba8", [&] {
+        upload_texture_arrays(textures, asset, packing, uncompressed);
+        glFinish();
+    }, double(stats.uncompressedBytes), "B", [&] {
+        gltf::destroy_textures(textures);
+        glFinish();
+    });
+    gltf::destroy_textures(textures);
+    cg::bench_run(suite, prefix + "/upload_texture_arrays_compressed", [&] {
+        upload_texture_arrays(textures, asset, packing, compressed);
+        glFinish();
+    }, double(stats.uncompressedBytes), "B", [&] {
+        gltf::destroy_textures(textures);
+        glFinish();
+    });
+    gltf::destroy_textures(textures);
+    suite.info.push_back(
+        std::make_pair(prefix + "/texture_bytes_rgba8", std::to_string(stats.uncompressedBytes)));
+    suite.info.push_back(std::make_pair(prefix + "/texture_bytes_compressed",
+                                        std::to_string(stats.compressedBytes)));
+}
+
+void bench_image_decode(cg::BenchSuite &suite, const std::string &dir, const std::string &filename)
+{
+    std::vector<char> encoded;
+    if (!gltf::load_file_to_bytebuffer(dir + filename, encoded)) return;
+    int width = 0, height = 0, channels = 0;
+    stbi_info_from_memory(reinterpret_cast<const stbi_uc *>(encoded.data()), int(encoded.size()), &width,
+                          &height, &channels);
+    cg::bench_run(suite, "image/" + filename + "/decode", [&] {
+        int w, h, c;
+        stbi_uc *pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(encoded.data()),
+                                                int(encoded.size()), &w, &h, &c, 4);
+        stbi_image_free(pixels);
+    }, double(width) * height, "pixels");
+}
+
+// Default thread counts for scaling numbers: powers of two, and all threads
+std::vector<size_t> default_thread_counts()
+{
+    std::vector<size_t> counts;
+    const size_t all = size_t(cg::hardware_threads());
+    for (size_t count = 1; count < all; count *= 2) counts.push_back(count);
+    counts.push_back(all);
+    return counts;
+}
+
+// Benchmarks the overhead of the job system: spawning and waiting for empty
+// jobs, a fine-grained parallel loop, and a chain of continuations
+void bench_job_system(cg::BenchSuite &suite, const std::vector<size_t> &threadCounts)
+{
+    std::vector<float> values(size_t(1) << 22, 1.0f);
+    for (size_t threads : threadCounts) {
+        const std::string suffix = "_" + std::to_string(threads) + "_threads";
+        cg::JobSystem jobs;
+        cg::job_system_init(jobs, int(threads));
+
+        const size_t spawnCount = 100000;
+        cg::bench_run(suite, "jobs/spawn_wait" + suffix, [&] {
+            cg::JobCounter counter;
+            for (size_t i = 0; i < spawnCount; ++i) cg::job_spawn(jobs, [] {}, &counter);
+            cg::job_wait(jobs, counter);
+        }, double(spawnCount), "jobs");
+
+        cg::bench_run(suite, "jobs/parallel_for_4M" + suffix, [&] {
+            cg::JobCounter counter;
+            cg::job_parallel_for(jobs, values.size(), 4096, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) values[i] = values[i] * 0.5f + 0.5f;
+            }, &counter);
+            cg::job_wait(jobs, counter);
+        }, double(values.size()), "items");
+
+        // Each link only starts when the previous one has finished
+        const size_t chainLength = 10000;
+        cg::bench_run(suite, "jobs/continuation_chain" + suffix, [&] {
+            std::vector<std::unique_ptr<cg::JobCounter>> counters;
+            for (size_t i = 0; i < chainLength; ++i) counters.emplace_back(new cg::JobCounter());
+            cg::job_spawn(jobs, [] {}, counters[0].get());
+            for (size_t i = 1; i < chainLength; ++i)
+                cg::job_then(jobs, *counters[i - 1], [] {}, counters[i].get());
+            cg::job_wait(jobs, *counters.back());
+        }, double(chainLength), "jobs");
+
+        cg::job_system_destroy(jobs);
+    }
+}
+
+// Benchmarks the frame preparation job graph (transforms, culling, sorting
+// and draw packets) of an asset, on each number of threads
+void bench_frame_prep(cg::BenchSuite &suite, const std::string &prefix,
+                      const gltf::GLTFAsset &asset, const std::vector<size_t> &threadCounts)
+{
+    glm::mat4 viewProjection;
+    std::vector<glm::mat4> modelMatrices;
+    frame_asset(asset, viewProjection, modelMatrices);
+    gltf::FramePrep prep;
+    gltf::frame_prep_init(prep, asset);
+    gltf::FramePrepInput input;
+    input.projection = viewProjection;
+    for (size_t threads : threadCounts) {
+        const std::string name = prefix + "/frame_prep_" + std::to_string(threads) + "_threads";
+        if (!cg::bench_enabled(suite, name)) continue;
+        cg::JobSystem jobs;
+        cg::job_system_init(jobs, int(threads));
+        cg::bench_run(suite, name, [&] {
+            gltf::frame_prep_run(prep, jobs, asset, input);
+        }, double(asset.nodes.size()), "nodes");
+        cg::job_system_destroy(jobs);
+    }
+}
+
+// Vertex shader of the draw submission benchmarks, which finds its model
+// matrix like mesh.vert does
+const char *DRAW_BENCH_VERTEX_SHADER = R"(#version 330
+#extension GL_ARB_shader_draw_parameters : enable
+layout(location = 0) in vec4 a_position;
+uniform samplerBuffer u_models;
+uniform int u_drawIndex;
+uniform mat4 u_viewProjection;
+void main()
+{
+#ifdef GL_ARB_shader_draw_parameters
+    int texel = (u_drawIndex + gl_DrawIDARB) * 4;
+#else
+    int texel = u_drawIndex * 4;
+#endif
+    mat4 model = mat4(texelFetch(u_models, texel), texelFetch(u_models, texel + 1),
+                      texelFetch(u_models, texel + 2), texelFetch(u_models, texel + 3));
+    gl_Position = u_viewProjection * model * a_position;
+}
+)";
+
+const char *DRAW_BENCH_FRAGMENT_SHADER = R"(#version 330
+out vec4 frag_color;
+void main() { frag_color = vec4(1.0); }
+)";
+
+GLuint compile_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Returns 0 if the shaders do not link
+GLuint create_draw_bench_program()
+{
+    GLuint program = glCreateProgram();
+    GLuint shaders[2] = {compile_shader(GL_VERTEX_SHADER, DRAW_BENCH_VERTEX_SHADER),
+                         compile_shader(GL_FRAGMENT_SHADER, DRAW_BENCH_FRAGMENT_SHADER)};
+    for (GLuint shader : shaders) {
+        glAttachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    glLinkProgram(program);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// Benchmarks the submission of one draw per node, as the viewer does it: with
+// one glDrawElements call per draw, and with glMultiDrawElementsIndirect
+// where it is available. The model matrices are read from a buffer texture,
+// and the time includes the rendering to a small framebuffer.
+void bench_draw_submission(cg::BenchSuite &suite, const std::string &prefix,
+                           const gltf::GLTFAsset &asset)
+{
+    const std::string perDrawName = prefix + "/submit_per_draw";
+    const std::string multiDrawName = prefix + "/submit_multi_draw";
+    if (!cg::bench_enabled(suite, perDrawName) && !cg::bench_enabled(suite, multiDrawName)) return;
+    const GLuint program = create_draw_bench_program();
+    if (!program) {
+        std::cerr << "Error: failed to link the draw submission benchmark shaders" << std::endl;
+        return;
+    }
+
+    glm::mat4 viewProjection;
+    std::vector<glm::mat4> modelMatrices;
+    frame_asset(asset, viewProjection, modelMatrices);
+    std::vector<gltf::DrawPacket> packets;
+    for (size_t i = 0; i < asset.nodes.size(); ++i) {
+        if (asset.nodes[i].mesh < 0) continue;
+        packets.push_back(gltf::DrawPacket());
+        packets.back().node = int(i);
+        packets.back().mesh = asset.nodes[i].mesh;
+    }
+    std::stable_sort(packets.begin(), packets.end(),
+                     [](const gltf::DrawPacket &a, const gltf::DrawPacket &b) { return a.mesh < b.mesh; });
+
+    std::vector<glm::mat4> models(packets.size());
+    for (size_t i = 0; i < packets.size(); ++i) models[i] = modelMatrices[packets[i].node];
+    GLuint buffers[2];  // Model matrices and draw commands
+    glGenBuffers(2, buffers);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(models.size() * sizeof(glm::mat4)), models.data(),
+                 GL_STATIC_DRAW);
+    GLuint modelTexture;
+    glGenTextures(1, &modelTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, modelTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[0]);
+
+    GLuint framebuffer, renderbuffer;
+    glGenRenderbuffers(1, &renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 256, 256);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+    glViewport(0, 0, 256, 256);
+
+    gltf::DrawableList drawables;
+    gltf::create_drawables_from_gltf_asset(drawables, asset);
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_viewProjection"), 1, GL_FALSE,
+                       &viewProjection[0][0]);
+    const GLint drawIndexLocation = glGetUniformLocation(program, "u_drawIndex");
+
+    cg::bench_run(suite, perDrawName, [&] {
+        glClear(GL_COLOR_BUFFER_BIT);
+        GLuint vao = 0;
+        for (size_t i = 0; i < packets.size(); ++i) {
+            const gltf::Drawable &drawable = drawables[packets[i].mesh];
+            const gltf::IndexRange indices = gltf::get_drawable_indices(drawable, packets[i].lod);
+            glUniform1i(drawIndexLocation, int(i));
+            if (drawable.vao != vao) glBindVertexArray(vao = drawable.vao);
+            glDrawElements(GL_TRIANGLES, indices.count, drawable.indexType,
+                           (GLvoid *)(intptr_t)indices.byteOffset);
+        }
+        glFinish();
+    }, double(packets.size()), "draws");
+
+    if (gltf::multi_draw_supported()) {
+        gltf::MultiDrawList list;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[1]);
+        cg::bench_run(suite, multiDrawName, [&] {
+            glClear(GL_COLOR_BUFFER_BIT);
+            gltf::multi_draw_build(list, packets, drawables);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                         GLsizeiptr(list.commands.size() * sizeof(gltf::DrawElementsIndirectCommand)),
+                         list.commands.data(), GL_STREAM_DRAW);
+            for (const gltf::MultiDrawRun &run : list.runs) {
+                glUniform1i(drawIndexLocation, run.first);
+                glBindVertexArray(run.vao);
+                gltf::multi_draw_submit(run, 0);
+            }
+            glFinish();
+        }, double(packets.size()), "draws");
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gltf::destroy_drawables(drawables);
+    glDeleteTextures(1, &modelTexture);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &renderbuffer);
+    glDeleteBuffers(2, buffers);
+    glDeleteProgram(program);
+}
+
+void print_usage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options] [file.gltf...]\n"
+              << "  --warmup N         untimed runs before each benchmark (default 1)\n"
+              << "  --repetitions N    timed runs of each benchmark (default 5)\n"
+              << "  --filter TEXT      only run benchmarks whose name contains TEXT\n"
+              << "  --json FILE        write the results as JSON\n"
+              << "  --gl               also benchmark uploads to OpenGL (headless context)\n"
+              << "  --no-egl           use a hidden GLFW window instead of EGL for --gl\n"
+              << "  --triangles LIST   synthetic mesh sizes (default 1M,10M,100M; 0 for none)\n"
+              << "  --nodes LIST       synthetic node counts (default 10k,100k,1M; 0 for none),\n"
+              << "                     also drawn one draw per node with --gl\n"
+              << "  --large-buffers LIST\n"
+              << "                     synthetic mesh files in MB that are streamed to OpenGL\n"
+              << "                     with --gl (default 1000,4000; 0 for none)\n"
+              << "  --threads LIST     job system thread counts (default 1,2,4,... up to all)\n"
+              << "  --tmp DIR          directory for synthetic asset files (default /tmp)\n"
+              << "Files default to the bundled assets in assets/gltf.\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    cg::BenchSuite suite;
+    BenchOptions options;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--warmup" && hasValue) {
+            suite.settings.warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--repetitions" && hasValue) {
+            suite.settings.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--filter" && hasValue) {
+            suite.settings.filter = argv[++i];
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--gl") {
+            options.gl = true;
+        } else if (arg == "--no-egl") {
+            options.allowEGL = false;
+        } else if (arg == "--triangles" && hasValue && parse_counts(argv[i + 1], options.triangles)) {
+            i++;
+        } else if (arg == "--nodes" && hasValue && parse_counts(argv[i + 1], options.nodes)) {
+            i++;
+        } else if (arg == "--large-buffers" && hasValue && parse_counts(argv[i + 1], options.largeBuffers)) {
+            i++;
+        } else if (arg == "--threads" && hasValue && parse_counts(argv[i + 1], options.threads)) {
+            i++;
+        } else if (arg == "--tmp" && hasValue) {
+            options.tmpDir = std::string(argv[++i]) + "/";
+        } else if (arg.compare(0, 2, "--") == 0) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (!files.empty()) options.assets = files;
+    if (options.threads.empty()) options.threads = default_thread_counts();
+
+    cg::HeadlessContext hc;
+    if (options.gl) {
+        if (!cg::headless_context_create(hc, options.allowEGL) || gl3wInit() || !gl3wIsSupported(3, 3)) {
+            std::cerr << "Error: failed to create headless OpenGL context, skipping GL benchmarks" << std::endl;
+            options.gl = false;
+        } else {
+            suite.info.push_back(std::make_pair("gl_renderer", std::string((const char *)glGetString(GL_RENDERER))));
+        }
+    }
+    suite.info.push_back(std::make_pair("hardware_threads", std::to_string(cg::hardware_threads())));
+#ifdef NDEBUG
+    suite.info.push_back(std::make_pair("asserts", "off"));
+#else
+    suite.info.push_back(std::make_pair("asserts", "on"));
+#endif
+
+    bench_job_system(suite, options.threads);
+
+    // Bundled (or given) assets
+    for (const std::string &path : options.assets) {
+        size_t separator = path.find_last_of("/\\");
+        std::string dir = separator == std::string::npos ? assets_dir() : path.substr(0, separator + 1);
+        std::string filename = separator == std::string::npos ? path : path.substr(separator + 1);
+        std::string name = filename.substr(0, filename.find_last_of('.'));
+
+        bench_loader_stages(suite, "load/" + name, dir, filename);
+        gltf::GLTFAsset asset;
+        if (!gltf::load_gltf_asset(filename, dir, asset)) continue;
+        bench_kernels(suite, "kernel/" + name, asset, true);
+        bench_mipmaps(suite, "texture/" + name, asset);
+        bench_texture_compression(suite, "texture/" + name, asset);
+        if (options.gl) {
+            bench_upload(suite, "gl/" + name, asset);
+            bench_mipmap_upload(suite, "gl/" + name, asset);
+            bench_texture_array_upload(suite, "gl/" + name, asset);
+        }
+        for (const gltf::Image &image : asset.images) {
+            if (!image.data.empty()) bench_image_decode(suite, dir, image.uri);
+        }
+    }
+
+    // Synthetic meshes and node hierarchies, written to files so that the
+    // loader is measured at scale
+    for (size_t triangles : options.triangles) {
+        std::string name = "synthetic_" + count_label(triangles) + "_triangles";
+        if (!synthetic_asset_enabled(suite, name)) continue;
+        if (!gltf::write_gltf_asset(options.tmpDir, name, gltf::create_synthetic_mesh_asset(triangles)))
+            continue;
+        bench_loader_stages(suite, "load/" + name, options.tmpDir, name + ".gltf");
+        gltf::GLTFAsset asset;
+        if (gltf::load_gltf_asset(name + ".gltf", options.tmpDir, asset)) {
+            bench_kernels(suite, "kernel/" + name, asset, false);
+            if (options.gl) bench_upload(suite, "gl/" + name, asset);
+        }
+        std::remove((options.tmpDir + name + ".gltf").c_str());
+        std::remove((options.tmpDir + name + ".bin").c_str());
+    }
+    for (size_t nodes : options.nodes) {
+        std::string name = "synthetic_" + count_label(nodes) + "_nodes";
+        if (!synthetic_asset_enabled(suite, name)) continue;
+        if (!gltf::write_gltf_asset(options.tmpDir, name, gltf::create_synthetic_node_asset(nodes))) continue;
+        bench_loader_stages(suite, "load/" + name, options.tmpDir, name + ".gltf");
+        gltf::GLTFAsset asset;
+        if (gltf::load_gltf_asset(name + ".gltf", options.tmpDir, asset)) {
+            bench_kernels(suite, "kernel/" + name, asset, false);
+            bench_frame_prep(suite, "kernel/" + name, asset, options.threads);
+            if (options.gl) bench_draw_submission(suite, "gl/" + name, asset);
+        }
+        std::remove((options.tmpDir + name + ".gltf").c_str());
+        std::remove((options.tmpDir + name + ".bin").c_str());
+    }
+
+    // Meshes of several GB, streamed from their files to OpenGL
+    for (size_t megabytes : options.largeBuffers) {
+        if (options.gl) bench_large_buffer(suite, options.tmpDir, megabytes);
+    }
+
+    if (options.gl) cg::headless_context_destroy(hc);
+    if (!options.jsonPath.empty() && !cg::bench_write_json(suite, options.jsonPath)) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+// Minimal benchmark harness.
+//
+
+#include "cg_bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+namespace cg {
+
+namespace {
+
+double median_of_sorted(const std::vector<double> &sorted)
+{
+    size_t n = sorted.size();
+    if (n == 0) return 0.0;
+    return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+}
+
+void json_string(FILE *file, const std::string &s)
+{
+    std::fputc('"', file);
+    for (char c : s) {
+        if (c == '"' || c == '\\') std::fputc('\\', file);
+        if (uint8_t(c) >= 0x20) std::fputc(c, file);
+    }
+    std::fputc('"', file);
+}
+
+void print_result(const BenchResult &result)
+{
+    std::printf("%-48s %10.3f ms +- %8.3f (min %.3f, max %.3f)", result.name.c_str(), result.medianMs,
+                result.madMs, result.minMs, result.maxMs);
+    if (result.items > 0.0 && result.medianMs > 0.0) {
+        double perSecond = result.items / (result.medianMs * 1e-3);
+        const char *prefix = "";
+        if (perSecond >= 1e9) perSecond *= 1e-9, prefix = "G";
+        else if (perSecond >= 1e6) perSecond *= 1e-6, prefix = "M";
+        else if (perSecond >= 1e3) perSecond *= 1e-3, prefix = "k";
+        std::printf("  %.2f %s%s/s", perSecond, prefix, result.itemName.c_str());
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+}  // namespace
+
+bool bench_enabled(const BenchSuite &suite, const std::string &name)
+{
+    return suite.settings.filter.empty() || name.find(suite.settings.filter) != std::string::npos;
+}
+
+void bench_run(BenchSuite &suite, const std::string &name, const std::function<void()> &fn, double items,
+               const std::string &itemName, const std::function<void()> &setup)
+{
+    if (!bench_enabled(suite, name)) return;
+
+    typedef std::chrono::steady_clock Clock;
+    for (int i = 0; i < suite.settings.warmup; ++i) {
+        if (setup) setup();
+        fn();
+    }
+    std::vector<double> timesMs;
+    for (int i = 0; i < std::max(1, suite.settings.repetitions); ++i) {
+        if (setup) setup();
+        Clock::time_point start = Clock::now();
+        fn();
+        timesMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.items = items;
+    result.itemName = itemName;
+    bench_summarize(timesMs, result);
+    print_result(result);
+    suite.results.push_back(result);
+}
+
+void bench_summarize(std::vector<double> timesMs, BenchResult &result)
+{
+    std::sort(timesMs.begin(), timesMs.end());
+    result.repetitions = int(timesMs.size());
+    result.medianMs = median_of_sorted(timesMs);
+    result.minMs = timesMs.empty() ? 0.0 : timesMs.front();
+    result.maxMs = timesMs.empty() ? 0.0 : timesMs.back();
+    std::vector<double> deviations;
+    for (double ms : timesMs) deviations.push_back(std::fabs(ms - result.medianMs));
+    std::sort(deviations.begin(), deviations.end());
+    result.madMs = median_of_sorted(deviations);
+}
+
+bool bench_write_json(const BenchSuite &suite, const std::string &filename)
+{
+    FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    std::fprintf(file, "{\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"info\": {",
+                 suite.settings.warmup, suite.settings.repetitions);
+    for (size_t i = 0; i < suite.info.size(); ++i) {
+        std::fprintf(file, "%s\n    ", i ? "," : "");
+        json_string(file, suite.info[i].first);
+        std::fprintf(file, ": ");
+        json_string(file, suite.info[i].second);
+    }
+    std::fprintf(file, "\n  },\n  \"benchmarks\": [");
+    for (size_t i = 0; i < suite.results.size(); ++i) {
+        const BenchResult &result = suite.results[i];
+        std::fprintf(file, "%s\n    {\"name\": ", i ? "," : "");
+        json_string(file, result.name);
+        std::fprintf(file,
+                     ", \"repetitions\": %d, \"median_ms\": %.6f, \"mad_ms\": %.6f, \"min_ms\": %.6f, "
+                     "\"max_ms\": %.6f",
+                     result.repetitions, result.medianMs, result.madMs, result.minMs, result.maxMs);
+        if (result.items > 0.0) {
+            std::fprintf(file, ", \"items\": %.0f, \"item_name\": ", result.items);
+            json_string(file, result.itemName);
+        }
+        std::fprintf(file, "}");
+    }
+    std::fprintf(file, "\n  ]\n}\n");
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+}  // namespace cg
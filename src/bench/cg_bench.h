@@ -0,0 +1,53 @@
+// Minimal benchmark harness.
+//
+// Every benchmark runs a few untimed warmup iterations and then a number of
+// timed repetitions, and is summarized by the median and the median absolute
+// deviation (MAD), which are robust against the occasional slow outlier.
+//
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cg {
+
+struct BenchSettings {
+    int warmup = 1;
+    int repetitions = 5;
+    std::string filter;  // Only run benchmarks whose name contains this
+};
+
+struct BenchResult {
+    std::string name;
+    int repetitions = 0;
+    double medianMs = 0.0;
+    double madMs = 0.0;
+    double minMs = 0.0;
+    double maxMs = 0.0;
+    double items = 0.0;    // Work done per repetition (e.g. triangles or bytes)
+    std::string itemName;  // Unit of the items, for throughput
+};
+
+struct BenchSuite {
+    BenchSettings settings;
+    std::vector<BenchResult> results;
+    std::vector<std::pair<std::string, std::string>> info;  // Written to the JSON output
+};
+
+// Returns true if a benchmark of this name passes the filter
+bool bench_enabled(const BenchSuite &suite, const std::string &name);
+
+// Run and time fn. If given, setup runs untimed before every call of fn. The
+// result is printed and added to the suite.
+void bench_run(BenchSuite &suite, const std::string &name, const std::function<void()> &fn,
+               double items = 0.0, const std::string &itemName = "",
+               const std::function<void()> &setup = std::function<void()>());
+
+// Compute the median and MAD of a list of times (in milliseconds)
+void bench_summarize(std::vector<double> timesMs, BenchResult &result);
+
+bool bench_write_json(const BenchSuite &suite, const std::string &filename);
+
+}  // namespace cg
@@ -0,0 +1,308 @@
+// Synthetic glTF assets of arbitrary size, for benchmarks.
+//
+
+#include "synthetic_assets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace gltf {
+
+namespace {
+
+const int FLOAT = 5126;         // GL_FLOAT
+const int UNSIGNED_INT = 5125;  // GL_UNSIGNED_INT
+
+Node default_node(int mesh)
+{
+    Node node;
+    node.mesh = mesh;
+    node.translation = glm::vec3(0.0f);
+    node.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    node.scale = glm::vec3(1.0f);
+    node.matrix = -1;
+    return node;
+}
+
+// Writes the positions of row y of a grid of cols x rows quads in [-1, 1]^2
+void grid_row_positions(size_t cols, size_t rows, size_t y, float *positions)
+{
+    for (size_t x = 0; x <= cols; ++x) {
+        float u = 2.0f * x / cols - 1.0f, v = 2.0f * y / rows - 1.0f;
+        float *p = positions + 3 * x;
+        p[0] = u, p[1] = v, p[2] = 0.05f * std::sin(8.0f * u) * std::cos(8.0f * v);
+    }
+}
+
+// Writes the indices of the quads of row y of the grid
+void grid_row_indices(size_t cols, size_t y, uint32_t *indices)
+{
+    for (size_t x = 0; x < cols; ++x) {
+        uint32_t i = uint32_t(y * (cols + 1) + x), j = i + uint32_t(cols + 1);
+        uint32_t quad[6] = {i, i + 1, j + 1, i, j + 1, j};
+        std::memcpy(indices, quad, sizeof(quad));
+        indices += 6;
+    }
+}
+
+// Returns the columns and rows of a grid of about the given number of quads
+void grid_size(size_t quads, size_t &cols, size_t &rows)
+{
+    quads = std::max(size_t(1), quads);
+    cols = size_t(std::ceil(std::sqrt(double(quads))));
+    rows = (quads + cols - 1) / cols;
+}
+
+// Add a mesh with a grid of cols x rows quads in [-1, 1]^2 to the asset,
+// with its data appended to the first buffer
+void add_grid_mesh(GLTFAsset &asset, size_t cols, size_t rows)
+{
+    size_t numVertices = (cols + 1) * (rows + 1), numIndices = cols * rows * 6;
+    size_t positionBytes = numVertices * 12, indexBytes = numIndices * 4;
+    if (asset.buffers.empty()) asset.buffers.push_back(Buffer());
+    Buffer &buffer = asset.buffers[0];
+    size_t offset = buffer.data.size();
+    buffer.data.resize(offset + positionBytes + indexBytes);
+
+    float *positions = reinterpret_cast<float *>(&buffer.data[offset]);
+    for (size_t y = 0; y <= rows; ++y) grid_row_positions(cols, rows, y, positions + 3 * y * (cols + 1));
+    uint32_t *indices = reinterpret_cast<uint32_t *>(&buffer.data[offset + positionBytes]);
+    for (size_t y = 0; y < rows; ++y) grid_row_indices(cols, y, indices + 6 * y * cols);
+    buffer.byteLength = int64_t(buffer.data.size());
+
+    int view = int(asset.bufferViews.size());
+    BufferView positionView = {0, int64_t(positionBytes), int64_t(offset), 0};
+    BufferView indexView = {0, int64_t(indexBytes), int64_t(offset + positionBytes), 0};
+    asset.bufferViews.push_back(positionView);
+    asset.bufferViews.push_back(indexView);
+
+    int accessor = int(asset.accessors.size());
+    Accessor positionAccessor = {view, FLOAT, int64_t(numVertices), 0, ACCESSOR_VEC3, false, -1};
+    Accessor indexAccessor = {view + 1, UNSIGNED_INT, int64_t(numIndices), 0, ACCESSOR_SCALAR, false,
+                              -1};
+    asset.accessors.push_back(positionAccessor);
+    asset.accessors.push_back(indexAccessor);
+
+    Attribute position = {ATTRIBUTE_POSITION, add_string(asset, "POSITION"), accessor};
+    Primitive primitive;
+    primitive.attributes = add_span(asset.attributes, &position, 1);
+    primitive.indices = accessor + 1;
+    primitive.hasMaterial = false;
+    primitive.material = 0;
+    Mesh mesh;
+    mesh.name = add_string(asset, "Grid");
+    mesh.primitives = add_span(asset.primitives, &primitive, 1);
+    asset.meshes.push_back(mesh);
+}
+
+// Computes the bounds of a float VEC3 accessor
+void accessor_bounds(const GLTFAsset &asset, const Accessor &accessor, glm::vec3 &min, glm::vec3 &max)
+{
+    int stride;
+    const char *data = get_accessor_data(asset, accessor, 12, stride);
+    min = glm::vec3(INFINITY), max = glm::vec3(-INFINITY);
+    for (int64_t i = 0; i < accessor.count; ++i) {
+        glm::vec3 p;
+        std::memcpy(&p, data + size_t(i) * stride, sizeof(p));
+        min = glm::min(min, p), max = glm::max(max, p);
+    }
+}
+
+}  // namespace
+
+GLTFAsset create_synthetic_mesh_asset(size_t triangles)
+{
+    size_t cols, rows;
+    grid_size((triangles + 1) / 2, cols, rows);
+
+    GLTFAsset asset;
+    add_grid_mesh(asset, cols, rows);
+    asset.nodes.push_back(default_node(0));
+    asset.nodes[0].name = asset.meshes[0].name;
+    return asset;
+}
+
+GLTFAsset create_synthetic_node_asset(size_t nodes)
+{
+    GLTFAsset asset;
+    add_grid_mesh(asset, 1, 1);
+    asset.nodes.resize(std::max(size_t(1), nodes), default_node(0));
+    asset.nodeIndices.reserve(asset.nodes.size() - 1);
+    for (size_t i = 0; i < asset.nodes.size(); ++i) {
+        Node &node = asset.nodes[i];
+        node.name = add_string(asset, "Node" + std::to_string(i));
+        node.translation = glm::vec3(float(i % 8) - 3.5f, float((i / 8) % 8) - 3.5f, 0.5f) * 0.25f;
+        node.scale = glm::vec3(0.5f);
+        node.children.offset = uint32_t(asset.nodeIndices.size());
+        for (size_t child = 8 * i + 1; child <= 8 * i + 8 && child < asset.nodes.size(); ++child) {
+            asset.nodeIndices.push_back(int(child));
+            node.children.count++;
+        }
+    }
+    return asset;
+}
+
+bool write_gltf_asset(const std::string &dir, const std::string &name, const GLTFAsset &asset)
+{
+    size_t totalBytes = 0;
+    for (const Buffer &buffer : asset.buffers) totalBytes += buffer.data.size();
+
+    std::string binFilename = dir + name + ".bin", gltfFilename = dir + name + ".gltf";
+    FILE *bin = std::fopen(binFilename.c_str(), "wb");
+    FILE *file = std::fopen(gltfFilename.c_str(), "w");
+    if (!bin || !file) {
+        std::cerr << "Error: Could not write " << gltfFilename << std::endl;
+        if (bin) std::fclose(bin);
+        if (file) std::fclose(file);
+        return false;
+    }
+
+    // All buffers are concatenated into one, so buffer views are offset
+    std::vector<size_t> bufferOffsets;
+    size_t offset = 0;
+    for (const Buffer &buffer : asset.buffers) {
+        bufferOffsets.push_back(offset);
+        offset += buffer.data.size();
+        if (!buffer.data.empty()) std::fwrite(buffer.data.data(), 1, buffer.data.size(), bin);
+    }
+
+    std::fprintf(file, "{\n\"asset\":{\"generator\":\"model_viewer_bench\",\"version\":\"2.0\"},\n");
+    std::fprintf(file, "\"nodes\":[");
+    for (size_t i = 0; i < asset.nodes.size(); ++i) {
+        const Node &node = asset.nodes[i];
+        std::fprintf(file, "%s\n{\"mesh\":%d,\"name\":\"%s\"", i ? "," : "", node.mesh,
+                     get_string(asset, node.name));
+        ArrayView<const int> children = get_node_children(asset, node);
+        if (!children.empty()) {
+            std::fprintf(file, ",\"children\":[");
+            for (size_t j = 0; j < children.size(); ++j) {
+                std::fprintf(file, "%s%d", j ? "," : "", children[j]);
+            }
+            std::fprintf(file, "]");
+        }
+        if (node.matrix >= 0) {
+            const glm::mat4 &matrix = asset.matrices[node.matrix];
+            std::fprintf(file, ",\"matrix\":[");
+            for (int j = 0; j < 16; ++j) std::fprintf(file, "%s%.9g", j ? "," : "", matrix[j / 4][j % 4]);
+            std::fprintf(file, "]");
+        } else {
+            const glm::vec3 &t = node.translation, &s = node.scale;
+            const glm::quat &r = node.rotation;
+            std::fprintf(file, ",\"translation\":[%.9g,%.9g,%.9g]", t.x, t.y, t.z);
+            std::fprintf(file, ",\"rotation\":[%.9g,%.9g,%.9g,%.9g]", r.x, r.y, r.z, r.w);
+            std::fprintf(file, ",\"scale\":[%.9g,%.9g,%.9g]", s.x, s.y, s.z);
+        }
+        std::fprintf(file, "}");
+    }
+    std::fprintf(file, "],\n\"meshes\":[");
+    for (size_t i = 0; i < asset.meshes.size(); ++i) {
+        std::fprintf(file, "%s\n{\"name\":\"%s\",\"primitives\":[", i ? "," : "",
+                     get_string(asset, asset.meshes[i].name));
+        ArrayView<const Primitive> primitives = get_mesh_primitives(asset, asset.meshes[i]);
+        for (size_t j = 0; j < primitives.size(); ++j) {
+            std::fprintf(file, "%s{\"attributes\":{", j ? "," : "");
+            ArrayView<const Attribute> attributes = get_primitive_attributes(asset, primitives[j]);
+            for (size_t k = 0; k < attributes.size(); ++k) {
+                std::fprintf(file, "%s\"%s\":%d", k ? "," : "", get_string(asset, attributes[k].name),
+                             attributes[k].index);
+            }
+            std::fprintf(file, "},\"indices\":%d", primitives[j].indices);
+            if (primitives[j].hasMaterial) std::fprintf(file, ",\"material\":%d", primitives[j].material);
+            std::fprintf(file, "}");
+        }
+        std::fprintf(file, "]}");
+    }
+    std::fprintf(file, "],\n\"accessors\":[");
+    for (size_t i = 0; i < asset.accessors.size(); ++i) {
+        const Accessor &accessor = asset.accessors[i];
+        std::fprintf(file, "%s\n{\"bufferView\":%d,\"componentType\":%d,\"count\":%lld,\"byteOffset\":%lld,"
+                     "\"type\":\"%s\"", i ? "," : "", accessor.bufferView, accessor.componentType,
+                     (long long)accessor.count, (long long)accessor.byteOffset,
+                     accessor_type_name(accessor.type));
+        if (accessor.type == ACCESSOR_VEC3 && accessor.componentType == FLOAT) {
+            glm::vec3 min, max;  // Required for POSITION attributes
+            accessor_bounds(asset, accessor, min, max);
+            std::fprintf(file, ",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]", min.x, min.y, min.z,
+                         max.x, max.y, max.z);
+        }
+        std::fprintf(file, "}");
+    }
+    std::fprintf(file, "],\n\"bufferViews\":[");
+    for (size_t i = 0; i < asset.bufferViews.size(); ++i) {
+        const BufferView &view = asset.bufferViews[i];
+        std::fprintf(file, "%s\n{\"buffer\":0,\"byteLength\":%lld,\"byteOffset\":%zu", i ? "," : "",
+                     (long long)view.byteLength, bufferOffsets[view.buffer] + size_t(view.byteOffset));
+        if (view.byteStride) std::fprintf(file, ",\"byteStride\":%d", view.byteStride);
+        std::fprintf(file, "}");
+    }
+    std::fprintf(file, "],\n\"buffers\":[{\"byteLength\":%zu,\"uri\":\"%s.bin\"}]\n}\n", totalBytes,
+                 name.c_str());
+
+    bool ok = !std::ferror(file) && !std::ferror(bin);
+    std::fclose(file);
+    std::fclose(bin);
+    if (!ok) std::cerr << "Error: Could not write " << gltfFilename << std::endl;
+    return ok;
+}
+
+bool write_synthetic_mesh_file(const std::string &dir, const std::string &name, size_t bytes)
+{
+    // 12 bytes per vertex and 24 bytes of indices per quad
+    size_t cols, rows;
+    grid_size(bytes / 36, cols, rows);
+    size_t positionBytes = (cols + 1) * (rows + 1) * 12, indexBytes = cols * rows * 24;
+
+    std::string binFilename = dir + name + ".bin", gltfFilename = dir + name + ".gltf";
+    FILE *bin = std::fopen(binFilename.c_str(), "wb");
+    FILE *file = std::fopen(gltfFilename.c_str(), "w");
+    if (!bin || !file) {
+        std::cerr << "Error: Could not write " << gltfFilename << std::endl;
+        if (bin) std::fclose(bin);
+        if (file) std::fclose(file);
+        return false;
+    }
+
+    // One row at a time, so that only a row is in memory
+    std::vector<float> positions(3 * (cols + 1));
+    glm::vec3 min(INFINITY), max(-INFINITY);
+    for (size_t y = 0; y <= rows && !std::ferror(bin); ++y) {
+        grid_row_positions(cols, rows, y, positions.data());
+        for (size_t x = 0; x <= cols; ++x) {
+            glm::vec3 p(positions[3 * x], positions[3 * x + 1], positions[3 * x + 2]);
+            min = glm::min(min, p), max = glm::max(max, p);
+        }
+        std::fwrite(positions.data(), sizeof(float), positions.size(), bin);
+    }
+    std::vector<uint32_t> indices(6 * cols);
+    for (size_t y = 0; y < rows && !std::ferror(bin); ++y) {
+        grid_row_indices(cols, y, indices.data());
+        std::fwrite(indices.data(), sizeof(uint32_t), indices.size(), bin);
+    }
+
+    std::fprintf(file, "{\n\"asset\":{\"generator\":\"model_viewer_bench\",\"version\":\"2.0\"},\n");
+    std::fprintf(file, "\"nodes\":[{\"mesh\":0,\"name\":\"Grid\"}],\n");
+    std::fprintf(file, "\"meshes\":[{\"name\":\"Grid\",\"primitives\":[{\"attributes\":{\"POSITION\":0},"
+                       "\"indices\":1}]}],\n");
+    std::fprintf(file, "\"accessors\":[\n{\"bufferView\":0,\"componentType\":%d,\"count\":%zu,"
+                       "\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},", FLOAT,
+                 (cols + 1) * (rows + 1), min.x, min.y, min.z, max.x, max.y, max.z);
+    std::fprintf(file, "\n{\"bufferView\":1,\"componentType\":%d,\"count\":%zu,\"type\":\"SCALAR\"}],\n",
+                 UNSIGNED_INT, cols * rows * 6);
+    std::fprintf(file, "\"bufferViews\":[\n{\"buffer\":0,\"byteLength\":%zu,\"byteOffset\":0},",
+                 positionBytes);
+    std::fprintf(file, "\n{\"buffer\":0,\"byteLength\":%zu,\"byteOffset\":%zu}],\n", indexBytes,
+                 positionBytes);
+    std::fprintf(file, "\"buffers\":[{\"byteLength\":%zu,\"uri\":\"%s.bin\"}]\n}\n",
+                 positionBytes + indexBytes, name.c_str());
+
+    bool ok = !std::ferror(file) && !std::ferror(bin);
+    std::fclose(file);
+    ok &= std::fclose(bin) == 0;
+    if (!ok) std::cerr << "Error: Could not write " << gltfFilename << std::endl;
+    return ok;
+}
+
+}  // namespace gltf
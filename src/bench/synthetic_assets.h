@@ -0,0 +1,30 @@
+// Synthetic glTF assets of arbitrary size, for benchmarks.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <string>
+
+namespace gltf {
+
+// A single grid mesh with at least the given number of triangles. Only
+// POSITION and 32-bit indices are stored, so that even 100M triangles fit
+// in a few GB.
+GLTFAsset create_synthetic_mesh_asset(size_t triangles);
+
+// A tree of nodes (eight children per node) that all reference one small
+// mesh, with distinct translations and names
+GLTFAsset create_synthetic_node_asset(size_t nodes);
+
+// Write the geometry and nodes of an asset to <dir><name>.gltf, with all
+// buffers in <dir><name>.bin (materials and images are not written)
+bool write_gltf_asset(const std::string &dir, const std::string &name, const GLTFAsset &asset);
+
+// Write the grid mesh of create_synthetic_mesh_asset(), of about the given size in bytes, to <dir><name>.gltf
+// and <dir><name>.bin one row at a time, so that meshes larger than memory
+// can be written (e.g. for the streamed upload benchmarks)
+bool write_synthetic_mesh_file(const std::string &dir, const std::string &name, size_t bytes);
+
+}  // namespace gltf
@@ -0,0 +1,285 @@
+// Frame capture to video streams or image sequences.
+//
+
+#include "cg_capture.h"
+#include "cg_parallel.h"
+#include "cg_profiler.h"
+#include "cg_utils.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace cg {
+
+struct CaptureWriter {
+    static const int MAX_QUEUED_FRAMES = 8;
+
+    CaptureFormat format;
+    std::string path;
+    int fps;
+    FILE *file = nullptr;
+    bool isPipe = false;
+    int streamWidth = 0;  // Size of the first frame of a stream
+    int streamHeight = 0;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;  // Protects the members below
+    std::condition_variable condition;
+    std::deque<ReadbackImage> queue;
+    std::vector<std::vector<uint8_t>> freeBuffers;
+    bool stopping = false;
+    CaptureStats stats;
+    bool writeError = false;
+};
+
+namespace {
+
+bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string png_sequence_filename(const std::string &path, int frame)
+{
+    std::string prefix = ends_with(path, ".png") ? path.substr(0, path.size() - 4) : path;
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%05d.png", frame);
+    return prefix + number;
+}
+
+// Convert bottom-first RGBA8 to planar 4:2:0 YCbCr (BT.601, full range as in
+// C420jpeg). The width and height must be even.
+void rgba_to_yuv420(const ReadbackImage &image, int width, int height, std::vector<uint8_t> &yuv)
+{
+    yuv.resize(size_t(width) * height * 3 / 2);
+    uint8_t *Y = &yuv[0], *U = Y + size_t(width) * height, *V = U + size_t(width) * height / 4;
+    const size_t rowSize = size_t(image.width) * 4;
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t *rows[2] = {&image.pixels[(image.height - 1 - y) * rowSize],
+                                  &image.pixels[(image.height - 2 - y) * rowSize]};
+        for (int x = 0; x < width; x += 2) {
+            int sumR = 0, sumG = 0, sumB = 0;
+            for (int dy = 0; dy < 2; ++dy) {
+                for (int dx = 0; dx < 2; ++dx) {
+                    const uint8_t *p = rows[dy] + (x + dx) * 4;
+                    int r = p[0], g = p[1], b = p[2];
+                    Y[size_t(y + dy) * width + x + dx] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+                    sumR += r, sumG += g, sumB += b;
+                }
+            }
+            int cb = (-43 * sumR - 85 * sumG + 128 * sumB + 512) / 1024 + 128;
+            int cr = (128 * sumR - 107 * sumG - 21 * sumB + 512) / 1024 + 128;
+            U[size_t(y / 2) * (width / 2) + x / 2] = uint8_t(std::max(0, std::min(255, cb)));
+            V[size_t(y / 2) * (width / 2) + x / 2] = uint8_t(std::max(0, std::min(255, cr)));
+        }
+    }
+}
+
+// Convert bottom-first RGBA8 to top-first RGB24
+void rgba_to_rgb(const ReadbackImage &image, std::vector<uint8_t> &rgb)
+{
+    rgb.resize(size_t(image.width) * image.height * 3);
+    const size_t rowSize = size_t(image.width) * 4;
+    for (int y = 0; y < image.height; ++y) {
+        const uint8_t *src = &image.pixels[(image.height - 1 - y) * rowSize];
+        uint8_t *dst = &rgb[size_t(y) * image.width * 3];
+        for (int x = 0; x < image.width; ++x) {
+            dst[3 * x + 0] = src[4 * x + 0];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+}
+
+// Write one frame. Returns the number of bytes written, or zero on failure.
+size_t write_frame(CaptureWriter &writer, const ReadbackImage &image, std::vector<uint8_t> &scratch)
+{
+    if (writer.format == CAPTURE_PNG_SEQUENCE) {
+        std::string filename = png_sequence_filename(writer.path, image.tag);
+        if (!save_png_image(filename, image.width, image.height, image.pixels)) return 0;
+        return image.pixels.size();
+    }
+
+    // Streams have a fixed size, so frames of another size (e.g. after the
+    // window was resized) are skipped
+    if (writer.streamWidth == 0) {
+        writer.streamWidth = image.width;
+        writer.streamHeight = image.height;
+        if (writer.format == CAPTURE_Y4M) {
+            std::fprintf(writer.file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                         image.width & ~1, image.height & ~1, writer.fps);
+        }
+    }
+    if (image.width != writer.streamWidth || image.height != writer.streamHeight) return 0;
+
+    if (writer.format == CAPTURE_Y4M) {
+        rgba_to_yuv420(image, image.width & ~1, image.height & ~1, scratch);
+        std::fputs("FRAME\n", writer.file);
+    } else {
+        rgba_to_rgb(image, scratch);
+    }
+    if (std::fwrite(&scratch[0], 1, scratch.size(), writer.file) != scratch.size()) return 0;
+    return scratch.size();
+}
+
+void writer_thread(CaptureWriter *writer)
+{
+    profiler_set_thread_name("Capture Writer");
+    std::vector<uint8_t> scratch;
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    while (true) {
+        writer->condition.wait(lock, [&] { return writer->stopping || !writer->queue.empty(); });
+        if (writer->queue.empty()) break;  // Stopping, and all frames are written
+        ReadbackImage image = std::move(writer->queue.front());
+        writer->queue.pop_front();
+        lock.unlock();
+
+        size_t bytes;
+        {
+            CG_PROFILE_SCOPE("Write Frame");
+            bytes = write_frame(*writer, image, scratch);
+        }
+
+        lock.lock();
+        if (bytes) {
+            writer->stats.framesWritten++;
+            writer->stats.bytesWritten += bytes;
+        } else {
+            writer->stats.framesDropped++;
+            writer->writeError |= writer->format != CAPTURE_PNG_SEQUENCE && ferror(writer->file);
+        }
+        writer->freeBuffers.push_back(std::move(image.pixels));
+    }
+}
+
+// Move completed readbacks to the writer queue. If wait is true, this blocks
+// until the oldest readback has completed. Returns false if none completed.
+bool fetch_frame(FrameCapture &capture, bool wait)
+{
+    CaptureWriter &writer = *capture.writer;
+    ReadbackImage image;
+    {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        if (!writer.freeBuffers.empty()) {
+            image.pixels = std::move(writer.freeBuffers.back());
+            writer.freeBuffers.pop_back();
+        }
+    }
+    if (!readback_fetch(capture.readback, image, wait)) {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        writer.freeBuffers.push_back(std::move(image.pixels));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    if (writer.queue.size() >= size_t(CaptureWriter::MAX_QUEUED_FRAMES)) {
+        writer.stats.framesDropped++;  // The writers cannot keep up
+        writer.freeBuffers.push_back(std::move(image.pixels));
+    } else {
+        writer.queue.push_back(std::move(image));
+        writer.condition.notify_one();
+    }
+    return true;
+}
+
+}  // namespace
+
+CaptureFormat capture_format_from_path(const std::string &path)
+{
+    if (ends_with(path, ".png")) return CAPTURE_PNG_SEQUENCE;
+    if (ends_with(path, ".rgb") || ends_with(path, ".raw")) return CAPTURE_RAW_RGB;
+    return CAPTURE_Y4M;
+}
+
+bool capture_start(FrameCapture &capture, const std::string &path, CaptureFormat format, int fps,
+                   int numThreads)
+{
+    if (capture.recording) capture_stop(capture);
+
+    std::shared_ptr<CaptureWriter> writer = std::make_shared<CaptureWriter>();
+    writer->format = format;
+    writer->path = path;
+    writer->fps = std::max(1, fps);
+    writer->isPipe = !path.empty() && path[0] == '|';
+    if (format != CAPTURE_PNG_SEQUENCE) {
+        writer->file = writer->isPipe ? popen(path.c_str() + 1, "w") : std::fopen(path.c_str(), "wb");
+        if (!writer->file) {
+            std::cerr << "Error: Could not open " << path << " for capture" << std::endl;
+            return false;
+        }
+    }
+
+    // Streams must be written in order, so only PNG encoding is parallel
+    int numWriters = format == CAPTURE_PNG_SEQUENCE ? (numThreads > 0 ? numThreads : hardware_threads()) : 1;
+    for (int i = 0; i < numWriters; ++i) {
+        writer->threads.push_back(std::thread(writer_thread, writer.get()));
+    }
+
+    capture.format = format;
+    capture.path = path;
+    capture.fps = writer->fps;
+    capture.framesIssued = 0;
+    capture.writer = writer;
+    readback_init(capture.readback);
+    capture.recording = true;
+    return true;
+}
+
+void capture_frame(FrameCapture &capture, GLuint framebuffer, int width, int height)
+{
+    if (!capture.recording || width <= 0 || height <= 0) return;
+
+    while (fetch_frame(capture, false)) {}
+    if (readback_full(capture.readback)) fetch_frame(capture, true);
+    if (readback_issue(capture.readback, framebuffer, width, height, int(capture.framesIssued)))
+        capture.framesIssued++;
+}
+
+void capture_stop(FrameCapture &capture)
+{
+    if (!capture.recording) return;
+
+    while (readback_pending(capture.readback)) fetch_frame(capture, true);
+    readback_destroy(capture.readback);
+    CaptureWriter &writer = *capture.writer;
+    {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        writer.stopping = true;
+    }
+    writer.condition.notify_all();
+    for (auto &thread : writer.threads) thread.join();
+    if (writer.file) {
+        if (writer.isPipe) pclose(writer.file);
+        else std::fclose(writer.file);
+    }
+    capture.recording = false;
+
+    const CaptureStats &stats = writer.stats;
+    std::cout << "Captured " << stats.framesWritten << " frames (" << stats.framesDropped
+              << " dropped, " << stats.bytesWritten / (1024.0 * 1024.0) << " MB) to "
+              << capture.path << std::endl;
+    if (writer.writeError) std::cerr << "Error: Writing to " << capture.path << " failed" << std::endl;
+    capture.writer.reset();
+}
+
+CaptureStats capture_stats(const FrameCapture &capture)
+{
+    if (!capture.writer) return CaptureStats();
+    std::lock_guard<std::mutex> lock(capture.writer->mutex);
+    CaptureStats stats = capture.writer->stats;
+    stats.framesQueued = unsigned(capture.writer->queue.size());
+    return stats;
+}
+
+}  // namespace cg
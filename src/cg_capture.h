@@ -0,0 +1,62 @@
+// Frame capture to video streams or image sequences.
+//
+// Frames are read back asynchronously through the pixel-pack buffer ring of
+// cg_readback, and converted and written by writer threads, so that
+// recording does not stall rendering. Frames are dropped (and counted)
+// rather than blocking the render loop if the writers fall behind.
+//
+
+#pragma once
+
+#include "cg_readback.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cg {
+
+enum CaptureFormat {
+    CAPTURE_Y4M = 0,           // YUV4MPEG2 stream (4:2:0), e.g. for piping to ffmpeg
+    CAPTURE_RAW_RGB = 1,       // Raw RGB24 frames, top row first
+    CAPTURE_PNG_SEQUENCE = 2,  // Numbered PNG files, encoded in parallel
+};
+
+struct CaptureWriter;  // Writer threads and their frame queue
+
+struct FrameCapture {
+    bool recording = false;
+    CaptureFormat format = CAPTURE_Y4M;
+    std::string path;  // File, "|command" for a pipe, or PNG filename prefix
+    int fps = 60;
+    PixelReadback readback;
+    unsigned framesIssued = 0;
+    std::shared_ptr<CaptureWriter> writer;
+};
+
+struct CaptureStats {
+    unsigned framesWritten = 0;
+    unsigned framesDropped = 0;  // Because the writers fell behind or failed
+    unsigned framesQueued = 0;
+    uint64_t bytesWritten = 0;
+};
+
+// Returns the format implied by a path: PNG sequence for .png, raw RGB for
+// .rgb and .raw, and Y4M otherwise (including pipes)
+CaptureFormat capture_format_from_path(const std::string &path);
+
+// Start recording. For PNG sequences, numThreads encoders are used (zero
+// uses all hardware threads). Returns false if the output could not be opened.
+bool capture_start(FrameCapture &capture, const std::string &path, CaptureFormat format,
+                   int fps = 60, int numThreads = 0);
+
+// Capture the color attachment 0 of a framebuffer (0 for the back buffer).
+// Call once per frame, after rendering.
+void capture_frame(FrameCapture &capture, GLuint framebuffer, int width, int height);
+
+// Finish all pending readbacks and writes, and close the output
+void capture_stop(FrameCapture &capture);
+
+CaptureStats capture_stats(const FrameCapture &capture);
+
+}  // namespace cg
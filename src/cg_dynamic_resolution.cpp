@@ -0,0 +1,127 @@
+// Dynamic resolution scaling driven by measured GPU frame time.
+//
+
+#include "cg_dynamic_resolution.h"
+#include "cg_gl_state.h"
+#include "cg_memory.h"
+
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+namespace cg {
+
+void dynamic_resolution_resize(DynamicResolution &dynres, int width, int height)
+{
+    if (dynres.fbo && dynres.width == width && dynres.height == height) return;
+    if (!dynres.fbo) {
+        glGenFramebuffers(1, &dynres.fbo);
+        glGenTextures(1, &dynres.colorTexture);
+        glGenRenderbuffers(1, &dynres.depthRenderbuffer);
+    }
+    dynres.width = width;
+    dynres.height = height;
+
+    gl_state_bind_texture(GL_TEXTURE_2D, dynres.colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl_state_bind_texture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, dynres.depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    memory_track_gl(GL_TEXTURE, dynres.colorTexture, MEMORY_GL_RENDER_TARGETS,
+                    gl_image_bytes(GL_RGBA8, width, height));
+    memory_track_gl(GL_RENDERBUFFER, dynres.depthRenderbuffer, MEMORY_GL_RENDER_TARGETS,
+                    gl_image_bytes(GL_DEPTH_COMPONENT24, width, height));
+
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, dynres.fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dynres.colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                              dynres.depthRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: framebuffer object not complete" << std::endl;
+    }
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void dynamic_resolution_destroy(DynamicResolution &dynres)
+{
+    glDeleteFramebuffers(1, &dynres.fbo);
+    memory_release_gl(GL_TEXTURE, 1, &dynres.colorTexture);
+    memory_release_gl(GL_RENDERBUFFER, 1, &dynres.depthRenderbuffer);
+    glDeleteTextures(1, &dynres.colorTexture);
+    glDeleteRenderbuffers(1, &dynres.depthRenderbuffer);
+    gpu_timer_destroy(dynres.timer);
+    dynres.fbo = dynres.colorTexture = dynres.depthRenderbuffer = 0;
+    dynres.width = dynres.height = 0;
+}
+
+void dynamic_resolution_update(DynamicResolution &dynres)
+{
+    if (!gpu_timer_poll(dynres.timer)) return;
+    if (!dynres.enabled) {
+        dynres.scale = dynres.maxScale;
+        return;
+    }
+
+    // GPU time is roughly proportional to the number of shaded pixels, i.e.,
+    // to the square of the scale factor. Small errors are ignored, and the
+    // step is damped, since results arrive several frames late.
+    double measuredMs = glm::max(dynres.timer.lastMs, 0.01);
+    double error = (measuredMs - dynres.targetMs) / dynres.targetMs;
+    if (glm::abs(error) < 0.05) return;
+    double desired = dynres.scale * glm::sqrt(dynres.targetMs / measuredMs);
+    double scale = dynres.scale + 0.25 * (desired - dynres.scale);
+
+    // Quantize to avoid shimmering from tiny changes of the render size
+    scale = glm::round(scale * 64.0) / 64.0;
+    dynres.scale = glm::clamp(float(scale), dynres.minScale, dynres.maxScale);
+}
+
+int dynamic_resolution_render_width(const DynamicResolution &dynres)
+{
+    float scale = dynres.enabled ? dynres.scale : 1.0f;
+    return glm::max(1, int(dynres.width * scale + 0.5f));
+}
+
+int dynamic_resolution_render_height(const DynamicResolution &dynres)
+{
+    float scale = dynres.enabled ? dynres.scale : 1.0f;
+    return glm::max(1, int(dynres.height * scale + 0.5f));
+}
+
+void dynamic_resolution_upscale(const DynamicResolution &dynres, GLuint upscaleProgram,
+                                GLuint emptyVAO, int width, int height)
+{
+    int renderWidth = dynamic_resolution_render_width(dynres);
+    int renderHeight = dynamic_resolution_render_height(dynres);
+
+    if (dynres.filter == UPSCALE_BILINEAR || !upscaleProgram) {
+        gl_state_bind_framebuffer(GL_READ_FRAMEBUFFER, dynres.fbo);
+        glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        gl_state_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+        return;
+    }
+
+    gl_state_viewport(0, 0, width, height);
+    gl_state_disable(GL_DEPTH_TEST);
+    gl_state_use_program(upscaleProgram);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, dynres.colorTexture);
+    glUniform1i(glGetUniformLocation(upscaleProgram, "u_source"), 0);
+    glUniform2f(glGetUniformLocation(upscaleProgram, "u_sourceScale"),
+                float(renderWidth) / dynres.width, float(renderHeight) / dynres.height);
+    glUniform2f(glGetUniformLocation(upscaleProgram, "u_texelSize"), 1.0f / dynres.width,
+                1.0f / dynres.height);
+    gl_state_bind_vertex_array(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl_state_bind_vertex_array(0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+    gl_state_use_program(0);
+}
+
+}  // namespace cg
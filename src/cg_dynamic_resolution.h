@@ -0,0 +1,55 @@
+// Dynamic resolution scaling driven by measured GPU frame time.
+//
+// The scene is rendered into the lower-left part of an offscreen target that
+// is allocated at full framebuffer size, so changing the scale factor never
+// reallocates anything. The result is then upscaled to the backbuffer.
+//
+
+#pragma once
+
+#include "cg_gpu_timer.h"
+
+#include <GL/gl3w.h>
+
+namespace cg {
+
+enum UpscaleFilter { UPSCALE_BILINEAR = 0, UPSCALE_EDGE_AWARE = 1 };
+
+// Struct for the dynamic resolution controller and its render target
+struct DynamicResolution {
+    bool enabled = false;
+    float targetMs = 14.0f;  // Target GPU time of the scene passes
+    float scale = 1.0f;      // Current scale factor (per axis)
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    int filter = UPSCALE_EDGE_AWARE;
+    GpuTimer timer;
+
+    GLuint fbo = 0;
+    GLuint colorTexture = 0;
+    GLuint depthRenderbuffer = 0;
+    int width = 0;   // Allocated (full) size of the render target
+    int height = 0;
+};
+
+// (Re)allocate the offscreen render target if the framebuffer size changed
+void dynamic_resolution_resize(DynamicResolution &dynres, int width, int height);
+
+void dynamic_resolution_destroy(DynamicResolution &dynres);
+
+// Feed the controller with the latest available GPU time. Should be called
+// once per frame, before the scene is rendered.
+void dynamic_resolution_update(DynamicResolution &dynres);
+
+// Size of the region of the render target that the scene is rendered into
+int dynamic_resolution_render_width(const DynamicResolution &dynres);
+
+int dynamic_resolution_render_height(const DynamicResolution &dynres);
+
+// Upscale the rendered region to the currently bound draw framebuffer. The
+// edge-aware filter needs a program created from upscale.vert/upscale.frag,
+// and an empty VAO for drawing a full-screen triangle.
+void dynamic_resolution_upscale(const DynamicResolution &dynres, GLuint upscaleProgram,
+                                GLuint emptyVAO, int width, int height);
+
+}  // namespace cg
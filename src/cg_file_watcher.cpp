@@ -0,0 +1,204 @@
+// Watching files for changes on disk, e.g. for hot reloading.
+//
+
+#include "cg_file_watcher.h"
+#include "cg_profiler.h"
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace cg {
+
+struct FileWatcherThread {
+    static const int POLL_MS = 100;  // Interval of checks for stopping (and of polling stat)
+
+    std::set<std::string> paths;
+    int debounceMs = 50;
+    std::function<void()> onChange;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+#ifdef __linux__
+    int fd = -1;
+    std::map<int, std::string> directories;  // Of each inotify watch, ending with a separator
+#else
+    std::map<std::string, std::pair<int64_t, int64_t>> stats;  // Modification time and size
+#endif
+
+    std::mutex mutex;  // Protects the member below
+    std::vector<FileChange> ready;
+};
+
+namespace {
+
+std::string directory_of(const std::string &path)
+{
+    size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? std::string("./") : path.substr(0, separator + 1);
+}
+
+#ifdef __linux__
+
+bool open_watches(FileWatcherThread &watcher)
+{
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd < 0) return false;
+    std::set<std::string> directories;
+    for (const std::string &path : watcher.paths) directories.insert(directory_of(path));
+    for (const std::string &directory : directories) {
+        // Completed writes, and files renamed into place (as many editors save)
+        int wd = inotify_add_watch(watcher.fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0) {
+            std::cerr << "Warning: could not watch " << directory << std::endl;
+            continue;
+        }
+        watcher.directories[wd] = directory == "./" ? std::string() : directory;
+    }
+    return true;
+}
+
+void close_watches(FileWatcherThread &watcher)
+{
+    if (watcher.fd >= 0) close(watcher.fd);
+    watcher.fd = -1;
+}
+
+// Wait up to timeoutMs for changes, and append the watched files that changed
+void wait_for_changes(FileWatcherThread &watcher, int timeoutMs, std::vector<std::string> &changed)
+{
+    pollfd request = {watcher.fd, POLLIN, 0};
+    if (poll(&request, 1, timeoutMs) <= 0 || !(request.revents & POLLIN)) return;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(watcher.fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            auto directory = watcher.directories.find(event->wd);
+            if (event->len == 0 || directory == watcher.directories.end()) continue;
+            std::string path = directory->second + event->name;
+            if (watcher.paths.count(path)) changed.push_back(path);
+        }
+    }
+}
+
+#else
+
+std::pair<int64_t, int64_t> file_stat(const std::string &path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return std::make_pair(int64_t(-1), int64_t(-1));
+    return std::make_pair(int64_t(info.st_mtime), int64_t(info.st_size));
+}
+
+bool open_watches(FileWatcherThread &watcher)
+{
+    for (const std::string &path : watcher.paths) watcher.stats[path] = file_stat(path);
+    return true;
+}
+
+void close_watches(FileWatcherThread &) {}
+
+// Without inotify, the modification times and sizes are polled
+void wait_for_changes(FileWatcherThread &watcher, int timeoutMs, std::vector<std::string> &changed)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    for (auto &it : watcher.stats) {
+        std::pair<int64_t, int64_t> stat = file_stat(it.first);
+        if (stat == it.second) continue;
+        it.second = stat;
+        changed.push_back(it.first);
+    }
+}
+
+#endif
+
+void run_watcher(FileWatcherThread &watcher)
+{
+    std::map<std::string, int64_t> pending;  // First change of each file since the last report
+    int64_t lastChange = 0;
+    const int64_t debounce = int64_t(watcher.debounceMs) * 1000000;
+    std::vector<std::string> changed;
+    while (!watcher.stopping) {
+        int timeoutMs = FileWatcherThread::POLL_MS;
+        if (!pending.empty()) {
+            int64_t remaining = (lastChange + debounce - profiler_now()) / 1000000;
+            timeoutMs = int(std::min<int64_t>(std::max<int64_t>(remaining, 0), timeoutMs));
+        }
+        changed.clear();
+        wait_for_changes(watcher, timeoutMs, changed);
+        int64_t now = profiler_now();
+        for (const std::string &path : changed) pending.insert(std::make_pair(path, now));
+        if (!changed.empty()) lastChange = now;
+        if (pending.empty() || now - lastChange < debounce) continue;
+
+        {
+            std::lock_guard<std::mutex> lock(watcher.mutex);
+            for (const auto &it : pending) {
+                FileChange change;
+                change.path = it.first;
+                change.time = it.second;
+                watcher.ready.push_back(change);
+            }
+        }
+        pending.clear();
+        if (watcher.onChange) watcher.onChange();
+    }
+}
+
+}  // namespace
+
+bool file_watcher_start(FileWatcher &watcher, const std::vector<std::string> &paths)
+{
+    std::set<std::string> pathSet(paths.begin(), paths.end());
+    if (watcher.thread && watcher.thread->paths == pathSet) return true;
+    file_watcher_stop(watcher);
+    std::shared_ptr<FileWatcherThread> thread = std::make_shared<FileWatcherThread>();
+    thread->paths.swap(pathSet);
+    thread->debounceMs = watcher.debounceMs;
+    thread->onChange = watcher.onChange;
+    if (!open_watches(*thread)) {
+        std::cerr << "Error: could not start watching files" << std::endl;
+        return false;
+    }
+    profiler_now();  // Start the clock of the change times
+    FileWatcherThread *state = thread.get();
+    thread->thread = std::thread([state] {
+        profiler_set_thread_name("File Watcher");
+        run_watcher(*state);
+    });
+    watcher.thread = thread;
+    return true;
+}
+
+void file_watcher_stop(FileWatcher &watcher)
+{
+    if (!watcher.thread) return;
+    watcher.thread->stopping = true;
+    watcher.thread->thread.join();
+    close_watches(*watcher.thread);
+    watcher.thread.reset();
+}
+
+std::vector<FileChange> file_watcher_poll(FileWatcher &watcher)
+{
+    std::vector<FileChange> changes;
+    if (!watcher.thread) return changes;
+    std::lock_guard<std::mutex> lock(watcher.thread->mutex);
+    changes.swap(watcher.thread->ready);
+    return changes;
+}
+
+}  // namespace cg
@@ -0,0 +1,46 @@
+// Watching files for changes on disk, e.g. for hot reloading.
+//
+// A background thread waits for changes of the watched files (with inotify
+// on Linux, and by polling their modification times elsewhere). The
+// directories of the files are watched rather than the files themselves, so
+// that editors that save by writing a new file and renaming it over the old
+// one are also seen. Changes are debounced: a file is only reported once no
+// new change of any watched file has been seen for a while, so that a save
+// that writes a file in several steps is reloaded once.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cg {
+
+struct FileWatcherThread;  // Watcher thread and its queue of changes
+
+struct FileChange {
+    std::string path;  // As given to file_watcher_start()
+    int64_t time = 0;  // Of the first change since the last report (see profiler_now())
+};
+
+struct FileWatcher {
+    int debounceMs = 50;
+    // Called on the watcher thread when new changes are ready, e.g. to wake up
+    // a render loop that waits for events
+    std::function<void()> onChange;
+    std::shared_ptr<FileWatcherThread> thread;
+};
+
+// Start watching files (replacing any files that were watched before, unless
+// they are the same). Returns false if the watcher could not be started.
+bool file_watcher_start(FileWatcher &watcher, const std::vector<std::string> &paths);
+
+void file_watcher_stop(FileWatcher &watcher);
+
+// Returns the files that have changed since the last call, each once
+std::vector<FileChange> file_watcher_poll(FileWatcher &watcher);
+
+}  // namespace cg
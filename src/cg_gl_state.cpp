@@ -0,0 +1,368 @@
+// Shadowed OpenGL state that skips redundant state changes.
+//
+
+#include "cg_gl_state.h"
+
+#include <array>
+#include <iostream>
+
+namespace cg {
+
+namespace {
+
+const int NUM_TEXTURE_UNITS = 16;  // Bindings of higher units are passed on without shadowing
+const GLenum TEXTURE_TARGETS[] = {GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP,
+                                  GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER};
+const GLenum TEXTURE_BINDINGS[] = {GL_TEXTURE_BINDING_1D, GL_TEXTURE_BINDING_2D,
+                                   GL_TEXTURE_BINDING_3D, GL_TEXTURE_BINDING_CUBE_MAP,
+                                   GL_TEXTURE_BINDING_2D_ARRAY, GL_TEXTURE_BINDING_BUFFER};
+const int NUM_TEXTURE_TARGETS = 6;
+const GLenum CAPABILITIES[] = {GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_MULTISAMPLE,
+                               GL_POLYGON_OFFSET_FILL, GL_PROGRAM_POINT_SIZE, GL_RASTERIZER_DISCARD,
+                               GL_SAMPLE_ALPHA_TO_COVERAGE, GL_SCISSOR_TEST, GL_STENCIL_TEST};
+const int NUM_CAPABILITIES = 10;
+
+template <typename T>
+struct Shadow {
+    T value = T();
+    bool known = false;
+};
+
+struct ShadowState {
+    Shadow<GLuint> program;
+    Shadow<GLuint> vertexArray;
+    Shadow<GLuint> drawFramebuffer;
+    Shadow<GLuint> readFramebuffer;
+    Shadow<int> activeUnit;
+    Shadow<GLuint> textures[NUM_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+    Shadow<std::array<GLint, 4>> viewport;
+    Shadow<bool> capabilities[NUM_CAPABILITIES];
+    Shadow<GLenum> cullFace;
+    Shadow<GLenum> polygonMode;
+    Shadow<std::array<GLfloat, 2>> polygonOffset;
+    Shadow<GLfloat> lineWidth;
+    Shadow<GLenum> depthFunc;
+    Shadow<GLboolean> depthMask;
+    Shadow<std::array<GLdouble, 2>> depthRange;
+    Shadow<std::array<GLenum, 4>> blendFunc;
+    Shadow<std::array<GLenum, 2>> blendEquation;
+    Shadow<std::array<GLboolean, 4>> colorMask;
+};
+
+struct GLStateCache {
+    bool caching = true;
+    bool debug = false;
+    ShadowState state;
+    GLStateCounts counts;  // Of the current frame
+    GLStateCounts lastFrame;
+    bool reported = false;  // Whether a mismatch of the shadow was reported
+};
+
+GLStateCache &cache()
+{
+    static GLStateCache instance;
+    return instance;
+}
+
+// Counts a call in debug mode. Returns true if it must be passed on.
+bool record(bool redundant, GLStateCall call)
+{
+    GLStateCache &c = cache();
+    if (c.debug) (redundant ? c.counts.redundant : c.counts.effective)[call]++;
+    return !redundant || !c.caching;
+}
+
+// Sets shadowed state. Returns true if the call must be passed on.
+template <typename T>
+bool update(Shadow<T> &shadow, const T &value, GLStateCall call)
+{
+    bool redundant = shadow.known && shadow.value == value;
+    shadow.value = value;
+    shadow.known = true;
+    return record(redundant, call);
+}
+
+int texture_target_index(GLenum target)
+{
+    for (int i = 0; i < NUM_TEXTURE_TARGETS; ++i) {
+        if (TEXTURE_TARGETS[i] == target) return i;
+    }
+    return -1;
+}
+
+int capability_index(GLenum capability)
+{
+    for (int i = 0; i < NUM_CAPABILITIES; ++i) {
+        if (CAPABILITIES[i] == capability) return i;
+    }
+    return -1;
+}
+
+bool set_capability(GLenum capability, bool enabled)
+{
+    int index = capability_index(capability);
+    bool issue = index >= 0
+                     ? update(cache().state.capabilities[index], enabled, STATE_CALL_CAPABILITY)
+                     : record(false, STATE_CALL_CAPABILITY);
+    if (!issue) return false;
+    if (enabled) glEnable(capability);
+    else glDisable(capability);
+    return true;
+}
+
+GLint get_integer(GLenum name)
+{
+    GLint value = 0;
+    glGetIntegerv(name, &value);
+    return value;
+}
+
+// Reports (once) if known shadowed state differs from the OpenGL state
+template <typename T>
+bool check(const Shadow<T> &shadow, const T &actual, const char *name)
+{
+    if (!shadow.known || shadow.value == actual) return true;
+    GLStateCache &c = cache();
+    if (!c.reported) {
+        std::cerr << "Warning: OpenGL state was changed without the state cache (" << name
+                  << "), see gl_state_invalidate()" << std::endl;
+        c.reported = true;
+    }
+    return false;
+}
+
+// Returns false if any known shadowed state differs from the OpenGL state
+bool validate(const ShadowState &s)
+{
+    bool ok = check(s.program, GLuint(get_integer(GL_CURRENT_PROGRAM)), "program");
+    ok &= check(s.vertexArray, GLuint(get_integer(GL_VERTEX_ARRAY_BINDING)), "vertex array");
+    ok &= check(s.drawFramebuffer, GLuint(get_integer(GL_DRAW_FRAMEBUFFER_BINDING)),
+                "draw framebuffer");
+    ok &= check(s.readFramebuffer, GLuint(get_integer(GL_READ_FRAMEBUFFER_BINDING)),
+                "read framebuffer");
+    int activeUnit = get_integer(GL_ACTIVE_TEXTURE) - GL_TEXTURE0;
+    ok &= check(s.activeUnit, activeUnit, "active texture");
+    if (activeUnit >= 0 && activeUnit < NUM_TEXTURE_UNITS) {
+        for (int i = 0; i < NUM_TEXTURE_TARGETS; ++i) {
+            GLuint texture = GLuint(get_integer(TEXTURE_BINDINGS[i]));
+            ok &= check(s.textures[activeUnit][i], texture, "texture");
+        }
+    }
+    std::array<GLint, 4> viewport;
+    glGetIntegerv(GL_VIEWPORT, viewport.data());
+    ok &= check(s.viewport, viewport, "viewport");
+    for (int i = 0; i < NUM_CAPABILITIES; ++i) {
+        ok &= check(s.capabilities[i], glIsEnabled(CAPABILITIES[i]) == GL_TRUE, "capability");
+    }
+    ok &= check(s.cullFace, GLenum(get_integer(GL_CULL_FACE_MODE)), "cull face");
+    ok &= check(s.depthFunc, GLenum(get_integer(GL_DEPTH_FUNC)), "depth func");
+    GLboolean depthMask = GL_TRUE;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+    ok &= check(s.depthMask, depthMask, "depth mask");
+    std::array<GLboolean, 4> colorMask;
+    glGetBooleanv(GL_COLOR_WRITEMASK, colorMask.data());
+    ok &= check(s.colorMask, colorMask, "color mask");
+    return ok;
+}
+
+}  // namespace
+
+const char *gl_state_call_name(GLStateCall call)
+{
+    switch (call) {
+    case STATE_CALL_PROGRAM: return "Program";
+    case STATE_CALL_VERTEX_ARRAY: return "Vertex array";
+    case STATE_CALL_ACTIVE_TEXTURE: return "Active texture";
+    case STATE_CALL_TEXTURE: return "Texture";
+    case STATE_CALL_FRAMEBUFFER: return "Framebuffer";
+    case STATE_CALL_VIEWPORT: return "Viewport";
+    case STATE_CALL_CAPABILITY: return "Enable/disable";
+    case STATE_CALL_FIXED_FUNCTION: return "Fixed function";
+    default: return "Unknown";
+    }
+}
+
+void gl_state_set_caching(bool caching) { cache().caching = caching; }
+
+bool gl_state_caching() { return cache().caching; }
+
+void gl_state_set_debug(bool debug)
+{
+    GLStateCache &c = cache();
+    c.debug = debug;
+    c.counts = GLStateCounts();
+    c.lastFrame = GLStateCounts();
+}
+
+bool gl_state_debug() { return cache().debug; }
+
+void gl_state_invalidate() { cache().state = ShadowState(); }
+
+void gl_state_frame_end()
+{
+    GLStateCache &c = cache();
+    if (!c.debug) return;
+    c.lastFrame = c.counts;
+    c.counts = GLStateCounts();
+    if (!validate(c.state)) gl_state_invalidate();
+}
+
+const GLStateCounts &gl_state_last_frame() { return cache().lastFrame; }
+
+bool gl_state_use_program(GLuint program)
+{
+    if (!update(cache().state.program, program, STATE_CALL_PROGRAM)) return false;
+    glUseProgram(program);
+    return true;
+}
+
+bool gl_state_bind_vertex_array(GLuint vertexArray)
+{
+    if (!update(cache().state.vertexArray, vertexArray, STATE_CALL_VERTEX_ARRAY)) return false;
+    glBindVertexArray(vertexArray);
+    return true;
+}
+
+bool gl_state_bind_texture(int unit, GLenum target, GLuint texture)
+{
+    ShadowState &s = cache().state;
+    int index = texture_target_index(target);
+    if (unit >= 0 && unit < NUM_TEXTURE_UNITS && index >= 0) {
+        if (!update(s.textures[unit][index], texture, STATE_CALL_TEXTURE)) return false;
+    } else {
+        record(false, STATE_CALL_TEXTURE);
+    }
+    if (update(s.activeUnit, unit, STATE_CALL_ACTIVE_TEXTURE)) glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, texture);
+    return true;
+}
+
+bool gl_state_bind_texture(GLenum target, GLuint texture)
+{
+    ShadowState &s = cache().state;
+    if (s.activeUnit.known) return gl_state_bind_texture(s.activeUnit.value, target, texture);
+
+    // The unit is not known, so the binding of the target on any unit may change
+    int index = texture_target_index(target);
+    if (index >= 0) {
+        for (int unit = 0; unit < NUM_TEXTURE_UNITS; ++unit) s.textures[unit][index].known = false;
+    }
+    record(false, STATE_CALL_TEXTURE);
+    glBindTexture(target, texture);
+    return true;
+}
+
+bool gl_state_active_texture(int unit)
+{
+    ShadowState &s = cache().state;
+    if (!update(s.activeUnit, unit, STATE_CALL_ACTIVE_TEXTURE)) return false;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    return true;
+}
+
+bool gl_state_bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+    ShadowState &s = cache().state;
+    if (target == GL_DRAW_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER) {
+        Shadow<GLuint> &shadow =
+            target == GL_DRAW_FRAMEBUFFER ? s.drawFramebuffer : s.readFramebuffer;
+        if (!update(shadow, framebuffer, STATE_CALL_FRAMEBUFFER)) return false;
+    } else {
+        bool redundant = s.drawFramebuffer.known && s.drawFramebuffer.value == framebuffer &&
+                         s.readFramebuffer.known && s.readFramebuffer.value == framebuffer;
+        s.drawFramebuffer.value = s.readFramebuffer.value = framebuffer;
+        s.drawFramebuffer.known = s.readFramebuffer.known = true;
+        if (!record(redundant, STATE_CALL_FRAMEBUFFER)) return false;
+    }
+    glBindFramebuffer(target, framebuffer);
+    return true;
+}
+
+bool gl_state_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    std::array<GLint, 4> viewport = {{x, y, width, height}};
+    if (!update(cache().state.viewport, viewport, STATE_CALL_VIEWPORT)) return false;
+    glViewport(x, y, width, height);
+    return true;
+}
+
+bool gl_state_enable(GLenum capability) { return set_capability(capability, true); }
+
+bool gl_state_disable(GLenum capability) { return set_capability(capability, false); }
+
+bool gl_state_cull_face(GLenum mode)
+{
+    if (!update(cache().state.cullFace, mode, STATE_CALL_FIXED_FUNCTION)) return false;
+    glCullFace(mode);
+    return true;
+}
+
+bool gl_state_polygon_mode(GLenum mode)
+{
+    if (!update(cache().state.polygonMode, mode, STATE_CALL_FIXED_FUNCTION)) return false;
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    return true;
+}
+
+bool gl_state_polygon_offset(GLfloat factor, GLfloat units)
+{
+    std::array<GLfloat, 2> offset = {{factor, units}};
+    if (!update(cache().state.polygonOffset, offset, STATE_CALL_FIXED_FUNCTION)) return false;
+    glPolygonOffset(factor, units);
+    return true;
+}
+
+bool gl_state_line_width(GLfloat width)
+{
+    if (!update(cache().state.lineWidth, width, STATE_CALL_FIXED_FUNCTION)) return false;
+    glLineWidth(width);
+    return true;
+}
+
+bool gl_state_depth_func(GLenum func)
+{
+    if (!update(cache().state.depthFunc, func, STATE_CALL_FIXED_FUNCTION)) return false;
+    glDepthFunc(func);
+    return true;
+}
+
+bool gl_state_depth_mask(GLboolean mask)
+{
+    if (!update(cache().state.depthMask, mask, STATE_CALL_FIXED_FUNCTION)) return false;
+    glDepthMask(mask);
+    return true;
+}
+
+bool gl_state_depth_range(GLdouble nearValue, GLdouble farValue)
+{
+    std::array<GLdouble, 2> range = {{nearValue, farValue}};
+    if (!update(cache().state.depthRange, range, STATE_CALL_FIXED_FUNCTION)) return false;
+    glDepthRange(nearValue, farValue);
+    return true;
+}
+
+bool gl_state_blend_func_separate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+    std::array<GLenum, 4> func = {{srcRGB, dstRGB, srcAlpha, dstAlpha}};
+    if (!update(cache().state.blendFunc, func, STATE_CALL_FIXED_FUNCTION)) return false;
+    glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+    return true;
+}
+
+bool gl_state_blend_equation_separate(GLenum modeRGB, GLenum modeAlpha)
+{
+    std::array<GLenum, 2> equation = {{modeRGB, modeAlpha}};
+    if (!update(cache().state.blendEquation, equation, STATE_CALL_FIXED_FUNCTION)) return false;
+    glBlendEquationSeparate(modeRGB, modeAlpha);
+    return true;
+}
+
+bool gl_state_color_mask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+    std::array<GLboolean, 4> mask = {{red, green, blue, alpha}};
+    if (!update(cache().state.colorMask, mask, STATE_CALL_FIXED_FUNCTION)) return false;
+    glColorMask(red, green, blue, alpha);
+    return true;
+}
+
+}  // namespace cg
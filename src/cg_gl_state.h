@@ -0,0 +1,114 @@
+// Shadowed OpenGL state that skips redundant state changes.
+//
+// The bound program, vertex array, framebuffers and textures of each unit,
+// the viewport, and the fixed-function state that reset_gl_render_state()
+// sets are shadowed on the CPU. Setting state through these functions only
+// calls OpenGL when the value differs from the shadow, so the render passes
+// can set the state that they need without knowing what was set before.
+//
+// Only state that is set through these functions is shadowed. Code that
+// changes the same state directly, or deletes an object that may be bound,
+// must call gl_state_invalidate() before the next function here is used. The
+// viewer invalidates at the start of each frame, so loading code and ImGui
+// (which restores what it changes) can use OpenGL directly.
+//
+// In debug mode, the calls of each frame are counted as effective or
+// redundant, and the shadow is checked against the OpenGL state at the end of
+// the frame. Main thread only.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstdint>
+
+namespace cg {
+
+enum GLStateCall {
+    STATE_CALL_PROGRAM = 0,
+    STATE_CALL_VERTEX_ARRAY = 1,
+    STATE_CALL_ACTIVE_TEXTURE = 2,
+    STATE_CALL_TEXTURE = 3,
+    STATE_CALL_FRAMEBUFFER = 4,
+    STATE_CALL_VIEWPORT = 5,
+    STATE_CALL_CAPABILITY = 6,      // glEnable and glDisable
+    STATE_CALL_FIXED_FUNCTION = 7,  // Depth, blend, cull, polygon and color mask state
+    NUM_STATE_CALLS = 8
+};
+
+struct GLStateCounts {
+    uint64_t effective[NUM_STATE_CALLS] = {0};  // Calls that changed state
+    uint64_t redundant[NUM_STATE_CALLS] = {0};  // Calls that set the state it had
+};
+
+// Returns the name of a kind of call, e.g. "Texture"
+const char *gl_state_call_name(GLStateCall call);
+
+// With caching off, every call is passed on to OpenGL (redundant calls are
+// still counted in debug mode)
+void gl_state_set_caching(bool caching);
+
+bool gl_state_caching();
+
+void gl_state_set_debug(bool debug);
+
+bool gl_state_debug();
+
+// Forget all shadowed state, so that the next call of each kind is issued
+void gl_state_invalidate();
+
+// Finish the counts of the current frame, and check the shadow in debug
+// mode. Call once per frame, after swapping buffers.
+void gl_state_frame_end();
+
+// Returns the counts of the last finished frame (debug mode only)
+const GLStateCounts &gl_state_last_frame();
+
+// The functions below return true if the call was passed on to OpenGL
+
+bool gl_state_use_program(GLuint program);
+
+bool gl_state_bind_vertex_array(GLuint vertexArray);
+
+// Bind a texture to a unit, selecting the unit only if the binding changes
+bool gl_state_bind_texture(int unit, GLenum target, GLuint texture);
+
+// Bind a texture to the active unit
+bool gl_state_bind_texture(GLenum target, GLuint texture);
+
+// Select the active texture unit, e.g. to respecify a texture that is bound
+// to a unit (which gl_state_bind_texture() does not select if it is bound)
+bool gl_state_active_texture(int unit);
+
+// Target is GL_FRAMEBUFFER (both), GL_DRAW_FRAMEBUFFER or GL_READ_FRAMEBUFFER
+bool gl_state_bind_framebuffer(GLenum target, GLuint framebuffer);
+
+bool gl_state_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+bool gl_state_enable(GLenum capability);
+
+bool gl_state_disable(GLenum capability);
+
+bool gl_state_cull_face(GLenum mode);
+
+// Sets the mode of GL_FRONT_AND_BACK
+bool gl_state_polygon_mode(GLenum mode);
+
+bool gl_state_polygon_offset(GLfloat factor, GLfloat units);
+
+bool gl_state_line_width(GLfloat width);
+
+bool gl_state_depth_func(GLenum func);
+
+bool gl_state_depth_mask(GLboolean mask);
+
+bool gl_state_depth_range(GLdouble nearValue, GLdouble farValue);
+
+bool gl_state_blend_func_separate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+
+bool gl_state_blend_equation_separate(GLenum modeRGB, GLenum modeAlpha);
+
+bool gl_state_color_mask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+
+}  // namespace cg
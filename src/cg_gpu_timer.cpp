@@ -0,0 +1,55 @@
+// GPU timer based on asynchronous OpenGL timer queries.
+//
+
+#include "cg_gpu_timer.h"
+
+namespace cg {
+
+void gpu_timer_init(GpuTimer &timer)
+{
+    gpu_timer_destroy(timer);
+    glGenQueries(GpuTimer::LATENCY, timer.queries);
+}
+
+void gpu_timer_destroy(GpuTimer &timer)
+{
+    if (timer.queries[0]) glDeleteQueries(GpuTimer::LATENCY, timer.queries);
+    timer = GpuTimer();
+}
+
+void gpu_timer_begin(GpuTimer &timer)
+{
+    // If all queries are still in flight, we have to drop the oldest result
+    // instead of waiting for it
+    if (timer.issued - timer.resolved >= unsigned(GpuTimer::LATENCY)) { timer.resolved++; }
+    glBeginQuery(GL_TIME_ELAPSED, timer.queries[timer.issued % GpuTimer::LATENCY]);
+}
+
+void gpu_timer_end(GpuTimer &timer)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    timer.issued++;
+    gpu_timer_poll(timer);
+}
+
+bool gpu_timer_poll(GpuTimer &timer)
+{
+    bool updated = false;
+    while (timer.resolved < timer.issued) {
+        GLuint query = timer.queries[timer.resolved % GpuTimer::LATENCY];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        timer.lastMs = double(elapsed) * 1e-6;
+        timer.averageMs = (timer.resolved == 0) ? timer.lastMs
+                                                : 0.9 * timer.averageMs + 0.1 * timer.lastMs;
+        timer.resolved++;
+        updated = true;
+    }
+    return updated;
+}
+
+}  // namespace cg
@@ -0,0 +1,37 @@
+// GPU timer based on asynchronous OpenGL timer queries.
+//
+// Results are read back a few frames after they were issued, so measuring
+// GPU time never stalls the pipeline.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+namespace cg {
+
+// Struct for a ring of GL_TIME_ELAPSED queries
+struct GpuTimer {
+    static const int LATENCY = 4;  // Number of frames in flight
+    GLuint queries[LATENCY] = {0};
+    unsigned issued = 0;    // Total number of begin/end pairs issued
+    unsigned resolved = 0;  // Total number of results read back
+    double lastMs = 0.0;    // Most recent available result (in milliseconds)
+    double averageMs = 0.0; // Exponential moving average of the results
+};
+
+void gpu_timer_init(GpuTimer &timer);
+
+void gpu_timer_destroy(GpuTimer &timer);
+
+// Begin and end a timed GPU region. Only one timer can be active at a time,
+// since GL_TIME_ELAPSED queries cannot be nested.
+void gpu_timer_begin(GpuTimer &timer);
+
+void gpu_timer_end(GpuTimer &timer);
+
+// Read back all results that have become available without blocking.
+// Returns true if at least one new result was read.
+bool gpu_timer_poll(GpuTimer &timer);
+
+}  // namespace cg
@@ -0,0 +1,98 @@
+// Creation of OpenGL contexts without a visible window.
+//
+
+#include "cg_headless.h"
+
+#ifdef MODEL_VIEWER_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+
+namespace cg {
+
+#ifdef MODEL_VIEWER_USE_EGL
+static bool create_egl_context(HeadlessContext &hc)
+{
+    // The surfaceless platform needs neither a display server nor a GPU
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) return false;
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(display);
+        return false;
+    }
+
+    const EGLint attribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                              3,
+                              EGL_CONTEXT_MINOR_VERSION,
+                              3,
+                              EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                              EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                              EGL_NONE};
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    if (context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+    hc.eglDisplay = display;
+    hc.eglContext = context;
+    return true;
+}
+#endif
+
+static bool create_glfw_context(HeadlessContext &hc)
+{
+    if (!glfwInit()) return false;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    hc.window = glfwCreateWindow(16, 16, "Model viewer (headless)", nullptr, nullptr);
+    if (!hc.window) {
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(hc.window);
+    return true;
+}
+
+bool headless_context_create(HeadlessContext &hc, bool allowEGL)
+{
+#ifdef MODEL_VIEWER_USE_EGL
+    if (allowEGL && create_egl_context(hc)) return true;
+    if (allowEGL) std::cerr << "Warning: EGL not available, using hidden GLFW window" << std::endl;
+#else
+    (void)allowEGL;
+#endif
+    return create_glfw_context(hc);
+}
+
+void headless_context_destroy(HeadlessContext &hc)
+{
+#ifdef MODEL_VIEWER_USE_EGL
+    if (hc.eglContext) {
+        eglMakeCurrent(hc.eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(hc.eglDisplay, hc.eglContext);
+        eglTerminate(hc.eglDisplay);
+    }
+#endif
+    if (hc.window) {
+        glfwDestroyWindow(hc.window);
+        glfwTerminate();
+    }
+    hc = HeadlessContext();
+}
+
+}  // namespace cg
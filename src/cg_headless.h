@@ -0,0 +1,27 @@
+// Creation of OpenGL contexts without a visible window.
+//
+// Uses EGL with the surfaceless platform when available (this works with for
+// example Mesa llvmpipe on servers without a display or GPU), and falls back
+// to an invisible GLFW window otherwise.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+namespace cg {
+
+struct HeadlessContext {
+    void *eglDisplay = nullptr;
+    void *eglContext = nullptr;
+    GLFWwindow *window = nullptr;  // Only used by the GLFW fallback
+};
+
+// Create an OpenGL 3.3 core context and make it current. Note that there is
+// no usable default framebuffer, so all rendering must go to FBOs.
+bool headless_context_create(HeadlessContext &hc, bool allowEGL = true);
+
+void headless_context_destroy(HeadlessContext &hc);
+
+}  // namespace cg
@@ -0,0 +1,240 @@
+// Recording and replay of input events and GUI state.
+//
+
+#include "cg_input_recording.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace cg {
+
+namespace {
+
+void read_variable(const StateVariable &variable, double *values)
+{
+    switch (variable.type) {
+    case STATE_BOOL: values[0] = *static_cast<bool *>(variable.data) ? 1.0 : 0.0; break;
+    case STATE_INT: values[0] = *static_cast<int *>(variable.data); break;
+    case STATE_FLOAT: values[0] = *static_cast<float *>(variable.data); break;
+    case STATE_VEC3: {
+        const glm::vec3 &v = *static_cast<glm::vec3 *>(variable.data);
+        values[0] = v.x, values[1] = v.y, values[2] = v.z;
+        break;
+    }
+    }
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) return 0.0;
+    size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+}  // namespace
+
+bool save_input_recording(const std::string &filename, const InputRecording &recording)
+{
+    FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    // Values are written with full precision so that replays are exact
+    std::fprintf(file, "recording 1 %d %d\n", recording.width, recording.height);
+    for (const InputFrame &frame : recording.frames) {
+        std::fprintf(file, "frame %.17g\n", frame.time);
+        for (const InputEvent &event : frame.events) {
+            switch (event.type) {
+            case INPUT_MOUSE_BUTTON:
+                std::fprintf(file, "button %.17g %.17g %d\n", event.x, event.y, event.value[0] != 0.0);
+                break;
+            case INPUT_CURSOR_POS: std::fprintf(file, "cursor %.17g %.17g\n", event.x, event.y); break;
+            case INPUT_SCROLL: std::fprintf(file, "scroll %.17g\n", event.y); break;
+            case INPUT_STATE:
+                std::fprintf(file, "state %s %.9g %.9g %.9g\n", event.name.c_str(), event.value[0],
+                             event.value[1], event.value[2]);
+                break;
+            }
+        }
+    }
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+bool load_input_recording(const std::string &filename, InputRecording &recording)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Error: Could not open " << filename << std::endl;
+        return false;
+    }
+    recording = InputRecording();
+    std::string line, keyword;
+    int version = 0, lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream stream(line);
+        if (!(stream >> keyword)) continue;
+
+        InputEvent event;
+        bool ok = true;
+        if (keyword == "recording") {
+            ok = bool(stream >> version >> recording.width >> recording.height) && version == 1;
+        } else if (keyword == "frame") {
+            recording.frames.push_back(InputFrame());
+            ok = bool(stream >> recording.frames.back().time);
+        } else if (recording.frames.empty()) {
+            ok = false;  // Events before the first frame
+        } else if (keyword == "button") {
+            event.type = INPUT_MOUSE_BUTTON;
+            ok = bool(stream >> event.x >> event.y >> event.value[0]);
+        } else if (keyword == "cursor") {
+            event.type = INPUT_CURSOR_POS;
+            ok = bool(stream >> event.x >> event.y);
+        } else if (keyword == "scroll") {
+            event.type = INPUT_SCROLL;
+            ok = bool(stream >> event.y);
+        } else if (keyword == "state") {
+            event.type = INPUT_STATE;
+            ok = bool(stream >> event.name >> event.value[0] >> event.value[1] >> event.value[2]);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Error: Invalid input recording " << filename << " (line " << lineNumber << ")"
+                      << std::endl;
+            return false;
+        }
+        if (keyword != "recording" && keyword != "frame") recording.frames.back().events.push_back(event);
+    }
+    if (version != 1) {
+        std::cerr << "Error: " << filename << " is not an input recording" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void record_state_changes(const std::vector<StateVariable> &variables, std::vector<double> &last,
+                          InputFrame &frame)
+{
+    bool all = last.empty();
+    last.resize(variables.size() * 3, 0.0);
+    for (size_t i = 0; i < variables.size(); ++i) {
+        double values[3] = {0.0, 0.0, 0.0};
+        read_variable(variables[i], values);
+        if (!all && std::equal(values, values + 3, &last[i * 3])) continue;
+
+        InputEvent event;
+        event.type = INPUT_STATE;
+        event.name = variables[i].name;
+        std::copy(values, values + 3, event.value);
+        std::copy(values, values + 3, &last[i * 3]);
+        frame.events.push_back(event);
+    }
+}
+
+bool apply_state_event(const std::vector<StateVariable> &variables, const InputEvent &event)
+{
+    for (const StateVariable &variable : variables) {
+        if (event.name != variable.name) continue;
+        switch (variable.type) {
+        case STATE_BOOL: *static_cast<bool *>(variable.data) = event.value[0] != 0.0; break;
+        case STATE_INT: *static_cast<int *>(variable.data) = int(event.value[0]); break;
+        case STATE_FLOAT: *static_cast<float *>(variable.data) = float(event.value[0]); break;
+        case STATE_VEC3:
+            *static_cast<glm::vec3 *>(variable.data) =
+                glm::vec3(float(event.value[0]), float(event.value[1]), float(event.value[2]));
+            break;
+        }
+        return true;
+    }
+    return false;
+}
+
+FrameTimeStats compute_frame_time_stats(const std::vector<double> &frameTimesMs, double bucketMs,
+                                        int numBuckets)
+{
+    FrameTimeStats stats;
+    stats.bucketMs = bucketMs;
+    stats.histogram.assign(std::max(numBuckets, 1), 0);
+    if (frameTimesMs.empty()) return stats;
+
+    std::vector<double> sorted(frameTimesMs);
+    std::sort(sorted.begin(), sorted.end());
+    stats.frames = int(sorted.size());
+    for (double ms : sorted) {
+        stats.meanMs += ms;
+        int bucket = int(ms / bucketMs);
+        stats.histogram[std::min(std::max(bucket, 0), int(stats.histogram.size()) - 1)]++;
+    }
+    stats.meanMs /= sorted.size();
+    stats.minMs = sorted.front();
+    stats.maxMs = sorted.back();
+    stats.p50Ms = percentile(sorted, 50.0);
+    stats.p95Ms = percentile(sorted, 95.0);
+    stats.p99Ms = percentile(sorted, 99.0);
+    return stats;
+}
+
+void print_frame_time_stats(const FrameTimeStats &stats)
+{
+    std::printf("Frame times over %d frames: mean %.2f ms, min %.2f ms, max %.2f ms\n", stats.frames,
+                stats.meanMs, stats.minMs, stats.maxMs);
+    std::printf("  p50 %.2f ms, p95 %.2f ms, p99 %.2f ms\n", stats.p50Ms, stats.p95Ms, stats.p99Ms);
+
+    // Only print the range of buckets that have frames
+    int first = 0, last = int(stats.histogram.size()) - 1;
+    while (first < last && stats.histogram[first] == 0) first++;
+    while (last > first && stats.histogram[last] == 0) last--;
+    int maxCount = *std::max_element(stats.histogram.begin(), stats.histogram.end());
+    for (int i = first; i <= last && maxCount > 0; ++i) {
+        bool open = i + 1 == int(stats.histogram.size());
+        int width = (stats.histogram[i] * 50 + maxCount - 1) / maxCount;
+        std::printf("  %6.1f%s ms |%-50s| %d\n", i * stats.bucketMs, open ? "+" : " ",
+                    std::string(width, '#').c_str(), stats.histogram[i]);
+    }
+    std::fflush(stdout);
+}
+
+bool write_frame_time_summary(const std::string &filename, const FrameTimeStats &stats,
+                              const std::vector<double> &frameTimesMs, const std::string &replayFilename)
+{
+    FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    std::string replay;
+    for (char c : replayFilename) {
+        if (c == '"' || c == '\\') replay += '\\';
+        replay += c;
+    }
+    std::fprintf(file, "{\n  \"replay\": \"%s\",\n  \"frames\": %d,\n", replay.c_str(), stats.frames);
+    std::fprintf(file, "  \"mean_ms\": %.4f,\n  \"min_ms\": %.4f,\n  \"max_ms\": %.4f,\n", stats.meanMs,
+                 stats.minMs, stats.maxMs);
+    std::fprintf(file, "  \"p50_ms\": %.4f,\n  \"p95_ms\": %.4f,\n  \"p99_ms\": %.4f,\n", stats.p50Ms,
+                 stats.p95Ms, stats.p99Ms);
+    std::fprintf(file, "  \"histogram_bucket_ms\": %g,\n  \"histogram\": [", stats.bucketMs);
+    for (size_t i = 0; i < stats.histogram.size(); ++i) {
+        std::fprintf(file, "%s%d", i ? ", " : "", stats.histogram[i]);
+    }
+    std::fprintf(file, "],\n  \"frame_times_ms\": [");
+    for (size_t i = 0; i < frameTimesMs.size(); ++i) {
+        std::fprintf(file, "%s%.4f", i ? ", " : "", frameTimesMs[i]);
+    }
+    std::fprintf(file, "]\n}\n");
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+}  // namespace cg
@@ -0,0 +1,93 @@
+// Recording and replay of timestamped input events and GUI state, and
+// frame-time statistics for comparing replays between builds.
+//
+// A recording is a text file with one line per frame and per event:
+//
+//     recording 1 <width> <height>
+//     frame <time>
+//     button <x> <y> <pressed>
+//     cursor <x> <y>
+//     scroll <offset>
+//     state <name> <value> [<value> <value>]
+//
+// Events belong to the frame line before them. Only changed GUI state is
+// written, so the first frame holds a full snapshot.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace cg {
+
+enum InputEventType {
+    INPUT_MOUSE_BUTTON = 0,  // Left mouse button at (x, y), pressed if value[0] != 0
+    INPUT_CURSOR_POS = 1,    // Cursor moved to (x, y)
+    INPUT_SCROLL = 2,        // Vertical scroll offset in y
+    INPUT_STATE = 3          // GUI variable name set to value
+};
+
+struct InputEvent {
+    InputEventType type = INPUT_MOUSE_BUTTON;
+    double x = 0.0;
+    double y = 0.0;
+    std::string name;
+    double value[3] = {0.0, 0.0, 0.0};
+};
+
+struct InputFrame {
+    double time = 0.0;  // Seconds, relative to any fixed point
+    std::vector<InputEvent> events;
+};
+
+struct InputRecording {
+    int width = 0;  // Window size during recording
+    int height = 0;
+    std::vector<InputFrame> frames;
+};
+
+bool save_input_recording(const std::string &filename, const InputRecording &recording);
+
+bool load_input_recording(const std::string &filename, InputRecording &recording);
+
+enum StateVariableType { STATE_BOOL = 0, STATE_INT = 1, STATE_FLOAT = 2, STATE_VEC3 = 3 };
+
+// A named GUI variable that is recorded and replayed
+struct StateVariable {
+    const char *name;
+    StateVariableType type;
+    void *data;
+};
+
+// Append state events to frame for all variables that differ from last,
+// which is updated. An empty last records all variables.
+void record_state_changes(const std::vector<StateVariable> &variables, std::vector<double> &last,
+                          InputFrame &frame);
+
+// Set the variable named in a state event. Returns false if it is unknown.
+bool apply_state_event(const std::vector<StateVariable> &variables, const InputEvent &event);
+
+struct FrameTimeStats {
+    int frames = 0;
+    double meanMs = 0.0;
+    double minMs = 0.0;
+    double maxMs = 0.0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+    double bucketMs = 1.0;        // Width of the histogram buckets
+    std::vector<int> histogram;  // Frame counts per bucket (the last is open-ended)
+};
+
+FrameTimeStats compute_frame_time_stats(const std::vector<double> &frameTimesMs, double bucketMs = 1.0,
+                                        int numBuckets = 34);
+
+// Print the percentiles and a text histogram to stdout
+void print_frame_time_stats(const FrameTimeStats &stats);
+
+// Write the statistics (and the per-frame times) as JSON for regression gating
+bool write_frame_time_summary(const std::string &filename, const FrameTimeStats &stats,
+                              const std::vector<double> &frameTimesMs, const std::string &replayFilename);
+
+}  // namespace cg
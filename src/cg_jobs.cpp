@@ -0,0 +1,263 @@
+// Work-stealing job system.
+//
+
+#include "cg_jobs.h"
+#include "cg_parallel.h"
+#include "cg_profiler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+
+namespace cg {
+
+namespace {
+
+// Deques are locked rather than lock-free: jobs are coarse (a parallel loop
+// spawns a few per thread), so the locks are rarely contended. Deques are
+// padded to separate cache lines, so that threads do not slow each other down
+// by writing next to each other's deques.
+struct JobDeque {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    char padding[64];
+};
+
+}  // namespace
+
+struct JobScheduler {
+    std::vector<std::unique_ptr<JobDeque>> deques;  // One per thread, 0 for the creating one
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false};
+    std::atomic<int> queued{0};    // Jobs in all deques
+    std::atomic<int> sleeping{0};  // Workers that are (about to go) waiting for jobs
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+};
+
+namespace {
+
+// Deque of the current thread, if it is a thread of a scheduler
+thread_local JobScheduler *currentScheduler = nullptr;
+thread_local int currentDeque = 0;
+
+void push_job(JobScheduler &scheduler, Job job)
+{
+    // Other threads (e.g. a loader thread) share the deque of the creating one
+    int index = currentScheduler == &scheduler ? currentDeque : 0;
+    JobDeque &deque = *scheduler.deques[index];
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.jobs.push_back(std::move(job));
+    }
+    // A worker increments sleeping before checking queued, and this thread
+    // increments queued before checking sleeping, so one of them sees the other
+    scheduler.queued++;
+    if (scheduler.sleeping > 0) {
+        std::lock_guard<std::mutex> lock(scheduler.sleepMutex);
+        scheduler.wake.notify_one();
+    }
+}
+
+bool pop_job(JobScheduler &scheduler, int index, uint32_t &random, Job &job)
+{
+    if (scheduler.queued == 0) return false;
+    {
+        JobDeque &own = *scheduler.deques[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            scheduler.queued--;
+            return true;
+        }
+    }
+    // Steal from the other deques, starting at a random one so that thieves
+    // spread out
+    const int count = int(scheduler.deques.size());
+    random = random * 1664525u + 1013904223u;
+    int first = int((random >> 8) % uint32_t(count));
+    for (int i = 0; i < count; ++i) {
+        int victim = (first + i) % count;
+        if (victim == index) continue;
+        JobDeque &deque = *scheduler.deques[victim];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (deque.jobs.empty()) continue;
+        job = std::move(deque.jobs.front());
+        deque.jobs.pop_front();
+        scheduler.queued--;
+        return true;
+    }
+    return false;
+}
+
+void finish_job(JobScheduler *scheduler, JobCounter *counter);
+
+void run_job(JobScheduler *scheduler, Job &job)
+{
+    job.fn();
+    job.fn = nullptr;  // Release captured state before the counter drops
+    finish_job(scheduler, job.counter);
+}
+
+void submit_job(JobScheduler *scheduler, Job job)
+{
+    if (scheduler) {
+        push_job(*scheduler, std::move(job));
+    } else {
+        run_job(nullptr, job);
+    }
+}
+
+void finish_job(JobScheduler *scheduler, JobCounter *counter)
+{
+    if (!counter) return;
+    std::vector<Job> continuations;
+    {
+        // The drop to zero happens under the lock, so that job_then() either
+        // sees it or has its continuation taken here, and so that job_wait()
+        // can wait for this thread to be done with the counter
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (--counter->pending == 0) continuations.swap(counter->continuations);
+    }
+    for (Job &job : continuations) submit_job(scheduler, std::move(job));
+}
+
+void run_worker(JobScheduler &scheduler, int index)
+{
+    currentScheduler = &scheduler;
+    currentDeque = index;
+    uint32_t random = uint32_t(index) * 2654435761u;
+    Job job;
+    while (true) {
+        if (pop_job(scheduler, index, random, job)) {
+            run_job(&scheduler, job);
+            continue;
+        }
+        if (scheduler.stopping) break;
+        scheduler.sleeping++;
+        {
+            std::unique_lock<std::mutex> lock(scheduler.sleepMutex);
+            scheduler.wake.wait(lock, [&] { return scheduler.queued > 0 || scheduler.stopping; });
+        }
+        scheduler.sleeping--;
+    }
+}
+
+void split_range(JobSystem &jobs, size_t begin, size_t end, size_t grain,
+                 const std::shared_ptr<std::function<void(size_t, size_t)>> &fn,
+                 JobCounter *counter)
+{
+    // Hand off the upper halves, and keep the lowest range for this thread
+    while (end - begin > grain) {
+        size_t middle = begin + (end - begin) / 2;
+        job_spawn(jobs, [&jobs, middle, end, grain, fn, counter] {
+            split_range(jobs, middle, end, grain, fn, counter);
+        }, counter);
+        end = middle;
+    }
+    (*fn)(begin, end);
+}
+
+}  // namespace
+
+void job_system_init(JobSystem &jobs, int threads)
+{
+    job_system_destroy(jobs);
+    if (threads <= 0) threads = hardware_threads();
+    std::shared_ptr<JobScheduler> scheduler = std::make_shared<JobScheduler>();
+    for (int i = 0; i < threads; ++i) scheduler->deques.emplace_back(new JobDeque());
+    currentScheduler = scheduler.get();
+    currentDeque = 0;
+    JobScheduler *state = scheduler.get();
+    for (int i = 1; i < threads; ++i) {
+        scheduler->workers.push_back(std::thread([state, i] {
+            std::string name = "Job Worker " + std::to_string(i);
+            profiler_set_thread_name(name.c_str());
+            run_worker(*state, i);
+        }));
+    }
+    jobs.scheduler = scheduler;
+}
+
+void job_system_destroy(JobSystem &jobs)
+{
+    if (!jobs.scheduler) return;
+    JobScheduler &scheduler = *jobs.scheduler;
+    {
+        std::lock_guard<std::mutex> lock(scheduler.sleepMutex);
+        scheduler.stopping = true;
+        scheduler.wake.notify_all();
+    }
+    for (std::thread &worker : scheduler.workers) worker.join();
+    // Without workers, jobs left in the deque of this thread run here
+    uint32_t random = 0;
+    Job job;
+    while (pop_job(scheduler, 0, random, job)) run_job(&scheduler, job);
+    if (currentScheduler == &scheduler) currentScheduler = nullptr;
+    jobs.scheduler.reset();
+}
+
+int job_system_threads(const JobSystem &jobs)
+{
+    return jobs.scheduler ? int(jobs.scheduler->deques.size()) : 1;
+}
+
+void job_spawn(JobSystem &jobs, JobFunction fn, JobCounter *counter)
+{
+    Job job;
+    job.fn = std::move(fn);
+    job.counter = counter;
+    if (counter) counter->pending++;
+    submit_job(jobs.scheduler.get(), std::move(job));
+}
+
+void job_then(JobSystem &jobs, JobCounter &dependency, JobFunction fn, JobCounter *counter)
+{
+    Job job;
+    job.fn = std::move(fn);
+    job.counter = counter;
+    if (counter) counter->pending++;
+    {
+        std::lock_guard<std::mutex> lock(dependency.mutex);
+        if (dependency.pending > 0) {
+            dependency.continuations.push_back(std::move(job));
+            return;
+        }
+    }
+    submit_job(jobs.scheduler.get(), std::move(job));
+}
+
+void job_parallel_for(JobSystem &jobs, size_t count, size_t grain,
+                      const std::function<void(size_t, size_t)> &fn, JobCounter *counter)
+{
+    if (count == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    auto shared = std::make_shared<std::function<void(size_t, size_t)>>(fn);
+    job_spawn(jobs, [&jobs, count, grain, shared, counter] {
+        split_range(jobs, 0, count, grain, shared, counter);
+    }, counter);
+}
+
+void job_wait(JobSystem &jobs, JobCounter &counter)
+{
+    JobScheduler *scheduler = jobs.scheduler.get();
+    if (scheduler) {
+        int index = currentScheduler == scheduler ? currentDeque : 0;
+        uint32_t random = uint32_t(index) * 2654435761u + 1u;
+        Job job;
+        while (counter.pending > 0) {
+            if (pop_job(*scheduler, index, random, job)) {
+                run_job(scheduler, job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+    // The thread that finished the last job may still hold the lock
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+}  // namespace cg
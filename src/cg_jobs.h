@@ -0,0 +1,76 @@
+// Work-stealing job system.
+//
+// Every worker thread, and the thread that creates the system (which runs
+// jobs while it waits for them), owns a deque of jobs. A thread pushes and
+// pops jobs at the back of its own deque, so that the most recently spawned
+// (cache-warm) job runs first, and steals from the front of other deques
+// when its own is empty, which takes the oldest and usually largest piece of
+// work. Parallel loops split their range in halves recursively, so idle
+// threads steal large halves rather than single iterations. Jobs are grouped
+// by counters, which can be waited for and which start continuations (e.g.
+// the next stage of a job graph) when all their jobs have finished.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cg {
+
+struct JobScheduler;  // Worker threads and their deques
+
+typedef std::function<void()> JobFunction;
+
+struct JobCounter;
+
+struct Job {
+    JobFunction fn;
+    JobCounter *counter = nullptr;  // Decremented when the job has finished
+};
+
+// Number of unfinished jobs of a group. A counter must outlive its jobs and
+// continuations (job_wait() makes sure of that).
+struct JobCounter {
+    std::atomic<int> pending{0};
+    std::mutex mutex;                // Protects the continuations, and the drop to zero
+    std::vector<Job> continuations;  // Spawned when pending drops to zero
+};
+
+struct JobSystem {
+    std::shared_ptr<JobScheduler> scheduler;
+};
+
+// Start threads - 1 workers (0 for one thread per hardware thread). The
+// calling thread is the remaining one, and runs jobs in job_wait().
+void job_system_init(JobSystem &jobs, int threads = 0);
+
+// Finish the queued jobs and stop the workers
+void job_system_destroy(JobSystem &jobs);
+
+// Returns the number of threads that run jobs (including the creating one)
+int job_system_threads(const JobSystem &jobs);
+
+// Run a job on any thread. If given, the counter counts it until it has
+// finished. Without a system (e.g. before it is initialized), jobs run
+// immediately on the calling thread.
+void job_spawn(JobSystem &jobs, JobFunction fn, JobCounter *counter = nullptr);
+
+// Run a job once all jobs of the dependency have finished (right away if they
+// already have). The counter counts it from now on.
+void job_then(JobSystem &jobs, JobCounter &dependency, JobFunction fn,
+              JobCounter *counter = nullptr);
+
+// Call fn(begin, end) for ranges of at most grain iterations that cover
+// [0, count), as jobs counted by the counter
+void job_parallel_for(JobSystem &jobs, size_t count, size_t grain,
+                      const std::function<void(size_t, size_t)> &fn, JobCounter *counter);
+
+// Run jobs on the calling thread until the counter drops to zero
+void job_wait(JobSystem &jobs, JobCounter &counter);
+
+}  // namespace cg
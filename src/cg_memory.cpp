@@ -0,0 +1,215 @@
+// Accounting of CPU and GPU memory per resource category.
+//
+
+#include "cg_memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+namespace cg {
+
+namespace {
+
+// BC1-BC3 formats of EXT_texture_compression_s3tc, which is not core
+const GLenum COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+const GLenum COMPRESSED_RGBA_S3TC_DXT1 = 0x83F1;
+const GLenum COMPRESSED_RGBA_S3TC_DXT3 = 0x83F2;
+const GLenum COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+
+struct GLAllocation {
+    MemoryCategory category;
+    uint64_t bytes;
+};
+
+struct MemoryTracker {
+    std::mutex mutex;  // Protects everything below
+    MemoryUsage usage[NUM_MEMORY_CATEGORIES];
+    MemoryUsage totals[2];  // CPU and GPU
+    std::unordered_map<uint64_t, GLAllocation> allocations;  // By type and name
+};
+
+MemoryTracker &tracker()
+{
+    static MemoryTracker instance;
+    return instance;
+}
+
+uint64_t gl_object_key(GLenum type, GLuint name) { return uint64_t(type) << 32 | name; }
+
+// Adds to the live bytes and objects of a category (with the mutex held)
+void add_usage(MemoryTracker &t, MemoryCategory category, int64_t bytes, int objects)
+{
+    MemoryUsage *usages[2] = {&t.usage[category], &t.totals[memory_category_gpu(category)]};
+    for (MemoryUsage *usage : usages) {
+        usage->bytes += uint64_t(bytes);
+        usage->peakBytes = std::max(usage->peakBytes, usage->bytes);
+        usage->objects += objects;
+    }
+}
+
+void write_usage(FILE *file, const MemoryUsage &usage)
+{
+    std::fprintf(file, "{\"bytes\":%llu,\"peakBytes\":%llu,\"objects\":%d}",
+                 (unsigned long long)usage.bytes, (unsigned long long)usage.peakBytes,
+                 usage.objects);
+}
+
+}  // namespace
+
+const char *memory_category_name(MemoryCategory category)
+{
+    switch (category) {
+    case MEMORY_CPU_GEOMETRY: return "CPU geometry";
+    case MEMORY_CPU_IMAGES: return "CPU images";
+    case MEMORY_CPU_TEXTURE_LEVELS: return "CPU texture levels";
+    case MEMORY_CPU_SCENE: return "CPU scene description";
+    case MEMORY_CPU_SCENE_CACHE: return "CPU scene cache";
+    case MEMORY_GL_BUFFERS: return "GPU buffers";
+    case MEMORY_GL_TEXTURES: return "GPU textures";
+    case MEMORY_GL_ENVIRONMENT: return "GPU environment";
+    case MEMORY_GL_RENDER_TARGETS: return "GPU render targets";
+    case MEMORY_GL_STREAMING: return "GPU streaming";
+    default: return "Unknown";
+    }
+}
+
+bool memory_category_gpu(MemoryCategory category) { return category >= MEMORY_GL_BUFFERS; }
+
+MemoryUsage memory_usage(MemoryCategory category)
+{
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    return t.usage[category];
+}
+
+MemoryUsage memory_total(bool gpu)
+{
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    return t.totals[gpu];
+}
+
+void memory_reset_peaks()
+{
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    for (MemoryUsage &usage : t.usage) usage.peakBytes = usage.bytes;
+    for (MemoryUsage &usage : t.totals) usage.peakBytes = usage.bytes;
+}
+
+MemoryTag::~MemoryTag() { memory_tag_set(*this, 0); }
+
+void memory_tag_set(MemoryTag &tag, uint64_t bytes)
+{
+    if (bytes == tag.bytes) return;
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    int objects = (bytes != 0) - (tag.bytes != 0);
+    add_usage(t, tag.category, int64_t(bytes - tag.bytes), objects);
+    tag.bytes = bytes;
+}
+
+void memory_track_gl(GLenum type, GLuint name, MemoryCategory category, uint64_t bytes)
+{
+    if (!name) return;
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    auto inserted =
+        t.allocations.insert({gl_object_key(type, name), GLAllocation{category, bytes}});
+    GLAllocation &allocation = inserted.first->second;
+    if (!inserted.second) {
+        add_usage(t, allocation.category, -int64_t(allocation.bytes), -1);
+        allocation = GLAllocation{category, bytes};
+    }
+    add_usage(t, category, int64_t(bytes), 1);
+}
+
+void memory_release_gl(GLenum type, GLsizei count, const GLuint *names)
+{
+    MemoryTracker &t = tracker();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    for (GLsizei i = 0; i < count; ++i) {
+        auto it = t.allocations.find(gl_object_key(type, names[i]));
+        if (it == t.allocations.end()) continue;
+        add_usage(t, it->second.category, -int64_t(it->second.bytes), -1);
+        t.allocations.erase(it);
+    }
+}
+
+uint64_t gl_image_bytes(GLenum internalFormat, int width, int height, int depth)
+{
+    const uint64_t w = uint64_t(std::max(width, 0)), h = uint64_t(std::max(height, 0));
+    const uint64_t d = uint64_t(std::max(depth, 0));
+    const uint64_t blocks = (w + 3) / 4 * ((h + 3) / 4) * d;
+    switch (internalFormat) {
+    case COMPRESSED_RGB_S3TC_DXT1:
+    case COMPRESSED_RGBA_S3TC_DXT1:
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+        return blocks * 8;
+    case COMPRESSED_RGBA_S3TC_DXT3:
+    case COMPRESSED_RGBA_S3TC_DXT5:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return blocks * 16;
+    case GL_RED:
+    case GL_R8:
+        return w * h * d;
+    case GL_RG:
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        return w * h * d * 2;
+    case GL_RGBA16F:
+    case GL_RG32F:
+        return w * h * d * 8;
+    case GL_RGBA32F:
+        return w * h * d * 16;
+    default:  // RGBA8 and sRGB, and RGB8 and 24-bit depth, which are padded to 4 bytes
+        return w * h * d * 4;
+    }
+}
+
+uint64_t gl_mip_chain_bytes(GLenum internalFormat, int width, int height, int depth, int levels)
+{
+    uint64_t bytes = 0;
+    for (int level = 0; level < levels; ++level) {
+        bytes += gl_image_bytes(internalFormat, std::max(1, width >> level),
+                                std::max(1, height >> level), depth);
+    }
+    return bytes;
+}
+
+bool memory_write_json(const std::string &filename)
+{
+    FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    MemoryTracker &t = tracker();
+    {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        std::fprintf(file, "{\n  \"cpu\": ");
+        write_usage(file, t.totals[0]);
+        std::fprintf(file, ",\n  \"gpu\": ");
+        write_usage(file, t.totals[1]);
+        std::fprintf(file, ",\n  \"categories\": {");
+        for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i) {
+            std::fprintf(file, "%s\n    \"%s\": ", i ? "," : "",
+                         memory_category_name(MemoryCategory(i)));
+            write_usage(file, t.usage[i]);
+        }
+        std::fprintf(file, "\n  }\n}\n");
+    }
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+}  // namespace cg
@@ -0,0 +1,92 @@
+// Accounting of CPU and GPU memory per resource category.
+//
+// GPU memory is estimated from the size of each GL buffer, texture and
+// renderbuffer when its storage is specified, and released when it is
+// deleted, so the modules that create GL objects report them by name. CPU
+// memory is reported by its owners through tags, which hold the bytes of an
+// owner in a category and are set whenever the owner's data changes. Each
+// category keeps its live total and its high-water mark. All functions are
+// thread-safe.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cg {
+
+enum MemoryCategory {
+    MEMORY_CPU_GEOMETRY = 0,        // Vertex and index data of the shown asset
+    MEMORY_CPU_IMAGES = 1,          // Decoded pixels and mip levels of its images
+    MEMORY_CPU_TEXTURE_LEVELS = 2,  // Levels of the texture arrays, kept for streaming
+    MEMORY_CPU_SCENE = 3,           // Scene description (nodes, meshes, accessors...)
+    MEMORY_CPU_SCENE_CACHE = 4,     // Data that the scene loader keeps for other scenes
+    MEMORY_GL_BUFFERS = 5,          // Vertex and index buffers
+    MEMORY_GL_TEXTURES = 6,         // Material textures
+    MEMORY_GL_ENVIRONMENT = 7,      // Cubemaps and lookup textures
+    MEMORY_GL_RENDER_TARGETS = 8,   // Framebuffer attachments
+    MEMORY_GL_STREAMING = 9,        // Staging, uniform, pixel unpack and readback buffers
+    NUM_MEMORY_CATEGORIES = 10
+};
+
+struct MemoryUsage {
+    uint64_t bytes = 0;
+    uint64_t peakBytes = 0;  // Since the start, or since memory_reset_peaks()
+    int objects = 0;         // GL objects or CPU tags that hold memory
+};
+
+// Returns the name of a category, e.g. "GPU buffers"
+const char *memory_category_name(MemoryCategory category);
+
+// Returns true for categories of GPU memory
+bool memory_category_gpu(MemoryCategory category);
+
+MemoryUsage memory_usage(MemoryCategory category);
+
+// Returns the sums of the live and peak bytes of all CPU or GPU categories.
+// The peak of the sum is not the sum of the peaks, so it is tracked too.
+MemoryUsage memory_total(bool gpu);
+
+// Set the high-water marks to the live totals
+void memory_reset_peaks();
+
+// CPU memory that an owner holds in a category. The bytes are released when
+// the tag is destroyed, and moved along with the tag.
+struct MemoryTag {
+    MemoryCategory category;
+    uint64_t bytes = 0;
+    explicit MemoryTag(MemoryCategory category) : category(category) {}
+    MemoryTag(MemoryTag &&other) : category(other.category), bytes(other.bytes) { other.bytes = 0; }
+    ~MemoryTag();
+    MemoryTag(const MemoryTag &) = delete;
+    MemoryTag &operator=(const MemoryTag &) = delete;
+};
+
+// Replace the bytes that the owner of a tag holds
+void memory_tag_set(MemoryTag &tag, uint64_t bytes);
+
+// Record the storage of a GL object (type GL_BUFFER, GL_TEXTURE or
+// GL_RENDERBUFFER), replacing what was recorded for it before, e.g. when a
+// texture is resized
+void memory_track_gl(GLenum type, GLuint name, MemoryCategory category, uint64_t bytes);
+
+// Release the storage of GL objects that are deleted. Names that were never
+// tracked are ignored.
+void memory_release_gl(GLenum type, GLsizei count, const GLuint *names);
+
+// Returns the size of one level of an image with the given internal format
+// (uncompressed, depth or BC1-BC7 compressed), e.g. for memory_track_gl()
+uint64_t gl_image_bytes(GLenum internalFormat, int width, int height, int depth = 1);
+
+// Returns the size of levels of a mip chain, starting at level 0 of the given
+// size, with depth layers each (e.g. 6 for cubemaps)
+uint64_t gl_mip_chain_bytes(GLenum internalFormat, int width, int height, int depth, int levels);
+
+// Write the live and peak bytes of all categories as JSON
+bool memory_write_json(const std::string &filename);
+
+}  // namespace cg
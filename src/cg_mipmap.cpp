@@ -0,0 +1,297 @@
+// CPU generation of mipmap chains for RGBA8 images.
+//
+
+#include "cg_mipmap.h"
+#include "cg_parallel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <numeric>
+
+namespace cg {
+
+namespace {
+
+double srgb_to_linear(double c)
+{
+    return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+// Lookup tables for decoding 8-bit sRGB values and encoding linear ones. A
+// linear value encodes to the number of thresholds below it, which is at least
+// the coarse encoding of its first 14 bits (and at most one more).
+struct SRGBTables {
+    float toLinear[256];
+    float thresholds[256];  // Linear value halfway (in sRGB) between i and i + 1
+    uint8_t coarse[16385];
+
+    SRGBTables()
+    {
+        for (int i = 0; i < 256; ++i) toLinear[i] = float(srgb_to_linear(i / 255.0));
+        for (int i = 0; i < 255; ++i) thresholds[i] = float(srgb_to_linear((i + 0.5) / 255.0));
+        thresholds[255] = INFINITY;
+        for (int k = 0, i = 0; k <= 16384; ++k) {
+            while (k / 16384.0f > thresholds[i]) ++i;
+            coarse[k] = uint8_t(i);
+        }
+    }
+};
+
+const SRGBTables &srgb_tables()
+{
+    static const SRGBTables tables;
+    return tables;
+}
+
+inline uint8_t encode_srgb(const SRGBTables &tables, float value)
+{
+    if (!(value > 0.0f)) return 0;
+    if (value >= 1.0f) return 255;
+    int i = tables.coarse[int(value * 16384.0f)];
+    return uint8_t(value > tables.thresholds[i] ? i + 1 : i);
+}
+
+inline uint8_t encode_unorm(float value)
+{
+    return uint8_t(std::min(std::max(value * 255.0f + 0.5f, 0.0f), 255.0f));
+}
+
+// Source texels (clamped to the edges) and weights of each destination texel
+// along one axis, padded with zero weights to the same count
+struct FilterTaps {
+    int count = 0;
+    std::vector<int> texels;
+    std::vector<float> weights;
+};
+
+double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+double sinc(double x)
+{
+    const double pi = 3.14159265358979323846;
+    return std::fabs(x) < 1e-9 ? 1.0 : std::sin(pi * x) / (pi * x);
+}
+
+FilterTaps filter_taps(int size, int newSize, MipFilter filter)
+{
+    const double scale = double(size) / newSize;
+    const double kaiserWidth = 3.0, kaiserAlpha = 4.0;  // In destination texels
+    std::vector<std::vector<std::pair<int, double>>> lists(newSize);
+    for (int i = 0; i < newSize; ++i) {
+        std::vector<std::pair<int, double>> &taps = lists[i];
+        if (newSize == size) {
+            taps.push_back(std::make_pair(i, 1.0));
+        } else if (filter == MIP_FILTER_BOX) {
+            // Coverage of the source texels by [lo, hi)
+            double lo = i * scale, hi = (i + 1) * scale;
+            for (int j = int(lo); j < int(std::ceil(hi)); ++j) {
+                double weight = std::min(hi, j + 1.0) - std::max(lo, double(j));
+                if (weight > 1e-9) taps.push_back(std::make_pair(j, weight));
+            }
+        } else {
+            double center = (i + 0.5) * scale;
+            int first = int(std::floor(center - kaiserWidth * scale));
+            int last = int(std::ceil(center + kaiserWidth * scale));
+            for (int j = first; j <= last; ++j) {
+                double x = (j + 0.5 - center) / scale, r = x / kaiserWidth;
+                if (std::fabs(r) >= 1.0) continue;
+                double window =
+                    bessel_i0(kaiserAlpha * std::sqrt(1.0 - r * r)) / bessel_i0(kaiserAlpha);
+                int texel = std::min(std::max(j, 0), size - 1);
+                taps.push_back(std::make_pair(texel, sinc(x) * window));
+            }
+        }
+    }
+
+    FilterTaps result;
+    for (const auto &taps : lists) result.count = std::max(result.count, int(taps.size()));
+    result.texels.resize(size_t(newSize) * result.count);
+    result.weights.resize(size_t(newSize) * result.count, 0.0f);
+    for (int i = 0; i < newSize; ++i) {
+        double total = 0.0;
+        for (const auto &tap : lists[i]) total += tap.second;
+        for (int t = 0; t < result.count; ++t) {
+            bool padding = t >= int(lists[i].size());
+            size_t index = size_t(i) * result.count + t;
+            result.texels[index] = lists[i][padding ? 0 : t].first;
+            if (!padding) result.weights[index] = float(lists[i][t].second / total);
+        }
+    }
+    return result;
+}
+
+void decode_row(const uint8_t *src, int width, bool srgb, const SRGBTables &tables, float *dst)
+{
+    const size_t count = size_t(width) * 4;
+    for (size_t i = 0; i < count; ++i) dst[i] = src[i] * (1.0f / 255.0f);
+    if (!srgb) return;
+    for (size_t i = 0; i < count; i += 4) {
+        for (int c = 0; c < 3; ++c) dst[i + c] = tables.toLinear[src[i + c]];
+    }
+}
+
+void encode_row(const float *src, int width, bool srgb, const SRGBTables &tables, uint8_t *dst)
+{
+    const size_t count = size_t(width) * 4;
+    for (size_t i = 0; i < count; ++i) dst[i] = encode_unorm(src[i]);
+    if (!srgb) return;
+    for (size_t i = 0; i < count; i += 4) {
+        for (int c = 0; c < 3; ++c) dst[i + c] = encode_srgb(tables, src[i + c]);
+    }
+}
+
+// Filter a row of linear RGBA texels horizontally, one texel (four floats)
+// at a time
+void filter_row(const float *src, const FilterTaps &taps, int newWidth, float *dst)
+{
+    for (int x = 0; x < newWidth; ++x) {
+        const int *texels = &taps.texels[size_t(x) * taps.count];
+        const float *weights = &taps.weights[size_t(x) * taps.count];
+#ifdef __SSE2__
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < taps.count; ++t) {
+            __m128 texel = _mm_loadu_ps(src + 4 * texels[t]);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), texel));
+        }
+        _mm_storeu_ps(dst + 4 * x, sum);
+#else
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int t = 0; t < taps.count; ++t) {
+            for (int c = 0; c < 4; ++c) sum[c] += weights[t] * src[4 * texels[t] + c];
+        }
+        std::copy(sum, sum + 4, dst + 4 * x);
+#endif
+    }
+}
+
+// dst += weight * src, for a multiple of four floats
+void accumulate_row(float *dst, const float *src, float weight, size_t count)
+{
+#ifdef __SSE2__
+    __m128 w = _mm_set1_ps(weight);
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(w, _mm_loadu_ps(src + i)));
+        _mm_storeu_ps(dst + i, sum);
+    }
+#else
+    for (size_t i = 0; i < count; ++i) dst[i] += weight * src[i];
+#endif
+}
+
+// Compute rows [firstRow, lastRow) of the destination. Horizontally filtered
+// source rows are kept in a ring, so that each is filtered once even when
+// the vertical taps of neighboring rows overlap.
+void resample_rows(const uint8_t *src, int width, int height, uint8_t *dst, int newWidth,
+                   int newHeight, const FilterTaps &tx, const FilterTaps &ty, bool srgb,
+                   int firstRow, int lastRow)
+{
+    const SRGBTables &tables = srgb_tables();
+    const int ringSize = ty.count + int(std::ceil(double(height) / newHeight)) + 1;
+    const size_t rowFloats = size_t(newWidth) * 4;
+    std::vector<float> linear(size_t(width) * 4), ring(ringSize * rowFloats), row(rowFloats);
+    std::vector<int> ringRows(ringSize, -1);
+    for (int y = firstRow; y < lastRow; ++y) {
+        std::fill(row.begin(), row.end(), 0.0f);
+        for (int t = 0; t < ty.count; ++t) {
+            int sy = ty.texels[size_t(y) * ty.count + t];
+            float weight = ty.weights[size_t(y) * ty.count + t];
+            if (weight == 0.0f) continue;
+            float *filtered = &ring[(sy % ringSize) * rowFloats];
+            if (ringRows[sy % ringSize] != sy) {
+                decode_row(src + size_t(sy) * width * 4, width, srgb, tables, linear.data());
+                filter_row(linear.data(), tx, newWidth, filtered);
+                ringRows[sy % ringSize] = sy;
+            }
+            accumulate_row(row.data(), filtered, weight, rowFloats);
+        }
+        encode_row(row.data(), newWidth, srgb, tables, dst + size_t(y) * newWidth * 4);
+    }
+}
+
+int resolve_threads(int threads)
+{
+    return threads > 0 ? threads : hardware_threads();
+}
+
+}  // namespace
+
+int mip_level_count(int width, int height)
+{
+    int levels = 1;
+    while ((width >> levels) > 0 || (height >> levels) > 0) levels++;
+    return levels;
+}
+
+std::vector<uint8_t> downsample_rgba8(const uint8_t *rgba, int width, int height, bool srgb,
+                                      const MipSettings &settings)
+{
+    const int newWidth = std::max(1, width / 2), newHeight = std::max(1, height / 2);
+    FilterTaps tx = filter_taps(width, newWidth, settings.filter);
+    FilterTaps ty = filter_taps(height, newHeight, settings.filter);
+    std::vector<uint8_t> result(size_t(newWidth) * newHeight * 4);
+    // Small levels are not worth starting threads for
+    int threads = std::max(1, std::min(resolve_threads(settings.threads), newHeight / 32));
+    parallel_for(threads, size_t(newHeight), [&](size_t begin, size_t end, int) {
+        resample_rows(rgba, width, height, result.data(), newWidth, newHeight, tx, ty, srgb,
+                      int(begin), int(end));
+    });
+    return result;
+}
+
+std::vector<std::vector<uint8_t>> generate_mip_chain(const uint8_t *rgba, int width, int height,
+                                                     bool srgb, const MipSettings &settings)
+{
+    std::vector<std::vector<uint8_t>> levels(mip_level_count(width, height) - 1);
+    const uint8_t *src = rgba;
+    for (size_t level = 0; level < levels.size(); ++level) {
+        levels[level] = downsample_rgba8(src, width, height, srgb, settings);
+        src = levels[level].data();
+        width = std::max(1, width / 2), height = std::max(1, height / 2);
+    }
+    return levels;
+}
+
+void generate_mip_chains(std::vector<MipChain> &chains, const MipSettings &settings)
+{
+    const int threads = resolve_threads(settings.threads);
+    if (int(chains.size()) < threads) {
+        for (MipChain &chain : chains) {
+            chain.levels =
+                generate_mip_chain(chain.rgba, chain.width, chain.height, chain.srgb, settings);
+        }
+        return;
+    }
+
+    // One image per thread at a time, largest first
+    std::vector<size_t> order(chains.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        size_t pixelsA = size_t(chains[a].width) * chains[a].height;
+        return pixelsA > size_t(chains[b].width) * chains[b].height;
+    });
+    MipSettings single = settings;
+    single.threads = 1;
+    std::atomic<size_t> next(0);
+    parallel_for(threads, size_t(threads), [&](size_t, size_t, int) {
+        for (size_t i = next++; i < order.size(); i = next++) {
+            MipChain &chain = chains[order[i]];
+            chain.levels =
+                generate_mip_chain(chain.rgba, chain.width, chain.height, chain.srgb, single);
+        }
+    });
+}
+
+}  // namespace cg
@@ -0,0 +1,55 @@
+// CPU generation of mipmap chains for RGBA8 images.
+//
+// Unlike glGenerateMipmap, the filtering does not depend on the driver, runs
+// on all hardware threads, and its result can be cached and uploaded level by
+// level. Color channels of sRGB images are filtered in linear space (alpha
+// always is). Odd sizes are halved with filters that cover the whole source
+// image (three taps for the box filter), so non-power-of-two images do not
+// shift or lose their last row and column.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace cg {
+
+enum MipFilter {
+    MIP_FILTER_BOX = 0,  // Average of the texels that each texel covers
+    MIP_FILTER_KAISER    // Kaiser-windowed sinc, sharper than the box filter
+};
+
+struct MipSettings {
+    MipFilter filter = MIP_FILTER_BOX;
+    int threads = 0;  // 0 for all hardware threads
+};
+
+// The mip chain of an image, with the levels below its base level
+struct MipChain {
+    const uint8_t *rgba = nullptr;  // Level 0
+    int width = 0;
+    int height = 0;
+    bool srgb = false;
+    std::vector<std::vector<uint8_t>> levels;  // Levels 1 and up
+};
+
+// Number of levels of a full mip chain (down to 1x1), including level 0
+int mip_level_count(int width, int height);
+
+// Halve an RGBA8 image (sizes are rounded down, to at least 1)
+std::vector<uint8_t> downsample_rgba8(const uint8_t *rgba, int width, int height, bool srgb,
+                                      const MipSettings &settings = MipSettings());
+
+// Compute levels 1 and up of an RGBA8 image. The rows of each level are
+// split between threads.
+std::vector<std::vector<uint8_t>> generate_mip_chain(const uint8_t *rgba, int width, int height,
+                                                     bool srgb,
+                                                     const MipSettings &settings = MipSettings());
+
+// Compute the levels of several images, in parallel across images (or across
+// the rows of each level if there are fewer images than threads)
+void generate_mip_chains(std::vector<MipChain> &chains,
+                         const MipSettings &settings = MipSettings());
+
+}  // namespace cg
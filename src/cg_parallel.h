@@ -0,0 +1,145 @@
+// Minimal helpers for data-parallel loops on a persistent pool of threads.
+//
+// The pool is started by the first parallel_for() call that needs it, with
+// one thread less than the hardware has (the calling thread takes part in
+// every loop), and stopped at exit. Loops only queue a ticket that idle pool
+// threads pick up, so starting one costs a few atomic operations and a wake
+// up instead of creating threads. Loops can be started from any thread,
+// including from inside another loop: the calling thread runs the ranges
+// that no pool thread has claimed, so a loop finishes even when all pool
+// threads are busy.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cg {
+
+// Returns the number of hardware threads (at least one)
+inline int hardware_threads()
+{
+    unsigned count = std::thread::hardware_concurrency();
+    return count ? int(count) : 1;
+}
+
+namespace detail {
+
+// The ranges of one parallel_for() call, claimed one at a time
+struct ParallelLoop {
+    std::function<void(size_t, size_t, int)> fn;
+    size_t count = 0;
+    int ranges = 0;
+    std::atomic<int> next{0};      // First unclaimed range
+    std::atomic<int> finished{0};  // Ranges that have returned
+    std::mutex mutex;              // Protects the drop to the last finished range
+    std::condition_variable done;
+
+    // Run unclaimed ranges until there are none left
+    void run()
+    {
+        for (int i = next++; i < ranges; i = next++) {
+            fn(count * i / ranges, count * (i + 1) / ranges, i);
+            if (++finished == ranges) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+};
+
+// Threads that run the ranges of queued loops. They are stopped when the
+// pool is destroyed at exit.
+struct ParallelPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;  // Protects everything below
+    std::condition_variable wake;
+    std::deque<std::shared_ptr<ParallelLoop>> loops;  // With unclaimed ranges, oldest first
+    bool quitting = false;
+
+    ~ParallelPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads) thread.join();
+    }
+};
+
+inline void parallel_pool_work(ParallelPool &pool)
+{
+    for (;;) {
+        std::shared_ptr<ParallelLoop> loop;
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.wake.wait(lock, [&] { return pool.quitting || !pool.loops.empty(); });
+            if (pool.quitting) return;
+            loop = pool.loops.front();
+            if (loop->next >= loop->ranges) {  // All claimed, so it is not needed any more
+                pool.loops.pop_front();
+                continue;
+            }
+        }
+        loop->run();
+    }
+}
+
+inline ParallelPool &parallel_pool()
+{
+    static ParallelPool pool;
+    static std::once_flag started;
+    std::call_once(started, [] {
+        for (int i = 1; i < hardware_threads(); ++i) {
+            pool.threads.push_back(std::thread([] { parallel_pool_work(pool); }));
+        }
+    });
+    return pool;
+}
+
+// Run the loop on the calling thread and on idle pool threads, and return
+// when all its ranges have finished
+inline void parallel_pool_run(ParallelPool &pool, const std::shared_ptr<ParallelLoop> &loop)
+{
+    if (!pool.threads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.loops.push_back(loop);
+        }
+        pool.wake.notify_all();
+    }
+    loop->run();
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->done.wait(lock, [&] { return loop->finished == loop->ranges; });
+}
+
+}  // namespace detail
+
+// Calls fn(begin, end, range) for numThreads contiguous ranges of [0, count),
+// at most one per thread at a time, so that range can index per-thread data.
+// The calling thread takes part, so the ranges run on at most the number of
+// hardware threads at once, however large numThreads is.
+template <typename Function>
+void parallel_for(int numThreads, size_t count, Function fn)
+{
+    if (numThreads <= 1 || count < 2) {
+        fn(size_t(0), count, 0);
+        return;
+    }
+    std::shared_ptr<detail::ParallelLoop> loop = std::make_shared<detail::ParallelLoop>();
+    loop->fn = fn;
+    loop->count = count;
+    loop->ranges = numThreads;
+    detail::parallel_pool_run(detail::parallel_pool(), loop);
+}
+
+}  // namespace cg
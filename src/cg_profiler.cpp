@@ -0,0 +1,386 @@
+// Lightweight scoped CPU/GPU profiler.
+//
+
+#include "cg_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace cg {
+
+namespace {
+
+// Events of one thread. Only the owning thread writes, and only the main
+// thread reads (in profiler_frame_end). Events that are overwritten before
+// they are collected are lost, which can only happen if a thread records
+// more than CAPACITY events per frame.
+struct ThreadRing {
+    static const int CAPACITY = 4096;
+    ProfilerEvent events[CAPACITY];
+    std::atomic<uint64_t> head;
+    uint64_t tail = 0;  // First event not yet collected
+    std::string name;
+    int index = 0;
+    int depth = 0;  // Current nesting depth of ProfileScope
+};
+
+struct GpuQuery {
+    const char *name;
+    GLuint begin;
+    GLuint end;
+    int depth;
+};
+
+// GPU queries of one frame
+struct GpuFrame {
+    uint64_t frameIndex = 0;
+    std::vector<GpuQuery> queries;
+    std::vector<GLuint> pool;  // Query objects, reused between frames
+    int64_t clockOffset = 0;   // CPU time minus GPU time, in nanoseconds
+    bool pending = false;
+};
+
+struct Profiler {
+    static const int GPU_LATENCY = 4;
+    static const int HISTORY = GPU_LATENCY + 2;
+
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;  // Protects rings and freeRings
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::vector<ThreadRing *> freeRings;  // Rings of threads that have exited
+
+    uint64_t frameIndex = 0;
+    int64_t frameStart = 0;
+    uint64_t counters[NUM_PROFILER_COUNTERS] = {0};
+    ProfilerFrame frames[HISTORY];
+    int latestFrame = -1;
+
+    bool gpuEnabled = false;
+    GpuFrame gpuFrames[GPU_LATENCY];
+    std::vector<int> gpuStack;  // Open GPU scopes of the current frame
+    int gpuDepth = 0;
+
+    bool tracing = false;
+    std::vector<ProfilerEvent> traceEvents;
+    std::vector<ProfilerFrame> traceCounters;  // Counters only
+};
+
+Profiler &profiler()
+{
+    static Profiler instance;
+    return instance;
+}
+
+ThreadRing *acquire_ring()
+{
+    Profiler &p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (!p.freeRings.empty()) {
+        ThreadRing *ring = p.freeRings.back();
+        p.freeRings.pop_back();
+        ring->name = "Worker " + std::to_string(ring->index);
+        ring->depth = 0;
+        return ring;
+    }
+    p.rings.push_back(std::unique_ptr<ThreadRing>(new ThreadRing()));
+    ThreadRing *ring = p.rings.back().get();
+    ring->head = 0;
+    ring->index = int(p.rings.size()) - 1;
+    ring->name = ring->index == 0 ? "Main" : "Worker " + std::to_string(ring->index);
+    return ring;
+}
+
+// Returns the ring of a thread to the free list when the thread exits
+struct ThreadRingHolder {
+    ThreadRing *ring = nullptr;
+    ~ThreadRingHolder()
+    {
+        if (!ring) return;
+        Profiler &p = profiler();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.freeRings.push_back(ring);
+    }
+};
+
+ThreadRing &thread_ring()
+{
+    static thread_local ThreadRingHolder holder;
+    if (!holder.ring) holder.ring = acquire_ring();
+    return *holder.ring;
+}
+
+void collect_cpu_events(Profiler &p, std::vector<ProfilerEvent> &events)
+{
+    std::lock_guard<std::mutex> lock(p.mutex);
+    for (auto &ring : p.rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(ring->tail, head > uint64_t(ThreadRing::CAPACITY) ? head - ThreadRing::CAPACITY : 0);
+        for (uint64_t i = first; i < head; ++i) {
+            events.push_back(ring->events[i % ThreadRing::CAPACITY]);
+        }
+        ring->tail = head;
+    }
+}
+
+GLuint gpu_query(GpuFrame &frame, size_t index)
+{
+    while (frame.pool.size() <= index) {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame.pool.push_back(query);
+    }
+    return frame.pool[index];
+}
+
+// Read back the queries of a frame if they have all completed
+bool resolve_gpu_frame(Profiler &p, GpuFrame &frame)
+{
+    if (!frame.pending) return false;
+    if (!frame.queries.empty()) {
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries.back().end, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return false;
+    }
+
+    ProfilerFrame &record = p.frames[frame.frameIndex % Profiler::HISTORY];
+    if (record.index != frame.frameIndex) return false;  // Too old
+    record.gpuEvents.clear();
+    for (const GpuQuery &query : frame.queries) {
+        GLint64 begin = 0, end = 0;
+        glGetQueryObjecti64v(query.begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjecti64v(query.end, GL_QUERY_RESULT, &end);
+        ProfilerEvent event = {query.name, begin + frame.clockOffset, end + frame.clockOffset, -1,
+                               query.depth};
+        record.gpuEvents.push_back(event);
+        if (p.tracing) p.traceEvents.push_back(event);
+    }
+    record.gpuResolved = true;
+    frame.pending = false;
+    return true;
+}
+
+void json_string(FILE *file, const char *s)
+{
+    std::fputc('"', file);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') std::fputc('\\', file);
+        std::fputc(*s, file);
+    }
+    std::fputc('"', file);
+}
+
+}  // namespace
+
+int64_t profiler_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                profiler().epoch)
+        .count();
+}
+
+void profiler_set_thread_name(const char *name)
+{
+    ThreadRing &ring = thread_ring();
+    std::lock_guard<std::mutex> lock(profiler().mutex);
+    ring.name = name;
+}
+
+std::vector<std::string> profiler_thread_names()
+{
+    Profiler &p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    std::vector<std::string> names;
+    for (auto &ring : p.rings) names.push_back(ring->name);
+    return names;
+}
+
+void profiler_record(const char *name, int64_t start, int64_t end, int depth)
+{
+    ThreadRing &ring = thread_ring();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ProfilerEvent &event = ring.events[head % ThreadRing::CAPACITY];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.thread = ring.index;
+    event.depth = depth;
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+ProfileScope::ProfileScope(const char *name) : name(name), start(profiler_now())
+{
+    depth = thread_ring().depth++;
+}
+
+ProfileScope::~ProfileScope()
+{
+    thread_ring().depth--;
+    profiler_record(name, start, profiler_now(), depth);
+}
+
+void profiler_count(ProfilerCounter counter, uint64_t value)
+{
+    profiler().counters[counter] += value;
+}
+
+void profiler_gpu_init()
+{
+    Profiler &p = profiler();
+    profiler_gpu_destroy();
+    p.gpuEnabled = true;
+}
+
+void profiler_gpu_destroy()
+{
+    Profiler &p = profiler();
+    for (GpuFrame &frame : p.gpuFrames) {
+        if (!frame.pool.empty()) glDeleteQueries(GLsizei(frame.pool.size()), &frame.pool[0]);
+        frame = GpuFrame();
+    }
+    p.gpuStack.clear();
+    p.gpuEnabled = false;
+}
+
+void profiler_gpu_begin(const char *name)
+{
+    Profiler &p = profiler();
+    if (!p.gpuEnabled) return;
+    GpuFrame &frame = p.gpuFrames[p.frameIndex % Profiler::GPU_LATENCY];
+    if (frame.pending && frame.frameIndex != p.frameIndex) return;  // Still in flight, skip
+
+    if (!frame.pending) {
+        // Relate the GPU clock to the CPU clock once per frame
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        frame.clockOffset = profiler_now() - gpuNow;
+        frame.frameIndex = p.frameIndex;
+        frame.queries.clear();
+        frame.pending = true;
+    }
+    size_t index = frame.queries.size();
+    GpuQuery query = {name, gpu_query(frame, 2 * index), gpu_query(frame, 2 * index + 1), p.gpuDepth++};
+    glQueryCounter(query.begin, GL_TIMESTAMP);
+    frame.queries.push_back(query);
+    p.gpuStack.push_back(int(index));
+}
+
+void profiler_gpu_end()
+{
+    Profiler &p = profiler();
+    if (p.gpuStack.empty()) return;
+    GpuFrame &frame = p.gpuFrames[p.frameIndex % Profiler::GPU_LATENCY];
+    glQueryCounter(frame.queries[p.gpuStack.back()].end, GL_TIMESTAMP);
+    p.gpuStack.pop_back();
+    p.gpuDepth--;
+}
+
+void profiler_frame_end()
+{
+    Profiler &p = profiler();
+    int64_t now = profiler_now();
+
+    ProfilerFrame &record = p.frames[p.frameIndex % Profiler::HISTORY];
+    record.index = p.frameIndex;
+    record.start = p.frameStart;
+    record.end = now;
+    std::copy(p.counters, p.counters + NUM_PROFILER_COUNTERS, record.counters);
+    record.cpuEvents.clear();
+    record.gpuEvents.clear();
+    collect_cpu_events(p, record.cpuEvents);
+    if (p.tracing) {
+        p.traceEvents.insert(p.traceEvents.end(), record.cpuEvents.begin(), record.cpuEvents.end());
+        ProfilerFrame counters;
+        counters.start = record.start;
+        std::copy(p.counters, p.counters + NUM_PROFILER_COUNTERS, counters.counters);
+        p.traceCounters.push_back(counters);
+    }
+
+    // Unbalanced GPU scopes are closed by dropping them
+    GpuFrame &gpuFrame = p.gpuFrames[p.frameIndex % Profiler::GPU_LATENCY];
+    while (!p.gpuStack.empty()) profiler_gpu_end();
+    record.gpuResolved = !(gpuFrame.pending && gpuFrame.frameIndex == p.frameIndex);
+
+    // Read back completed GPU frames, oldest first
+    for (int i = Profiler::GPU_LATENCY - 1; i >= 0; --i) {
+        if (p.frameIndex < uint64_t(i)) continue;
+        resolve_gpu_frame(p, p.gpuFrames[(p.frameIndex - i) % Profiler::GPU_LATENCY]);
+    }
+
+    // The latest frame with complete data
+    for (int i = 0; i < Profiler::HISTORY; ++i) {
+        if (p.frameIndex < uint64_t(i)) break;
+        const ProfilerFrame &frame = p.frames[(p.frameIndex - i) % Profiler::HISTORY];
+        if (frame.index == p.frameIndex - i && frame.gpuResolved) {
+            p.latestFrame = int((p.frameIndex - i) % Profiler::HISTORY);
+            break;
+        }
+    }
+
+    std::fill(p.counters, p.counters + NUM_PROFILER_COUNTERS, 0);
+    p.frameIndex++;
+    p.frameStart = now;
+}
+
+const ProfilerFrame &profiler_latest_frame()
+{
+    Profiler &p = profiler();
+    static const ProfilerFrame empty;
+    return p.latestFrame >= 0 ? p.frames[p.latestFrame] : empty;
+}
+
+void profiler_start_trace()
+{
+    Profiler &p = profiler();
+    p.tracing = true;
+    p.traceEvents.clear();
+    p.traceCounters.clear();
+}
+
+bool profiler_write_trace(const std::string &filename)
+{
+    Profiler &p = profiler();
+    FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+
+    // Timestamps and durations are in microseconds
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}");
+    std::vector<std::string> names = profiler_thread_names();
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                     int(i));
+        json_string(file, names[i].c_str());
+        std::fprintf(file, "}}");
+    }
+    for (const ProfilerEvent &event : p.traceEvents) {
+        std::fprintf(file, ",\n{\"name\":");
+        json_string(file, event.name);
+        std::fprintf(file, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                     event.thread < 0 ? 2 : 1, std::max(event.thread, 0), event.start * 1e-3,
+                     (event.end - event.start) * 1e-3);
+    }
+    for (const ProfilerFrame &frame : p.traceCounters) {
+        std::fprintf(file,
+                     ",\n{\"name\":\"Counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":"
+                     "{\"draw calls\":%llu,\"triangles\":%llu,\"state changes\":%llu,\"texture binds\":%llu}}",
+                     frame.start * 1e-3, (unsigned long long)frame.counters[COUNTER_DRAW_CALLS],
+                     (unsigned long long)frame.counters[COUNTER_TRIANGLES],
+                     (unsigned long long)frame.counters[COUNTER_STATE_CHANGES],
+                     (unsigned long long)frame.counters[COUNTER_TEXTURE_BINDS]);
+    }
+    std::fprintf(file, "\n]}\n");
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+}  // namespace cg
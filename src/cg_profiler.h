@@ -0,0 +1,99 @@
+// Lightweight scoped CPU/GPU profiler.
+//
+// CPU scopes are written to per-thread ring buffers without any locks (only
+// the first event of a new thread takes a lock, to register its ring). GPU
+// scopes use GL_TIMESTAMP queries that are read back several frames later,
+// so profiling never stalls the pipeline. Once per frame, the main thread
+// collects everything into a frame record, which can also be accumulated
+// into a Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cg {
+
+enum ProfilerCounter {
+    COUNTER_DRAW_CALLS = 0,
+    COUNTER_TRIANGLES = 1,
+    COUNTER_STATE_CHANGES = 2,  // Program, texture, VAO and framebuffer binds
+    COUNTER_TEXTURE_BINDS = 3,  // Material texture binds (also counted as state changes)
+    NUM_PROFILER_COUNTERS = 4
+};
+
+struct ProfilerEvent {
+    const char *name;  // Must be a string literal (or otherwise outlive the profiler)
+    int64_t start;     // Nanoseconds since the profiler was initialized
+    int64_t end;
+    int thread;        // Index of the thread, or -1 for GPU events
+    int depth;         // Nesting depth within the thread
+};
+
+struct ProfilerFrame {
+    uint64_t index = 0;
+    int64_t start = 0;
+    int64_t end = 0;
+    uint64_t counters[NUM_PROFILER_COUNTERS] = {0};
+    std::vector<ProfilerEvent> cpuEvents;
+    std::vector<ProfilerEvent> gpuEvents;
+    bool gpuResolved = false;
+};
+
+// Returns the time in nanoseconds since the profiler was first used
+int64_t profiler_now();
+
+// Name the calling thread in the timeline and trace
+void profiler_set_thread_name(const char *name);
+
+// Returns the names of all threads that have recorded events, by index
+std::vector<std::string> profiler_thread_names();
+
+// Record a CPU event on the calling thread
+void profiler_record(const char *name, int64_t start, int64_t end, int depth);
+
+// Records the lifetime of the scope as a CPU event
+struct ProfileScope {
+    const char *name;
+    int64_t start;
+    int depth;
+    explicit ProfileScope(const char *name);
+    ~ProfileScope();
+};
+
+#define CG_PROFILE_CONCAT_(a, b) a##b
+#define CG_PROFILE_CONCAT(a, b) CG_PROFILE_CONCAT_(a, b)
+#define CG_PROFILE_SCOPE(name) cg::ProfileScope CG_PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+// Add to a counter of the current frame (main thread only)
+void profiler_count(ProfilerCounter counter, uint64_t value = 1);
+
+// GPU queries need a current OpenGL context
+void profiler_gpu_init();
+
+void profiler_gpu_destroy();
+
+// Begin and end a GPU scope (main thread only). Scopes may be nested.
+void profiler_gpu_begin(const char *name);
+
+void profiler_gpu_end();
+
+// Finish the current frame: collect CPU events and counters, and read back
+// GPU queries of earlier frames that have completed. Call once per frame,
+// after swapping buffers.
+void profiler_frame_end();
+
+// Returns the most recent frame whose GPU events have been read back
+const ProfilerFrame &profiler_latest_frame();
+
+// Start accumulating all events for profiler_write_trace()
+void profiler_start_trace();
+
+// Write all events since profiler_start_trace() in Chrome trace-event format
+bool profiler_write_trace(const std::string &filename);
+
+}  // namespace cg
@@ -0,0 +1,94 @@
+// Asynchronous readback of framebuffer pixels through pixel-pack buffers.
+//
+
+#include "cg_readback.h"
+#include "cg_memory.h"
+
+#include <cstring>
+
+namespace cg {
+
+void readback_init(PixelReadback &readback)
+{
+    readback_destroy(readback);
+    glGenBuffers(PixelReadback::RING_SIZE, readback.buffers);
+}
+
+void readback_destroy(PixelReadback &readback)
+{
+    for (int i = 0; i < PixelReadback::RING_SIZE; ++i) {
+        if (readback.fences[i]) glDeleteSync(readback.fences[i]);
+    }
+    if (readback.buffers[0]) {
+        memory_release_gl(GL_BUFFER, PixelReadback::RING_SIZE, readback.buffers);
+        glDeleteBuffers(PixelReadback::RING_SIZE, readback.buffers);
+    }
+    readback = PixelReadback();
+}
+
+bool readback_full(const PixelReadback &readback)
+{
+    return readback.issued - readback.resolved >= unsigned(PixelReadback::RING_SIZE);
+}
+
+bool readback_pending(const PixelReadback &readback)
+{
+    return readback.issued != readback.resolved;
+}
+
+bool readback_issue(PixelReadback &readback, GLuint framebuffer, int width, int height, int tag)
+{
+    if (readback_full(readback)) return false;
+
+    int slot = readback.issued % PixelReadback::RING_SIZE;
+    GLsizeiptr size = GLsizeiptr(width) * height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffers[slot]);
+    if (readback.widths[slot] != width || readback.heights[slot] != height) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        memory_track_gl(GL_BUFFER, readback.buffers[slot], MEMORY_GL_STREAMING, uint64_t(size));
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.widths[slot] = width;
+    readback.heights[slot] = height;
+    readback.tags[slot] = tag;
+    readback.issued++;
+    return true;
+}
+
+bool readback_fetch(PixelReadback &readback, ReadbackImage &image, bool wait)
+{
+    if (!readback_pending(readback)) return false;
+
+    int slot = readback.resolved % PixelReadback::RING_SIZE;
+    GLenum status = glClientWaitSync(readback.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     wait ? GLuint64(1000000000) : GLuint64(0));
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        if (!wait) return false;
+        glClientWaitSync(readback.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    }
+    glDeleteSync(readback.fences[slot]);
+    readback.fences[slot] = 0;
+
+    image.width = readback.widths[slot];
+    image.height = readback.heights[slot];
+    image.tag = readback.tags[slot];
+    image.pixels.resize(size_t(image.width) * image.height * 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffers[slot]);
+    void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size(), GL_MAP_READ_BIT);
+    if (data) {
+        std::memcpy(&image.pixels[0], data, image.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.resolved++;
+    return data != nullptr;
+}
+
+}  // namespace cg
@@ -0,0 +1,55 @@
+// Asynchronous readback of framebuffer pixels through pixel-pack buffers.
+//
+// glReadPixels into a PBO returns immediately; the buffer is only mapped a
+// few frames later, once its fence has signaled, so reading back rendered
+// images never stalls the pipeline.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace cg {
+
+// Struct for a ring of pixel-pack buffers with one fence each
+struct PixelReadback {
+    static const int RING_SIZE = 4;
+    GLuint buffers[RING_SIZE] = {0};
+    GLsync fences[RING_SIZE] = {0};
+    int widths[RING_SIZE] = {0};
+    int heights[RING_SIZE] = {0};
+    int tags[RING_SIZE] = {0};  // User data, e.g. a frame or image index
+    unsigned issued = 0;
+    unsigned resolved = 0;
+};
+
+// Pixels read back from the GPU, in RGBA8 format with the bottom row first
+struct ReadbackImage {
+    int width = 0;
+    int height = 0;
+    int tag = 0;
+    std::vector<uint8_t> pixels;
+};
+
+void readback_init(PixelReadback &readback);
+
+void readback_destroy(PixelReadback &readback);
+
+// Returns true if all buffers of the ring are in flight, in which case the
+// oldest one must be fetched before a new readback can be issued
+bool readback_full(const PixelReadback &readback);
+
+bool readback_pending(const PixelReadback &readback);
+
+// Issue an asynchronous read of the color attachment 0 of the framebuffer.
+// Returns false if the ring is full.
+bool readback_issue(PixelReadback &readback, GLuint framebuffer, int width, int height, int tag);
+
+// Fetch the oldest readback if it has completed. If wait is true, this
+// blocks until it has completed. Returns false if nothing was fetched.
+bool readback_fetch(PixelReadback &readback, ReadbackImage &image, bool wait);
+
+}  // namespace cg
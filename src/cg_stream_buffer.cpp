@@ -0,0 +1,176 @@
+// Ring buffer for streaming per-frame data (e.g. uniform blocks) to the GPU.
+//
+
+#include "cg_stream_buffer.h"
+#include "cg_memory.h"
+#include "cg_utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace cg {
+
+namespace {
+
+const GLbitfield PERSISTENT_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+bool buffer_storage_supported()
+{
+    if (!glBufferStorage) return false;
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 4 || (major == 4 && minor >= 4) || has_gl_extension("GL_ARB_buffer_storage");
+}
+
+// Block until the fence has signaled
+void wait_for_fence(GLsync fence)
+{
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        GLenum status = glClientWaitSync(fence, flags, GLuint64(1000000000));
+        if (status != GL_TIMEOUT_EXPIRED) break;  // Signaled, or GL_WAIT_FAILED
+        flags = 0;
+    }
+}
+
+}  // namespace
+
+bool stream_buffer_init(StreamBuffer &stream, GLenum target, GLsizeiptr frameSize, bool allowPersistent)
+{
+    stream_buffer_destroy(stream);
+    stream.target = target;
+    stream.allowPersistent = allowPersistent;
+    if (target == GL_UNIFORM_BUFFER) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &stream.alignment);
+        stream.alignment = std::max(stream.alignment, GLint(16));
+    }
+    stream.frameSize = stream_buffer_aligned_size(stream, std::max(frameSize, GLsizeiptr(1)));
+    const GLsizeiptr totalSize = stream.frameSize * StreamBuffer::FRAMES;
+
+    while (glGetError() != GL_NO_ERROR) {}  // Only report errors of this function
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(target, stream.buffer);
+    stream.allocations++;
+    if (allowPersistent && buffer_storage_supported()) {
+        glBufferStorage(target, totalSize, nullptr, PERSISTENT_FLAGS);
+        stream.mapped = static_cast<uint8_t *>(glMapBufferRange(target, 0, totalSize, PERSISTENT_FLAGS));
+        stream.persistent = stream.mapped != nullptr;
+        if (!stream.persistent) {  // Immutable storage cannot be respecified
+            glDeleteBuffers(1, &stream.buffer);
+            glGenBuffers(1, &stream.buffer);
+            glBindBuffer(target, stream.buffer);
+        }
+    }
+    if (!stream.persistent) glBufferData(target, totalSize, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(target, 0);
+    memory_track_gl(GL_BUFFER, stream.buffer, MEMORY_GL_STREAMING, uint64_t(totalSize));
+
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "Error: Could not create stream buffer of " << totalSize << " bytes" << std::endl;
+        stream_buffer_destroy(stream);
+        return false;
+    }
+    return true;
+}
+
+void stream_buffer_destroy(StreamBuffer &stream)
+{
+    for (int i = 0; i < StreamBuffer::FRAMES; ++i) {
+        if (stream.fences[i]) glDeleteSync(stream.fences[i]);
+    }
+    if (stream.buffer) {
+        if (stream.mapped) {
+            glBindBuffer(stream.target, stream.buffer);
+            glUnmapBuffer(stream.target);
+            glBindBuffer(stream.target, 0);
+        }
+        memory_release_gl(GL_BUFFER, 1, &stream.buffer);
+        glDeleteBuffers(1, &stream.buffer);
+    }
+    stream = StreamBuffer();
+}
+
+bool stream_buffer_begin_frame(StreamBuffer &stream, GLsizeiptr size)
+{
+    if (!stream.buffer) return false;
+    if (size > stream.frameSize) {
+        // The old buffer is only released by the driver when the GPU is done with it
+        const StreamBuffer old = stream;
+        if (!stream_buffer_init(stream, old.target, std::max(size, 2 * old.frameSize), old.allowPersistent))
+            return false;
+        stream.frame = old.frame, stream.waits = old.waits, stream.orphans = old.orphans;
+        stream.allocations += old.allocations;
+    }
+
+    const int region = stream.frame % StreamBuffer::FRAMES;
+    GLsync &fence = stream.fences[region];
+    if (fence && glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        if (stream.persistent) {
+            wait_for_fence(fence);
+            stream.waits++;
+        } else {
+            // Let the driver allocate new storage rather than stall; all
+            // regions of the old storage stay valid for the GPU
+            glBindBuffer(stream.target, stream.buffer);
+            glBufferData(stream.target, stream.frameSize * StreamBuffer::FRAMES, nullptr, GL_STREAM_DRAW);
+            for (int i = 0; i < StreamBuffer::FRAMES; ++i) {
+                if (stream.fences[i] && stream.fences[i] != fence) glDeleteSync(stream.fences[i]);
+                if (i != region) stream.fences[i] = 0;
+            }
+            stream.orphans++;
+        }
+    }
+    if (fence) glDeleteSync(fence);
+    fence = 0;
+
+    glBindBuffer(stream.target, stream.buffer);
+    if (!stream.persistent) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        stream.mapped = static_cast<uint8_t *>(
+            glMapBufferRange(stream.target, region * stream.frameSize, stream.frameSize, flags));
+        if (!stream.mapped) {
+            std::cerr << "Error: Could not map stream buffer" << std::endl;
+            return false;
+        }
+    }
+    stream.used = 0;
+    return true;
+}
+
+GLintptr stream_buffer_write(StreamBuffer &stream, const void *data, GLsizeiptr size)
+{
+    if (!stream.mapped || stream.used + size > stream.frameSize) return -1;
+
+    const GLintptr regionOffset = (stream.frame % StreamBuffer::FRAMES) * stream.frameSize;
+    uint8_t *dst = stream.mapped + stream.used + (stream.persistent ? regionOffset : 0);
+    std::memcpy(dst, data, size_t(size));
+    GLintptr offset = regionOffset + stream.used;
+    stream.used = std::min(stream.used + stream_buffer_aligned_size(stream, size), stream.frameSize);
+    return offset;
+}
+
+void stream_buffer_flush(StreamBuffer &stream)
+{
+    // Writes to a coherent mapping are visible to all later commands
+    if (stream.persistent || !stream.mapped) return;
+    glBindBuffer(stream.target, stream.buffer);
+    glUnmapBuffer(stream.target);
+    stream.mapped = nullptr;
+}
+
+void stream_buffer_end_frame(StreamBuffer &stream)
+{
+    if (!stream.buffer) return;
+    stream_buffer_flush(stream);
+    stream.fences[stream.frame % StreamBuffer::FRAMES] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream.frame++;
+}
+
+GLsizeiptr stream_buffer_aligned_size(const StreamBuffer &stream, GLsizeiptr size)
+{
+    return (size + stream.alignment - 1) / stream.alignment * stream.alignment;
+}
+
+}  // namespace cg
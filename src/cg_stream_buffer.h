@@ -0,0 +1,62 @@
+// Ring buffer for streaming per-frame data (e.g. uniform blocks) to the GPU.
+//
+// The buffer is split into one region per frame in flight. Each region is
+// protected by a fence, so the CPU never overwrites data that the GPU may
+// still read. With ARB_buffer_storage the whole buffer stays persistently
+// mapped; otherwise each region is mapped unsynchronized every frame, and
+// the buffer is orphaned instead of waiting if its region is still in use.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstdint>
+
+namespace cg {
+
+// Struct for a buffer with FRAMES regions of frameSize bytes each
+struct StreamBuffer {
+    static const int FRAMES = 3;  // Number of frames in flight
+    GLuint buffer = 0;
+    GLenum target = GL_UNIFORM_BUFFER;
+    GLsizeiptr frameSize = 0;
+    GLint alignment = 16;         // Of allocations, e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    bool allowPersistent = true;
+    bool persistent = false;      // Persistent coherent mapping (ARB_buffer_storage)
+    uint8_t *mapped = nullptr;    // Current region (or the whole buffer if persistent)
+    GLsync fences[FRAMES] = {0};
+    unsigned frame = 0;           // Total number of frames begun
+    GLsizeiptr used = 0;          // Bytes allocated in the current region
+    unsigned waits = 0;           // Frames that had to wait for the GPU
+    unsigned orphans = 0;         // Frames that orphaned the buffer instead
+    unsigned allocations = 0;     // Buffers created, which may reuse the name of an earlier one
+};
+
+// Create the buffer. If allowPersistent is false, the unsynchronized
+// mapping path is used even if ARB_buffer_storage is available.
+bool stream_buffer_init(StreamBuffer &stream, GLenum target, GLsizeiptr frameSize,
+                        bool allowPersistent = true);
+
+void stream_buffer_destroy(StreamBuffer &stream);
+
+// Start writing the region of the next frame, growing the buffer first if a
+// frame needs more than frameSize bytes (which creates a new buffer, and
+// counts it in allocations). The buffer stays bound to its target.
+bool stream_buffer_begin_frame(StreamBuffer &stream, GLsizeiptr size);
+
+// Copy data into the current region and return its offset in the buffer (for
+// glBindBufferRange), or -1 if the region is full
+GLintptr stream_buffer_write(StreamBuffer &stream, const void *data, GLsizeiptr size);
+
+// Make the data written this frame visible to the GPU. Must be called before
+// any draw call that reads it.
+void stream_buffer_flush(StreamBuffer &stream);
+
+// Fence the current region after the last draw call that reads it
+void stream_buffer_end_frame(StreamBuffer &stream);
+
+// Size of an allocation of the given size, including alignment padding
+GLsizeiptr stream_buffer_aligned_size(const StreamBuffer &stream, GLsizeiptr size);
+
+}  // namespace cg
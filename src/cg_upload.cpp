@@ -0,0 +1,100 @@
+// Chunked uploads of large buffers through a small pool of staging buffers.
+//
+
+#include "cg_upload.h"
+#include "cg_memory.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace cg {
+
+bool staging_pool_init(StagingPool &pool, GLsizeiptr chunkSize)
+{
+    staging_pool_destroy(pool);
+    pool.chunkSize = std::max(chunkSize, GLsizeiptr(4));
+
+    while (glGetError() != GL_NO_ERROR) {}  // Only report errors of this function
+    glGenBuffers(StagingPool::BUFFERS, pool.buffers);
+    for (int i = 0; i < StagingPool::BUFFERS; ++i) {
+        glBindBuffer(GL_COPY_READ_BUFFER, pool.buffers[i]);
+        glBufferData(GL_COPY_READ_BUFFER, pool.chunkSize, nullptr, GL_STREAM_COPY);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    for (int i = 0; i < StagingPool::BUFFERS; ++i)
+        memory_track_gl(GL_BUFFER, pool.buffers[i], MEMORY_GL_STREAMING, uint64_t(pool.chunkSize));
+
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "Error: Could not create staging buffers of " << pool.chunkSize << " bytes"
+                  << std::endl;
+        staging_pool_destroy(pool);
+        return false;
+    }
+    return true;
+}
+
+void staging_pool_destroy(StagingPool &pool)
+{
+    for (int i = 0; i < StagingPool::BUFFERS; ++i) {
+        if (pool.fences[i]) glDeleteSync(pool.fences[i]);
+    }
+    if (pool.buffers[0]) {
+        memory_release_gl(GL_BUFFER, StagingPool::BUFFERS, pool.buffers);
+        glDeleteBuffers(StagingPool::BUFFERS, pool.buffers);
+    }
+    pool = StagingPool();
+}
+
+bool staging_upload(StagingPool &pool, GLuint buffer, GLintptr offset, GLsizeiptr size,
+                    const UploadSource &source)
+{
+    if (!pool.buffers[0]) return false;
+    bool ok = true;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    for (GLsizeiptr done = 0; done < size && ok;) {
+        const GLsizeiptr chunk = std::min(pool.chunkSize, size - done);
+        const int index = pool.next % StagingPool::BUFFERS;
+
+        // Wait until the GPU has copied the last chunk of this buffer
+        GLsync &fence = pool.fences[index];
+        if (fence) {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                pool.waits++;
+                GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+                do {
+                    status = glClientWaitSync(fence, flags, GLuint64(1000000000));
+                    flags = 0;
+                } while (status == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, pool.buffers[index]);
+        const GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        void *mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, chunk, flags);
+        if (!mapped) {
+            std::cerr << "Error: Could not map staging buffer" << std::endl;
+            ok = false;
+            break;
+        }
+        ok = source(mapped, uint64_t(done), size_t(chunk));
+        // The contents of a buffer can be lost while it is mapped (e.g. on a
+        // mode switch), in which case the chunk is written again
+        if (glUnmapBuffer(GL_COPY_READ_BUFFER) == GL_FALSE && ok) continue;
+        if (!ok) break;
+
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset + done, chunk);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pool.next++;
+        pool.bytes += uint64_t(chunk);
+        done += chunk;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return ok;
+}
+
+}  // namespace cg
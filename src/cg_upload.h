@@ -0,0 +1,50 @@
+// Chunked uploads of large buffers through a small pool of staging buffers.
+//
+// glBufferData() with a pointer needs all the data in host memory at once,
+// which the driver may copy once more. Here, the destination buffer is filled
+// one chunk at a time instead: each chunk is written into a mapped staging
+// buffer (e.g. read straight from a file) and copied into place on the GPU
+// with glCopyBufferSubData(). Each staging buffer is fenced after its copy
+// and only reused once the GPU is done with it, so host memory stays at the
+// size of the pool however large the buffer is, while the CPU fills the next
+// chunk as the GPU copies the last one.
+//
+
+#pragma once
+
+#include <GL/gl3w.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace cg {
+
+// Struct for a ring of staging buffers of chunkSize bytes each
+struct StagingPool {
+    static const int BUFFERS = 4;
+    GLuint buffers[BUFFERS] = {0};
+    GLsync fences[BUFFERS] = {0};
+    GLsizeiptr chunkSize = 0;
+    unsigned next = 0;   // Total number of chunks copied
+    uint64_t bytes = 0;  // Total bytes uploaded
+    unsigned waits = 0;  // Chunks that had to wait for the GPU to free a buffer
+};
+
+// Writes size bytes of the uploaded data, starting at offset, to dst (which
+// is mapped staging memory). Returns false if the data cannot be produced
+// (e.g. a file could not be read), which stops the upload.
+typedef std::function<bool(void *dst, uint64_t offset, size_t size)> UploadSource;
+
+// Create the staging buffers
+bool staging_pool_init(StagingPool &pool, GLsizeiptr chunkSize = GLsizeiptr(8) << 20);
+
+void staging_pool_destroy(StagingPool &pool);
+
+// Upload size bytes from source to the range of buffer at offset, one chunk
+// at a time. The copies are queued on the GPU when this returns, and ordered
+// before any later command that reads the buffer.
+bool staging_upload(StagingPool &pool, GLuint buffer, GLintptr offset, GLsizeiptr size,
+                    const UploadSource &source);
+
+}  // namespace cg
@@ -4,11 +4,18 @@
 //
 
 #include "cg_utils.h"
+#include "cg_gl_state.h"
+#include "cg_mipmap.h"
+#include "cg_memory.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -53,37 +60,74 @@ std::string get_env_var(const std::string &name)
     }
 }
 
+bool has_gl_extension(const char *name)
+{
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; ++i) {
+        const GLubyte *extension = glGetStringi(GL_EXTENSIONS, GLuint(i));
+        if (extension && std::strcmp(reinterpret_cast<const char *>(extension), name) == 0) return true;
+    }
+    return false;
+}
+
 void reset_gl_render_state()
 {
     // See e.g. http://docs.gl for information about each state
     //
     // Feel free to extend this function with defaults for other states!
+    // States are set through the state cache, so states that are already at
+    // their default are not set again.
 
     // Rasterization states
-    glDisable(GL_RASTERIZER_DISCARD);
-    glDisable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glPolygonOffset(0.0f, 0.0f);
-    glDisable(GL_PROGRAM_POINT_SIZE);
-    glLineWidth(1.0f);
+    gl_state_disable(GL_RASTERIZER_DISCARD);
+    gl_state_disable(GL_CULL_FACE);
+    gl_state_cull_face(GL_BACK);
+    gl_state_polygon_mode(GL_FILL);
+    gl_state_polygon_offset(0.0f, 0.0f);
+    gl_state_disable(GL_PROGRAM_POINT_SIZE);
+    gl_state_line_width(1.0f);
 
     // Multisample states
-    glDisable(GL_MULTISAMPLE);
-    glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+    gl_state_disable(GL_MULTISAMPLE);
+    gl_state_disable(GL_SAMPLE_ALPHA_TO_COVERAGE);
 
     // Depth and stencil states
-    glDisable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glDepthMask(GL_TRUE);
-    glDepthRange(0.0f, 1.0f);
-    glDisable(GL_STENCIL_TEST);
+    gl_state_disable(GL_DEPTH_TEST);
+    gl_state_depth_func(GL_LESS);
+    gl_state_depth_mask(GL_TRUE);
+    gl_state_depth_range(0.0f, 1.0f);
+    gl_state_disable(GL_STENCIL_TEST);
 
     // Color and blend states
-    glDisable(GL_BLEND);
-    glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
-    glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    gl_state_disable(GL_BLEND);
+    gl_state_blend_func_separate(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
+    gl_state_blend_equation_separate(GL_FUNC_ADD, GL_FUNC_ADD);
+    gl_state_color_mask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+bool save_png_image(const std::string &filename, int width, int height,
+                    const std::vector<uint8_t> &pixels)
+{
+    // OpenGL stores the bottom row first, so flip the rows before writing.
+    // Alpha is dropped: the render targets store whatever the passes wrote
+    // to it (e.g. 0 for the background), not coverage.
+    const size_t rowSize = size_t(width) * 3;
+    std::vector<uint8_t> flipped(size_t(height) * rowSize);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *src = &pixels[size_t(height - 1 - y) * width * 4];
+        uint8_t *dst = &flipped[size_t(y) * rowSize];
+        for (int x = 0; x < width; ++x) {
+            dst[3 * x + 0] = src[4 * x + 0];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+    if (!stbi_write_png(filename.c_str(), width, height, 3, &flipped[0], int(rowSize))) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    return true;
 }
 
 GLuint load_shader_program(const std::string &vertexShaderFilename,
@@ -172,11 +216,14 @@ GLuint load_texture_2d(const std::string &filename)
                  &(image[0]));
     stbi_image_free(image);  // Clean up resources
     glBindTexture(GL_TEXTURE_2D, 0);
+    memory_track_gl(GL_TEXTURE, texture, MEMORY_GL_TEXTURES,
+                    gl_image_bytes(GL_RGBA8, width, height));
 
     return texture;
 }
 
-// Load cubemap texture and let OpenGL generate a mipmap chain
+// Load cubemap texture and generate its mipmap chain (in linear space, since
+// the sides are sRGB) on the CPU
 GLuint load_cubemap(const std::string &dirname)
 {
     const char *filenames[] = {"posx.png", "negx.png", "posy.png",
@@ -194,21 +241,35 @@ GLuint load_cubemap(const std::string &dirname)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    std::vector<MipChain> sides(nSides);
     for (unsigned i = 0; i < nSides; ++i) {
         // Load image for current cube side
         std::string filename = dirname + "/" + filenames[i];
-        int width, height, comp;
-        uint8_t *image = stbi_load(filename.c_str(), &width, &height, &comp, 4);
-        if (image == nullptr) {
+        int comp;
+        sides[i].rgba = stbi_load(filename.c_str(), &sides[i].width, &sides[i].height, &comp, 4);
+        sides[i].srgb = true;
+        if (sides[i].rgba == nullptr) {
             std::cerr << "Error: " << stbi_failure_reason() << std::endl;
             std::exit(EXIT_FAILURE);
         }
+    }
+    generate_mip_chains(sides);  // All sides at once
+    uint64_t bytes = 0;
+    for (unsigned i = 0; i < nSides; ++i) {
+        int width = sides[i].width, height = sides[i].height;
         glTexImage2D(targets[i], 0, GL_SRGB8_ALPHA8, width, height,
-                     0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        stbi_image_free(image);  // Clean up resources
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, sides[i].rgba);
+        bytes += gl_mip_chain_bytes(GL_SRGB8_ALPHA8, width, height, 1,
+                                    int(sides[i].levels.size()) + 1);
+        for (unsigned level = 0; level < sides[i].levels.size(); ++level) {
+            width = std::max(1, width / 2), height = std::max(1, height / 2);
+            glTexImage2D(targets[i], level + 1, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, sides[i].levels[level].data());
+        }
+        stbi_image_free(const_cast<uint8_t *>(sides[i].rgba));  // Clean up resources
     }
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    memory_track_gl(GL_TEXTURE, texture, MEMORY_GL_ENVIRONMENT, bytes);
 
     return texture;
 }
@@ -233,6 +294,7 @@ GLuint load_cubemap_prefiltered(const std::string &dirname)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    uint64_t bytes = 0;
     for (unsigned i = 0; i < nLevels; ++i) {
         for (unsigned j = 0; j < nSides; ++j) {
             // Load image for current mip level and cube side
@@ -245,10 +307,12 @@ GLuint load_cubemap_prefiltered(const std::string &dirname)
             }
             glTexImage2D(targets[j], i, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA,
                          GL_UNSIGNED_BYTE, image);
+            bytes += gl_image_bytes(GL_SRGB8_ALPHA8, width, height);
             stbi_image_free(image);  // Clean up resources
         }
     }
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    memory_track_gl(GL_TEXTURE, texture, MEMORY_GL_ENVIRONMENT, bytes);
 
     return texture;
 }
@@ -265,6 +329,8 @@ GLuint create_depth_texture(int width, int height)
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height,
                  0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
     glBindTexture(GL_TEXTURE_2D, 0);
+    memory_track_gl(GL_TEXTURE, depthTexture, MEMORY_GL_RENDER_TARGETS,
+                    gl_image_bytes(GL_DEPTH_COMPONENT, width, height));
 
     return depthTexture;
 }
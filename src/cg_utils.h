@@ -7,6 +7,7 @@
 
 #include <GL/gl3w.h>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -15,14 +16,26 @@ namespace cg {
 // Helper function for loading values from environment variables
 std::string get_env_var(const std::string &name);
 
+// Returns true if the current OpenGL context supports the extension (e.g.
+// "GL_ARB_buffer_storage")
+bool has_gl_extension(const char *name);
+
 // This function should be called at the beginning of each frame and whenever
 // we want to restore the OpenGL pipeline to its default state. Feel free to
-// change or extend this function if necessary!
+// change or extend this function if necessary! The states are set through
+// cg_gl_state.h, which skips the ones that are already at their default.
 void reset_gl_render_state();
 
+// Write RGBA8 pixels (stored bottom row first, as returned by glReadPixels)
+// to an RGB PNG file, without their alpha
+bool save_png_image(const std::string &filename, int width, int height,
+                    const std::vector<uint8_t> &pixels);
+
 GLuint load_shader_program(const std::string &vertexShaderFilename,
                            const std::string &fragmentShaderFilename);
 
+// The textures below are recorded by the memory tracker (see cg_memory.h), so
+// call memory_release_gl() along with glDeleteTextures()
 GLuint load_texture_2d(const std::string &filename);
 
 GLuint load_cubemap(const std::string &filename);
@@ -0,0 +1,525 @@
+// Ray-traced ambient occlusion baking for glTF assets.
+//
+
+#include "gltf_ambient_occlusion.h"
+#include "cg_parallel.h"
+
+#include <glm/gtc/constants.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace gltf {
+
+namespace {
+
+const int PACKET_SIZE = 8;
+const int LEAF_SIZE = 4;
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+struct Triangle {
+    glm::vec3 v0, e1, e2;  // First vertex and edges, for Moller-Trumbore tests
+};
+
+struct BVHNode {
+    glm::vec3 min;
+    int first;  // First triangle (leaves) or left child (inner nodes)
+    glm::vec3 max;
+    int count;  // Number of triangles, or zero for inner nodes
+};
+
+struct BVH {
+    std::vector<Triangle> triangles;
+    std::vector<BVHNode> nodes;
+};
+
+// Rays of a packet share the origin and the maximum distance
+struct RayPacket {
+    glm::vec3 origin;
+    float tMax;
+    float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    float ix[PACKET_SIZE], iy[PACKET_SIZE], iz[PACKET_SIZE];  // Inverse directions
+};
+
+const Accessor *find_accessor(const GLTFAsset &asset, const Primitive &primitive,
+                              AttributeSemantic semantic)
+{
+    const Attribute *attribute = find_attribute(asset, primitive, semantic);
+    return attribute ? &asset.accessors[attribute->index] : nullptr;
+}
+
+glm::vec3 read_vec3(const char *data, int stride, size_t i)
+{
+    return *(const glm::vec3 *)(data + i * stride);
+}
+
+int build_node(BVH &bvh, std::vector<glm::vec3> &centroids, int first, int count)
+{
+    int index = int(bvh.nodes.size());
+    bvh.nodes.push_back(BVHNode());
+    glm::vec3 min(1e30f), max(-1e30f), centroidMin(1e30f), centroidMax(-1e30f);
+    for (int i = first; i < first + count; ++i) {
+        const Triangle &tri = bvh.triangles[i];
+        glm::vec3 v1 = tri.v0 + tri.e1, v2 = tri.v0 + tri.e2;
+        min = glm::min(min, glm::min(tri.v0, glm::min(v1, v2)));
+        max = glm::max(max, glm::max(tri.v0, glm::max(v1, v2)));
+        centroidMin = glm::min(centroidMin, centroids[i]);
+        centroidMax = glm::max(centroidMax, centroids[i]);
+    }
+    bvh.nodes[index].min = min;
+    bvh.nodes[index].max = max;
+    if (count <= LEAF_SIZE) {
+        bvh.nodes[index].first = first;
+        bvh.nodes[index].count = count;
+        return index;
+    }
+
+    // Median split along the largest axis of the centroid bounds
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int middle = first + count / 2;
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = first + i;
+    std::nth_element(order.begin(), order.begin() + count / 2, order.end(),
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    std::vector<Triangle> triangles(count);
+    std::vector<glm::vec3> sortedCentroids(count);
+    for (int i = 0; i < count; ++i) {
+        triangles[i] = bvh.triangles[order[i]];
+        sortedCentroids[i] = centroids[order[i]];
+    }
+    std::copy(triangles.begin(), triangles.end(), bvh.triangles.begin() + first);
+    std::copy(sortedCentroids.begin(), sortedCentroids.end(), centroids.begin() + first);
+
+    build_node(bvh, centroids, first, middle - first);  // Left child follows its parent
+    int right = build_node(bvh, centroids, middle, first + count - middle);
+    bvh.nodes[index].first = right;
+    bvh.nodes[index].count = 0;
+    return index;
+}
+
+void build_bvh(const GLTFAsset &asset, const std::vector<glm::mat4> &worldMatrices, BVH &bvh,
+               Bounds &sceneBounds)
+{
+    sceneBounds.min = glm::vec3(1e30f);
+    sceneBounds.max = glm::vec3(-1e30f);
+    for (unsigned i = 0; i < asset.nodes.size(); ++i) {
+        const Node &node = asset.nodes[i];
+        if (node.mesh < 0) continue;
+        const Mesh &mesh = asset.meshes[node.mesh];
+        if (mesh.primitives.count == 0) continue;
+        const Primitive &primitive = get_mesh_primitives(asset, mesh)[0];
+        const Accessor *positions = find_accessor(asset, primitive, ATTRIBUTE_POSITION);
+        if (!positions || primitive.indices < 0) continue;
+
+        int positionStride, indexStride;
+        const char *positionData = get_accessor_data(asset, *positions, 12, positionStride);
+        const Accessor &indices = asset.accessors[primitive.indices];
+        const char *indexData = get_accessor_data(asset, indices, 0, indexStride);
+        for (int64_t j = 0; j + 2 < indices.count; j += 3) {
+            glm::vec3 v[3];
+            bool valid = true;
+            for (int k = 0; k < 3; ++k) {
+                uint32_t index = read_index(indexData, indices.componentType, size_t(j + k));
+                valid &= index < uint32_t(positions->count);
+                if (!valid) break;
+                v[k] = glm::vec3(worldMatrices[i] *
+                                 glm::vec4(read_vec3(positionData, positionStride, index), 1.0f));
+                sceneBounds.min = glm::min(sceneBounds.min, v[k]);
+                sceneBounds.max = glm::max(sceneBounds.max, v[k]);
+            }
+            if (!valid) continue;
+            Triangle tri = {v[0], v[1] - v[0], v[2] - v[0]};
+            bvh.triangles.push_back(tri);
+        }
+    }
+
+    bvh.nodes.clear();
+    if (bvh.triangles.empty()) return;
+    std::vector<glm::vec3> centroids(bvh.triangles.size());
+    for (size_t i = 0; i < bvh.triangles.size(); ++i) {
+        const Triangle &tri = bvh.triangles[i];
+        centroids[i] = tri.v0 + (tri.e1 + tri.e2) / 3.0f;
+    }
+    bvh.nodes.reserve(2 * bvh.triangles.size() / LEAF_SIZE + 1);
+    build_node(bvh, centroids, 0, int(bvh.triangles.size()));
+}
+
+#ifdef __SSE2__
+inline __m128 cross_component(__m128 ay, __m128 az, __m128 by, __m128 bz)
+{
+    return _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+}
+
+// Returns a 4-bit mask of the rays in lanes [base, base + 4) that hit the box
+int intersect_box(const RayPacket &packet, const BVHNode &node, int base)
+{
+    __m128 tNear = _mm_setzero_ps(), tFar = _mm_set1_ps(packet.tMax);
+    const float *inverse[3] = {packet.ix + base, packet.iy + base, packet.iz + base};
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 o = _mm_set1_ps(packet.origin[axis]);
+        __m128 inv = _mm_loadu_ps(inverse[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[axis]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[axis]), o), inv);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+// Returns a 4-bit mask of the rays in lanes [base, base + 4) that hit the triangle
+int intersect_triangle(const RayPacket &packet, const Triangle &tri, int base)
+{
+    __m128 dx = _mm_loadu_ps(packet.dx + base), dy = _mm_loadu_ps(packet.dy + base),
+           dz = _mm_loadu_ps(packet.dz + base);
+    __m128 e1x = _mm_set1_ps(tri.e1.x), e1y = _mm_set1_ps(tri.e1.y), e1z = _mm_set1_ps(tri.e1.z);
+    __m128 e2x = _mm_set1_ps(tri.e2.x), e2y = _mm_set1_ps(tri.e2.y), e2z = _mm_set1_ps(tri.e2.z);
+    glm::vec3 s = packet.origin - tri.v0;
+    __m128 sx = _mm_set1_ps(s.x), sy = _mm_set1_ps(s.y), sz = _mm_set1_ps(s.z);
+
+    __m128 px = cross_component(dy, dz, e2y, e2z);
+    __m128 py = cross_component(dz, dx, e2z, e2x);
+    __m128 pz = cross_component(dx, dy, e2x, e2y);
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    __m128 u = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+    // q = s x e1 is the same for all rays of the packet
+    glm::vec3 q = glm::cross(s, tri.e1);
+    __m128 qx = _mm_set1_ps(q.x), qy = _mm_set1_ps(q.y), qz = _mm_set1_ps(q.z);
+    __m128 v = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    __m128 t = _mm_mul_ps(_mm_set1_ps(glm::dot(tri.e2, q)), invDet);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), det), _mm_set1_ps(1e-12f));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(packet.tMax)));
+    return _mm_movemask_ps(hit);
+}
+#else
+int intersect_box(const RayPacket &packet, const BVHNode &node, int base)
+{
+    int mask = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        float inverse[3] = {packet.ix[base + lane], packet.iy[base + lane], packet.iz[base + lane]};
+        float tNear = 0.0f, tFar = packet.tMax;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t0 = (node.min[axis] - packet.origin[axis]) * inverse[axis];
+            float t1 = (node.max[axis] - packet.origin[axis]) * inverse[axis];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        if (tNear <= tFar) mask |= 1 << lane;
+    }
+    return mask;
+}
+
+int intersect_triangle(const RayPacket &packet, const Triangle &tri, int base)
+{
+    int mask = 0;
+    glm::vec3 s = packet.origin - tri.v0, q = glm::cross(s, tri.e1);
+    for (int lane = 0; lane < 4; ++lane) {
+        glm::vec3 d(packet.dx[base + lane], packet.dy[base + lane], packet.dz[base + lane]);
+        glm::vec3 p = glm::cross(d, tri.e2);
+        float det = glm::dot(tri.e1, p);
+        if (!(std::fabs(det) > 1e-12f)) continue;
+        float invDet = 1.0f / det;
+        float u = glm::dot(s, p) * invDet, v = glm::dot(d, q) * invDet;
+        float t = glm::dot(tri.e2, q) * invDet;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < packet.tMax)
+            mask |= 1 << lane;
+    }
+    return mask;
+}
+#endif
+
+// Returns a mask of the rays that hit anything (any-hit traversal)
+int occluded_rays(const BVH &bvh, const RayPacket &packet)
+{
+    const int allRays = (1 << PACKET_SIZE) - 1;
+    int occluded = 0;
+    int stack[64], stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const BVHNode &node = bvh.nodes[stack[--stackSize]];
+        int active = ~occluded & allRays;
+        int hits = 0;
+        for (int base = 0; base < PACKET_SIZE; base += 4) {
+            if ((active >> base) & 0xf) hits |= intersect_box(packet, node, base) << base;
+        }
+        if (!(hits & active)) continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                for (int base = 0; base < PACKET_SIZE; base += 4) {
+                    if ((~occluded >> base) & 0xf)
+                        occluded |= intersect_triangle(packet, bvh.triangles[i], base) << base;
+                }
+            }
+            if (occluded == allRays) break;
+        } else if (stackSize + 2 <= 64) {
+            stack[stackSize++] = node.first;  // Right child
+            stack[stackSize++] = int(&node - &bvh.nodes[0]) + 1;  // Left child
+        }
+    }
+    return occluded;
+}
+
+uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random_float(uint32_t &state)
+{
+    state = hash_u32(state + 0x9e3779b9u);
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Orthonormal basis around a unit vector (Duff et al. 2017)
+void make_basis(const glm::vec3 &n, glm::vec3 &b1, glm::vec3 &b2)
+{
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    b1 = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    b2 = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+// Fill a packet with cosine-weighted directions. Each packet covers one
+// azimuthal sector of the hemisphere and is stratified in radius, which
+// keeps its rays coherent (Malley's method: uniform disk samples projected
+// up onto the hemisphere).
+void generate_packet(RayPacket &packet, const glm::vec3 &n, int sector, int numSectors,
+                     uint32_t &rng)
+{
+    glm::vec3 b1, b2;
+    make_basis(n, b1, b2);
+    for (int i = 0; i < PACKET_SIZE; ++i) {
+        float r2 = (i + random_float(rng)) / PACKET_SIZE;
+        float phi = glm::two_pi<float>() * (sector + random_float(rng)) / numSectors;
+        float r = std::sqrt(r2);
+        glm::vec3 d = b1 * (r * std::cos(phi)) + b2 * (r * std::sin(phi)) +
+                      n * std::sqrt(std::max(0.0f, 1.0f - r2));
+        packet.dx[i] = d.x, packet.dy[i] = d.y, packet.dz[i] = d.z;
+        packet.ix[i] = 1.0f / d.x, packet.iy[i] = 1.0f / d.y, packet.iz[i] = 1.0f / d.z;
+    }
+}
+
+}  // namespace
+
+void bake_ambient_occlusion(const GLTFAsset &asset, const AOBakeSettings &settings,
+                            VertexOcclusion &occlusion, AOBakeStats *stats)
+{
+    AOBakeStats localStats;
+    localStats.threads = settings.numThreads > 0 ? settings.numThreads : cg::hardware_threads();
+    int numSectors = std::max(1, (settings.raysPerVertex + PACKET_SIZE - 1) / PACKET_SIZE);
+
+    if (!buffers_loaded(asset)) {
+        // The geometry is streamed from files, so there is nothing to trace
+        occlusion.assign(asset.meshes.size(), std::vector<float>());
+        if (stats) *stats = localStats;
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    std::vector<glm::mat4> worldMatrices = compute_node_world_matrices(asset);
+    BVH bvh;
+    Bounds sceneBounds;
+    build_bvh(asset, worldMatrices, bvh, sceneBounds);
+    localStats.triangles = bvh.triangles.size();
+    localStats.bvhSeconds = seconds_since(start);
+
+    float diagonal = bvh.triangles.empty() ? 0.0f : glm::length(sceneBounds.max - sceneBounds.min);
+    float maxDistance = settings.maxDistance * diagonal;
+    float offset = 1e-4f * diagonal;
+
+    start = Clock::now();
+    occlusion.assign(asset.meshes.size(), std::vector<float>());
+    for (unsigned meshIndex = 0; meshIndex < asset.meshes.size(); ++meshIndex) {
+        const Mesh &mesh = asset.meshes[meshIndex];
+        ArrayView<const Primitive> primitives = get_mesh_primitives(asset, mesh);
+        if (primitives.empty()) continue;
+        const Accessor *positions = find_accessor(asset, primitives[0], ATTRIBUTE_POSITION);
+        const Accessor *normals = find_accessor(asset, primitives[0], ATTRIBUTE_NORMAL);
+        if (!positions) continue;
+        occlusion[meshIndex].assign(size_t(positions->count), 1.0f);
+        if (!normals || normals->count != positions->count || bvh.triangles.empty()) continue;
+
+        // Bake in the space of the first node that instances the mesh
+        glm::mat4 world(1.0f);
+        for (unsigned i = 0; i < asset.nodes.size(); ++i) {
+            if (asset.nodes[i].mesh == int(meshIndex)) {
+                world = worldMatrices[i];
+                break;
+            }
+        }
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+
+        int positionStride, normalStride;
+        const char *positionData = get_accessor_data(asset, *positions, 12, positionStride);
+        const char *normalData = get_accessor_data(asset, *normals, 12, normalStride);
+        std::vector<float> &result = occlusion[meshIndex];
+        cg::parallel_for(localStats.threads, result.size(), [&](size_t begin, size_t end, int) {
+            RayPacket packet;
+            packet.tMax = maxDistance;
+            for (size_t i = begin; i < end; ++i) {
+                glm::vec3 n = normalMatrix * read_vec3(normalData, normalStride, i);
+                if (!(glm::dot(n, n) > 0.0f)) continue;
+                n = glm::normalize(n);
+                glm::vec3 p(world * glm::vec4(read_vec3(positionData, positionStride, i), 1.0f));
+                packet.origin = p + n * offset;
+
+                uint32_t rng = hash_u32(uint32_t(i) * 2654435761u + meshIndex);
+                int hits = 0;
+                for (int sector = 0; sector < numSectors; ++sector) {
+                    generate_packet(packet, n, sector, numSectors, rng);
+                    int mask = occluded_rays(bvh, packet);
+                    for (; mask; mask &= mask - 1) hits++;
+                }
+                result[i] = 1.0f - float(hits) / (numSectors * PACKET_SIZE);
+            }
+        });
+        localStats.vertices += result.size();
+        localStats.rays += result.size() * numSectors * PACKET_SIZE;
+    }
+    localStats.traceSeconds = seconds_since(start);
+    if (stats) *stats = localStats;
+}
+
+void serialize_ambient_occlusion(const VertexOcclusion &occlusion, std::vector<char> &payload)
+{
+    payload.clear();
+    auto append = [&](const void *data, size_t size) {
+        payload.insert(payload.end(), (const char *)data, (const char *)data + size);
+    };
+    uint32_t meshCount = uint32_t(occlusion.size());
+    append(&meshCount, sizeof(meshCount));
+    for (const std::vector<float> &values : occlusion) {
+        uint32_t count = uint32_t(values.size());
+        append(&count, sizeof(count));
+        if (count) append(&values[0], count * sizeof(float));
+    }
+}
+
+bool deserialize_ambient_occlusion(const std::vector<char> &payload, const GLTFAsset &asset,
+                                   VertexOcclusion &occlusion)
+{
+    size_t offset = 0;
+    auto read = [&](void *data, size_t size) {
+        if (offset + size > payload.size()) return false;
+        std::memcpy(data, &payload[offset], size);
+        offset += size;
+        return true;
+    };
+    uint32_t meshCount = 0;
+    if (!read(&meshCount, sizeof(meshCount)) || meshCount != asset.meshes.size()) return false;
+    occlusion.assign(meshCount, std::vector<float>());
+    for (uint32_t i = 0; i < meshCount; ++i) {
+        uint32_t count = 0;
+        if (!read(&count, sizeof(count))) return false;
+        occlusion[i].resize(count);
+        if (count && !read(&occlusion[i][0], count * sizeof(float))) return false;
+    }
+    return true;
+}
+
+void apply_ambient_occlusion(GLTFAsset &asset, const VertexOcclusion &occlusion)
+{
+    if (asset.buffers.empty() || !buffers_loaded(asset)) return;
+    StringRef colorName;  // Added to the string pool once, when needed
+
+    // Buffer views that several attributes read (e.g. identical colors that
+    // were deduplicated) must not be overwritten with the values of one mesh
+    std::vector<int> viewUses(asset.bufferViews.size(), 0);
+    for (const Attribute &attribute : asset.attributes) {
+        int view = asset.accessors[attribute.index].bufferView;
+        if (view >= 0 && view < int(viewUses.size())) viewUses[view]++;
+    }
+    for (unsigned i = 0; i < asset.meshes.size() && i < occlusion.size(); ++i) {
+        if (asset.meshes[i].primitives.count == 0 || occlusion[i].empty()) continue;
+        Primitive &primitive = get_mesh_primitives(asset, asset.meshes[i])[0];
+        const std::vector<float> &values = occlusion[i];
+
+        // Reuse an existing attribute with the same layout (e.g. from an
+        // earlier bake), so that baking again does not grow the buffer
+        const Attribute *color = find_attribute(asset, primitive, ATTRIBUTE_COLOR_0);
+        int colorAccessor = color ? color->index : -1;
+        bool reuse = false;
+        if (color) {
+            const Accessor &accessor = asset.accessors[colorAccessor];
+            const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
+            reuse = accessor.componentType == 5126 /*GL_FLOAT*/ &&
+                    accessor.type == ACCESSOR_VEC4 && accessor.count == int64_t(values.size()) &&
+                    bufferView.buffer == 0 &&
+                    (bufferView.byteStride == 0 || bufferView.byteStride == 16) &&
+                    viewUses[accessor.bufferView] == 1;
+        }
+        if (!reuse) {
+            Buffer &buffer = asset.buffers[0];
+            buffer.data.resize((buffer.data.size() + 3) & ~size_t(3));
+            BufferView bufferView;
+            bufferView.buffer = 0;
+            bufferView.byteOffset = int64_t(buffer.data.size());
+            bufferView.byteLength = int64_t(values.size() * 16);
+            bufferView.byteStride = 16;
+            buffer.data.resize(buffer.data.size() + bufferView.byteLength);
+            buffer.byteLength = int64_t(buffer.data.size());
+            asset.bufferViews.push_back(bufferView);
+
+            Accessor accessor;
+            accessor.bufferView = int(asset.bufferViews.size()) - 1;
+            accessor.componentType = 5126 /*GL_FLOAT*/;
+            accessor.count = int64_t(values.size());
+            accessor.byteOffset = 0;
+            accessor.type = ACCESSOR_VEC4;
+            accessor.normalized = false;
+            accessor.bounds = -1;
+            asset.accessors.push_back(accessor);
+            colorAccessor = int(asset.accessors.size()) - 1;
+            if (color) {
+                for (Attribute &it : get_primitive_attributes(asset, primitive)) {
+                    if (it.semantic != ATTRIBUTE_COLOR_0) continue;
+                    it.index = colorAccessor;
+                    break;
+                }
+            } else {
+                if (colorName.offset == 0) colorName = add_string(asset, "COLOR_0");
+                Attribute attribute = {ATTRIBUTE_COLOR_0, colorName, colorAccessor};
+                add_primitive_attribute(asset, primitive, attribute);
+            }
+        }
+
+        const Accessor &accessor = asset.accessors[colorAccessor];
+        const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
+        char *data = &asset.buffers[0].data[0] + bufferView.byteOffset + accessor.byteOffset;
+        for (size_t j = 0; j < values.size(); ++j) {
+            float rgba[4] = {values[j], values[j], values[j], 1.0f};
+            std::memcpy(data + j * 16, rgba, sizeof(rgba));
+        }
+    }
+}
+
+}  // namespace gltf
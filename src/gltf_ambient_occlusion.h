@@ -0,0 +1,54 @@
+// Ray-traced ambient occlusion baking for glTF assets.
+//
+// Casts cosine-weighted rays from every vertex against a BVH of the whole
+// scene and stores the unoccluded fraction per vertex. Rays are traced in
+// packets of eight that share an origin and a sector of the hemisphere, so
+// the packets stay coherent while traversing the BVH.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace gltf {
+
+struct AOBakeSettings {
+    int raysPerVertex = 64;     // Rounded up to a multiple of the packet size
+    float maxDistance = 0.25f;  // Relative to the diagonal of the scene bounds
+    int numThreads = 0;         // Zero uses all hardware threads
+};
+
+struct AOBakeStats {
+    int threads = 0;
+    size_t triangles = 0;
+    size_t vertices = 0;
+    size_t rays = 0;
+    double bvhSeconds = 0.0;
+    double traceSeconds = 0.0;
+};
+
+// Ambient occlusion per mesh and vertex (1 means unoccluded)
+typedef std::vector<std::vector<float>> VertexOcclusion;
+
+// Bake ambient occlusion for the first primitive of each mesh. Meshes
+// without normals, and all meshes of assets whose buffers are streamed from
+// files, are left unoccluded.
+void bake_ambient_occlusion(const GLTFAsset &asset, const AOBakeSettings &settings,
+                            VertexOcclusion &occlusion, AOBakeStats *stats = nullptr);
+
+void serialize_ambient_occlusion(const VertexOcclusion &occlusion, std::vector<char> &payload);
+
+// Returns false if the payload does not match the meshes of the asset
+bool deserialize_ambient_occlusion(const std::vector<char> &payload, const GLTFAsset &asset,
+                                   VertexOcclusion &occlusion);
+
+// Store the occlusion as the COLOR_0 attribute (RGB = occlusion, A = 1) of
+// the first primitive of each mesh. The vertex data is appended to the first
+// buffer, or overwrites an existing float VEC4 COLOR_0 attribute. Assets
+// whose buffers are streamed from files are left as they are.
+void apply_ambient_occlusion(GLTFAsset &asset, const VertexOcclusion &occlusion);
+
+}  // namespace gltf
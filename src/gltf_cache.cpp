@@ -0,0 +1,75 @@
+// Sidecar cache files for data derived from glTF assets.
+//
+
+#include "gltf_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace gltf {
+
+namespace {
+
+const char CACHE_MAGIC[4] = {'G', 'V', 'C', '1'};
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t payloadSize;
+};
+
+}  // namespace
+
+std::string cache_filename(const std::string &gltfDir, const std::string &gltfFilename,
+                           const std::string &kind)
+{
+    std::string name = gltfFilename.substr(0, gltfFilename.find_last_of('.'));
+    return gltfDir + name + "." + kind + ".cache";
+}
+
+uint64_t hash_asset_buffers(const GLTFAsset &asset)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const Buffer &buffer : asset.buffers) hash = hash_bytes(buffer.data.data(), buffer.data.size(), hash);
+    return hash;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t hash)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool write_cache_file(const std::string &filename, uint64_t key, const std::vector<char> &payload)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = 1;
+    header.key = key;
+    header.payloadSize = payload.size();
+    file.write((const char *)&header, sizeof(header));
+    if (!payload.empty()) file.write(&payload[0], payload.size());
+    return bool(file);
+}
+
+bool read_cache_file(const std::string &filename, uint64_t key, std::vector<char> &payload)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    CacheHeader header;
+    if (!file.read((char *)&header, sizeof(header))) return false;
+    if (std::memcmp(header.magic, CACHE_MAGIC, 4) != 0 || header.version != 1 || header.key != key)
+        return false;
+    payload.resize(header.payloadSize);
+    if (!payload.empty() && !file.read(&payload[0], payload.size())) return false;
+    return true;
+}
+
+}  // namespace gltf
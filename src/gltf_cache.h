@@ -0,0 +1,35 @@
+// Sidecar cache files for data derived from glTF assets.
+//
+// Expensive preprocessing results (e.g. baked ambient occlusion) are stored
+// next to the glTF file as <name>.<kind>.cache. Each file is tagged with a
+// hash of the asset's buffers, so entries are ignored once the source data
+// changes.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gltf {
+
+// Returns the filename of the cache file of the given kind for a glTF file
+std::string cache_filename(const std::string &gltfDir, const std::string &gltfFilename,
+                           const std::string &kind);
+
+// Returns a 64-bit FNV-1a hash of all buffer data of the asset
+uint64_t hash_asset_buffers(const GLTFAsset &asset);
+
+// Continues a 64-bit FNV-1a hash with the given bytes
+uint64_t hash_bytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+bool write_cache_file(const std::string &filename, uint64_t key, const std::vector<char> &payload);
+
+// Returns false if the file does not exist, is corrupt, or has another key
+bool read_cache_file(const std::string &filename, uint64_t key, std::vector<char> &payload);
+
+}  // namespace gltf
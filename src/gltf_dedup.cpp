@@ -0,0 +1,367 @@
+// Deduplication of glTF assets at load time.
+//
+
+#include "gltf_dedup.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+namespace gltf {
+
+namespace {
+
+const uint32_t NO_VERTEX = 0xffffffffu;
+
+const uint64_t PRIME_1 = 0x9e3779b185ebca87ull;
+const uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+const uint64_t PRIME_3 = 0x165667b19e3779f9ull;
+
+uint64_t rotate_left(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+uint64_t read_u64(const char *data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, 8);
+    return value;
+}
+
+size_t align4(size_t size)
+{
+    return (size + 3) & ~size_t(3);
+}
+
+// The rebuilt buffer, in which blocks of identical data are stored once
+struct BlockWriter {
+    std::vector<char> buffer;
+    std::vector<BufferView> views;
+    std::multimap<uint64_t, int> hashes;  // Buffer view of each block, by hash
+    size_t reusedBytes = 0;
+};
+
+// Returns the buffer view of a block of data (an earlier one if the data is
+// the same)
+int add_block(BlockWriter &writer, const std::vector<char> &block, int byteStride)
+{
+    uint64_t hash = hash_content(block.data(), block.size(), uint64_t(byteStride));
+    auto range = writer.hashes.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const BufferView &view = writer.views[it->second];
+        if (view.byteStride == byteStride && size_t(view.byteLength) == block.size() &&
+            std::memcmp(&writer.buffer[view.byteOffset], block.data(), block.size()) == 0) {
+            writer.reusedBytes += block.size();
+            return it->second;
+        }
+    }
+
+    size_t offset = align4(writer.buffer.size());
+    BufferView view;
+    view.buffer = 0;
+    view.byteOffset = int64_t(offset);
+    view.byteLength = int64_t(block.size());
+    view.byteStride = byteStride;
+    writer.buffer.resize(offset, '\0');
+    writer.buffer.insert(writer.buffer.end(), block.begin(), block.end());
+    writer.views.push_back(view);
+    writer.hashes.insert(std::make_pair(hash, int(writer.views.size()) - 1));
+    return int(writer.views.size()) - 1;
+}
+
+// Returns true for images that hold sRGB colors (as srgb_images() in
+// gltf_texture_arrays.h), which must not be merged with linear ones
+std::vector<bool> color_images(const GLTFAsset &asset)
+{
+    std::vector<bool> color(asset.images.size(), false);
+    for (const Material &material : asset.materials) {
+        const PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+        int index = pbr.baseColorTexture.index;
+        if (!pbr.hasBaseColorTexture || index < 0 || index >= int(asset.textures.size())) continue;
+        int source = asset.textures[index].source;
+        if (source >= 0 && source < int(color.size())) color[source] = true;
+    }
+    return color;
+}
+
+bool dedup_failed(const char *reason)
+{
+    std::cerr << "Warning: " << reason << ", the asset is not deduplicated" << std::endl;
+    return false;
+}
+
+}  // namespace
+
+void add_vertex_stream(VertexStreams &streams, const GLTFAsset &asset, const Attribute &attribute)
+{
+    const Accessor &accessor = asset.accessors[attribute.index];
+    int stride, size = accessor_element_size(accessor);
+    streams.vertexCount = streams.attributes.empty()
+                              ? size_t(accessor.count)
+                              : std::min(streams.vertexCount, size_t(accessor.count));
+    streams.attributes.push_back(&attribute);
+    streams.data.push_back(get_accessor_data(asset, accessor, size, stride));
+    streams.strides.push_back(stride);
+    streams.sizes.push_back(size);
+    streams.vertexSize += size;
+}
+
+std::vector<uint32_t> weld_vertices(const VertexStreams &streams, std::vector<uint32_t> &indices,
+                                    bool weld)
+{
+    // The first vertex with the same bytes as each vertex. Vertices are hashed
+    // in order, so that they are read sequentially, after being gathered (and
+    // padded with zeros to whole words). Each slot of the table holds a vertex
+    // in its lower half and the upper half of its hash in the other, which is
+    // compared before the vertices themselves (with linear probing).
+    std::vector<uint32_t> first(streams.vertexCount);
+    for (size_t v = 0; v < first.size(); ++v) first[v] = uint32_t(v);
+    if (weld) {
+        const uint64_t EMPTY = ~uint64_t(0), TAG_MASK = ~uint64_t(0xffffffffu);
+        const size_t size = (streams.vertexSize + 7) & ~size_t(7);
+        size_t tableSize = 16;
+        while (tableSize < 2 * streams.vertexCount) tableSize *= 2;
+        const size_t mask = tableSize - 1;
+        std::vector<uint64_t> table(tableSize, EMPTY);
+        std::vector<char> tuple(size, '\0');
+        for (size_t v = 0; v < first.size(); ++v) {
+            streams.gather(v, tuple.data());
+            uint64_t hash = hash_content(tuple.data(), size);
+            size_t slot = size_t(hash) & mask;
+            while (table[slot] != EMPTY && ((table[slot] & TAG_MASK) != (hash & TAG_MASK) ||
+                                            !streams.equal(uint32_t(table[slot]), v)))
+                slot = (slot + 1) & mask;
+            if (table[slot] == EMPTY) table[slot] = (hash & TAG_MASK) | v;
+            first[v] = uint32_t(table[slot]);
+        }
+    }
+
+    std::vector<uint32_t> remap(streams.vertexCount, NO_VERTEX), sources;
+    for (uint32_t &index : indices) {
+        uint32_t vertex = first[index];
+        if (remap[vertex] == NO_VERTEX) {
+            remap[vertex] = uint32_t(sources.size());
+            sources.push_back(vertex);
+        }
+        index = remap[vertex];
+    }
+    return sources;
+}
+
+uint64_t hash_content(const void *data, size_t size, uint64_t seed)
+{
+    // Four lanes over 32-byte stripes, without dependencies between them, then
+    // single words and bytes, and a final mix (after xxHash64)
+    const char *bytes = static_cast<const char *>(data);
+    uint64_t hash = seed + PRIME_3;
+    size_t i = 0;
+    if (size >= 32) {
+        uint64_t lanes[4] = {seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1};
+        for (; i + 32 <= size; i += 32) {
+            for (int k = 0; k < 4; ++k) {
+                uint64_t word = read_u64(bytes + i + 8 * k);
+                lanes[k] = rotate_left(lanes[k] + word * PRIME_2, 31) * PRIME_1;
+            }
+        }
+        hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) +
+               rotate_left(lanes[3], 18);
+    }
+    hash += size;
+    for (; i + 8 <= size; i += 8) {
+        hash ^= rotate_left(read_u64(bytes + i) * PRIME_2, 31) * PRIME_1;
+        hash = rotate_left(hash, 27) * PRIME_1 + PRIME_3;
+    }
+    for (; i < size; ++i) {
+        hash ^= uint8_t(bytes[i]) * PRIME_3;
+        hash = rotate_left(hash, 11) * PRIME_1;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    return hash ^ (hash >> 32);
+}
+
+bool deduplicate_gltf_asset(GLTFAsset &asset, DedupStats &stats)
+{
+    stats = DedupStats();
+    if (!buffers_loaded(asset)) return false;  // The geometry is streamed from files
+    for (const Buffer &buffer : asset.buffers) stats.bufferBytesBefore += buffer.data.size();
+
+    // Geometry: the vertices of each primitive are welded and written to a
+    // new buffer, one tightly packed buffer view per attribute (with elements
+    // padded to multiples of 4 bytes, as glTF requires). Meshes whose
+    // primitives have the same buffer views and materials are merged.
+    BlockWriter writer;
+    std::vector<Accessor> accessors;
+    std::vector<Attribute> attributes;
+    std::vector<Primitive> primitives;
+    std::vector<Mesh> meshes;
+    std::vector<int> meshIndices(asset.meshes.size(), -1);  // New index of each mesh
+    std::map<std::vector<int>, int> meshKeys;
+    std::vector<bool> viewsUsed(asset.bufferViews.size(), false);
+    std::vector<char> block;
+    for (size_t i = 0; i < asset.meshes.size(); ++i) {
+        Mesh mesh = asset.meshes[i];
+        const size_t accessorCount = accessors.size(), attributeCount = attributes.size();
+        const size_t reusedBytes = writer.reusedBytes;
+        std::vector<int> key;
+        for (const Primitive &primitive : get_mesh_primitives(asset, asset.meshes[i])) {
+            bool valid = accessor_in_bounds(asset, primitive.indices);
+            for (const Attribute &attribute : get_primitive_attributes(asset, primitive))
+                valid &= accessor_in_bounds(asset, attribute.index);
+            if (!valid) return dedup_failed("Accessor out of range");
+
+            VertexStreams streams;
+            for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+                add_vertex_stream(streams, asset, attribute);
+                viewsUsed[asset.accessors[attribute.index].bufferView] = true;
+            }
+            const Accessor &indexAccessor = asset.accessors[primitive.indices];
+            viewsUsed[indexAccessor.bufferView] = true;
+            int indexStride;
+            const char *indexData = get_accessor_data(asset, indexAccessor, 0, indexStride);
+            std::vector<uint32_t> indices(size_t(indexAccessor.count));
+            for (size_t j = 0; j < indices.size(); ++j) {
+                indices[j] = read_index(indexData, indexAccessor.componentType, j);
+                if (indices[j] >= streams.vertexCount) return dedup_failed("Index out of range");
+            }
+
+            std::vector<uint32_t> sources = weld_vertices(streams, indices);
+            stats.verticesBefore += streams.vertexCount;
+            stats.verticesAfter += sources.size();
+            stats.vertexBytesSaved += (streams.vertexCount - sources.size()) * streams.vertexSize;
+
+            Primitive result = primitive;
+            result.attributes.offset = uint32_t(attributes.size());
+            key.push_back(int(streams.attributes.size()));
+            key.push_back(primitive.hasMaterial ? primitive.material : -1);
+            for (size_t k = 0; k < streams.attributes.size(); ++k) {
+                Attribute attribute = *streams.attributes[k];
+                Accessor accessor = asset.accessors[attribute.index];
+                const int size = streams.sizes[k], stride = int(align4(size));
+                block.assign(sources.size() * stride, '\0');
+                for (size_t v = 0; v < sources.size(); ++v) {
+                    std::memcpy(&block[v * stride], streams.data[k] + sources[v] * streams.strides[k],
+                                size);
+                }
+                accessor.bufferView = add_block(writer, block, stride != size ? stride : 0);
+                accessor.byteOffset = 0;
+                accessor.count = int64_t(sources.size());
+                accessors.push_back(accessor);
+                attribute.index = int(accessors.size()) - 1;
+                attributes.push_back(attribute);
+                int fields[] = {attribute.semantic,   int(attribute.name.offset), accessor.bufferView,
+                                accessor.componentType, accessor.type,              accessor.normalized};
+                key.insert(key.end(), fields, fields + 6);
+            }
+
+            // The index type is kept, since welding never adds vertices
+            Accessor accessor = indexAccessor;
+            const int indexSize = component_type_size(accessor.componentType);
+            block.assign(indices.size() * indexSize, '\0');
+            for (size_t j = 0; j < indices.size(); ++j) {
+                uint16_t index16 = uint16_t(indices[j]);
+                if (indexSize == 1) block[j] = char(indices[j]);
+                if (indexSize == 2) std::memcpy(&block[j * 2], &index16, 2);
+                if (indexSize == 4) std::memcpy(&block[j * 4], &indices[j], 4);
+            }
+            accessor.bufferView = add_block(writer, block, 0);
+            accessor.byteOffset = 0;
+            accessors.push_back(accessor);
+            result.indices = int(accessors.size()) - 1;
+            key.push_back(accessor.bufferView);
+            key.push_back(accessor.componentType);
+            key.push_back(int(accessor.count));
+            key.push_back(int(accessor.count >> 32));
+            primitives.push_back(result);
+        }
+
+        auto found = meshKeys.find(key);
+        if (found != meshKeys.end()) {
+            // All data of the mesh was found in the buffer already
+            meshIndices[i] = found->second;
+            stats.meshesMerged++;
+            stats.meshBytesSaved += writer.reusedBytes - reusedBytes;
+            accessors.resize(accessorCount);
+            attributes.resize(attributeCount);
+            primitives.resize(primitives.size() - asset.meshes[i].primitives.count);
+            continue;
+        }
+        stats.bufferBytesSaved += writer.reusedBytes - reusedBytes;
+        mesh.primitives.offset = uint32_t(primitives.size() - asset.meshes[i].primitives.count);
+        meshIndices[i] = int(meshes.size());
+        meshKeys[key] = int(meshes.size());
+        meshes.push_back(mesh);
+    }
+    writer.buffer.resize(align4(writer.buffer.size()), '\0');
+
+    size_t referencedBytes = 0;
+    for (size_t i = 0; i < viewsUsed.size(); ++i) {
+        if (viewsUsed[i]) referencedBytes += size_t(asset.bufferViews[i].byteLength);
+    }
+    if (stats.bufferBytesBefore > referencedBytes)
+        stats.unreferencedBytes = stats.bufferBytesBefore - referencedBytes;
+
+    // Images with the same size, pixels and color space
+    std::vector<int> imageIndices(asset.images.size());
+    std::vector<bool> color = color_images(asset);
+    std::multimap<uint64_t, int> imageHashes;
+    for (size_t i = 0; i < asset.images.size(); ++i) {
+        const Image &image = asset.images[i];
+        imageIndices[i] = int(i);
+        if (image.data.empty()) continue;  // Not loaded, or merged already
+        uint64_t seed = uint64_t(image.width) << 32 | uint32_t(image.height);
+        uint64_t hash = hash_content(image.data.data(), image.data.size(), seed);
+        auto range = imageHashes.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Image &other = asset.images[it->second];
+            if (other.width == image.width && other.height == image.height &&
+                color[it->second] == color[i] && other.data == image.data) {
+                imageIndices[i] = it->second;
+                break;
+            }
+        }
+        if (imageIndices[i] == int(i)) imageHashes.insert(std::make_pair(hash, int(i)));
+    }
+
+    // Nothing fails from here on, so the asset can be changed. Merged images
+    // keep their uri (so that they are reloaded when their files change), but
+    // not their pixels, and no image is embedded in the new buffer.
+    for (size_t i = 0; i < asset.images.size(); ++i) {
+        Image &image = asset.images[i];
+        image.bufferView = -1;
+        if (imageIndices[i] == int(i)) continue;
+        stats.imagesMerged++;
+        stats.imageBytesSaved += image.data.size();
+        std::vector<char>().swap(image.data);
+        image.levels.clear();
+    }
+    for (Texture &texture : asset.textures) {
+        if (texture.source >= 0 && texture.source < int(imageIndices.size()))
+            texture.source = imageIndices[texture.source];
+    }
+    if (asset.meshes.empty()) {
+        stats.bufferBytesAfter = stats.bufferBytesBefore;
+        return true;  // The buffers are left as they are
+    }
+
+    for (Node &node : asset.nodes) {
+        if (node.mesh >= 0 && node.mesh < int(meshIndices.size())) node.mesh = meshIndices[node.mesh];
+    }
+    std::string uri = asset.buffers.empty() ? std::string() : asset.buffers[0].uri;
+    stats.bufferBytesAfter = writer.buffer.size();
+    asset.buffers.assign(1, Buffer());
+    asset.buffers[0].uri = uri;  // Still reloaded when its file changes
+    asset.buffers[0].byteLength = int64_t(writer.buffer.size());
+    asset.buffers[0].data.swap(writer.buffer);
+    asset.bufferViews.swap(writer.views);
+    asset.accessors.swap(accessors);
+    asset.attributes.swap(attributes);
+    asset.primitives.swap(primitives);
+    asset.meshes.swap(meshes);
+    return true;
+}
+
+}  // namespace gltf
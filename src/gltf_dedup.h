@@ -0,0 +1,95 @@
+// Deduplication of glTF assets at load time.
+//
+// Exporters often write the same data more than once: vertices that are
+// split along flat-shading or UV seams but end up identical, and meshes and
+// images that are copied under different names. deduplicate_gltf_asset()
+// merges them before anything is uploaded: the vertices of each primitive
+// are welded (compared on all their attributes, whatever the strides of the
+// buffer views), all geometry is rebuilt into one buffer in which blocks of
+// identical data are stored once, meshes that end up with identical data
+// and materials are merged, and textures of images with identical pixels
+// share one image (and so one texture array layer). The welding and hashing
+// are also used by the offline optimizer (see gltf_optimize.h).
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace gltf {
+
+struct DedupStats {
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t meshesMerged = 0;
+    size_t imagesMerged = 0;
+
+    // Bytes saved by each stage. Buffer bytes are blocks of identical data
+    // (accessors or whole buffers) in meshes that are not merged, and
+    // unreferenced bytes those that no primitive uses (e.g. embedded images,
+    // whose pixels are decoded already).
+    size_t vertexBytesSaved = 0;
+    size_t meshBytesSaved = 0;
+    size_t bufferBytesSaved = 0;
+    size_t unreferencedBytes = 0;
+    size_t imageBytesSaved = 0;
+    size_t bufferBytesBefore = 0;
+    size_t bufferBytesAfter = 0;
+};
+
+// Vertices of a primitive, as the tightly packed bytes of all their
+// attributes, so that vertices can be compared whatever the strides
+struct VertexStreams {
+    std::vector<const Attribute *> attributes;
+    std::vector<const char *> data;
+    std::vector<int> strides;
+    std::vector<int> sizes;
+    size_t vertexSize = 0;   // Sum of sizes
+    size_t vertexCount = 0;  // Of the shortest attribute
+
+    void gather(size_t vertex, char *out) const
+    {
+        for (size_t i = 0; i < data.size(); ++i) {
+            std::memcpy(out, data[i] + vertex * strides[i], sizes[i]);
+            out += sizes[i];
+        }
+    }
+
+    bool equal(size_t a, size_t b) const
+    {
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (std::memcmp(data[i] + a * strides[i], data[i] + b * strides[i], sizes[i]) != 0)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Adds an attribute of a primitive to its vertex streams. The accessor
+// must be in bounds (see accessor_in_bounds()).
+void add_vertex_stream(VertexStreams &streams, const GLTFAsset &asset, const Attribute &attribute);
+
+// Assigns a new index to each referenced vertex, in order of first use.
+// With welding, vertices with the same bytes get the same index, found by
+// their hash in a table with open addressing. Returns the original vertex of
+// each new index. All indices must be less than streams.vertexCount.
+std::vector<uint32_t> weld_vertices(const VertexStreams &streams, std::vector<uint32_t> &indices,
+                                    bool weld = true);
+
+// 64-bit hash of a block of memory, in four independent lanes of eight bytes
+// (so that it runs at several bytes per cycle). Not for files on disk, since
+// it may change between versions (see hash_bytes() in gltf_cache.h).
+uint64_t hash_content(const void *data, size_t size, uint64_t seed = 0);
+
+// Deduplicate the vertices, geometry, meshes and images of a loaded asset,
+// as described above. Returns false if an accessor or index is out of range,
+// or if the buffers are streamed from files, in which case the asset is left
+// unchanged.
+bool deduplicate_gltf_asset(GLTFAsset &asset, DedupStats &stats);
+
+}  // namespace gltf
@@ -0,0 +1,362 @@
+// Preparation of the draws of a frame as a graph of jobs.
+//
+
+#include "gltf_frame_prep.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <functional>
+#include <iostream>
+
+namespace gltf {
+
+namespace {
+
+const uint64_t KEY_FIELD_MASK = (uint64_t(1) << 24) - 1;
+const int KEY_MAX_ARRAYS = (1 << 16) - 1;
+
+// The node and mesh counts are checked by frame_prep_init()
+uint64_t make_sort_key(int array, int mesh, int node)
+{
+    assert(array >= -1 && array < KEY_MAX_ARRAYS);
+    assert(uint64_t(mesh) <= KEY_FIELD_MASK && uint64_t(node) <= KEY_FIELD_MASK);
+    return (uint64_t(array + 1) << 48) | (uint64_t(mesh) << 24) | uint64_t(node);
+}
+
+int key_node(uint64_t key)
+{
+    return int(key & KEY_FIELD_MASK);
+}
+
+const TextureSlot *mesh_slot(const FramePrep &prep, int mesh)
+{
+    const int texture = prep.meshTextures[mesh];
+    if (texture < 0 || !prep.input.packing || texture >= int(prep.input.packing->slots.size()))
+        return nullptr;
+    const TextureSlot &slot = prep.input.packing->slots[texture];
+    return slot.array >= 0 ? &slot : nullptr;
+}
+
+// Planes of the view frustum (pointing inwards) from a view-projection matrix
+void extract_frustum_planes(const glm::mat4 &m, glm::vec4 planes[6])
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    for (int i = 0; i < 3; ++i) {
+        planes[2 * i] = rows[3] + rows[i];
+        planes[2 * i + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; ++i) planes[i] /= std::max(glm::length(glm::vec3(planes[i])), 1e-20f);
+}
+
+bool sphere_in_frustum(const glm::vec4 planes[6], const glm::vec3 &center, float radius)
+{
+    for (int i = 0; i < 6; ++i) {
+        if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) return false;
+    }
+    return true;
+}
+
+float max_scale(const glm::mat4 &m)
+{
+    return std::max(glm::length(glm::vec3(m[0])),
+                    std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+}
+
+void update_transforms(FramePrep &prep, const std::vector<int> &nodes, size_t begin, size_t end)
+{
+    const glm::mat4 &root = prep.input.rootMatrix;
+    for (size_t i = begin; i < end; ++i) {
+        const int node = nodes[i], parent = prep.parents[node];
+        const glm::mat4 &parentMatrix = parent < 0 ? root : prep.worldMatrices[parent];
+        prep.worldMatrices[node] = parentMatrix * prep.localMatrices[node];
+    }
+}
+
+// Returns the coarsest level of detail of a mesh whose error is at most the
+// given number of pixels on screen, at the point of its bounding sphere
+// nearest to the camera (1 for the first level in GLTFAsset::lods, 0 for the
+// full mesh)
+int select_lod(const FramePrep &prep, const GLTFAsset &asset, int mesh, const glm::mat4 &model)
+{
+    const FramePrepInput &input = prep.input;
+    ArrayView<const MeshLod> lods = get_mesh_lods(asset, asset.meshes[mesh]);
+    if (lods.empty() || !(input.lodPixelError > 0.0f)) return 0;
+    const glm::mat4 modelView = input.view * model;
+    const glm::vec4 &sphere = prep.meshSpheres[mesh];
+    const float scale = max_scale(modelView);
+    float pixelsPerUnit = 0.5f * input.viewportHeight * input.projection[1][1] * scale;
+    if (input.projection[3][3] == 0.0f) {  // Perspective projection
+        float depth = -(modelView * glm::vec4(glm::vec3(sphere), 1.0f)).z - sphere.w * scale;
+        if (depth <= 0.0f) return 0;  // The camera is inside the bounds
+        pixelsPerUnit /= depth;
+    }
+    int lod = 0;
+    while (lod < int(lods.size()) && lods[lod].error * pixelsPerUnit <= input.lodPixelError) lod++;
+    return lod;
+}
+
+void cull_and_select_levels(FramePrep &prep, const GLTFAsset &asset, const glm::vec4 planes[6],
+                            size_t begin, size_t end)
+{
+    const FramePrepInput &input = prep.input;
+    const bool occlusion = input.occlusion && input.occlusion->enabled;
+    for (size_t i = begin; i < end; ++i) {
+        const int mesh = asset.nodes[i].mesh;
+        const glm::mat4 &model = prep.worldMatrices[i];
+        bool visible = mesh >= 0 && mesh < int(asset.meshes.size()) &&
+                       asset.meshes[mesh].primitives.count > 0;
+        if (visible && occlusion) visible = occlusion_visible(*input.occlusion, int(i));
+        if (visible && input.frustumCulling) {
+            const glm::vec4 &sphere = prep.meshSpheres[mesh];
+            glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f));
+            visible = sphere_in_frustum(planes, center, sphere.w * max_scale(model));
+        }
+        prep.visible[i] = visible;
+        prep.lodLevels[i] = uint8_t(visible ? select_lod(prep, asset, mesh, model) : 0);
+
+        glm::ivec2 &level = prep.textureLevels[i];
+        level = glm::ivec2(-1, -1);
+        if (visible && input.streamer) {
+            level.y = texture_streaming_select_level(*input.streamer, asset, mesh,
+                                                     input.view * model, input.projection,
+                                                     input.viewportHeight, level.x);
+        }
+    }
+}
+
+// Write the keys of the visible nodes of a chunk to the start of its range of
+// keys, and sort them
+void generate_sort_keys(FramePrep &prep, const GLTFAsset &asset, size_t chunk)
+{
+    const size_t begin = chunk * FramePrep::SORT_CHUNK;
+    const size_t end = std::min(begin + FramePrep::SORT_CHUNK, asset.nodes.size());
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i) {
+        if (!prep.visible[i]) continue;
+        const int mesh = asset.nodes[i].mesh;
+        const TextureSlot *slot = mesh_slot(prep, mesh);
+        // More arrays than the key holds are sorted as one (which only costs
+        // texture binds)
+        const int array = slot ? std::min(slot->array, KEY_MAX_ARRAYS - 1) : -1;
+        prep.keys[begin + count++] = make_sort_key(array, mesh, int(i));
+    }
+    std::sort(prep.keys.begin() + begin, prep.keys.begin() + begin + count);
+    prep.runCounts[0][chunk] = count;
+}
+
+// Merge the sorted runs 2 * pair and 2 * pair + 1 (if there are more than
+// that) of a round, whose ranges are width keys apart, into the start of the
+// range of the first one
+void merge_runs(FramePrep &prep, int round, size_t runs, size_t width, size_t pair)
+{
+    const std::vector<uint64_t> &src = round % 2 == 0 ? prep.keys : prep.scratch;
+    std::vector<uint64_t> &dst = round % 2 == 0 ? prep.scratch : prep.keys;
+    const std::vector<size_t> &counts = prep.runCounts[round % 2];
+    const size_t first = 2 * pair, second = first + 1;
+    const size_t countA = counts[first];
+    const size_t countB = second < runs ? counts[second] : 0;
+    const uint64_t *a = src.data() + first * width;
+    const uint64_t *b = countB ? src.data() + second * width : a;
+    std::merge(a, a + countA, b, b + countB, dst.begin() + first * width);
+    prep.runCounts[1 - round % 2][pair] = countA + countB;
+}
+
+void build_packets(FramePrep &prep, const GLTFAsset &asset, const std::vector<uint64_t> &keys,
+                   size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        DrawPacket &packet = prep.packets[i];
+        packet.key = keys[i];
+        packet.node = key_node(keys[i]);
+        packet.mesh = asset.nodes[packet.node].mesh;
+        packet.model = prep.worldMatrices[packet.node];
+        packet.lod = prep.lodLevels[packet.node];
+        const TextureSlot *slot = mesh_slot(prep, packet.mesh);
+        packet.array = slot ? slot->array : -1;
+        packet.textured = slot != nullptr;
+        packet.texTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+        if (slot) {
+            packet.texTransform =
+                glm::vec4(slot->scale, float(slot->layer), slot->repeat ? 1.0f : 0.0f);
+        }
+    }
+}
+
+size_t loop_grain(const cg::JobSystem &jobs, size_t count)
+{
+    // A few ranges per thread, so that threads that finish early can steal
+    return std::max<size_t>(256, count / (size_t(cg::job_system_threads(jobs)) * 8));
+}
+
+}  // namespace
+
+void frame_prep_init(FramePrep &prep, const GLTFAsset &asset)
+{
+    const size_t count = asset.nodes.size();
+    prep.worldMatrices.clear();  // Not valid for this asset until it is prepared
+    prep.parents.clear();
+    if (count > KEY_FIELD_MASK + 1 || asset.meshes.size() > KEY_FIELD_MASK + 1) {
+        std::cerr << "Error: Cannot draw more than " << KEY_FIELD_MASK + 1
+                  << " nodes or meshes (the asset has " << count << " nodes and "
+                  << asset.meshes.size() << " meshes)" << std::endl;
+        return;  // Without a hierarchy, so frame_prep_run() prepares no draws
+    }
+    prep.parents.assign(count, -1);
+    prep.localMatrices.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        prep.localMatrices[i] = compute_node_local_matrix(asset, asset.nodes[i]);
+        for (int child : get_node_children(asset, asset.nodes[i])) {
+            if (child >= 0 && child < int(count) && prep.parents[child] < 0)
+                prep.parents[child] = int(i);
+        }
+    }
+
+    // Group the nodes by depth, so that each level only depends on the one
+    // above it. Nodes that are not reached from a root (in cycles of invalid
+    // files) are treated as roots.
+    std::vector<int> depths(count, -1);
+    prep.depthLevels.assign(1, std::vector<int>());
+    for (size_t i = 0; i < count; ++i) {
+        if (prep.parents[i] >= 0) continue;
+        prep.depthLevels[0].push_back(int(i));
+        depths[i] = 0;
+    }
+    for (size_t level = 0; level < prep.depthLevels.size(); ++level) {
+        std::vector<int> next;
+        for (int node : prep.depthLevels[level]) {
+            for (int child : get_node_children(asset, asset.nodes[node])) {
+                if (child < 0 || child >= int(count) || depths[child] >= 0) continue;
+                if (prep.parents[child] != node) continue;  // Also a child of another node
+                depths[child] = int(level) + 1;
+                next.push_back(child);
+            }
+        }
+        if (!next.empty()) prep.depthLevels.push_back(next);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (depths[i] >= 0) continue;
+        prep.parents[i] = -1;
+        prep.depthLevels[0].push_back(int(i));
+    }
+
+    std::vector<Bounds> bounds = compute_mesh_bounds(asset);
+    prep.meshSpheres.resize(bounds.size());
+    prep.meshTextures.assign(asset.meshes.size(), -1);
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        glm::vec3 center = 0.5f * (bounds[i].min + bounds[i].max);
+        prep.meshSpheres[i] = glm::vec4(center, 0.5f * glm::length(bounds[i].max - bounds[i].min));
+        if (asset.meshes[i].primitives.count == 0) continue;
+        const Primitive &primitive = get_mesh_primitives(asset, asset.meshes[i])[0];
+        if (!primitive.hasMaterial) continue;
+        const PBRMetallicRoughness &pbr = asset.materials[primitive.material].pbrMetallicRoughness;
+        if (pbr.hasBaseColorTexture) prep.meshTextures[i] = pbr.baseColorTexture.index;
+    }
+}
+
+void frame_prep_run(FramePrep &prep, cg::JobSystem &jobs, const GLTFAsset &asset,
+                    const FramePrepInput &input)
+{
+    const size_t count = asset.nodes.size();
+    prep.input = input;
+    prep.packets.clear();
+    if (count == 0 || prep.parents.size() != count) return;
+    prep.worldMatrices.resize(count);
+    prep.visible.resize(count);
+    prep.textureLevels.resize(count);
+    prep.lodLevels.resize(count);
+    prep.keys.resize(count);
+    prep.scratch.resize(count);
+    const size_t chunks = (count + FramePrep::SORT_CHUNK - 1) / FramePrep::SORT_CHUNK;
+    prep.runCounts[0].assign(chunks, 0);
+    prep.runCounts[1].assign((chunks + 1) / 2, 0);
+
+    // Each stage has a counter, and starts once the counter of the previous
+    // stage drops to zero. The job that starts the loop of a stage (whose
+    // length may only be known then) is counted by the stage, so the stage
+    // does not end before its loop has been spawned. A grain of 0 splits the
+    // loop into a few ranges per thread.
+    FramePrep *state = &prep;
+    const GLTFAsset *source = &asset;
+    cg::JobSystem *system = &jobs;
+    prep.stages.clear();
+    cg::JobCounter *previous = nullptr;
+    auto add_loop_stage = [&](const std::function<size_t()> &loopCount,
+                              const std::function<void(size_t, size_t)> &fn, size_t grain) {
+        prep.stages.emplace_back(new cg::JobCounter());
+        cg::JobCounter *stage = prep.stages.back().get();
+        cg::JobFunction start = [system, stage, loopCount, grain, fn] {
+            const size_t n = loopCount();
+            cg::job_parallel_for(*system, n, grain ? grain : loop_grain(*system, n), fn, stage);
+        };
+        if (previous) cg::job_then(jobs, *previous, start, stage);
+        else cg::job_spawn(jobs, start, stage);
+        previous = stage;
+    };
+
+    // 1. Transforms
+    if (input.nodeTransforms) {
+        for (size_t level = 0; level < prep.depthLevels.size(); ++level) {
+            const std::vector<int> *nodes = &prep.depthLevels[level];
+            add_loop_stage([nodes] { return nodes->size(); },
+                           [state, nodes](size_t begin, size_t end) {
+                update_transforms(*state, *nodes, begin, end);
+            }, 0);
+        }
+    } else {
+        add_loop_stage([count] { return count; }, [state](size_t begin, size_t end) {
+            std::fill(state->worldMatrices.begin() + begin, state->worldMatrices.begin() + end,
+                      state->input.rootMatrix);
+        }, 0);
+    }
+
+    // 2. Culling and LOD selection
+    std::array<glm::vec4, 6> planes;
+    extract_frustum_planes(input.projection * input.view, planes.data());
+    add_loop_stage([count] { return count; }, [state, source, planes](size_t begin, size_t end) {
+        cull_and_select_levels(*state, *source, planes.data(), begin, end);
+    }, 0);
+
+    // 3. Sort keys, one sorted run per chunk
+    add_loop_stage([chunks] { return chunks; }, [state, source](size_t begin, size_t end) {
+        for (size_t chunk = begin; chunk < end; ++chunk) generate_sort_keys(*state, *source, chunk);
+    }, 1);
+
+    // 4. Merge rounds, until a single run is left
+    int rounds = 0;
+    for (size_t runs = chunks, width = FramePrep::SORT_CHUNK; runs > 1; runs = (runs + 1) / 2) {
+        const int round = rounds++;
+        const size_t pairs = (runs + 1) / 2;
+        add_loop_stage([pairs] { return pairs; },
+                       [state, round, runs, width](size_t begin, size_t end) {
+            for (size_t pair = begin; pair < end; ++pair)
+                merge_runs(*state, round, runs, width, pair);
+        }, 1);
+        width *= 2;
+    }
+
+    // 5. Packets, in the order of the merged keys
+    const std::vector<uint64_t> *sorted = rounds % 2 == 0 ? &prep.keys : &prep.scratch;
+    const std::vector<size_t> *sortedCount = &prep.runCounts[rounds % 2];
+    add_loop_stage([state, sortedCount] {
+        state->packets.resize((*sortedCount)[0]);
+        return state->packets.size();
+    }, [state, source, sorted](size_t begin, size_t end) {
+        build_packets(*state, *source, *sorted, begin, end);
+    }, 0);
+
+    // The texture requests write the streamer, so they run in a single job
+    prep.stages.emplace_back(new cg::JobCounter());
+    cg::JobCounter *requests = prep.stages.back().get();
+    cg::job_then(jobs, *previous, [state] {
+        if (!state->input.streamer) return;
+        for (const DrawPacket &packet : state->packets) {
+            const glm::ivec2 &level = state->textureLevels[packet.node];
+            texture_streaming_request_level(*state->input.streamer, level.x, level.y);
+        }
+    }, requests);
+    cg::job_wait(jobs, *requests);
+}
+
+}  // namespace gltf
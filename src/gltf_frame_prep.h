@@ -0,0 +1,97 @@
+// Preparation of the draws of a frame as a graph of jobs.
+//
+// Every frame, the nodes of an asset go through five stages, each a parallel
+// loop that starts as a continuation of the previous one:
+//
+//   1. Transforms: world matrices, one level of the node hierarchy at a time
+//   2. Culling and LOD: nodes outside the view frustum or hidden by the
+//      occlusion culler are dropped, and the others get the coarsest level of
+//      detail of their mesh whose error stays below lodPixelError pixels on
+//      screen (see gltf_lod.h), and a texture level for texture streaming
+//   3. Sort keys: the keys of the remaining nodes are generated and sorted in
+//      chunks of nodes
+//   4. Merge: the sorted chunks are merged in pairs, one round after another
+//   5. Packets: a draw packet is built for every key
+//
+// A last job then requests the selected texture levels (which is serial, as
+// it writes the streamer). The thread that starts the frame runs jobs until
+// the packets are done, so it only has to submit them to OpenGL afterwards.
+// Draws are sorted by texture array and then by mesh, so that consecutive
+// draws share as much state as possible.
+//
+
+#pragma once
+
+#include "cg_jobs.h"
+#include "gltf_occlusion.h"
+#include "gltf_scene.h"
+#include "gltf_texture_arrays.h"
+#include "gltf_texture_streaming.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gltf {
+
+struct DrawPacket {
+    uint64_t key = 0;  // Texture array (16 bits), mesh (24 bits) and node (24 bits)
+    int node = 0;
+    int mesh = 0;
+    int array = -1;    // Of the base color texture, or -1 if it has none
+    int lod = 0;       // Level of detail of the mesh, 0 for the full mesh
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::vec4 texTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);  // Scale, layer and wrap mode
+    bool textured = false;
+};
+
+// Camera and optional inputs of a frame. The pointed-to objects must not
+// change until frame_prep_run() returns.
+struct FramePrepInput {
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::mat4 rootMatrix = glm::mat4(1.0f);  // Applied to the world matrices of all nodes
+    bool nodeTransforms = true;  // Use the node hierarchy (else nodes only get rootMatrix)
+    bool frustumCulling = true;
+    const OcclusionCuller *occlusion = nullptr;  // Skipped unless enabled
+    const TexturePacking *packing = nullptr;     // For the texture of each packet
+    TextureStreamer *streamer = nullptr;         // Receives the selected texture levels
+    int viewportHeight = 1;
+    float lodPixelError = 1.0f;  // Largest error of a level of detail on screen (0 for none)
+};
+
+struct FramePrep {
+    static const size_t SORT_CHUNK = 4096;  // Nodes per sorted chunk of keys
+
+    // Node hierarchy, from frame_prep_init()
+    std::vector<int> parents;                 // Per node, -1 for roots
+    std::vector<std::vector<int>> depthLevels;  // Nodes at each depth of the hierarchy
+    std::vector<glm::mat4> localMatrices;
+    std::vector<glm::vec4> meshSpheres;       // Bounding sphere of each mesh (center and radius)
+    std::vector<int> meshTextures;            // Base color texture of each mesh, or -1
+
+    // Results of the last frame
+    FramePrepInput input;
+    std::vector<glm::mat4> worldMatrices;  // Including the root matrix
+    std::vector<uint8_t> visible;          // Per node
+    std::vector<glm::ivec2> textureLevels; // Per node: streamed array and level (or -1)
+    std::vector<uint8_t> lodLevels;        // Per node: level of detail of its mesh
+    std::vector<uint64_t> keys;            // Sort keys, merged back and forth with scratch
+    std::vector<uint64_t> scratch;
+    std::vector<size_t> runCounts[2];      // Keys of each sorted run (chunk, then merged pair)
+    std::vector<DrawPacket> packets;       // In draw order
+    std::vector<std::unique_ptr<cg::JobCounter>> stages;
+};
+
+// Flatten the node hierarchy and compute mesh bounds for a newly loaded (or
+// changed) asset. Assets with more than 16M nodes or meshes (which do not fit
+// the sort keys) are reported, and get no draws.
+void frame_prep_init(FramePrep &prep, const GLTFAsset &asset);
+
+// Build the sorted draw packets of a frame on the threads of the job system
+void frame_prep_run(FramePrep &prep, cg::JobSystem &jobs, const GLTFAsset &asset,
+                    const FramePrepInput &input);
+
+}  // namespace gltf
@@ -7,6 +7,9 @@
 
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
 
 // #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -15,26 +18,47 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
 namespace json = rapidjson;  // Use shorter alias for namespace
 
 namespace gltf {
 
-static bool load_file_to_bytebuffer(const std::string &filename, std::vector<char> &buffer)
+bool seek_file(FILE *stream, int64_t offset, int origin)
 {
-    FILE *stream = std::fopen(filename.c_str(), "rb+");
+#ifdef _WIN32
+    return _fseeki64(stream, offset, origin) == 0;
+#else
+    return fseeko(stream, off_t(offset), origin) == 0;
+#endif
+}
+
+int64_t tell_file(FILE *stream)
+{
+#ifdef _WIN32
+    return _ftelli64(stream);
+#else
+    return int64_t(ftello(stream));
+#endif
+}
+
+bool load_file_to_bytebuffer(const std::string &filename, std::vector<char> &buffer)
+{
+    FILE *stream = std::fopen(filename.c_str(), "rb");
     if (!stream) {
         std::cerr << "Error: Could not open " << filename << std::endl;
         return false;
     }
 
-    const int BUFFER_SIZE_MAX = 32000000;  // FIXME
-    buffer.resize(BUFFER_SIZE_MAX);
-    buffer.resize(std::fread(&buffer[0], sizeof(char), BUFFER_SIZE_MAX, stream));
-    assert(buffer.size() <= BUFFER_SIZE_MAX);
+    // Read the whole file at once, with the size taken from the file itself
+    int64_t size = seek_file(stream, 0, SEEK_END) ? tell_file(stream) : -1;
+    seek_file(stream, 0, SEEK_SET);
+    buffer.resize(size > 0 ? size_t(size) : 0);
+    bool ok = size >= 0 && std::fread(buffer.data(), 1, buffer.size(), stream) == buffer.size();
     std::fclose(stream);
-    return true;
+    if (!ok) std::cerr << "Error: Could not read " << filename << std::endl;
+    return ok;
 }
 
 static bool load_image_to_bytebuffer(const std::string &filename, std::vector<char> &buffer,
@@ -55,23 +79,75 @@ static bool load_image_to_bytebuffer(const std::string &filename, std::vector<ch
     return true;
 }
 
-static std::vector<Node> create_nodes_from_json(const json::Value &value)
+// Same as load_image_to_bytebuffer(), for an image file in memory
+static bool decode_image_to_bytebuffer(const char *data, size_t size, std::vector<char> &buffer,
+                                       int &width, int &height)
+{
+    int w, h, c;
+    uint8_t *image = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(data), int(size), &w,
+                                           &h, &c, 4);
+    if (image == nullptr) {
+        std::cerr << "Error: " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    width = w, height = h;
+    buffer.resize(width * height * 4);
+    std::memcpy(&buffer[0], image, width * height * 4);
+    stbi_image_free(image);
+    return true;
+}
+
+static StringRef create_string_from_json(const json::Value &value, GLTFAsset &asset)
+{
+    return add_string(asset, value.GetString(), value.GetStringLength());
+}
+
+static Span create_node_indices_from_json(const json::Value &value, GLTFAsset &asset)
+{
+    Span span;
+    span.offset = uint32_t(asset.nodeIndices.size());
+    span.count = value.Size();
+    for (unsigned j = 0; j < value.Size(); ++j) asset.nodeIndices.push_back(value[j].GetInt());
+    return span;
+}
+
+static std::vector<Scene> create_scenes_from_json(const json::Value &value, GLTFAsset &asset)
 {
+    std::vector<Scene> scenes(value.Size());
+    for (unsigned i = 0; i < value.Size(); ++i) {
+        if (value[i].HasMember("name")) {
+            scenes[i].name = create_string_from_json(value[i]["name"], asset);
+        }
+        if (value[i].HasMember("nodes")) {
+            scenes[i].nodes = create_node_indices_from_json(value[i]["nodes"], asset);
+        }
+    }
+    return scenes;
+}
+
+static std::vector<Node> create_nodes_from_json(const json::Value &value, GLTFAsset &asset)
+{
+    // Size the flat arrays up front, as large scenes have millions of nodes
+    size_t numChildren = 0, numChars = 0;
+    for (unsigned i = 0; i < value.Size(); ++i) {
+        if (value[i].HasMember("children")) numChildren += value[i]["children"].Size();
+        if (value[i].HasMember("name")) numChars += value[i]["name"].GetStringLength() + 1;
+    }
+    asset.nodeIndices.reserve(asset.nodeIndices.size() + numChildren);
+    asset.strings.reserve(asset.strings.size() + numChars + 1);
+
     std::vector<Node> nodes(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
         nodes[i].mesh = value[i]["mesh"].GetInt();
 
         if (value[i].HasMember("name")) {
             // Note: this attribute seems to be optional
-            nodes[i].name = value[i]["name"].GetString();
+            nodes[i].name = create_string_from_json(value[i]["name"], asset);
         }
 
         if (value[i].HasMember("children")) {
-            const json::Value &tmp = value[i]["children"];
-            nodes[i].children.resize(tmp.Size());
-            for (unsigned j = 0; j < tmp.Size(); ++j) {
-                nodes[i].children[j] = float(tmp[j].GetInt());
-            }
+            nodes[i].children = create_node_indices_from_json(value[i]["children"], asset);
         }
 
         if (value[i].HasMember("translation")) {
@@ -101,16 +177,16 @@ static std::vector<Node> create_nodes_from_json(const json::Value &value)
             nodes[i].scale = glm::vec3(1.0f);
         }
 
-        nodes[i].hasMatrix = false;
+        nodes[i].matrix = -1;
         if (value[i].HasMember("matrix")) {
             const json::Value &tmp = value[i]["matrix"];
-            for (unsigned j = 0; j < tmp.Size(); ++j) {
+            glm::mat4 matrix(1.0f);
+            for (unsigned j = 0; j < tmp.Size() && j < 16; ++j) {
                 // Note: matrix is stored in column major array order
-                nodes[i].matrix[j / 4][j % 4] = float(tmp[j].GetDouble());
+                matrix[j / 4][j % 4] = float(tmp[j].GetDouble());
             }
-            nodes[i].hasMatrix = true;
-        } else {
-            nodes[i].matrix = glm::mat4(1.0f);
+            nodes[i].matrix = int(asset.matrices.size());
+            asset.matrices.push_back(matrix);
         }
     }
     return nodes;
@@ -184,11 +260,12 @@ static PBRMetallicRoughness create_pbr_metallic_roughness_from_json(const json::
     return pbrMetallicRoughness;
 }
 
-static std::vector<Material> create_materials_from_json(const json::Value &value)
+static std::vector<Material> create_materials_from_json(const json::Value &value,
+                                                        GLTFAsset &asset)
 {
     std::vector<Material> materials(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
-        materials[i].name = value[i]["name"].GetString();
+        materials[i].name = create_string_from_json(value[i]["name"], asset);
         materials[i].type = DEFAULT_MATERIAL;
 
         if (value[i].HasMember("pbrMetallicRoughness")) {
@@ -209,9 +286,9 @@ static std::vector<Material> create_materials_from_json(const json::Value &value
         if (value[i].HasMember("occlusionTexture")) {
             auto materialTexture = create_material_texture_from_json(value[i]["occlusionTexture"]);
             materials[i].occlusionTexture = materialTexture;
-            materials[i].hasNormalTexture = true;
+            materials[i].hasOcclusionTexture = true;
         } else {
-            materials[i].hasNormalTexture = false;
+            materials[i].hasOcclusionTexture = false;
         }
     }
     return materials;
@@ -238,6 +315,10 @@ static std::vector<Image> create_images_from_json(const json::Value &value)
     std::vector<Image> images(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
         if (value[i].HasMember("uri")) { images[i].uri = value[i]["uri"].GetString(); }
+        if (value[i].HasMember("bufferView")) {
+            images[i].bufferView = value[i]["bufferView"].GetInt();
+            images[i].mimeType = value[i]["mimeType"].GetString();
+        }
     }
     return images;
 }
@@ -273,64 +354,126 @@ static std::vector<Sampler> create_samplers_from_json(const json::Value &value)
     return samplers;
 }
 
-static std::vector<Primitive> create_primitives_from_json(const json::Value &value)
+// Names of attributes, which most primitives share, are only stored once
+typedef std::unordered_map<std::string, StringRef> AttributeNames;
+
+static Span create_primitives_from_json(const json::Value &value, GLTFAsset &asset,
+                                        AttributeNames &attributeNames)
 {
-    std::vector<Primitive> primitives(value.Size());
+    Span span;
+    span.offset = uint32_t(asset.primitives.size());
+    span.count = value.Size();
+    asset.primitives.resize(asset.primitives.size() + value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
+        Primitive &primitive = asset.primitives[span.offset + i];
+        primitive.attributes.offset = uint32_t(asset.attributes.size());
         for (const auto &it : value[i]["attributes"].GetObject()) {
-            Attribute attribute = {it.name.GetString(), it.value.GetInt()};
-            primitives[i].attributes.push_back(attribute);
+            std::string name(it.name.GetString(), it.name.GetStringLength());
+            auto found = attributeNames.find(name);
+            if (found == attributeNames.end())
+                found = attributeNames.insert({name, add_string(asset, name)}).first;
+            Attribute attribute = {parse_attribute_semantic(name.c_str()), found->second,
+                                   it.value.GetInt()};
+            asset.attributes.push_back(attribute);
+            primitive.attributes.count++;
         }
-        primitives[i].indices = value[i]["indices"].GetInt();
+        primitive.indices = value[i]["indices"].GetInt();
 
         if (value[i].HasMember("material")) {
-            primitives[i].material = value[i]["material"].GetInt();
-            primitives[i].hasMaterial = true;
+            primitive.material = value[i]["material"].GetInt();
+            primitive.hasMaterial = true;
         } else {
-            primitives[i].hasMaterial = false;
+            primitive.hasMaterial = false;
         }
     }
-    return primitives;
+    return span;
 }
 
-static std::vector<Mesh> create_meshes_from_json(const json::Value &value)
+static std::vector<Mesh> create_meshes_from_json(const json::Value &value, GLTFAsset &asset)
 {
+    AttributeNames attributeNames;
     std::vector<Mesh> meshes(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
-        meshes[i].name = value[i]["name"].GetString();
+        meshes[i].name = create_string_from_json(value[i]["name"], asset);
         if (value[i].HasMember("primitives")) {
-            auto primitives = create_primitives_from_json(value[i]["primitives"]);
-            meshes[i].primitives = primitives;
+            meshes[i].primitives =
+                create_primitives_from_json(value[i]["primitives"], asset, attributeNames);
         }
     }
     return meshes;
 }
 
-static std::vector<Accessor> create_accessors_from_json(const json::Value &value)
+// Reads a size or offset, which must be a non-negative integer that fits in
+// 64 bits (0 if it is missing). Other values are reported as errors, rather
+// than wrapped around or truncated.
+static bool parse_size(const json::Value &object, const char *key, const char *kind,
+                       unsigned index, int64_t &size)
+{
+    size = 0;
+    if (!object.HasMember(key)) return true;
+    const json::Value &value = object[key];
+    if (!value.IsInt64() || value.GetInt64() < 0) {
+        std::cerr << "Error: Invalid " << key << " of " << kind << " " << index << std::endl;
+        return false;
+    }
+    size = value.GetInt64();
+    return true;
+}
+
+// Reads the min and max of a VEC3 accessor, if the file has them (as it must
+// for POSITION accessors)
+static int create_bounds_from_json(const json::Value &value, GLTFAsset &asset)
 {
-    std::vector<Accessor> accessors(value.Size());
+    if (!value.HasMember("min") || !value.HasMember("max")) return -1;
+    const json::Value &min = value["min"], &max = value["max"];
+    if (!min.IsArray() || !max.IsArray() || min.Size() != 3 || max.Size() != 3) return -1;
+    Bounds bounds;
+    for (unsigned i = 0; i < 3; ++i) {
+        if (!min[i].IsNumber() || !max[i].IsNumber()) return -1;
+        bounds.min[i] = min[i].GetFloat();
+        bounds.max[i] = max[i].GetFloat();
+    }
+    asset.bounds.push_back(bounds);
+    return int(asset.bounds.size()) - 1;
+}
+
+static bool create_accessors_from_json(const json::Value &value, GLTFAsset &asset)
+{
+    std::vector<Accessor> &accessors = asset.accessors;
+    accessors.resize(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
         accessors[i].bufferView = value[i]["bufferView"].GetInt();
         accessors[i].componentType = value[i]["componentType"].GetInt();
-        accessors[i].count = value[i]["count"].GetInt();
-        accessors[i].type = value[i]["type"].GetString();
+        accessors[i].type = parse_accessor_type(value[i]["type"].GetString());
+        accessors[i].normalized = false;
+        if (value[i].HasMember("normalized")) {
+            accessors[i].normalized = value[i]["normalized"].GetBool();
+        }
+        if (!parse_size(value[i], "count", "accessor", i, accessors[i].count) ||
+            !parse_size(value[i], "byteOffset", "accessor", i, accessors[i].byteOffset))
+            return false;
 
-        if (value[i].HasMember("byteOffset")) {
-            accessors[i].byteOffset = value[i]["byteOffset"].GetInt();
-        } else {
-            accessors[i].byteOffset = 0;
+        accessors[i].bounds = -1;
+        if (accessors[i].type == ACCESSOR_VEC3) {
+            accessors[i].bounds = create_bounds_from_json(value[i], asset);
         }
     }
-    return accessors;
+    return true;
 }
 
-static std::vector<BufferView> create_buffer_views_from_json(const json::Value &value)
+static bool create_buffer_views_from_json(const json::Value &value,
+                                          std::vector<BufferView> &bufferViews)
 {
-    std::vector<BufferView> bufferViews(value.Size());
+    bufferViews.resize(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
         bufferViews[i].buffer = value[i]["buffer"].GetInt();
-        bufferViews[i].byteLength = value[i]["byteLength"].GetInt();
-        bufferViews[i].byteOffset = value[i]["byteOffset"].GetInt();
+        if (!parse_size(value[i], "byteLength", "buffer view", i, bufferViews[i].byteLength) ||
+            !parse_size(value[i], "byteOffset", "buffer view", i, bufferViews[i].byteOffset))
+            return false;
+        if (bufferViews[i].byteLength > INT64_MAX - bufferViews[i].byteOffset) {
+            std::cerr << "Error: Buffer view " << i << " ends beyond 64 bits" << std::endl;
+            return false;
+        }
 
         if (value[i].HasMember("byteStride")) {
             bufferViews[i].byteStride = value[i]["byteStride"].GetInt();
@@ -338,39 +481,48 @@ static std::vector<BufferView> create_buffer_views_from_json(const json::Value &
             bufferViews[i].byteStride = 0;
         }
     }
-    return bufferViews;
+    return true;
 }
 
-static std::vector<Buffer> create_buffers_from_json(const json::Value &value)
+static bool create_buffers_from_json(const json::Value &value, std::vector<Buffer> &buffers)
 {
-    std::vector<Buffer> buffers(value.Size());
+    buffers.resize(value.Size());
     for (unsigned i = 0; i < value.Size(); ++i) {
-        buffers[i].byteLength = value[i]["byteLength"].GetInt();
-        buffers[i].uri = value[i]["uri"].GetString();
+        if (!parse_size(value[i], "byteLength", "buffer", i, buffers[i].byteLength)) return false;
+        if (value[i].HasMember("uri")) {
+            buffers[i].uri = value[i]["uri"].GetString();
+        }  // Else the BIN chunk of a .glb file
     }
-    return buffers;
+    return true;
 }
 
-bool load_gltf_asset(const std::string &filename, const std::string &filedir, GLTFAsset &asset)
+bool create_gltf_asset_from_json(const char *text, size_t length, GLTFAsset &asset)
 {
     json::Document root;
-    std::vector<char> buffer;
-    if (!load_file_to_bytebuffer(filedir + filename, buffer)) {
-        std::cerr << "Error: Could not open " << filename << std::endl;
+    root.Parse(text, length);
+    if (root.HasParseError() || !root.IsObject()) {
+        std::cerr << "Error: Invalid glTF JSON at offset " << root.GetErrorOffset() << ": "
+                  << json::GetParseError_En(root.GetParseError()) << std::endl;
         return false;
     }
-    root.Parse(&buffer[0]);
 
     asset = GLTFAsset();
+    add_string(asset, "", 0);
 
     if (root.HasMember("nodes")) {
-        auto nodes = create_nodes_from_json(root["nodes"]);
-        asset.nodes = nodes;
+        asset.nodes = create_nodes_from_json(root["nodes"], asset);
+    }
+
+    if (root.HasMember("scenes")) {
+        asset.scenes = create_scenes_from_json(root["scenes"], asset);
+    }
+
+    if (root.HasMember("scene")) {
+        asset.scene = root["scene"].GetInt();
     }
 
     if (root.HasMember("materials")) {
-        auto materials = create_materials_from_json(root["materials"]);
-        asset.materials = materials;
+        asset.materials = create_materials_from_json(root["materials"], asset);
     }
 
     if (root.HasMember("textures")) {
@@ -380,11 +532,6 @@ bool load_gltf_asset(const std::string &filename, const std::string &filedir, GL
 
     if (root.HasMember("images")) {
         auto images = create_images_from_json(root["images"]);
-        // Now also load the actual image data (from image files)
-        for (unsigned i = 0; i < images.size(); ++i) {
-            load_image_to_bytebuffer(filedir + images[i].uri, images[i].data, images[i].width,
-                                     images[i].height);
-        }
         asset.images = images;
     }
 
@@ -394,30 +541,490 @@ bool load_gltf_asset(const std::string &filename, const std::string &filedir, GL
     }
 
     if (root.HasMember("meshes")) {
-        auto meshes = create_meshes_from_json(root["meshes"]);
-        asset.meshes = meshes;
+        asset.meshes = create_meshes_from_json(root["meshes"], asset);
+    }
+
+    if (root.HasMember("accessors") && !create_accessors_from_json(root["accessors"], asset)) {
+        return false;
+    }
+
+    if (root.HasMember("bufferViews") &&
+        !create_buffer_views_from_json(root["bufferViews"], asset.bufferViews)) {
+        return false;
+    }
+
+    if (root.HasMember("buffers") && !create_buffers_from_json(root["buffers"], asset.buffers)) {
+        return false;
+    }
+
+    return true;
+}
+
+static uint32_t read_u32(const char *data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, 4);  // Little endian, as are all supported platforms
+    return value;
+}
+
+bool create_gltf_asset_from_glb(const char *data, size_t length, GLTFAsset &asset)
+{
+    // A 12-byte header (magic, version and length) and then chunks, each with
+    // its length and type: JSON first, and an optional BIN chunk
+    if (length < 20 || read_u32(data) != GLB_MAGIC || read_u32(data + 4) != 2 ||
+        read_u32(data + 8) > length) {
+        std::cerr << "Error: Invalid or unsupported .glb header" << std::endl;
+        return false;
+    }
+    length = read_u32(data + 8);
+    size_t jsonLength = read_u32(data + 12);
+    if (read_u32(data + 16) != GLB_CHUNK_JSON || jsonLength > length - 20) {
+        std::cerr << "Error: Missing JSON chunk in .glb file" << std::endl;
+        return false;
+    }
+    if (!create_gltf_asset_from_json(data + 20, jsonLength, asset)) return false;
+
+    size_t offset = 20 + jsonLength;
+    if (offset + 8 <= length && read_u32(data + offset + 4) == GLB_CHUNK_BIN) {
+        size_t binLength = read_u32(data + offset);
+        if (binLength > length - offset - 8 || asset.buffers.empty() ||
+            !asset.buffers[0].uri.empty()) {
+            std::cerr << "Error: Invalid BIN chunk in .glb file" << std::endl;
+            return false;
+        }
+        asset.buffers[0].data.assign(data + offset + 8, data + offset + 8 + binLength);
+    }
+    return true;
+}
+
+bool load_gltf_buffers(const std::string &filedir, GLTFAsset &asset)
+{
+    // Load the actual buffer data (from .bin files). Buffers without a uri
+    // are the BIN chunks of .glb files, which are already loaded.
+    bool ok = true;
+    for (unsigned i = 0; i < asset.buffers.size(); ++i) {
+        if (asset.buffers[i].uri.empty()) continue;
+        ok &= load_file_to_bytebuffer(filedir + asset.buffers[i].uri, asset.buffers[i].data);
+    }
+    return ok;
+}
+
+bool load_gltf_images(const std::string &filedir, GLTFAsset &asset)
+{
+    // Load the actual image data (from image files, or from buffer views for
+    // embedded images, which requires the buffers to be loaded first)
+    bool ok = true;
+    for (unsigned i = 0; i < asset.images.size(); ++i) {
+        Image &image = asset.images[i];
+        if (image.bufferView < 0) {
+            ok &= load_gltf_image(filedir, image);
+            continue;
+        }
+        const BufferView *view = image.bufferView < int(asset.bufferViews.size())
+                                     ? &asset.bufferViews[image.bufferView]
+                                     : nullptr;
+        if (!view || view->buffer >= int(asset.buffers.size()) ||
+            size_t(view->byteOffset) + view->byteLength > asset.buffers[view->buffer].data.size()) {
+            std::cerr << "Error: Invalid buffer view of embedded image " << i << std::endl;
+            ok = false;
+            continue;
+        }
+        const char *data = asset.buffers[view->buffer].data.data() + view->byteOffset;
+        ok &= decode_image_to_bytebuffer(data, view->byteLength, image.data, image.width,
+                                         image.height);
     }
+    return ok;
+}
+
+bool load_gltf_image(const std::string &filedir, Image &image)
+{
+    return load_image_to_bytebuffer(filedir + image.uri, image.data, image.width, image.height);
+}
+
+bool decode_gltf_image(const char *data, size_t size, Image &image)
+{
+    return decode_image_to_bytebuffer(data, size, image.data, image.width, image.height);
+}
+
+typedef json::Writer<json::StringBuffer> JSONWriter;
+
+static void write_floats_to_json(JSONWriter &writer, const char *key, const float *values,
+                                 int count)
+{
+    writer.Key(key);
+    writer.StartArray();
+    for (int i = 0; i < count; ++i) writer.Double(values[i]);
+    writer.EndArray();
+}
+
+static void write_material_texture_to_json(JSONWriter &writer, const char *key,
+                                           const MaterialTexture &texture, const char *factor,
+                                           float value)
+{
+    writer.Key(key);
+    writer.StartObject();
+    writer.Key("index"), writer.Int(texture.index);
+    if (texture.texCoord) writer.Key("texCoord"), writer.Int(texture.texCoord);
+    if (factor) writer.Key(factor), writer.Double(value);
+    writer.EndObject();
+}
 
-    if (root.HasMember("accessors")) {
-        auto accessors = create_accessors_from_json(root["accessors"]);
-        asset.accessors = accessors;
+static void write_nodes_to_json(JSONWriter &writer, const GLTFAsset &asset)
+{
+    writer.Key("nodes");
+    writer.StartArray();
+    for (const Node &node : asset.nodes) {
+        writer.StartObject();
+        if (node.name.offset) writer.Key("name"), writer.String(get_string(asset, node.name));
+        if (node.mesh >= 0) writer.Key("mesh"), writer.Int(node.mesh);
+        if (node.children.count) {
+            writer.Key("children");
+            writer.StartArray();
+            for (int child : get_node_children(asset, node)) writer.Int(child);
+            writer.EndArray();
+        }
+        if (node.matrix >= 0) {
+            write_floats_to_json(writer, "matrix", &asset.matrices[node.matrix][0][0], 16);
+        } else {
+            if (node.translation != glm::vec3(0.0f))
+                write_floats_to_json(writer, "translation", &node.translation[0], 3);
+            if (node.rotation != glm::quat(1.0f, 0.0f, 0.0f, 0.0f))
+                write_floats_to_json(writer, "rotation", &node.rotation[0], 4);  // x, y, z, w
+            if (node.scale != glm::vec3(1.0f))
+                write_floats_to_json(writer, "scale", &node.scale[0], 3);
+        }
+        writer.EndObject();
     }
+    writer.EndArray();
+}
 
-    if (root.HasMember("bufferViews")) {
-        auto bufferViews = create_buffer_views_from_json(root["bufferViews"]);
-        asset.bufferViews = bufferViews;
+static void write_materials_to_json(JSONWriter &writer, const GLTFAsset &asset)
+{
+    writer.Key("materials");
+    writer.StartArray();
+    for (const Material &material : asset.materials) {
+        writer.StartObject();
+        writer.Key("name"), writer.String(get_string(asset, material.name));
+        if (material.type == PBR_METALLIC_ROUGHNESS) {
+            const PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+            writer.Key("pbrMetallicRoughness");
+            writer.StartObject();
+            write_floats_to_json(writer, "baseColorFactor", &pbr.baseColorFactor[0], 4);
+            writer.Key("metallicFactor"), writer.Double(pbr.metallicFactor);
+            writer.Key("roughnessFactor"), writer.Double(pbr.roughnessFactor);
+            if (pbr.hasBaseColorTexture) {
+                write_material_texture_to_json(writer, "baseColorTexture", pbr.baseColorTexture,
+                                               nullptr, 0.0f);
+            }
+            if (pbr.hasMetallicRoughnessTexture) {
+                write_material_texture_to_json(writer, "metallicRoughnessTexture",
+                                               pbr.metallicRoughnessTexture, nullptr, 0.0f);
+            }
+            writer.EndObject();
+        }
+        if (material.hasNormalTexture) {
+            write_material_texture_to_json(writer, "normalTexture", material.normalTexture, "scale",
+                                           material.normalTexture.scale);
+        }
+        if (material.hasOcclusionTexture) {
+            write_material_texture_to_json(writer, "occlusionTexture", material.occlusionTexture,
+                                           "strength", material.occlusionTexture.strength);
+        }
+        writer.EndObject();
     }
+    writer.EndArray();
+}
 
-    if (root.HasMember("buffers")) {
-        auto buffers = create_buffers_from_json(root["buffers"]);
-        // Now also load the actual buffer data (from .bin files)
-        for (unsigned i = 0; i < buffers.size(); ++i) {
-            load_file_to_bytebuffer(filedir + buffers[i].uri, buffers[i].data);
+static void write_meshes_to_json(JSONWriter &writer, const GLTFAsset &asset)
+{
+    writer.Key("meshes");
+    writer.StartArray();
+    for (const Mesh &mesh : asset.meshes) {
+        writer.StartObject();
+        writer.Key("name"), writer.String(get_string(asset, mesh.name));
+        writer.Key("primitives");
+        writer.StartArray();
+        for (const Primitive &primitive : get_mesh_primitives(asset, mesh)) {
+            writer.StartObject();
+            writer.Key("attributes");
+            writer.StartObject();
+            for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+                writer.Key(get_string(asset, attribute.name)), writer.Int(attribute.index);
+            }
+            writer.EndObject();
+            writer.Key("indices"), writer.Int(primitive.indices);
+            if (primitive.hasMaterial) writer.Key("material"), writer.Int(primitive.material);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void write_accessors_to_json(JSONWriter &writer, const GLTFAsset &asset)
+{
+    // POSITION accessors must have bounds
+    std::vector<bool> positions(asset.accessors.size(), false);
+    for (const Attribute &attribute : asset.attributes) {
+        if (attribute.semantic == ATTRIBUTE_POSITION && attribute.index >= 0 &&
+            attribute.index < int(asset.accessors.size()))
+            positions[attribute.index] = true;
+    }
+
+    writer.Key("accessors");
+    writer.StartArray();
+    for (size_t i = 0; i < asset.accessors.size(); ++i) {
+        const Accessor &accessor = asset.accessors[i];
+        writer.StartObject();
+        writer.Key("bufferView"), writer.Int(accessor.bufferView);
+        if (accessor.byteOffset) writer.Key("byteOffset"), writer.Int64(accessor.byteOffset);
+        writer.Key("componentType"), writer.Int(accessor.componentType);
+        writer.Key("count"), writer.Int64(accessor.count);
+        writer.Key("type"), writer.String(accessor_type_name(accessor.type));
+        if (accessor.normalized) writer.Key("normalized"), writer.Bool(true);
+        if (positions[i] && accessor.type == ACCESSOR_VEC3 && accessor.componentType == 5126 &&
+            accessor_in_bounds(asset, int(i))) {
+            glm::vec3 min(0.0f), max(0.0f);
+            int stride;
+            const char *data = get_accessor_data(asset, accessor, 12, stride);
+            for (int64_t j = 0; j < accessor.count; ++j) {
+                glm::vec3 p;
+                std::memcpy(&p, data + size_t(j) * stride, sizeof(p));
+                min = j ? glm::min(min, p) : p;
+                max = j ? glm::max(max, p) : p;
+            }
+            write_floats_to_json(writer, "min", &min[0], 3);
+            write_floats_to_json(writer, "max", &max[0], 3);
+        }
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void write_gltf_asset_to_json(JSONWriter &writer, const GLTFAsset &asset)
+{
+    writer.StartObject();
+    writer.Key("asset");
+    writer.StartObject();
+    writer.Key("version"), writer.String("2.0");
+    writer.Key("generator"), writer.String("model_viewer");
+    writer.EndObject();
+
+    if (!asset.scenes.empty()) {
+        writer.Key("scene"), writer.Int(asset.scene >= 0 ? asset.scene : 0);
+        writer.Key("scenes");
+        writer.StartArray();
+        for (const Scene &scene : asset.scenes) {
+            writer.StartObject();
+            if (scene.name.offset) writer.Key("name"), writer.String(get_string(asset, scene.name));
+            writer.Key("nodes");
+            writer.StartArray();
+            for (int node : get_scene_nodes(asset, scene)) writer.Int(node);
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+    write_nodes_to_json(writer, asset);
+    write_meshes_to_json(writer, asset);
+    write_materials_to_json(writer, asset);
+
+    writer.Key("textures");
+    writer.StartArray();
+    for (const Texture &texture : asset.textures) {
+        writer.StartObject();
+        writer.Key("source"), writer.Int(texture.source);
+        if (texture.hasSampler) writer.Key("sampler"), writer.Int(texture.sampler);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("images");
+    writer.StartArray();
+    for (const Image &image : asset.images) {
+        writer.StartObject();
+        if (image.bufferView >= 0) {
+            writer.Key("bufferView"), writer.Int(image.bufferView);
+            writer.Key("mimeType"), writer.String(image.mimeType.c_str());
+        } else {
+            writer.Key("uri"), writer.String(image.uri.c_str());
         }
-        asset.buffers = buffers;
+        writer.EndObject();
     }
+    writer.EndArray();
 
+    writer.Key("samplers");
+    writer.StartArray();
+    for (const Sampler &sampler : asset.samplers) {
+        writer.StartObject();
+        writer.Key("magFilter"), writer.Int(sampler.magFilter);
+        writer.Key("minFilter"), writer.Int(sampler.minFilter);
+        writer.Key("wrapS"), writer.Int(sampler.wrapS);
+        writer.Key("wrapT"), writer.Int(sampler.wrapT);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    write_accessors_to_json(writer, asset);
+
+    writer.Key("bufferViews");
+    writer.StartArray();
+    for (const BufferView &view : asset.bufferViews) {
+        writer.StartObject();
+        writer.Key("buffer"), writer.Int(view.buffer);
+        writer.Key("byteOffset"), writer.Int64(view.byteOffset);
+        writer.Key("byteLength"), writer.Int64(view.byteLength);
+        if (view.byteStride) writer.Key("byteStride"), writer.Int(view.byteStride);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("buffers");
+    writer.StartArray();
+    for (const Buffer &buffer : asset.buffers) {
+        writer.StartObject();
+        writer.Key("byteLength"), writer.Uint64(buffer.data.size());
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+bool write_glb_asset(const std::string &filename, const GLTFAsset &asset)
+{
+    if (asset.buffers.size() > 1) {
+        std::cerr << "Error: " << filename << " can only have one buffer" << std::endl;
+        return false;
+    }
+    json::StringBuffer text;
+    JSONWriter writer(text);
+    write_gltf_asset_to_json(writer, asset);
+
+    // Chunks are padded to multiples of 4 bytes: JSON with spaces, BIN with zeros
+    std::vector<char> jsonChunk(text.GetString(), text.GetString() + text.GetSize());
+    jsonChunk.resize((jsonChunk.size() + 3) & ~size_t(3), ' ');
+    std::vector<char> binChunk;
+    if (!asset.buffers.empty()) binChunk = asset.buffers[0].data;
+    binChunk.resize((binChunk.size() + 3) & ~size_t(3), '\0');
+
+    size_t length = 12 + 8 + jsonChunk.size() + (asset.buffers.empty() ? 0 : 8 + binChunk.size());
+    if (length > UINT32_MAX) {
+        std::cerr << "Error: " << filename << " is too large for a .glb file" << std::endl;
+        return false;
+    }
+    uint32_t header[5] = {GLB_MAGIC, 2, uint32_t(length), uint32_t(jsonChunk.size()),
+                          GLB_CHUNK_JSON};
+    uint32_t binHeader[2] = {uint32_t(binChunk.size()), GLB_CHUNK_BIN};
+
+    FILE *stream = std::fopen(filename.c_str(), "wb");
+    if (!stream) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    std::fwrite(header, sizeof(header), 1, stream);
+    std::fwrite(jsonChunk.data(), 1, jsonChunk.size(), stream);
+    if (!asset.buffers.empty()) {
+        std::fwrite(binHeader, sizeof(binHeader), 1, stream);
+        std::fwrite(binChunk.data(), 1, binChunk.size(), stream);
+    }
+    bool ok = !std::ferror(stream);
+    ok &= std::fclose(stream) == 0;
+    if (!ok) std::cerr << "Error: Could not write " << filename << std::endl;
+    return ok;
+}
+
+// Same as create_gltf_asset_from_glb(), but reads the BIN chunk from the file
+// straight into the buffer, instead of copying it from the file contents. If
+// binOffset is given, the BIN chunk is not read, and the offset of its data in
+// the file is returned instead (0 if there is none).
+static bool load_glb_file(FILE *stream, GLTFAsset &asset, size_t *binOffset = nullptr)
+{
+    char header[20];
+    if (std::fread(header, 1, 20, stream) != 20 || read_u32(header + 4) != 2 ||
+        read_u32(header + 16) != GLB_CHUNK_JSON) {
+        std::cerr << "Error: Invalid or unsupported .glb header" << std::endl;
+        return false;
+    }
+    size_t length = read_u32(header + 8), jsonLength = read_u32(header + 12);
+    std::vector<char> json(jsonLength);
+    if (jsonLength > length - 20 || std::fread(json.data(), 1, jsonLength, stream) != jsonLength) {
+        std::cerr << "Error: Missing JSON chunk in .glb file" << std::endl;
+        return false;
+    }
+    if (!create_gltf_asset_from_json(json.data(), json.size(), asset)) return false;
+
+    char binHeader[8];
+    size_t offset = 20 + jsonLength;
+    if (binOffset) *binOffset = 0;
+    if (offset + 8 > length || std::fread(binHeader, 1, 8, stream) != 8 ||
+        read_u32(binHeader + 4) != GLB_CHUNK_BIN) {
+        return true;
+    }
+    size_t binLength = read_u32(binHeader);
+    if (binLength > length - offset - 8 || asset.buffers.empty() || !asset.buffers[0].uri.empty()) {
+        std::cerr << "Error: Invalid BIN chunk in .glb file" << std::endl;
+        return false;
+    }
+    if (binOffset) {
+        *binOffset = offset + 8;
+        return true;
+    }
+    std::vector<char> &data = asset.buffers[0].data;
+    data.resize(binLength);
+    if (std::fread(data.data(), 1, binLength, stream) != binLength) {
+        std::cerr << "Error: Truncated BIN chunk in .glb file" << std::endl;
+        return false;
+    }
     return true;
 }
 
+bool load_gltf_description(const std::string &filename, const std::string &filedir,
+                           GLTFAsset &asset, size_t &binOffset)
+{
+    binOffset = 0;
+    FILE *stream = std::fopen((filedir + filename).c_str(), "rb");
+    char magic[4];
+    bool glb = stream && std::fread(magic, 1, 4, stream) == 4 && read_u32(magic) == GLB_MAGIC;
+    if (glb) {
+        std::rewind(stream);
+        bool ok = load_glb_file(stream, asset, &binOffset);
+        std::fclose(stream);
+        return ok;
+    }
+    if (stream) std::fclose(stream);
+    std::vector<char> buffer;
+    if (!load_file_to_bytebuffer(filedir + filename, buffer)) {
+        std::cerr << "Error: Could not open " << filename << std::endl;
+        return false;
+    }
+    return create_gltf_asset_from_json(buffer.data(), buffer.size(), asset);
+}
+
+bool load_gltf_asset(const std::string &filename, const std::string &filedir, GLTFAsset &asset)
+{
+    FILE *stream = std::fopen((filedir + filename).c_str(), "rb");
+    char magic[4];
+    bool glb = stream && std::fread(magic, 1, 4, stream) == 4 && read_u32(magic) == GLB_MAGIC;
+    if (glb) {
+        std::rewind(stream);
+        bool ok = load_glb_file(stream, asset);
+        std::fclose(stream);
+        if (!ok) return false;
+    } else {
+        if (stream) std::fclose(stream);
+        std::vector<char> buffer;
+        if (!load_file_to_bytebuffer(filedir + filename, buffer)) {
+            std::cerr << "Error: Could not open " << filename << std::endl;
+            return false;
+        }
+        if (!create_gltf_asset_from_json(buffer.data(), buffer.size(), asset)) return false;
+    }
+
+    // Missing images are reported, but the asset can still be drawn without them
+    bool ok = load_gltf_buffers(filedir, asset);
+    load_gltf_images(filedir, asset);
+    return ok;
+}
+
 }  // namespace gltf
@@ -7,10 +7,56 @@
 
 #include "gltf_scene.h"
 
+#include <cstdio>
 #include <string>
+#include <vector>
 
 namespace gltf {
 
+// Magic number and chunk types of binary glTF (.glb) files
+const uint32_t GLB_MAGIC = 0x46546c67;       // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4e4f534a;  // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004e4942;   // "BIN\0"
+
+// Loads a .gltf or .glb file (detected from its contents) with its buffers
+// and images
 bool load_gltf_asset(const std::string &filename, const std::string &filedir, GLTFAsset &asset);
 
+// The stages of load_gltf_asset(), exposed for benchmarks. The scene
+// description is created from the JSON text first, then the buffers and
+// images it refers to are loaded from filedir.
+bool create_gltf_asset_from_json(const char *text, size_t length, GLTFAsset &asset);
+
+// Same as create_gltf_asset_from_json(), for the contents of a binary glTF
+// (.glb) file. The data of its BIN chunk is copied to the first buffer.
+bool create_gltf_asset_from_glb(const char *data, size_t length, GLTFAsset &asset);
+
+bool load_gltf_buffers(const std::string &filedir, GLTFAsset &asset);
+
+bool load_gltf_images(const std::string &filedir, GLTFAsset &asset);
+
+// Loads the pixels of one image (e.g. again, after its file has changed)
+bool load_gltf_image(const std::string &filedir, Image &image);
+
+// Decodes the pixels of an image file in memory (e.g. embedded in a buffer)
+bool decode_gltf_image(const char *data, size_t size, Image &image);
+
+// Loads only the scene description of a .gltf or .glb file, without the data
+// of its buffers and images. The BIN chunk of a .glb file is not read either:
+// binOffset is set to the offset of its data in the file (or 0).
+bool load_gltf_description(const std::string &filename, const std::string &filedir,
+                           GLTFAsset &asset, size_t &binOffset);
+
+// Writes an asset as a binary glTF (.glb) file, with its only buffer as the
+// BIN chunk (embedded images must be in that buffer too)
+bool write_glb_asset(const std::string &filename, const GLTFAsset &asset);
+
+// Reads a whole file
+bool load_file_to_bytebuffer(const std::string &filename, std::vector<char> &buffer);
+
+// Seeks and tells with 64-bit offsets (std::fseek() takes a long, which is 32
+// bits on Windows), for files larger than 2 GB
+bool seek_file(FILE *stream, int64_t offset, int origin = SEEK_SET);
+int64_t tell_file(FILE *stream);
+
 }  // namespace gltf
@@ -0,0 +1,212 @@
+// Levels of detail of glTF meshes, generated at load time.
+//
+
+#include "gltf_lod.h"
+#include "cg_parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace gltf {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef std::array<uint32_t, 3> Triangle;
+
+// The levels of one mesh, with offsets into its own indices
+struct MeshLevels {
+    std::vector<MeshLod> lods;
+    std::vector<char> indices;  // Padded to a multiple of four bytes per level
+    size_t triangles = 0;       // Of the full mesh
+};
+
+void write_index(char *data, int componentType, size_t i, uint32_t index)
+{
+    if (componentType == 5121 /*GL_UNSIGNED_BYTE*/) {
+        data[i] = char(uint8_t(index));
+    } else if (componentType == 5123 /*GL_UNSIGNED_SHORT*/) {
+        uint16_t value = uint16_t(index);
+        std::memcpy(data + i * 2, &value, sizeof(value));
+    } else {
+        std::memcpy(data + i * 4, &index, sizeof(index));
+    }
+}
+
+// Cluster the used vertices on a grid with the given cell size, and return
+// the triangles between different clusters, without repeats. The error is
+// the largest distance between a vertex and the vertex that replaces it.
+std::vector<Triangle> cluster_triangles(const std::vector<glm::vec3> &positions,
+                                        const std::vector<uint8_t> &used,
+                                        const std::vector<Triangle> &triangles,
+                                        const glm::vec3 &origin, float cellSize, float &error)
+{
+    const size_t count = positions.size();
+    std::unordered_map<uint64_t, uint32_t> cells;
+    std::vector<uint32_t> cluster(count, 0);
+    std::vector<glm::vec3> sums;
+    std::vector<uint32_t> sizes;
+    for (size_t i = 0; i < count; ++i) {
+        if (!used[i]) continue;
+        glm::vec3 cell = glm::floor((positions[i] - origin) / cellSize);
+        uint64_t key = uint64_t(cell.x) | (uint64_t(cell.y) << 21) | (uint64_t(cell.z) << 42);
+        auto it = cells.insert(std::make_pair(key, uint32_t(sums.size())));
+        if (it.second) {
+            sums.push_back(glm::vec3(0.0f));
+            sizes.push_back(0);
+        }
+        cluster[i] = it.first->second;
+        sums[cluster[i]] += positions[i];
+        sizes[cluster[i]]++;
+    }
+
+    // Each cell keeps the vertex nearest to the mean of its vertices
+    std::vector<uint32_t> kept(sums.size(), 0);
+    std::vector<float> nearest(sums.size(), INFINITY);
+    for (size_t i = 0; i < count; ++i) {
+        if (!used[i]) continue;
+        const uint32_t c = cluster[i];
+        glm::vec3 d = positions[i] - sums[c] / float(sizes[c]);
+        float distance = glm::dot(d, d);
+        if (distance < nearest[c]) nearest[c] = distance, kept[c] = uint32_t(i);
+    }
+    error = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        if (used[i]) error = std::max(error, glm::length(positions[i] - positions[kept[cluster[i]]]));
+    }
+
+    std::vector<Triangle> result;
+    for (const Triangle &t : triangles) {
+        Triangle r = {{kept[cluster[t[0]]], kept[cluster[t[1]]], kept[cluster[t[2]]]}};
+        if (r[0] == r[1] || r[1] == r[2] || r[0] == r[2]) continue;
+        // Smallest index first, which keeps the winding, so that repeats are equal
+        std::rotate(r.begin(), std::min_element(r.begin(), r.end()), r.end());
+        result.push_back(r);
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+MeshLevels simplify_mesh(const GLTFAsset &asset, const Mesh &mesh, const LodSettings &settings)
+{
+    MeshLevels levels;
+    if (mesh.primitives.count == 0) return levels;
+    const Primitive &primitive = get_mesh_primitives(asset, mesh)[0];
+    const Attribute *position = find_attribute(asset, primitive, ATTRIBUTE_POSITION);
+    if (!position || !accessor_in_bounds(asset, position->index) ||
+        !accessor_in_bounds(asset, primitive.indices))
+        return levels;
+    const Accessor &positions = asset.accessors[position->index];
+    const Accessor &indices = asset.accessors[primitive.indices];
+    if (positions.componentType != 5126 /*GL_FLOAT*/ || positions.type != ACCESSOR_VEC3)
+        return levels;
+
+    int positionStride, indexStride;
+    const char *positionData = get_accessor_data(asset, positions, 12, positionStride);
+    const char *indexData = get_accessor_data(asset, indices, 0, indexStride);
+    std::vector<glm::vec3> points(size_t(positions.count));
+    for (size_t i = 0; i < points.size(); ++i) {
+        std::memcpy(&points[i], positionData + i * positionStride, sizeof(glm::vec3));
+    }
+
+    // Triangles with indices out of range or vertices that are not finite
+    // are left out of all levels
+    std::vector<Triangle> triangles;
+    std::vector<uint8_t> used(points.size(), 0);
+    glm::vec3 min(INFINITY), max(-INFINITY);
+    for (int64_t i = 0; i + 2 < indices.count; i += 3) {
+        Triangle t;
+        bool valid = true;
+        for (int j = 0; j < 3; ++j) {
+            t[j] = read_index(indexData, indices.componentType, size_t(i + j));
+            valid = valid && t[j] < points.size() &&
+                    std::isfinite(points[t[j]].x + points[t[j]].y + points[t[j]].z);
+        }
+        if (!valid) continue;
+        for (int j = 0; j < 3; ++j) {
+            used[t[j]] = 1;
+            min = glm::min(min, points[t[j]]), max = glm::max(max, points[t[j]]);
+        }
+        triangles.push_back(t);
+    }
+    levels.triangles = triangles.size();
+    const glm::vec3 extent = max - min;
+    const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+    if (triangles.size() < settings.minTriangles || !(longest > 0.0f)) return levels;
+
+    const int maxLevels = std::min(settings.maxLevels, MAX_MESH_LODS);
+    const int indexSize = component_type_size(indices.componentType);
+    size_t previous = triangles.size();
+    for (int resolution = settings.gridResolution;
+         resolution >= 2 && int(levels.lods.size()) < maxLevels; resolution /= 2) {
+        float error;
+        std::vector<Triangle> simplified =
+            cluster_triangles(points, used, triangles, min, longest / resolution, error);
+        if (simplified.empty() || simplified.size() > size_t(INT_MAX / 3)) break;
+        if (simplified.size() > previous * settings.maxTriangleRatio) continue;
+
+        MeshLod lod;
+        lod.byteOffset = int64_t(levels.indices.size());
+        lod.indexCount = int(simplified.size() * 3);
+        lod.error = error;
+        levels.indices.resize(levels.indices.size() +
+                              ((size_t(lod.indexCount) * indexSize + 3) & ~size_t(3)));
+        char *data = &levels.indices[size_t(lod.byteOffset)];
+        for (size_t i = 0; i < simplified.size(); ++i) {
+            for (int j = 0; j < 3; ++j) write_index(data, indices.componentType, i * 3 + j, simplified[i][j]);
+        }
+        levels.lods.push_back(lod);
+        previous = simplified.size();
+    }
+    return levels;
+}
+
+}  // namespace
+
+bool generate_mesh_lods(GLTFAsset &asset, const LodSettings &settings, LodStats *stats)
+{
+    Clock::time_point start = Clock::now();
+    LodStats result;
+    asset.lods.clear();
+    asset.lodIndices.clear();
+    for (Mesh &mesh : asset.meshes) mesh.lods = Span();
+    if (!buffers_loaded(asset)) {
+        if (stats) *stats = result;
+        return false;
+    }
+
+    std::vector<MeshLevels> levels(asset.meshes.size());
+    const int threads = settings.threads > 0 ? settings.threads : cg::hardware_threads();
+    cg::parallel_for(threads, asset.meshes.size(), [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) levels[i] = simplify_mesh(asset, asset.meshes[i], settings);
+    });
+
+    // Each mesh's indices are a multiple of four bytes, so that all levels
+    // stay aligned to their index type
+    for (size_t i = 0; i < levels.size(); ++i) {
+        MeshLevels &mesh = levels[i];
+        if (mesh.lods.empty()) continue;
+        const int64_t base = int64_t(asset.lodIndices.size());
+        for (MeshLod &lod : mesh.lods) {
+            lod.byteOffset += base;
+            result.lodTriangles += size_t(lod.indexCount / 3);
+        }
+        asset.meshes[i].lods = add_span(asset.lods, mesh.lods.data(), mesh.lods.size());
+        asset.lodIndices.insert(asset.lodIndices.end(), mesh.indices.begin(), mesh.indices.end());
+        result.meshes++;
+        result.levels += int(mesh.lods.size());
+        result.triangles += mesh.triangles;
+    }
+    result.indexBytes = asset.lodIndices.size();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (stats) *stats = result;
+    return true;
+}
+
+}  // namespace gltf
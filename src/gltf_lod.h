@@ -0,0 +1,45 @@
+// Levels of detail of glTF meshes, generated at load time.
+//
+// generate_mesh_lods() simplifies the first primitive of each mesh by vertex
+// clustering (Rossignac and Borrel 1993): the vertices are snapped to a grid
+// over the bounds of the mesh, each cell keeps the vertex nearest to the mean
+// of its vertices, and the triangles are re-indexed to those, dropping the
+// ones that collapse or repeat. Each level has a grid of half the resolution
+// of the one before. The levels reuse the vertices of the mesh, so they only
+// add index data, which is uploaded into the vertex buffer after the asset's
+// data (see create_drawables_from_gltf_asset()) and drawn with the vertex
+// array of the mesh. Frame preparation picks the coarsest level whose error
+// projects to less than a given number of pixels (see gltf_frame_prep.h).
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+
+namespace gltf {
+
+struct LodSettings {
+    int maxLevels = 3;            // At most MAX_MESH_LODS
+    int gridResolution = 128;     // Cells along the longest side of the bounds, for the first level
+    float maxTriangleRatio = 0.5f;  // Of a level to the previous one, for it to be kept
+    size_t minTriangles = 256;    // Meshes with fewer triangles are not simplified
+    int threads = 0;              // 0 for all hardware threads
+};
+
+struct LodStats {
+    int meshes = 0;             // Meshes with at least one level
+    int levels = 0;
+    size_t triangles = 0;       // Of the full meshes that were simplified
+    size_t lodTriangles = 0;    // Of all their levels
+    size_t indexBytes = 0;
+    double seconds = 0.0;
+};
+
+// Replace the levels of detail of all meshes, as described above. Returns
+// false (and removes the levels) if the buffers are not loaded, e.g. because
+// they are streamed from files.
+bool generate_mesh_lods(GLTFAsset &asset, const LodSettings &settings, LodStats *stats = nullptr);
+
+}  // namespace gltf
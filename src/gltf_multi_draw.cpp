@@ -0,0 +1,67 @@
+// Submission of the draw packets of a frame with multi-draw-indirect.
+//
+
+#include "gltf_multi_draw.h"
+#include "cg_utils.h"
+
+namespace gltf {
+
+namespace {
+
+GLuint index_type_size(GLenum indexType)
+{
+    switch (indexType) {
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_UNSIGNED_SHORT: return 2;
+    default: return 4;
+    }
+}
+
+}  // namespace
+
+bool multi_draw_supported()
+{
+    return glMultiDrawElementsIndirect != nullptr &&
+           cg::has_gl_extension("GL_ARB_multi_draw_indirect") &&
+           cg::has_gl_extension("GL_ARB_shader_draw_parameters");
+}
+
+void multi_draw_build(MultiDrawList &list, const std::vector<DrawPacket> &packets,
+                      const DrawableList &drawables, int windowDraws)
+{
+    list.commands.resize(packets.size());
+    list.runs.clear();
+    for (size_t i = 0; i < packets.size(); ++i) {
+        const DrawPacket &packet = packets[i];
+        const Drawable &drawable = drawables[packet.mesh];
+        const IndexRange indices = get_drawable_indices(drawable, packet.lod);
+        DrawElementsIndirectCommand &command = list.commands[i];
+        command.count = GLuint(indices.count);
+        command.instanceCount = 1;
+        command.firstIndex = GLuint(indices.byteOffset / index_type_size(drawable.indexType));
+        command.baseVertex = drawable.baseVertex;
+        command.baseInstance = 0;
+
+        MultiDrawRun *run = list.runs.empty() ? nullptr : &list.runs.back();
+        if (!run || run->array != packet.array || run->vao != drawable.sharedVao ||
+            run->indexType != drawable.indexType || (windowDraws && i % size_t(windowDraws) == 0)) {
+            list.runs.push_back(MultiDrawRun());
+            run = &list.runs.back();
+            run->first = int(i);
+            run->array = packet.array;
+            run->vao = drawable.sharedVao;
+            run->indexType = drawable.indexType;
+        }
+        run->count++;
+        run->triangles += uint64_t(indices.count / 3);
+    }
+}
+
+void multi_draw_submit(const MultiDrawRun &run, GLintptr commandsOffset)
+{
+    const GLintptr offset =
+        commandsOffset + GLintptr(run.first) * GLintptr(sizeof(DrawElementsIndirectCommand));
+    glMultiDrawElementsIndirect(GL_TRIANGLES, run.indexType, (const GLvoid *)offset, run.count, 0);
+}
+
+}  // namespace gltf
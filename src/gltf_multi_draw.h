@@ -0,0 +1,66 @@
+// Submission of the draw packets of a frame with multi-draw-indirect.
+//
+// With ARB_multi_draw_indirect and ARB_shader_draw_parameters, the draw
+// packets of a frame are written as DrawElementsIndirectCommand records on
+// the CPU, and consecutive packets that can be drawn together (a run) are
+// issued with one glMultiDrawElementsIndirect call. The vertex shader finds
+// the per-draw data of each command by adding gl_DrawIDARB to the index of
+// the first draw of the run (u_drawIndex in mesh.vert). The per-draw data is
+// read from a buffer texture, as on the per-draw path, which remains the
+// fallback for plain OpenGL 3.3.
+//
+// Packets share a run if they use the same texture array, vertex array (see
+// Drawable::sharedVao) and index type. Draws are sorted by texture array and
+// mesh, so a pass usually takes one call per texture array and vertex
+// format.
+//
+
+#pragma once
+
+#include "gltf_frame_prep.h"
+#include "gltf_render.h"
+
+#include <GL/gl3w.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace gltf {
+
+// Layout of the commands that glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct MultiDrawRun {
+    int first = 0;  // Index of the first packet, and of its command
+    int count = 0;
+    int array = -1;  // Texture array of the packets, or -1
+    GLuint vao = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    uint64_t triangles = 0;
+};
+
+struct MultiDrawList {
+    std::vector<DrawElementsIndirectCommand> commands;  // One per packet, in the same order
+    std::vector<MultiDrawRun> runs;
+};
+
+// Returns true if the current context can submit multi-draws
+bool multi_draw_supported();
+
+// Write the commands and runs of the packets of a frame. Runs do not cross
+// multiples of windowDraws packets (e.g. the draws whose per-draw data is
+// readable at once), unless it is 0.
+void multi_draw_build(MultiDrawList &list, const std::vector<DrawPacket> &packets,
+                      const DrawableList &drawables, int windowDraws = 0);
+
+// Issue a run with the vertex array and textures of the run bound, and the
+// commands in the buffer bound to GL_DRAW_INDIRECT_BUFFER from commandsOffset
+void multi_draw_submit(const MultiDrawRun &run, GLintptr commandsOffset);
+
+}  // namespace gltf
@@ -0,0 +1,369 @@
+// Masked software occlusion culling for glTF nodes.
+//
+
+#include "gltf_occlusion.h"
+#include "cg_parallel.h"
+#include "cg_profiler.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace gltf {
+
+namespace {
+
+const int TILE_WIDTH = 8;
+const int TILE_HEIGHT = 4;
+const uint32_t FULL_MASK = 0xffffffffu;
+
+typedef std::chrono::steady_clock Clock;
+
+double milliseconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+struct OccluderTriangle {
+    float a[3], b[3], c[3];  // Edge functions, positive inside
+    float za, zb, zc;        // Plane equation of window-space depth
+    float zMin, zMax;
+    int x0, y0, x1, y1;      // Pixel bounding box (exclusive end)
+};
+
+size_t triangle_count(const GLTFAsset &asset, const Mesh &mesh)
+{
+    ArrayView<const Primitive> primitives = get_mesh_primitives(asset, mesh);
+    if (primitives.empty() || primitives[0].indices < 0) return 0;
+    return size_t(asset.accessors[primitives[0].indices].count / 3);
+}
+
+// Vertex in window coordinates, or with w = 0 if it is behind the near plane
+struct ScreenVertex {
+    float x, y, z, w;
+};
+
+ScreenVertex project_vertex(const glm::vec4 &clip, int width, int height)
+{
+    if (clip.w < 1e-5f || clip.z < -clip.w) return ScreenVertex{0.0f, 0.0f, 0.0f, 0.0f};
+    float invW = 1.0f / clip.w;
+    return ScreenVertex{(clip.x * invW * 0.5f + 0.5f) * width,
+                        (clip.y * invW * 0.5f + 0.5f) * height, clip.z * invW * 0.5f + 0.5f, 1.0f};
+}
+
+bool setup_triangle(const ScreenVertex *v[3], int width, int height, OccluderTriangle &tri)
+{
+    // Triangles that cross the near plane are skipped, which only makes the
+    // depth buffer less occluding and thus keeps the test conservative
+    if (v[0]->w == 0.0f || v[1]->w == 0.0f || v[2]->w == 0.0f) return false;
+
+    // Pixel centers are at half-integer coordinates, and most triangles of
+    // dense meshes cover none at this resolution
+    float minX = std::min(v[0]->x, std::min(v[1]->x, v[2]->x));
+    float maxX = std::max(v[0]->x, std::max(v[1]->x, v[2]->x));
+    float minY = std::min(v[0]->y, std::min(v[1]->y, v[2]->y));
+    float maxY = std::max(v[0]->y, std::max(v[1]->y, v[2]->y));
+    tri.x0 = std::max(0, int(std::ceil(std::max(minX, -1.0f) - 0.5f)));
+    tri.y0 = std::max(0, int(std::ceil(std::max(minY, -1.0f) - 0.5f)));
+    tri.x1 = std::min(width, int(std::floor(std::min(maxX, width + 1.0f) - 0.5f)) + 1);
+    tri.y1 = std::min(height, int(std::floor(std::min(maxY, height + 1.0f) - 0.5f)) + 1);
+    if (tri.x0 >= tri.x1 || tri.y0 >= tri.y1) return false;
+
+    float x[3] = {v[0]->x, v[1]->x, v[2]->x};
+    float y[3] = {v[0]->y, v[1]->y, v[2]->y};
+    float z[3] = {v[0]->z, v[1]->z, v[2]->z};
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(std::fabs(area) > 0.0f)) return false;
+    if (area < 0.0f) {
+        std::swap(x[1], x[2]), std::swap(y[1], y[2]), std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    tri.za = tri.zb = tri.zc = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+        int i0 = (i + 1) % 3, i1 = (i + 2) % 3;
+        tri.a[i] = y[i0] - y[i1];
+        tri.b[i] = x[i1] - x[i0];
+        tri.c[i] = -(tri.a[i] * x[i0] + tri.b[i] * y[i0]);
+        tri.za += tri.a[i] * z[i] / area;
+        tri.zb += tri.b[i] * z[i] / area;
+        tri.zc += tri.c[i] * z[i] / area;
+    }
+    tri.zMin = std::min(z[0], std::min(z[1], z[2]));
+    tri.zMax = std::max(z[0], std::max(z[1], z[2]));
+    return true;
+}
+
+// Returns the coverage of an 8x4 tile, with bit (8 * row + column) set for
+// each covered pixel center
+uint32_t coverage_mask(const OccluderTriangle &tri, int px, int py)
+{
+    uint32_t mask = 0;
+#ifdef __SSE2__
+    __m128 offsetLo = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 offsetHi = _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f);
+    __m128 eLo[3], eHi[3], stepY[3];
+    for (int i = 0; i < 3; ++i) {
+        __m128 a = _mm_set1_ps(tri.a[i]);
+        __m128 row = _mm_set1_ps(tri.a[i] * px + tri.b[i] * (py + 0.5f) + tri.c[i]);
+        eLo[i] = _mm_add_ps(row, _mm_mul_ps(a, offsetLo));
+        eHi[i] = _mm_add_ps(row, _mm_mul_ps(a, offsetHi));
+        stepY[i] = _mm_set1_ps(tri.b[i]);
+    }
+    __m128 zero = _mm_setzero_ps();
+    for (int row = 0; row < TILE_HEIGHT; ++row) {
+        __m128 insideLo = _mm_cmpge_ps(eLo[0], zero), insideHi = _mm_cmpge_ps(eHi[0], zero);
+        for (int i = 1; i < 3; ++i) {
+            insideLo = _mm_and_ps(insideLo, _mm_cmpge_ps(eLo[i], zero));
+            insideHi = _mm_and_ps(insideHi, _mm_cmpge_ps(eHi[i], zero));
+        }
+        uint32_t rowMask = _mm_movemask_ps(insideLo) | (_mm_movemask_ps(insideHi) << 4);
+        mask |= rowMask << (8 * row);
+        for (int i = 0; i < 3; ++i) {
+            eLo[i] = _mm_add_ps(eLo[i], stepY[i]);
+            eHi[i] = _mm_add_ps(eHi[i], stepY[i]);
+        }
+    }
+#else
+    for (int row = 0; row < TILE_HEIGHT; ++row) {
+        for (int column = 0; column < TILE_WIDTH; ++column) {
+            float x = px + column + 0.5f, y = py + row + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 3; ++i) inside &= tri.a[i] * x + tri.b[i] * y + tri.c[i] >= 0.0f;
+            if (inside) mask |= 1u << (8 * row + column);
+        }
+    }
+#endif
+    return mask;
+}
+
+// Merge a triangle into a tile. The working layer accumulates coverage and
+// its farthest depth; once it covers the whole tile, it replaces the
+// reference layer if that makes the tile nearer.
+void update_tile(OcclusionTile &tile, uint32_t mask, float zTriangle)
+{
+    if (zTriangle >= tile.zMax0) return;  // Cannot make the tile any nearer
+    tile.zMax1 = std::max(tile.zMax1, zTriangle);
+    tile.mask |= mask;
+    if (tile.mask == FULL_MASK) {
+        tile.zMax0 = std::min(tile.zMax0, tile.zMax1);
+        tile.zMax1 = 0.0f;
+        tile.mask = 0;
+    }
+}
+
+void rasterize_triangle(const OccluderTriangle &tri, int tilesX, int tileRow0, int tileRow1,
+                        std::vector<OcclusionTile> &tiles)
+{
+    int ty0 = std::max(tileRow0, tri.y0 / TILE_HEIGHT);
+    int ty1 = std::min(tileRow1, (tri.y1 - 1) / TILE_HEIGHT + 1);
+    int tx0 = tri.x0 / TILE_WIDTH, tx1 = (tri.x1 - 1) / TILE_WIDTH + 1;
+    for (int ty = ty0; ty < ty1; ++ty) {
+        for (int tx = tx0; tx < tx1; ++tx) {
+            int px = tx * TILE_WIDTH, py = ty * TILE_HEIGHT;
+            uint32_t mask = coverage_mask(tri, px, py);
+            if (!mask) continue;
+
+            // Farthest depth over the tile is at one of its corner pixels
+            float z = -1e30f;
+            for (int corner = 0; corner < 4; ++corner) {
+                float x = px + ((corner & 1) ? TILE_WIDTH - 0.5f : 0.5f);
+                float y = py + ((corner & 2) ? TILE_HEIGHT - 0.5f : 0.5f);
+                z = std::max(z, tri.za * x + tri.zb * y + tri.zc);
+            }
+            z = std::max(tri.zMin, std::min(tri.zMax, z));
+            update_tile(tiles[ty * tilesX + tx], mask, z);
+        }
+    }
+}
+
+glm::mat4 node_mvp(const OcclusionCuller &culler, int nodeIndex)
+{
+    if (!culler.nodeMatrices) return culler.viewProjection;
+    return culler.viewProjection * (*culler.nodeMatrices)[nodeIndex];
+}
+
+void transform_occluders(const OcclusionCuller &culler, const GLTFAsset &asset,
+                         std::vector<OccluderTriangle> &triangles)
+{
+    std::vector<ScreenVertex> vertices;
+    for (int nodeIndex : culler.occluders) {
+        const Node &node = asset.nodes[nodeIndex];
+        const Primitive &primitive = get_mesh_primitives(asset, asset.meshes[node.mesh])[0];
+        glm::mat4 MVP = node_mvp(culler, nodeIndex);
+
+        int position = -1;
+        for (const auto &it : get_primitive_attributes(asset, primitive)) {
+            if (it.semantic == ATTRIBUTE_POSITION) position = it.index;
+        }
+        // Geometry that is streamed from files is not in memory to rasterize
+        if (position < 0 || !accessor_in_bounds(asset, position) ||
+            !accessor_in_bounds(asset, primitive.indices))
+            continue;
+        const Accessor *positions = &asset.accessors[position];
+        int positionStride, indexStride;
+        const char *positionData = get_accessor_data(asset, *positions, 12, positionStride);
+        const Accessor &indices = asset.accessors[primitive.indices];
+        const char *indexData = get_accessor_data(asset, indices, 0, indexStride);
+
+        vertices.resize(size_t(positions->count));
+        for (int64_t i = 0; i < positions->count; ++i) {
+            glm::vec3 p = *(const glm::vec3 *)(positionData + size_t(i) * positionStride);
+            vertices[i] = project_vertex(MVP * glm::vec4(p, 1.0f), culler.width, culler.height);
+        }
+        const ScreenVertex invalid = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int64_t i = 0; i + 2 < indices.count; i += 3) {
+            const ScreenVertex *v[3];
+            for (int j = 0; j < 3; ++j) {
+                uint32_t index = read_index(indexData, indices.componentType, size_t(i + j));
+                v[j] = index < vertices.size() ? &vertices[index] : &invalid;
+            }
+            OccluderTriangle tri;
+            if (setup_triangle(v, culler.width, culler.height, tri)) triangles.push_back(tri);
+        }
+    }
+}
+
+// Returns 1 if the node may be visible, 0 if it is occluded, and 2 if it is
+// outside the view
+int test_node(const OcclusionCuller &culler, const GLTFAsset &asset, int nodeIndex)
+{
+    const Node &node = asset.nodes[nodeIndex];
+    const Bounds &bounds = culler.meshBounds[node.mesh];
+    glm::mat4 MVP = node_mvp(culler, nodeIndex);
+
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, zMin = 1e30f;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p((corner & 1) ? bounds.max.x : bounds.min.x,
+                    (corner & 2) ? bounds.max.y : bounds.min.y,
+                    (corner & 4) ? bounds.max.z : bounds.min.z);
+        glm::vec4 clip = MVP * glm::vec4(p, 1.0f);
+        if (clip.w < 1e-5f || clip.z < -clip.w) return 1;  // Crosses the near plane
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * culler.width;
+        float y = (clip.y * invW * 0.5f + 0.5f) * culler.height;
+        minX = std::min(minX, x), maxX = std::max(maxX, x);
+        minY = std::min(minY, y), maxY = std::max(maxY, y);
+        zMin = std::min(zMin, clip.z * invW * 0.5f + 0.5f);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX > culler.width || minY > culler.height || zMin > 1.0f)
+        return 2;
+
+    int tilesX = culler.width / TILE_WIDTH, tilesY = culler.height / TILE_HEIGHT;
+    int tx0 = std::max(0, int(std::floor(minX)) / TILE_WIDTH);
+    int ty0 = std::max(0, int(std::floor(minY)) / TILE_HEIGHT);
+    int tx1 = std::min(tilesX - 1, int(std::floor(maxX)) / TILE_WIDTH);
+    int ty1 = std::min(tilesY - 1, int(std::floor(maxY)) / TILE_HEIGHT);
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            if (zMin <= culler.tiles[ty * tilesX + tx].zMax0) return 1;
+        }
+    }
+    return 0;
+}
+
+void run_occlusion(OcclusionCuller &culler, const GLTFAsset &asset)
+{
+    int tilesX = culler.width / TILE_WIDTH, tilesY = culler.height / TILE_HEIGHT;
+    OcclusionStats &stats = culler.jobStats;
+    stats = OcclusionStats();
+    stats.occluders = int(culler.occluders.size());
+
+    // Rasterize occluders, with one band of tile rows per thread
+    cg::profiler_set_thread_name("Occlusion");
+    CG_PROFILE_SCOPE("Occlusion Culling");
+    Clock::time_point start = Clock::now();
+    std::vector<OccluderTriangle> triangles;
+    transform_occluders(culler, asset, triangles);
+    stats.occluderTriangles = triangles.size();
+    culler.tiles.assign(size_t(tilesX) * tilesY, OcclusionTile());
+    cg::parallel_for(culler.numThreads, size_t(tilesY), [&](size_t begin, size_t end, int) {
+        CG_PROFILE_SCOPE("Rasterize Occluders");
+        for (const OccluderTriangle &tri : triangles) {
+            rasterize_triangle(tri, tilesX, int(begin), int(end), culler.tiles);
+        }
+    });
+    stats.rasterMs = milliseconds_since(start);
+
+    // Test the bounding boxes of all nodes
+    start = Clock::now();
+    std::vector<uint8_t> results(asset.nodes.size(), 1);
+    cg::parallel_for(culler.numThreads, asset.nodes.size(), [&](size_t begin, size_t end, int) {
+        CG_PROFILE_SCOPE("Test Nodes");
+        for (size_t i = begin; i < end; ++i) {
+            if (asset.nodes[i].mesh >= 0) results[i] = uint8_t(test_node(culler, asset, int(i)));
+        }
+    });
+    culler.visible.resize(results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        culler.visible[i] = results[i] == 1;
+        stats.occluded += results[i] == 0;
+        stats.outsideView += results[i] == 2;
+    }
+    stats.tested = int(results.size());
+    stats.testMs = milliseconds_since(start);
+}
+
+}  // namespace
+
+void occlusion_init(OcclusionCuller &culler, const GLTFAsset &asset)
+{
+    occlusion_end(culler);
+    culler.meshBounds = compute_mesh_bounds(asset);
+    culler.visible.clear();
+
+    // Use the nodes with the largest bounds as occluders, until the triangle
+    // budget is spent (the largest node is always used)
+    std::vector<int> candidates;
+    for (unsigned i = 0; i < asset.nodes.size(); ++i) {
+        int mesh = asset.nodes[i].mesh;
+        if (mesh >= 0 && triangle_count(asset, asset.meshes[mesh]) > 0) candidates.push_back(i);
+    }
+    auto size = [&](int node) {
+        const Bounds &bounds = culler.meshBounds[asset.nodes[node].mesh];
+        return glm::length(bounds.max - bounds.min);
+    };
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [&](int a, int b) { return size(a) > size(b); });
+    culler.occluders.clear();
+    size_t triangles = 0;
+    for (int node : candidates) {
+        size_t count = triangle_count(asset, asset.meshes[asset.nodes[node].mesh]);
+        if (!culler.occluders.empty() && triangles + count > culler.occluderTriangleBudget)
+            continue;
+        culler.occluders.push_back(node);
+        triangles += count;
+    }
+}
+
+void occlusion_begin(OcclusionCuller &culler, const GLTFAsset &asset,
+                     const glm::mat4 &viewProjection, const glm::mat4 &modelMatrix,
+                     const std::vector<glm::mat4> *nodeMatrices)
+{
+    occlusion_end(culler);
+    if (culler.meshBounds.size() != asset.meshes.size()) occlusion_init(culler, asset);
+    culler.width = std::max(TILE_WIDTH, culler.width / TILE_WIDTH * TILE_WIDTH);
+    culler.height = std::max(TILE_HEIGHT, culler.height / TILE_HEIGHT * TILE_HEIGHT);
+    culler.viewProjection = viewProjection * modelMatrix;
+    culler.nodeMatrices = nodeMatrices;
+    culler.job = std::async(std::launch::async, [&culler, &asset] { run_occlusion(culler, asset); });
+}
+
+void occlusion_end(OcclusionCuller &culler)
+{
+    if (!culler.job.valid()) return;
+    culler.job.get();
+    culler.nodeMatrices = nullptr;
+    culler.stats = culler.jobStats;
+}
+
+bool occlusion_visible(const OcclusionCuller &culler, int node)
+{
+    return node >= int(culler.visible.size()) || culler.visible[node];
+}
+
+}  // namespace gltf
@@ -0,0 +1,78 @@
+// Masked software occlusion culling for glTF nodes.
+//
+// The largest nodes of the asset are selected as occluders and rasterized
+// into a coarse CPU depth buffer, after which the screen-space bounding box
+// of every node is tested against it. The depth buffer is split into 8x4
+// pixel tiles that store a 32-bit coverage mask and two depth layers, as in
+// Masked Software Occlusion Culling (Hasselgren et al. 2016), so there is
+// no per-pixel depth. All results are conservative: a node is only culled
+// if its bounding box is hidden behind occluders in every tile it overlaps.
+//
+// The work runs on a worker thread (which splits the depth buffer into
+// bands for more threads), so it overlaps with the GPU still executing the
+// previous frame and with the GUI of the current one.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <future>
+#include <vector>
+
+namespace gltf {
+
+struct OcclusionTile {
+    float zMax0 = 1.0f;  // Farthest depth of the tile (reference layer)
+    float zMax1 = 0.0f;  // Farthest depth of the pixels in mask (working layer)
+    uint32_t mask = 0;   // Pixels covered by the working layer, 8 bits per row
+};
+
+struct OcclusionStats {
+    int occluders = 0;
+    size_t occluderTriangles = 0;
+    int tested = 0;
+    int occluded = 0;
+    int outsideView = 0;  // Nodes culled because they are outside the view frustum
+    double rasterMs = 0.0;
+    double testMs = 0.0;
+};
+
+struct OcclusionCuller {
+    bool enabled = false;
+    int width = 256;  // Resolution of the depth buffer (multiples of the tile size)
+    int height = 128;
+    size_t occluderTriangleBudget = 50000;
+    int numThreads = 2;
+
+    std::vector<Bounds> meshBounds;
+    glm::mat4 viewProjection = glm::mat4(1.0f);  // Including the model matrix
+    const std::vector<glm::mat4> *nodeMatrices = nullptr;  // From occlusion_begin()
+    std::vector<int> occluders;  // Node indices, largest first
+    std::vector<OcclusionTile> tiles;
+    std::vector<uint8_t> visible;  // Per node
+    OcclusionStats stats;     // Of the last completed test, copied by occlusion_end()
+    OcclusionStats jobStats;  // Written by the worker thread
+    std::future<void> job;
+};
+
+// Compute bounds and pick occluders for a newly loaded asset
+void occlusion_init(OcclusionCuller &culler, const GLTFAsset &asset);
+
+// Start culling all nodes for the given view. Each node is transformed by
+// modelMatrix, times its entry in nodeMatrices unless that is null. The asset
+// and nodeMatrices must stay unchanged until occlusion_end().
+void occlusion_begin(OcclusionCuller &culler, const GLTFAsset &asset,
+                     const glm::mat4 &viewProjection, const glm::mat4 &modelMatrix,
+                     const std::vector<glm::mat4> *nodeMatrices = nullptr);
+
+// Wait for the results of occlusion_begin() and update the stats
+void occlusion_end(OcclusionCuller &culler);
+
+// Returns false if the node was culled by the last completed test
+bool occlusion_visible(const OcclusionCuller &culler, int node);
+
+}  // namespace gltf
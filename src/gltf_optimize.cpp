@@ -0,0 +1,422 @@
+// Offline optimization of glTF assets for rendering.
+//
+
+#include "gltf_optimize.h"
+#include "gltf_dedup.h"
+#include "gltf_io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+namespace gltf {
+
+namespace {
+
+const int UNSIGNED_BYTE = 5121;
+const int UNSIGNED_SHORT = 5123;
+const int UNSIGNED_INT = 5125;
+
+const uint32_t NO_VERTEX = 0xffffffffu;
+
+// Constants of Forsyth's vertex cache optimization
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_SCALE = 2.0f;
+const float FORSYTH_VALENCE_POWER = -0.5f;
+
+size_t align4(size_t size)
+{
+    return (size + 3) & ~size_t(3);
+}
+
+// Returns the TEXCOORD set of an attribute, or -1 for other attributes
+int texcoord_set(const GLTFAsset &asset, const Attribute &attribute)
+{
+    if (attribute.semantic == ATTRIBUTE_TEXCOORD_0) return 0;
+    if (attribute.semantic == ATTRIBUTE_TEXCOORD_1) return 1;
+    const char *name = get_string(asset, attribute.name);
+    if (std::strncmp(name, "TEXCOORD_", 9) == 0) return std::atoi(name + 9);
+    return -1;
+}
+
+// Returns true if the viewer reads an attribute of a primitive: positions,
+// normals and colors always, texture coordinates if a texture of the
+// material uses them, and tangents if the material has a normal texture.
+// Other attributes (e.g. joints and weights) are never read.
+bool attribute_used(const GLTFAsset &asset, const Primitive &primitive, const Attribute &attribute)
+{
+    if (attribute.semantic == ATTRIBUTE_POSITION || attribute.semantic == ATTRIBUTE_NORMAL ||
+        attribute.semantic == ATTRIBUTE_COLOR_0)
+        return true;
+    if (!primitive.hasMaterial || primitive.material < 0 ||
+        primitive.material >= int(asset.materials.size()))
+        return false;
+    const Material &material = asset.materials[primitive.material];
+    if (attribute.semantic == ATTRIBUTE_TANGENT) return material.hasNormalTexture;
+
+    int set = texcoord_set(asset, attribute);
+    if (set < 0) return false;
+    const PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+    bool pbrTextures = material.type == PBR_METALLIC_ROUGHNESS;
+    return (pbrTextures && pbr.hasBaseColorTexture && pbr.baseColorTexture.texCoord == set) ||
+           (pbrTextures && pbr.hasMetallicRoughnessTexture &&
+            pbr.metallicRoughnessTexture.texCoord == set) ||
+           (material.hasNormalTexture && material.normalTexture.texCoord == set) ||
+           (material.hasOcclusionTexture && material.occlusionTexture.texCoord == set);
+}
+
+// Append data to the new buffer as a buffer view (at a 4-byte aligned offset)
+int add_buffer_view(std::vector<char> &buffer, std::vector<BufferView> &views, const char *data,
+                    size_t size, int byteStride)
+{
+    buffer.resize(align4(buffer.size()), '\0');
+    BufferView view;
+    view.buffer = 0;
+    view.byteOffset = int64_t(buffer.size());
+    view.byteLength = int64_t(size);
+    view.byteStride = byteStride;
+    buffer.insert(buffer.end(), data, data + size);
+    views.push_back(view);
+    return int(views.size()) - 1;
+}
+
+// Returns the MIME type of an image file from its first bytes, or null if
+// it is not a PNG or JPEG file
+const char *image_mime_type(const std::vector<char> &data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data.data());
+    if (data.size() >= 8 && std::memcmp(bytes, "\x89PNG\r\n\x1a\n", 8) == 0) return "image/png";
+    if (data.size() >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff)
+        return "image/jpeg";
+    return nullptr;
+}
+
+float forsyth_vertex_score(int cachePosition, int valence)
+{
+    if (valence == 0) return -1.0f;  // No triangles left
+    float score = 0.0f;
+    if (cachePosition >= 3) {
+        float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+        score = std::pow(1.0f - (cachePosition - 3) * scale, FORSYTH_DECAY_POWER);
+    } else if (cachePosition >= 0) {
+        score = FORSYTH_LAST_TRIANGLE_SCORE;  // Of the last triangle, which would hit anyway
+    }
+    return score + FORSYTH_VALENCE_SCALE * std::pow(float(valence), FORSYTH_VALENCE_POWER);
+}
+
+}  // namespace
+
+void optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2) return;
+
+    // Remaining triangles of each vertex, in one array
+    std::vector<uint32_t> offsets(vertexCount + 1, 0), live(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) live[indices[i]]++;
+    for (size_t v = 0; v < vertexCount; ++v) offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> adjacency(triangleCount * 3), fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+
+    std::vector<int> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount), triangleScores(triangleCount, 0.0f);
+    for (size_t v = 0; v < vertexCount; ++v) vertexScores[v] = forsyth_vertex_score(-1, live[v]);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        triangleScores[i / 3] += vertexScores[indices[i]];
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> cache, nextCache, output;
+    output.reserve(triangleCount * 3);
+    size_t best = 0, nextUnemitted = 0;
+    for (size_t t = 1; t < triangleCount; ++t) {
+        if (triangleScores[t] > triangleScores[best]) best = t;
+    }
+    while (output.size() < triangleCount * 3) {
+        emitted[best] = 1;
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[3 * best + k];
+            output.push_back(v);
+            nextCache.push_back(v);
+            uint32_t *first = &adjacency[offsets[v]], *last = first + live[v] - 1;
+            *std::find(first, last + 1, uint32_t(best)) = *last;  // Remove the triangle
+            live[v]--;
+        }
+        for (uint32_t v : cache) {
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2]) nextCache.push_back(v);
+        }
+
+        // Update the scores of the cached vertices, and of those that fell out
+        // of the cache, and find the best triangle of the cached vertices
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            uint32_t v = nextCache[i];
+            int position = i < size_t(FORSYTH_CACHE_SIZE) ? int(i) : -1;
+            cachePositions[v] = position;
+            float score = forsyth_vertex_score(position, live[v]), delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (uint32_t j = 0; j < live[v]; ++j) {
+                uint32_t t = adjacency[offsets[v] + j];
+                triangleScores[t] += delta;
+                if (position < 0 || triangleScores[t] <= bestScore) continue;
+                bestScore = triangleScores[t];
+                best = t;
+            }
+        }
+        if (nextCache.size() > size_t(FORSYTH_CACHE_SIZE)) nextCache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(nextCache);
+
+        if (bestScore < 0.0f) {
+            // No cached vertex has triangles left, so continue anywhere
+            while (nextUnemitted < triangleCount && emitted[nextUnemitted]) nextUnemitted++;
+            best = nextUnemitted;
+        }
+    }
+    indices.swap(output);
+}
+
+double compute_acmr(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize)
+{
+    if (indices.size() < 3) return 0.0;
+    std::vector<size_t> timestamps(vertexCount, 0);
+    size_t time = size_t(cacheSize) + 1, misses = 0;
+    for (uint32_t index : indices) {
+        if (time - timestamps[index] > size_t(cacheSize)) {
+            timestamps[index] = time++;
+            misses++;
+        }
+    }
+    return double(misses) / double(indices.size() / 3);
+}
+
+bool optimize_gltf_asset(GLTFAsset &asset, const std::string &filedir,
+                         const OptimizeSettings &settings, OptimizeStats &stats)
+{
+    stats = OptimizeStats();
+    for (const Primitive &primitive : asset.primitives) {
+        bool valid = accessor_in_bounds(asset, primitive.indices);
+        for (const Attribute &attribute : get_primitive_attributes(asset, primitive))
+            valid &= accessor_in_bounds(asset, attribute.index);
+        if (!valid) {
+            std::cerr << "Error: Accessor out of range, the asset is not optimized" << std::endl;
+            return false;
+        }
+    }
+    for (const Buffer &buffer : asset.buffers) stats.bufferBytesBefore += buffer.data.size();
+
+    std::vector<char> buffer;
+    std::vector<BufferView> bufferViews;
+    std::vector<Accessor> accessors;
+    std::vector<Attribute> attributes;
+    std::vector<Primitive> primitives;
+    double missesBefore = 0.0, missesAfter = 0.0;
+    size_t triangles = 0;
+
+    // Primitives with the same accessors (after dropping attributes) share
+    // the optimized data
+    std::map<std::vector<int>, Primitive> optimized;
+    std::vector<Span> meshPrimitives;
+    for (const Mesh &mesh : asset.meshes) {
+        Span span;
+        span.offset = uint32_t(primitives.size());
+        for (const Primitive &primitive : get_mesh_primitives(asset, mesh)) {
+            VertexStreams streams;
+            std::vector<int> key(1, primitive.indices);
+            for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+                if (settings.dropUnusedAttributes && !attribute_used(asset, primitive, attribute)) {
+                    stats.droppedAttributes++;
+                    continue;
+                }
+                add_vertex_stream(streams, asset, attribute);
+                key.push_back(attribute.index);
+            }
+            stats.primitives++;
+
+            Primitive result = primitive;
+            auto found = optimized.find(key);
+            if (found != optimized.end()) {
+                result.attributes = found->second.attributes;
+                result.indices = found->second.indices;
+                primitives.push_back(result);
+                stats.sharedPrimitives++;
+                continue;
+            }
+
+            // Triangles with indices out of range are dropped
+            const Accessor &indexAccessor = asset.accessors[primitive.indices];
+            int indexStride;
+            const char *indexData = get_accessor_data(asset, indexAccessor, 0, indexStride);
+            std::vector<uint32_t> indices;
+            for (int64_t i = 0; i + 2 < indexAccessor.count; i += 3) {
+                uint32_t triangle[3];
+                for (int k = 0; k < 3; ++k)
+                    triangle[k] = read_index(indexData, indexAccessor.componentType, size_t(i + k));
+                uint32_t last = std::max(triangle[0], std::max(triangle[1], triangle[2]));
+                if (last >= streams.vertexCount) continue;
+                indices.insert(indices.end(), triangle, triangle + 3);
+            }
+            stats.verticesBefore += streams.vertexCount;
+            stats.indexBytesBefore +=
+                size_t(indexAccessor.count) * component_type_size(indexAccessor.componentType);
+            missesBefore += compute_acmr(indices, streams.vertexCount) * (indices.size() / 3);
+            triangles += indices.size() / 3;
+
+            std::vector<uint32_t> sources = weld_vertices(streams, indices, settings.weldVertices);
+            if (settings.optimizeVertexCache) {
+                optimize_vertex_cache(indices, sources.size());
+                // Store the vertices in the order of first use, for fetch locality
+                std::vector<uint32_t> order(sources.size(), NO_VERTEX), reordered;
+                reordered.reserve(sources.size());
+                for (uint32_t &index : indices) {
+                    if (order[index] == NO_VERTEX) {
+                        order[index] = uint32_t(reordered.size());
+                        reordered.push_back(sources[index]);
+                    }
+                    index = order[index];
+                }
+                sources.swap(reordered);
+            }
+            stats.verticesAfter += sources.size();
+            missesAfter += compute_acmr(indices, sources.size()) * (indices.size() / 3);
+
+            // One tightly packed buffer view per attribute (with elements
+            // padded to multiples of 4 bytes, as glTF requires)
+            result.attributes.offset = uint32_t(attributes.size());
+            result.attributes.count = uint32_t(streams.attributes.size());
+            std::vector<char> data;
+            for (size_t i = 0; i < streams.attributes.size(); ++i) {
+                Attribute attribute = *streams.attributes[i];
+                Accessor accessor = asset.accessors[attribute.index];
+                const int size = streams.sizes[i], stride = int(align4(size));
+                data.assign(sources.size() * stride, '\0');
+                const char *source = streams.data[i];
+                for (size_t v = 0; v < sources.size(); ++v)
+                    std::memcpy(&data[v * stride], source + sources[v] * streams.strides[i], size);
+                accessor.bufferView = add_buffer_view(buffer, bufferViews, data.data(), data.size(),
+                                                      stride != size ? stride : 0);
+                accessor.byteOffset = 0;
+                accessor.count = int64_t(sources.size());
+                accessors.push_back(accessor);
+                attribute.index = int(accessors.size()) - 1;
+                attributes.push_back(attribute);
+            }
+
+            Accessor accessor = indexAccessor;
+            if (settings.narrowIndices) {
+                // 8-bit indices are only kept, as they are slow on some GPUs
+                bool bytes = indexAccessor.componentType == UNSIGNED_BYTE && sources.size() <= 0xff;
+                bool shorts = sources.size() <= 0xffff;
+                accessor.componentType = bytes    ? UNSIGNED_BYTE
+                                         : shorts ? UNSIGNED_SHORT
+                                                  : UNSIGNED_INT;
+            }
+            const int indexSize = component_type_size(accessor.componentType);
+            data.assign(indices.size() * indexSize, '\0');
+            for (size_t i = 0; i < indices.size(); ++i) {
+                uint16_t index16 = uint16_t(indices[i]);
+                if (indexSize == 1) data[i] = char(indices[i]);
+                if (indexSize == 2) std::memcpy(&data[i * 2], &index16, 2);
+                if (indexSize == 4) std::memcpy(&data[i * 4], &indices[i], 4);
+            }
+            accessor.bufferView = add_buffer_view(buffer, bufferViews, data.data(), data.size(), 0);
+            accessor.byteOffset = 0;
+            accessor.count = int64_t(indices.size());
+            accessors.push_back(accessor);
+            result.indices = int(accessors.size()) - 1;
+            stats.indexBytesAfter += data.size();
+
+            optimized[key] = result;
+            primitives.push_back(result);
+        }
+        span.count = uint32_t(primitives.size()) - span.offset;
+        meshPrimitives.push_back(span);
+    }
+    stats.acmrBefore = triangles ? missesBefore / triangles : 0.0;
+    stats.acmrAfter = triangles ? missesAfter / triangles : 0.0;
+
+    // Image files are embedded in the buffer, and files with the same
+    // contents are merged. Images that cannot be read stay external.
+    std::vector<int> imageSources;  // Original image of each new one
+    std::vector<int> imageViews;    // Buffer view of each new image, or -1 if it stays external
+    std::vector<const char *> imageMimeTypes;
+    std::vector<int> imageIndices(asset.images.size(), -1);
+    std::multimap<uint64_t, int> imageHashes;
+    std::vector<char> file;
+    for (size_t i = 0; i < asset.images.size(); ++i) {
+        const Image &image = asset.images[i];
+        bool loaded = false;
+        if (image.bufferView >= 0 && image.bufferView < int(asset.bufferViews.size())) {
+            const BufferView &view = asset.bufferViews[image.bufferView];
+            bool bufferValid = view.buffer >= 0 && view.buffer < int(asset.buffers.size());
+            const std::vector<char> *data = bufferValid ? &asset.buffers[view.buffer].data : nullptr;
+            if (data && size_t(view.byteOffset) + view.byteLength <= data->size()) {
+                const char *first = data->data() + view.byteOffset;
+                file.assign(first, first + view.byteLength);
+                loaded = true;
+            }
+        } else if (image.bufferView < 0) {
+            loaded = load_file_to_bytebuffer(filedir + image.uri, file);
+        }
+        const char *mimeType = loaded ? image_mime_type(file) : nullptr;
+        if (!mimeType) {
+            std::cerr << "Warning: Image " << i << " (" << image.uri << ") is not embedded"
+                      << std::endl;
+            imageIndices[i] = int(imageSources.size());
+            imageSources.push_back(int(i));
+            imageViews.push_back(-1);
+            imageMimeTypes.push_back(nullptr);
+            continue;
+        }
+
+        uint64_t hash = hash_content(file.data(), file.size());
+        auto range = imageHashes.equal_range(hash);
+        for (auto it = range.first; it != range.second && imageIndices[i] < 0; ++it) {
+            const BufferView &view = bufferViews[imageViews[it->second]];
+            if (size_t(view.byteLength) == file.size() &&
+                std::memcmp(&buffer[view.byteOffset], file.data(), file.size()) == 0)
+                imageIndices[i] = it->second;
+        }
+        if (imageIndices[i] >= 0) continue;
+        imageIndices[i] = int(imageSources.size());
+        imageHashes.insert(std::make_pair(hash, imageIndices[i]));
+        imageSources.push_back(int(i));
+        imageViews.push_back(add_buffer_view(buffer, bufferViews, file.data(), file.size(), 0));
+        imageMimeTypes.push_back(mimeType);
+    }
+
+    buffer.resize(align4(buffer.size()), '\0');
+
+    // Nothing fails from here on, so the asset can be changed
+    std::vector<Image> images(imageSources.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        images[i] = std::move(asset.images[imageSources[i]]);
+        if (imageViews[i] < 0) continue;
+        images[i].uri.clear();
+        images[i].bufferView = imageViews[i];
+        images[i].mimeType = imageMimeTypes[i];
+    }
+    for (Texture &texture : asset.textures) {
+        if (texture.source >= 0 && texture.source < int(imageIndices.size()))
+            texture.source = imageIndices[texture.source];
+    }
+    for (size_t i = 0; i < asset.meshes.size(); ++i) asset.meshes[i].primitives = meshPrimitives[i];
+    stats.imagesBefore = asset.images.size();
+    stats.imagesAfter = images.size();
+    stats.bufferBytesAfter = buffer.size();
+    asset.images.swap(images);
+    asset.accessors.swap(accessors);
+    asset.bufferViews.swap(bufferViews);
+    asset.attributes.swap(attributes);
+    asset.primitives.swap(primitives);
+    asset.buffers.assign(1, Buffer());
+    asset.buffers[0].byteLength = int64_t(buffer.size());
+    asset.buffers[0].data.swap(buffer);
+    return true;
+}
+
+}  // namespace gltf
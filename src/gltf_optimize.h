@@ -0,0 +1,60 @@
+// Offline optimization of glTF assets for rendering.
+//
+// Rebuilds the geometry of an asset into one buffer that is ready to be
+// uploaded as it is: vertices are welded (identical vertices of a primitive
+// are merged, and unreferenced ones dropped), attributes that the viewer
+// never reads are dropped, triangles are reordered for the post-transform
+// vertex cache (Forsyth's linear-speed algorithm) and vertices for fetch
+// locality, and indices are narrowed to 16 bits where they fit. Image files
+// with identical contents are merged and embedded in the same buffer, so the
+// result can be written as a single .glb file.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gltf {
+
+struct OptimizeSettings {
+    bool weldVertices = true;
+    bool dropUnusedAttributes = true;
+    bool optimizeVertexCache = true;
+    bool narrowIndices = true;
+};
+
+struct OptimizeStats {
+    size_t primitives = 0;
+    size_t sharedPrimitives = 0;  // Primitives that reuse the data of an identical one
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t droppedAttributes = 0;
+    size_t indexBytesBefore = 0;
+    size_t indexBytesAfter = 0;
+    size_t bufferBytesBefore = 0;
+    size_t bufferBytesAfter = 0;
+    size_t imagesBefore = 0;
+    size_t imagesAfter = 0;
+    double acmrBefore = 0.0;  // Average vertex cache misses per triangle (FIFO of 16 entries)
+    double acmrAfter = 0.0;
+};
+
+// Optimize the geometry and images of an asset, as described above. Image
+// files are read from filedir. Returns false if an accessor or buffer view
+// is out of range, in which case the asset is left unchanged.
+bool optimize_gltf_asset(GLTFAsset &asset, const std::string &filedir,
+                         const OptimizeSettings &settings, OptimizeStats &stats);
+
+// Reorder the triangles of an index list for a post-transform vertex cache
+void optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Returns the average number of vertex cache misses per triangle of an index
+// list, for a FIFO cache of the given size
+double compute_acmr(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize = 16);
+
+}  // namespace gltf
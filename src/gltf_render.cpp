@@ -4,26 +4,261 @@
 //
 
 #include "gltf_render.h"
+#include "gltf_io.h"
+#include "cg_memory.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
 
 namespace gltf {
 
-void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset)
+namespace {
+
+// Returns true if the vertex array objects of one asset also fit the other
+bool same_vertex_layout(const GLTFAsset &a, const GLTFAsset &b)
+{
+    if (a.meshes.size() != b.meshes.size() || a.accessors.size() != b.accessors.size() ||
+        a.bufferViews.size() != b.bufferViews.size() || a.buffers.size() != b.buffers.size())
+        return false;
+    for (unsigned i = 0; i < a.meshes.size(); ++i) {
+        const Primitive &pa = get_mesh_primitives(a, a.meshes[i])[0];
+        const Primitive &pb = get_mesh_primitives(b, b.meshes[i])[0];
+        ArrayView<const Attribute> aa = get_primitive_attributes(a, pa);
+        ArrayView<const Attribute> ab = get_primitive_attributes(b, pb);
+        if (pa.indices != pb.indices || aa.size() != ab.size()) return false;
+        for (unsigned j = 0; j < aa.size(); ++j) {
+            if (aa[j].semantic != ab[j].semantic || aa[j].index != ab[j].index ||
+                std::strcmp(get_string(a, aa[j].name), get_string(b, ab[j].name)) != 0)
+                return false;
+        }
+    }
+    for (unsigned i = 0; i < a.accessors.size(); ++i) {
+        const Accessor &aa = a.accessors[i], &ab = b.accessors[i];
+        if (aa.bufferView != ab.bufferView || aa.componentType != ab.componentType ||
+            aa.count != ab.count || aa.byteOffset != ab.byteOffset || aa.type != ab.type)
+            return false;
+    }
+    for (unsigned i = 0; i < a.bufferViews.size(); ++i) {
+        const BufferView &va = a.bufferViews[i], &vb = b.bufferViews[i];
+        if (va.buffer != vb.buffer || va.byteLength != vb.byteLength ||
+            va.byteOffset != vb.byteOffset || va.byteStride != vb.byteStride)
+            return false;
+    }
+    for (unsigned i = 0; i < a.buffers.size(); ++i) {
+        if (a.buffers[i].byteLength != b.buffers[i].byteLength) return false;
+    }
+    // The levels of detail decide the size of their indices (which may have
+    // been released already)
+    if (a.lods.size() != b.lods.size()) return false;
+    for (unsigned i = 0; i < a.meshes.size(); ++i) {
+        const Span &la = a.meshes[i].lods, &lb = b.meshes[i].lods;
+        if (la.offset != lb.offset || la.count != lb.count) return false;
+    }
+    for (unsigned i = 0; i < a.lods.size(); ++i) {
+        if (a.lods[i].byteOffset != b.lods[i].byteOffset ||
+            a.lods[i].indexCount != b.lods[i].indexCount)
+            return false;
+    }
+    return true;
+}
+
+// Offset of the indices of the levels of detail in the vertex buffer
+int64_t lod_indices_offset(const GLTFAsset &asset)
+{
+    return (asset.buffers[0].byteLength + 3) & ~int64_t(3);
+}
+
+// Returns true for the attributes that the vertex arrays use
+bool vertex_array_attribute(int semantic)
+{
+    return semantic == ATTRIBUTE_POSITION || semantic == ATTRIBUTE_COLOR_0 ||
+           semantic == ATTRIBUTE_NORMAL || semantic == ATTRIBUTE_TEXCOORD_0;
+}
+
+// Let meshes share the vertex array of an earlier mesh when their attributes
+// have the same format, and their vertices are at the same (non-negative)
+// number of vertices from the earlier mesh's in every attribute, as with
+// interleaved vertices. Only the last group of each format is tried, so that
+// this stays linear in the number of meshes.
+void share_vertex_arrays(DrawableList &drawables, const GLTFAsset &asset)
+{
+    struct Group {
+        int first;                     // Mesh whose vertex array is shared
+        std::vector<int64_t> offsets;  // Of its first vertex in each attribute
+    };
+    std::map<std::vector<int64_t>, Group> groups;  // By index type and attribute formats
+    for (unsigned i = 0; i < drawables.size(); ++i) {
+        drawables[i].sharedVao = drawables[i].vao;
+        drawables[i].baseVertex = 0;
+
+        // Semantic, component type, normalization and stride of each attribute
+        const Primitive &primitive = get_mesh_primitives(asset, asset.meshes[i])[0];
+        std::vector<int64_t> format = {drawables[i].indexType}, offsets, strides;
+        std::vector<Attribute> attributes;
+        for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+            if (vertex_array_attribute(attribute.semantic)) attributes.push_back(attribute);
+        }
+        std::sort(attributes.begin(), attributes.end(),
+                  [](const Attribute &a, const Attribute &b) { return a.semantic < b.semantic; });
+        for (const Attribute &attribute : attributes) {
+            const Accessor &accessor = asset.accessors[attribute.index];
+            const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
+            int64_t stride =
+                bufferView.byteStride ? bufferView.byteStride : accessor_element_size(accessor);
+            format.insert(format.end(), {attribute.semantic, accessor.componentType,
+                                         accessor.normalized, accessor.type, stride});
+            offsets.push_back(bufferView.byteOffset + accessor.byteOffset);
+            strides.push_back(stride);
+        }
+
+        auto it = groups.find(format);
+        if (it != groups.end() && !offsets.empty()) {
+            const Group &group = it->second;
+            int64_t distance = offsets[0] - group.offsets[0];
+            int64_t baseVertex = distance / strides[0];
+            bool shared = distance >= 0 && distance % strides[0] == 0 && baseVertex <= INT_MAX;
+            for (size_t j = 1; j < offsets.size() && shared; ++j) {
+                shared = offsets[j] - group.offsets[j] == baseVertex * strides[j];
+            }
+            if (shared) {
+                drawables[i].sharedVao = drawables[group.first].vao;
+                drawables[i].baseVertex = GLint(baseVertex);
+                continue;
+            }
+        }
+        groups[format] = Group{int(i), offsets};
+    }
+}
+
+// Reads the chunks of a streamed buffer from its file ranges, which are
+// sorted by their offsets in the buffer, as are the chunks. The gaps between
+// the ranges (alignment padding) are zeroed.
+struct FileRangeReader {
+    const std::vector<BufferFileRange> *ranges;
+    size_t range = 0;  // First range that does not end before the current chunk
+    FILE *stream = nullptr;
+    std::string path;
+    int64_t position = -1;  // In the file, or -1 if unknown
+};
+
+bool read_file_ranges(FileRangeReader &reader, char *dst, uint64_t offset, size_t size)
+{
+    const std::vector<BufferFileRange> &ranges = *reader.ranges;
+    const uint64_t end = offset + size;
+    while (reader.range < ranges.size() &&
+           uint64_t(ranges[reader.range].byteOffset + ranges[reader.range].byteLength) <= offset)
+        reader.range++;
+    uint64_t position = offset;
+    for (size_t i = reader.range; i < ranges.size() && uint64_t(ranges[i].byteOffset) < end; ++i) {
+        const BufferFileRange &range = ranges[i];
+        uint64_t first = std::max(position, uint64_t(range.byteOffset));
+        uint64_t last = std::min(end, uint64_t(range.byteOffset + range.byteLength));
+        std::memset(dst + (position - offset), 0, size_t(first - position));
+        if (range.path != reader.path || !reader.stream) {
+            if (reader.stream) std::fclose(reader.stream);
+            reader.path = range.path;
+            reader.stream = std::fopen(range.path.c_str(), "rb");
+            reader.position = -1;
+        }
+        int64_t fileOffset = range.fileOffset + int64_t(first - range.byteOffset);
+        bool ok = reader.stream &&
+                  (reader.position == fileOffset || seek_file(reader.stream, fileOffset));
+        size_t length = size_t(last - first);
+        if (!ok || std::fread(dst + (first - offset), 1, length, reader.stream) != length) {
+            std::cerr << "Error: Could not read " << length << " bytes at offset " << fileOffset
+                      << " of " << range.path << std::endl;
+            return false;
+        }
+        reader.position = fileOffset + int64_t(length);
+        position = last;
+    }
+    std::memset(dst + (position - offset), 0, size_t(end - position));
+    return true;
+}
+
+// Uploads the data of the buffer of an asset (or streams it from its file
+// ranges) into a GL buffer, followed by the indices of the levels of detail
+bool upload_buffer(cg::StagingPool *staging, GLuint target, const GLTFAsset &asset)
+{
+    cg::StagingPool temporary;
+    if (!staging) {
+        if (!cg::staging_pool_init(temporary)) return false;
+        staging = &temporary;
+    }
+    const Buffer &buffer = asset.buffers[0];
+    bool ok;
+    if (!buffer.fileRanges.empty()) {
+        FileRangeReader reader;
+        reader.ranges = &buffer.fileRanges;
+        auto read = [&](void *dst, uint64_t offset, size_t size) {
+            return read_file_ranges(reader, static_cast<char *>(dst), offset, size);
+        };
+        ok = cg::staging_upload(*staging, target, 0, GLsizeiptr(buffer.byteLength), read);
+        if (reader.stream) std::fclose(reader.stream);
+    } else {
+        uint64_t size = std::min(uint64_t(buffer.byteLength), uint64_t(buffer.data.size()));
+        auto copy = [&](void *dst, uint64_t offset, size_t length) {
+            std::memcpy(dst, buffer.data.data() + offset, length);
+            return true;
+        };
+        ok = cg::staging_upload(*staging, target, 0, GLsizeiptr(size), copy);
+    }
+    if (ok && !asset.lodIndices.empty()) {
+        auto copy = [&](void *dst, uint64_t offset, size_t length) {
+            std::memcpy(dst, asset.lodIndices.data() + offset, length);
+            return true;
+        };
+        ok = cg::staging_upload(*staging, target, GLintptr(lod_indices_offset(asset)),
+                                GLsizeiptr(asset.lodIndices.size()), copy);
+    }
+    if (staging == &temporary) cg::staging_pool_destroy(temporary);
+    return ok;
+}
+
+}  // namespace
+
+IndexRange get_drawable_indices(const Drawable &drawable, int lod)
+{
+    if (lod <= 0 || drawable.lodCount == 0)
+        return IndexRange{drawable.indexCount, drawable.indexByteOffset};
+    return drawable.lods[std::min(lod, drawable.lodCount) - 1];
+}
+
+void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset,
+                                      cg::StagingPool *staging)
 {
     // First clean up existing OpenGL resources
     destroy_drawables(drawables);
 
-    // Create vertex buffer
+    // Create vertex buffer, and fill it in chunks
     GLuint buffer;
     glGenBuffers(1, &buffer);
     glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
     assert(asset.buffers.size() == 1);
-    glBufferData(GL_COPY_WRITE_BUFFER, asset.buffers[0].byteLength, &asset.buffers[0].data[0],
-                 GL_STATIC_DRAW);
+    const int64_t lodBase = lod_indices_offset(asset);
+    const int64_t size = asset.lodIndices.empty() ? asset.buffers[0].byteLength
+                                                  : lodBase + int64_t(asset.lodIndices.size());
+    while (glGetError() != GL_NO_ERROR) {}
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(size), nullptr, GL_STATIC_DRAW);
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "Error: Could not allocate a vertex buffer of " << size << " bytes"
+                  << std::endl;
+        glDeleteBuffers(1, &buffer);
+        return;  // Without drawables, so nothing is drawn
+    }
+    cg::memory_track_gl(GL_BUFFER, buffer, cg::MEMORY_GL_BUFFERS, uint64_t(size));
+    if (!upload_buffer(staging, buffer, asset)) {
+        std::cerr << "Error: Could not upload the vertex buffer" << std::endl;
+    }
 
     // Create one vertex array object per mesh/drawable
     drawables.resize(asset.meshes.size());
     for (unsigned i = 0; i < asset.meshes.size(); ++i) {
-        assert(asset.meshes[i].primitives.size() == 1);
+        assert(asset.meshes[i].primitives.count == 1);
         drawables[i].buffer = buffer;
 
         glGenVertexArrays(1, &drawables[i].vao);
@@ -31,33 +266,34 @@ void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &
 
         // Specify vertex format
         glBindBuffer(GL_ARRAY_BUFFER, drawables[i].buffer);
-        const Primitive &primitive = asset.meshes[i].primitives[0];
-        for (const auto &it : primitive.attributes) {
+        const Primitive &primitive = get_mesh_primitives(asset, asset.meshes[i])[0];
+        for (const auto &it : get_primitive_attributes(asset, primitive)) {
             const Accessor &accessor = asset.accessors[it.index];
             const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
 
             // Note: must add accessor's byte offset to buffer-view's
-            int byteOffset = bufferView.byteOffset + accessor.byteOffset;
+            int64_t byteOffset = bufferView.byteOffset + accessor.byteOffset;
+            GLboolean normalized = accessor.normalized ? GL_TRUE : GL_FALSE;
 
-            if (it.name.compare("POSITION") == 0) {
+            if (it.semantic == ATTRIBUTE_POSITION) {
                 glEnableVertexAttribArray(POSITION);
                 // Note: we often declare the position attribute as vec4 in the
                 // vertex shader, even if the actual type in the buffer is
                 // vec3. This is valid and will give us a homogenous coordinate
                 // with the last component assigned the value 1.
-                glVertexAttribPointer(POSITION, 3 /*VEC3*/, accessor.componentType, GL_FALSE,
+                glVertexAttribPointer(POSITION, 3 /*VEC3*/, accessor.componentType, normalized,
                                       bufferView.byteStride, (GLvoid *)(intptr_t)byteOffset);
-            } else if (it.name.compare("COLOR_0") == 0) {
+            } else if (it.semantic == ATTRIBUTE_COLOR_0) {
                 glEnableVertexAttribArray(COLOR_0);
-                glVertexAttribPointer(COLOR_0, 4 /*VEC4*/, accessor.componentType, GL_FALSE,
+                glVertexAttribPointer(COLOR_0, 4 /*VEC4*/, accessor.componentType, normalized,
                                       bufferView.byteStride, (GLvoid *)(intptr_t)byteOffset);
-            } else if (it.name.compare("NORMAL") == 0) {
+            } else if (it.semantic == ATTRIBUTE_NORMAL) {
                 glEnableVertexAttribArray(NORMAL);
-                glVertexAttribPointer(NORMAL, 3 /*VEC3*/, accessor.componentType, GL_FALSE,
+                glVertexAttribPointer(NORMAL, 3 /*VEC3*/, accessor.componentType, normalized,
                                       bufferView.byteStride, (GLvoid *)(intptr_t)byteOffset);
-            } else if (it.name.compare("TEXCOORD_0") == 0) {
+            } else if (it.semantic == ATTRIBUTE_TEXCOORD_0) {
                 glEnableVertexAttribArray(TEXCOORD_0);
-                glVertexAttribPointer(TEXCOORD_0, 2 /*VEC2*/, accessor.componentType, GL_FALSE,
+                glVertexAttribPointer(TEXCOORD_0, 2 /*VEC2*/, accessor.componentType, normalized,
                                       bufferView.byteStride, (GLvoid *)(intptr_t)byteOffset);
             }
             // You can add support for more named attributes here...
@@ -67,22 +303,62 @@ void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawables[i].buffer);
         const Accessor &accessor = asset.accessors[primitive.indices];
         const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
-        drawables[i].indexCount = accessor.count;
+        drawables[i].indexCount = int(std::min(accessor.count, int64_t(INT_MAX)));
+        if (accessor.count > INT_MAX) {
+            std::cerr << "Warning: Mesh " << i << " has more indices than can be drawn at once"
+                      << std::endl;
+        }
         drawables[i].indexType = accessor.componentType;
         drawables[i].indexByteOffset = bufferView.byteOffset;
+        ArrayView<const MeshLod> lods = get_mesh_lods(asset, asset.meshes[i]);
+        // Without their indices (e.g. released after an earlier upload), the
+        // levels cannot be drawn
+        drawables[i].lodCount =
+            asset.lodIndices.empty() ? 0 : int(std::min(lods.size(), size_t(MAX_MESH_LODS)));
+        for (int j = 0; j < drawables[i].lodCount; ++j) {
+            drawables[i].lods[j] = IndexRange{lods[j].indexCount, lodBase + lods[j].byteOffset};
+        }
     }
     glBindVertexArray(0);
+    share_vertex_arrays(drawables, asset);
+}
+
+bool update_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset,
+                                      const GLTFAsset &previous, cg::StagingPool *staging)
+{
+    if (drawables.empty() || !same_vertex_layout(asset, previous)) return false;
+
+    // All drawables share the vertex buffer, whose storage is kept. Its
+    // contents are undefined if the upload fails part of the way.
+    if (!upload_buffer(staging, drawables[0].buffer, asset)) {
+        std::cerr << "Error: Could not update the vertex buffer" << std::endl;
+        return false;
+    }
+    return true;
 }
 
 void destroy_drawables(DrawableList &drawables)
 {
     for (unsigned i = 0; i < drawables.size(); ++i) {
+        cg::memory_release_gl(GL_BUFFER, 1, &drawables[i].buffer);
         glDeleteBuffers(1, &drawables[i].buffer);
         glDeleteVertexArrays(1, &drawables[i].vao);
     }
     drawables.clear();
 }
 
+size_t release_buffer_data(GLTFAsset &asset)
+{
+    size_t bytes = 0;
+    for (Buffer &buffer : asset.buffers) {
+        bytes += buffer.data.capacity();
+        std::vector<char>().swap(buffer.data);
+    }
+    bytes += asset.lodIndices.capacity();
+    std::vector<char>().swap(asset.lodIndices);
+    return bytes;
+}
+
 void create_textures_from_gltf_asset(TextureList &textures, const GLTFAsset &asset)
 {
     // First clean up existing OpenGL resources
@@ -110,8 +386,15 @@ void create_textures_from_gltf_asset(TextureList &textures, const GLTFAsset &ass
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA,
                      GL_UNSIGNED_BYTE, &(image.data[0]));
         // We also need to create a mipmap chain in case GL_TEXTURE_MIN_FILTER
-        // is set to something else than GL_NEAREST or GL_LINEAR
-        glGenerateMipmap(GL_TEXTURE_2D);
+        // is set to something else than GL_NEAREST or GL_LINEAR. Levels that
+        // were generated on the CPU are uploaded as they are.
+        if (image.levels.empty()) glGenerateMipmap(GL_TEXTURE_2D);
+        int width = image.width, height = image.height;
+        for (unsigned level = 0; level < image.levels.size(); ++level) {
+            width = std::max(1, width / 2), height = std::max(1, height / 2);
+            glTexImage2D(GL_TEXTURE_2D, level + 1, GL_RGBA8, width, height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, image.levels[level].data());
+        }
     }
     glBindTexture(GL_TEXTURE_2D, 0);
 }
@@ -119,6 +402,7 @@ void create_textures_from_gltf_asset(TextureList &textures, const GLTFAsset &ass
 void destroy_textures(TextureList &textures)
 {
     if (!textures.size()) return;
+    cg::memory_release_gl(GL_TEXTURE, GLsizei(textures.size()), &textures[0]);
     glDeleteTextures(textures.size(), &textures[0]);
     textures.clear();
 }
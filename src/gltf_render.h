@@ -6,6 +6,7 @@
 #pragma once
 
 #include "gltf_scene.h"
+#include "cg_upload.h"
 
 #include <GL/gl3w.h>
 
@@ -14,21 +15,59 @@ namespace gltf {
 // Attribute locations we will use in vertex shaders
 enum AttributeLocation { POSITION = 0, COLOR_0 = 1, NORMAL = 2, TEXCOORD_0 = 3 };
 
+// Indices of one draw of a mesh, in the vertex buffer
+struct IndexRange {
+    int count;
+    int64_t byteOffset;
+};
+
 struct Drawable {
     GLuint vao;
     GLuint buffer;
     GLenum indexType;
     int indexCount;
-    int indexByteOffset;
+    int64_t indexByteOffset;
+    // Levels of detail of the mesh (see gltf_lod.h), whose indices follow
+    // the asset's data in the vertex buffer
+    int lodCount;
+    IndexRange lods[MAX_MESH_LODS];
+    // Vertex array of an earlier mesh with the same vertex format, which can
+    // draw this mesh too with its vertices offset by baseVertex, so that the
+    // meshes can be drawn by one multi-draw call (or vao and 0)
+    GLuint sharedVao;
+    GLint baseVertex;
 };
 
 typedef std::vector<Drawable> DrawableList;
+
+// Returns the indices of a level of detail of a drawable: 0 for the full
+// mesh, and the coarsest level it has for larger numbers
+IndexRange get_drawable_indices(const Drawable &drawable, int lod);
 typedef std::vector<GLuint> TextureList;
 
-void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset);
+// The buffer is uploaded in chunks through the staging buffers (or through
+// temporary ones, if staging is null), from its data or, if it is streamed,
+// from its file ranges, followed by the indices of the levels of detail. No
+// drawables are created if the buffer cannot be allocated.
+void create_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset,
+                                      cg::StagingPool *staging = nullptr);
+
+// Replace the vertex and index data of drawables that were created from
+// another version of the asset, if its vertex layout is the same. Returns
+// false if the drawables must be created again: either nothing was changed,
+// or the upload failed and the vertex buffer holds partial data.
+bool update_drawables_from_gltf_asset(DrawableList &drawables, const GLTFAsset &asset,
+                                      const GLTFAsset &previous,
+                                      cg::StagingPool *staging = nullptr);
 
 void destroy_drawables(DrawableList &drawables);
 
+// Free the CPU copies of the buffers (and of the indices of the levels of
+// detail) once the drawables have been created.
+// Only the GPU has the geometry afterwards (see buffers_loaded()), so the CPU
+// passes that need it skip the asset. Returns the number of bytes freed.
+size_t release_buffer_data(GLTFAsset &asset);
+
 void create_textures_from_gltf_asset(TextureList &textures, const GLTFAsset &asset);
 
 void destroy_textures(TextureList &textures);
@@ -5,6 +5,373 @@
 
 #include "gltf_scene.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstring>
+
 namespace gltf {
 
+namespace {
+
+const char *const ATTRIBUTE_NAMES[] = {"POSITION", "NORMAL", "TANGENT", "TEXCOORD_0",
+                                       "TEXCOORD_1", "COLOR_0"};
+const char *const ACCESSOR_TYPE_NAMES[] = {"SCALAR", "VEC2", "VEC3", "VEC4",
+                                           "MAT2",   "MAT3", "MAT4"};
+const int ACCESSOR_TYPE_COMPONENTS[] = {1, 2, 3, 4, 4, 9, 16};
+
+template <typename T>
+ArrayView<T> make_view(T *elements, size_t size, Span span)
+{
+    ArrayView<T> view;
+    if (size_t(span.offset) + span.count > size) return view;  // Empty for invalid spans
+    view.first = elements + span.offset;
+    view.count = span.count;
+    return view;
+}
+
+template <typename T>
+size_t vector_memory(const std::vector<T> &v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+}  // namespace
+
+ArrayView<const int> get_node_children(const GLTFAsset &asset, const Node &node)
+{
+    return make_view(asset.nodeIndices.data(), asset.nodeIndices.size(), node.children);
+}
+
+ArrayView<const int> get_scene_nodes(const GLTFAsset &asset, const Scene &scene)
+{
+    return make_view(asset.nodeIndices.data(), asset.nodeIndices.size(), scene.nodes);
+}
+
+ArrayView<const Primitive> get_mesh_primitives(const GLTFAsset &asset, const Mesh &mesh)
+{
+    return make_view(asset.primitives.data(), asset.primitives.size(), mesh.primitives);
+}
+
+ArrayView<Primitive> get_mesh_primitives(GLTFAsset &asset, const Mesh &mesh)
+{
+    return make_view(asset.primitives.data(), asset.primitives.size(), mesh.primitives);
+}
+
+ArrayView<const Attribute> get_primitive_attributes(const GLTFAsset &asset,
+                                                   const Primitive &primitive)
+{
+    return make_view(asset.attributes.data(), asset.attributes.size(), primitive.attributes);
+}
+
+ArrayView<Attribute> get_primitive_attributes(GLTFAsset &asset, const Primitive &primitive)
+{
+    return make_view(asset.attributes.data(), asset.attributes.size(), primitive.attributes);
+}
+
+ArrayView<const MeshLod> get_mesh_lods(const GLTFAsset &asset, const Mesh &mesh)
+{
+    return make_view(asset.lods.data(), asset.lods.size(), mesh.lods);
+}
+
+const char *get_string(const GLTFAsset &asset, StringRef string)
+{
+    if (string.offset >= asset.strings.size()) return "";
+    return &asset.strings[string.offset];
+}
+
+ArrayView<const int> Scene::get_nodes(const GLTFAsset &asset) const
+{
+    return get_scene_nodes(asset, *this);
+}
+
+const char *Scene::get_name(const GLTFAsset &asset) const
+{
+    return get_string(asset, name);
+}
+
+ArrayView<const int> Node::get_children(const GLTFAsset &asset) const
+{
+    return get_node_children(asset, *this);
+}
+
+const char *Node::get_name(const GLTFAsset &asset) const
+{
+    return get_string(asset, name);
+}
+
+const char *Material::get_name(const GLTFAsset &asset) const
+{
+    return get_string(asset, name);
+}
+
+const char *Attribute::get_name(const GLTFAsset &asset) const
+{
+    return get_string(asset, name);
+}
+
+ArrayView<const Attribute> Primitive::get_attributes(const GLTFAsset &asset) const
+{
+    return get_primitive_attributes(asset, *this);
+}
+
+ArrayView<Attribute> Primitive::get_attributes(GLTFAsset &asset) const
+{
+    return get_primitive_attributes(asset, *this);
+}
+
+ArrayView<const Primitive> Mesh::get_primitives(const GLTFAsset &asset) const
+{
+    return get_mesh_primitives(asset, *this);
+}
+
+ArrayView<Primitive> Mesh::get_primitives(GLTFAsset &asset) const
+{
+    return get_mesh_primitives(asset, *this);
+}
+
+ArrayView<const MeshLod> Mesh::get_lods(const GLTFAsset &asset) const
+{
+    return get_mesh_lods(asset, *this);
+}
+
+const char *Mesh::get_name(const GLTFAsset &asset) const
+{
+    return get_string(asset, name);
+}
+
+const char *Accessor::type_name() const
+{
+    return accessor_type_name(type);
+}
+
+const Attribute *find_attribute(const GLTFAsset &asset, const Primitive &primitive,
+                                AttributeSemantic semantic)
+{
+    for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+        if (attribute.semantic == semantic) return &attribute;
+    }
+    return nullptr;
+}
+
+StringRef add_string(GLTFAsset &asset, const char *string, size_t length)
+{
+    StringRef ref;
+    if (asset.strings.empty()) asset.strings.push_back('\0');
+    if (length == 0) return ref;
+    ref.offset = uint32_t(asset.strings.size());
+    asset.strings.insert(asset.strings.end(), string, string + length);
+    asset.strings.push_back('\0');
+    return ref;
+}
+
+StringRef add_string(GLTFAsset &asset, const std::string &string)
+{
+    return add_string(asset, string.c_str(), string.size());
+}
+
+void add_primitive_attribute(GLTFAsset &asset, Primitive &primitive, const Attribute &attribute)
+{
+    Span &span = primitive.attributes;
+    if (size_t(span.offset) + span.count != asset.attributes.size()) {
+        // Copy by index, since the insertion may reallocate the array
+        uint32_t offset = uint32_t(asset.attributes.size());
+        for (uint32_t i = 0; i < span.count; ++i)
+            asset.attributes.push_back(asset.attributes[span.offset + i]);
+        span.offset = offset;
+    }
+    asset.attributes.push_back(attribute);
+    span.count++;
+}
+
+AttributeSemantic parse_attribute_semantic(const char *name)
+{
+    for (int i = 0; i < int(ATTRIBUTE_OTHER); ++i) {
+        if (std::strcmp(name, ATTRIBUTE_NAMES[i]) == 0) return AttributeSemantic(i);
+    }
+    return ATTRIBUTE_OTHER;
+}
+
+AccessorType parse_accessor_type(const char *name)
+{
+    for (int i = 0; i <= int(ACCESSOR_MAT4); ++i) {
+        if (std::strcmp(name, ACCESSOR_TYPE_NAMES[i]) == 0) return AccessorType(i);
+    }
+    return ACCESSOR_SCALAR;
+}
+
+const char *accessor_type_name(AccessorType type)
+{
+    return ACCESSOR_TYPE_NAMES[type];
+}
+
+int accessor_type_components(AccessorType type)
+{
+    return ACCESSOR_TYPE_COMPONENTS[type];
+}
+
+size_t compute_scene_memory(const GLTFAsset &asset)
+{
+    size_t bytes = vector_memory(asset.scenes) + vector_memory(asset.nodes) +
+                   vector_memory(asset.materials) + vector_memory(asset.textures) +
+                   vector_memory(asset.images) + vector_memory(asset.samplers) +
+                   vector_memory(asset.meshes) + vector_memory(asset.accessors) +
+                   vector_memory(asset.bufferViews) + vector_memory(asset.buffers) +
+                   vector_memory(asset.bounds);
+    bytes += vector_memory(asset.nodeIndices) + vector_memory(asset.matrices) +
+             vector_memory(asset.primitives) + vector_memory(asset.attributes) +
+             vector_memory(asset.strings) + vector_memory(asset.lods);
+    for (const Image &image : asset.images) bytes += image.uri.capacity();
+    for (const Buffer &buffer : asset.buffers) bytes += buffer.uri.capacity();
+    return bytes;
+}
+
+size_t compute_buffer_memory(const GLTFAsset &asset)
+{
+    size_t bytes = 0;
+    for (const Buffer &buffer : asset.buffers) bytes += vector_memory(buffer.data);
+    return bytes + vector_memory(asset.lodIndices);
+}
+
+size_t compute_image_memory(const GLTFAsset &asset)
+{
+    size_t bytes = 0;
+    for (const Image &image : asset.images) {
+        bytes += vector_memory(image.data) + vector_memory(image.levels);
+        for (const std::vector<uint8_t> &level : image.levels) bytes += vector_memory(level);
+    }
+    return bytes;
+}
+
+const char *get_accessor_data(const GLTFAsset &asset, const Accessor &accessor, int elementSize,
+                              int &stride)
+{
+    const BufferView &bufferView = asset.bufferViews[accessor.bufferView];
+    const Buffer &buffer = asset.buffers[bufferView.buffer];
+    stride = bufferView.byteStride ? bufferView.byteStride : elementSize;
+    return &buffer.data[0] + bufferView.byteOffset + accessor.byteOffset;
+}
+
+uint32_t read_index(const char *data, int componentType, size_t i)
+{
+    if (componentType == 5121 /*GL_UNSIGNED_BYTE*/) return ((const uint8_t *)data)[i];
+    if (componentType == 5123 /*GL_UNSIGNED_SHORT*/) return ((const uint16_t *)data)[i];
+    return ((const uint32_t *)data)[i];
+}
+
+int component_type_size(int componentType)
+{
+    switch (componentType) {
+    case 5120: /*GL_BYTE*/
+    case 5121: /*GL_UNSIGNED_BYTE*/ return 1;
+    case 5122: /*GL_SHORT*/
+    case 5123: /*GL_UNSIGNED_SHORT*/ return 2;
+    default: return 4;  // GL_UNSIGNED_INT and GL_FLOAT
+    }
+}
+
+int accessor_element_size(const Accessor &accessor)
+{
+    return component_type_size(accessor.componentType) * accessor_type_components(accessor.type);
+}
+
+bool accessor_in_bounds(const GLTFAsset &asset, int index)
+{
+    if (index < 0 || index >= int(asset.accessors.size())) return false;
+    const Accessor &accessor = asset.accessors[index];
+    if (accessor.bufferView < 0 || accessor.bufferView >= int(asset.bufferViews.size()) ||
+        accessor.count < 0 || accessor.byteOffset < 0)
+        return false;
+    const BufferView &view = asset.bufferViews[accessor.bufferView];
+    if (view.buffer < 0 || view.buffer >= int(asset.buffers.size()) || view.byteOffset < 0 ||
+        view.byteLength < 0 || view.byteStride < 0)
+        return false;
+    // In 64 bits, with the multiplication checked, since counts come from the file
+    uint64_t size = accessor_element_size(accessor);
+    uint64_t stride = view.byteStride ? uint64_t(view.byteStride) : size;
+    uint64_t end = uint64_t(accessor.byteOffset);
+    if (accessor.count) {
+        uint64_t last = uint64_t(accessor.count - 1);
+        if (stride && last > (UINT64_MAX - size - end) / stride) return false;
+        end += last * stride + size;
+    }
+    return end <= uint64_t(view.byteLength) &&
+           uint64_t(view.byteOffset) + uint64_t(view.byteLength) <=
+               asset.buffers[view.buffer].data.size();
+}
+
+bool buffers_loaded(const GLTFAsset &asset)
+{
+    for (const Buffer &buffer : asset.buffers) {
+        if (!buffer.fileRanges.empty() || (buffer.data.empty() && buffer.byteLength > 0))
+            return false;
+    }
+    return true;
+}
+
+glm::mat4 compute_node_local_matrix(const GLTFAsset &asset, const Node &node)
+{
+    if (node.matrix >= 0 && node.matrix < int(asset.matrices.size()))
+        return asset.matrices[node.matrix];
+    return glm::translate(glm::mat4(1.0f), node.translation) * glm::mat4_cast(node.rotation) *
+           glm::scale(glm::mat4(1.0f), node.scale);
+}
+
+static void compute_world_matrix(const GLTFAsset &asset, int node, const glm::mat4 &parent,
+                                 std::vector<glm::mat4> &matrices, std::vector<bool> &visited)
+{
+    if (visited[node]) return;  // Guards against cycles in invalid files
+    visited[node] = true;
+    const Node &n = asset.nodes[node];
+    matrices[node] = parent * compute_node_local_matrix(asset, n);
+    for (int child : get_node_children(asset, n)) {
+        if (child >= 0 && child < int(asset.nodes.size()))
+            compute_world_matrix(asset, child, matrices[node], matrices, visited);
+    }
+}
+
+std::vector<glm::mat4> compute_node_world_matrices(const GLTFAsset &asset)
+{
+    std::vector<bool> isChild(asset.nodes.size(), false), visited(asset.nodes.size(), false);
+    for (const Node &node : asset.nodes) {
+        for (int child : get_node_children(asset, node)) {
+            if (child >= 0 && child < int(asset.nodes.size())) isChild[child] = true;
+        }
+    }
+    std::vector<glm::mat4> matrices(asset.nodes.size(), glm::mat4(1.0f));
+    for (unsigned i = 0; i < asset.nodes.size(); ++i) {
+        if (!isChild[i]) compute_world_matrix(asset, i, glm::mat4(1.0f), matrices, visited);
+    }
+    return matrices;
+}
+
+std::vector<Bounds> compute_mesh_bounds(const GLTFAsset &asset)
+{
+    std::vector<Bounds> bounds(asset.meshes.size());
+    for (unsigned i = 0; i < asset.meshes.size(); ++i) {
+        bounds[i].min = glm::vec3(0.0f);
+        bounds[i].max = glm::vec3(0.0f);
+        ArrayView<const Primitive> primitives = get_mesh_primitives(asset, asset.meshes[i]);
+        if (primitives.empty()) continue;
+        for (const Attribute &it : get_primitive_attributes(asset, primitives[0])) {
+            if (it.semantic != ATTRIBUTE_POSITION) continue;
+            const Accessor &accessor = asset.accessors[it.index];
+            if (!accessor_in_bounds(asset, it.index)) {
+                if (accessor.bounds >= 0 && accessor.bounds < int(asset.bounds.size()))
+                    bounds[i] = asset.bounds[accessor.bounds];
+                continue;
+            }
+            int stride;
+            const char *data = get_accessor_data(asset, accessor, 12, stride);
+            bounds[i].min = glm::vec3(1e30f);
+            bounds[i].max = glm::vec3(-1e30f);
+            for (int64_t j = 0; j < accessor.count; ++j) {
+                glm::vec3 p = *(const glm::vec3 *)(data + size_t(j) * stride);
+                bounds[i].min = glm::min(bounds[i].min, p);
+                bounds[i].max = glm::max(bounds[i].max, p);
+            }
+        }
+    }
+    return bounds;
+}
+
 }  // namespace gltf
@@ -2,33 +2,97 @@
 //
 // Author: Fredrik Nysjo (2021)
 //
+// The scene description is stored compactly, since large scenes have
+// millions of nodes: attribute semantics and accessor types are enums,
+// names are stored back to back in one string pool, and the variable-length
+// lists of nodes, meshes and primitives are spans of flat arrays of the asset
+// (e.g. the children of all nodes are one array of node indices). Spans and
+// names are read through views, such as get_node_children(asset, node), or
+// the equivalent members, such as node.get_children(asset). Views take the
+// asset because its arrays may be reallocated and assets are copied, so a
+// span cannot point into them.
+//
 
 #pragma once
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace gltf {
 
+struct GLTFAsset;
+
 enum MaterialType { DEFAULT_MATERIAL = 0, PBR_METALLIC_ROUGHNESS = 1 };
 
+// Attribute semantics used by the viewer (others are ATTRIBUTE_OTHER, and
+// only known by their names)
+enum AttributeSemantic : uint8_t {
+    ATTRIBUTE_POSITION = 0,
+    ATTRIBUTE_NORMAL,
+    ATTRIBUTE_TANGENT,
+    ATTRIBUTE_TEXCOORD_0,
+    ATTRIBUTE_TEXCOORD_1,
+    ATTRIBUTE_COLOR_0,
+    ATTRIBUTE_OTHER
+};
+
+enum AccessorType : uint8_t {
+    ACCESSOR_SCALAR = 0,
+    ACCESSOR_VEC2,
+    ACCESSOR_VEC3,
+    ACCESSOR_VEC4,
+    ACCESSOR_MAT2,
+    ACCESSOR_MAT3,
+    ACCESSOR_MAT4
+};
+
+// A string in the string pool of an asset (offset 0 is the empty string)
+struct StringRef {
+    uint32_t offset = 0;
+};
+
+// A range of one of the flat arrays of an asset
+struct Span {
+    uint32_t offset = 0;
+    uint32_t count = 0;
+};
+
+// Elements of a span, or any other array
+template <typename T>
+struct ArrayView {
+    T *first = nullptr;
+    size_t count = 0;
+
+    T *begin() const { return first; }
+    T *end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) const { return first[i]; }
+};
+
 struct Scene {
-    std::string name;
-    std::vector<int> nodes;
+    StringRef name;
+    Span nodes;  // In GLTFAsset::nodeIndices
+
+    ArrayView<const int> get_nodes(const GLTFAsset &asset) const;
+    const char *get_name(const GLTFAsset &asset) const;
 };
 
 struct Node {
     int mesh;
-    std::string name;
-    std::vector<int> children;
+    StringRef name;
+    Span children;  // In GLTFAsset::nodeIndices
     glm::vec3 translation;
     glm::quat rotation;
     glm::vec3 scale;
-    glm::mat4 matrix;
-    bool hasMatrix;
+    int matrix;  // In GLTFAsset::matrices, or -1 if the node has a translation, rotation and scale
+
+    ArrayView<const int> get_children(const GLTFAsset &asset) const;
+    const char *get_name(const GLTFAsset &asset) const;
 };
 
 struct MaterialTexture {
@@ -49,13 +113,15 @@ struct PBRMetallicRoughness {
 };
 
 struct Material {
-    std::string name;
+    StringRef name;
     MaterialType type;
     PBRMetallicRoughness pbrMetallicRoughness;
     MaterialTexture normalTexture;
     MaterialTexture occlusionTexture;
     bool hasNormalTexture;
     bool hasOcclusionTexture;
+
+    const char *get_name(const GLTFAsset &asset) const;
 };
 
 struct Texture {
@@ -66,9 +132,12 @@ struct Texture {
 
 struct Image {
     std::string uri;
+    int bufferView = -1;   // Of embedded image files (e.g. in .glb files), or -1 for uri
+    std::string mimeType;  // Of embedded image files
     int width;               // Image width (in pixels)
     int height;              // Image height (in pixels)
     std::vector<char> data;  // Pixel data in RGBA8 format
+    std::vector<std::vector<uint8_t>> levels;  // Mip levels 1 and up, if generated on the CPU
 };
 
 struct Sampler {
@@ -79,44 +148,89 @@ struct Sampler {
 };
 
 struct Attribute {
-    std::string name;
+    AttributeSemantic semantic;
+    StringRef name;
     int index;
+
+    const char *get_name(const GLTFAsset &asset) const;
 };
 
 struct Primitive {
-    std::vector<Attribute> attributes;
+    Span attributes;  // In GLTFAsset::attributes
     int indices;
     int material;
     bool hasMaterial;
+
+    ArrayView<const Attribute> get_attributes(const GLTFAsset &asset) const;
+    ArrayView<Attribute> get_attributes(GLTFAsset &asset) const;
 };
 
+// A simplified level of detail of a mesh (see gltf_lod.h), which is drawn
+// with the vertices of the mesh's first primitive
+struct MeshLod {
+    int64_t byteOffset;  // Of its indices in GLTFAsset::lodIndices
+    int indexCount;      // Of the same type as the indices of the primitive
+    float error;         // Largest distance a vertex was moved, in mesh units
+};
+
+const int MAX_MESH_LODS = 4;  // Levels of detail per mesh, besides the full mesh
+
 struct Mesh {
-    std::string name;
-    std::vector<Primitive> primitives;
+    StringRef name;
+    Span primitives;  // In GLTFAsset::primitives
+    Span lods;        // In GLTFAsset::lods, finest first (generated by the viewer)
+
+    ArrayView<const Primitive> get_primitives(const GLTFAsset &asset) const;
+    ArrayView<Primitive> get_primitives(GLTFAsset &asset) const;
+    ArrayView<const MeshLod> get_lods(const GLTFAsset &asset) const;
+    const char *get_name(const GLTFAsset &asset) const;
 };
 
+// Sizes and offsets of accessors, buffer views and buffers are 64-bit, so
+// that buffers can be larger than 2 GB
 struct Accessor {
     int bufferView;
     int componentType;
-    int count;
-    int byteOffset;
-    std::string type;
+    int64_t count;
+    int64_t byteOffset;
+    AccessorType type;
+    bool normalized;  // Integer components are mapped to [0, 1] or [-1, 1]
+    int bounds;       // Declared min and max of VEC3 accessors, in GLTFAsset::bounds, or -1
+
+    const char *type_name() const;  // E.g. "VEC3"
 };
 
 struct BufferView {
     int buffer;
-    int byteLength;
-    int byteOffset;
+    int64_t byteLength;
+    int64_t byteOffset;
     int byteStride;
 };
 
+// A range of a file that holds part of a buffer whose data is not loaded,
+// which is read when the buffer is uploaded (see gltf_scene_loader.h)
+struct BufferFileRange {
+    std::string path;
+    int64_t fileOffset;
+    int64_t byteOffset;  // In the buffer
+    int64_t byteLength;
+};
+
 struct Buffer {
-    int byteLength;
+    int64_t byteLength;
     std::string uri;
-    std::vector<char> data;
+    std::vector<char> data;  // Empty if streamed, or released after upload
+    std::vector<BufferFileRange> fileRanges;  // If the data is streamed from files instead
+};
+
+// Axis-aligned bounding box
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
 };
 
 struct GLTFAsset {
+    int scene = -1;  // Default scene, or -1 if the file does not name one
     std::vector<Scene> scenes;
     std::vector<Node> nodes;
     std::vector<Material> materials;
@@ -127,6 +241,102 @@ struct GLTFAsset {
     std::vector<Accessor> accessors;
     std::vector<BufferView> bufferViews;
     std::vector<Buffer> buffers;
+    std::vector<Bounds> bounds;  // Declared bounds of accessors
+
+    // Storage of the spans and names of the tables above
+    std::vector<int> nodeIndices;  // Children of nodes, and nodes of scenes
+    std::vector<glm::mat4> matrices;
+    std::vector<Primitive> primitives;
+    std::vector<Attribute> attributes;
+    std::vector<char> strings;  // Null-terminated, starting with the empty string
+
+    // Levels of detail of the meshes, which are not written to files. Their
+    // indices are uploaded after buffer 0 (see gltf_lod.h).
+    std::vector<MeshLod> lods;
+    std::vector<char> lodIndices;
 };
 
+// Views of the spans and names of an asset
+ArrayView<const int> get_node_children(const GLTFAsset &asset, const Node &node);
+ArrayView<const int> get_scene_nodes(const GLTFAsset &asset, const Scene &scene);
+ArrayView<const Primitive> get_mesh_primitives(const GLTFAsset &asset, const Mesh &mesh);
+ArrayView<Primitive> get_mesh_primitives(GLTFAsset &asset, const Mesh &mesh);
+ArrayView<const Attribute> get_primitive_attributes(const GLTFAsset &asset,
+                                                   const Primitive &primitive);
+ArrayView<Attribute> get_primitive_attributes(GLTFAsset &asset, const Primitive &primitive);
+ArrayView<const MeshLod> get_mesh_lods(const GLTFAsset &asset, const Mesh &mesh);
+const char *get_string(const GLTFAsset &asset, StringRef string);
+
+// Returns the first attribute of a primitive with a semantic, or null
+const Attribute *find_attribute(const GLTFAsset &asset, const Primitive &primitive,
+                                AttributeSemantic semantic);
+
+// Append a string to the string pool (the empty string is not stored again)
+StringRef add_string(GLTFAsset &asset, const char *string, size_t length);
+StringRef add_string(GLTFAsset &asset, const std::string &string);
+
+// Append elements to one of the flat arrays of an asset, as a new span
+template <typename T>
+Span add_span(std::vector<T> &array, const T *elements, size_t count)
+{
+    Span span;
+    span.offset = uint32_t(array.size());
+    span.count = uint32_t(count);
+    array.insert(array.end(), elements, elements + count);
+    return span;
+}
+
+// Add an attribute to a primitive. Its attributes are moved to the end of
+// the attribute array first, unless they already are there.
+void add_primitive_attribute(GLTFAsset &asset, Primitive &primitive, const Attribute &attribute);
+
+// Conversions between enums and their names in glTF files
+AttributeSemantic parse_attribute_semantic(const char *name);
+AccessorType parse_accessor_type(const char *name);
+const char *accessor_type_name(AccessorType type);
+int accessor_type_components(AccessorType type);
+
+// Returns the heap memory of the scene description (without buffer data and
+// image pixels), as allocated by its arrays
+size_t compute_scene_memory(const GLTFAsset &asset);
+
+// Returns the heap memory of the loaded buffer data (and of the indices of
+// the levels of detail)
+size_t compute_buffer_memory(const GLTFAsset &asset);
+
+// Returns the heap memory of the image pixels and their mip levels
+size_t compute_image_memory(const GLTFAsset &asset);
+
+// Returns a pointer to the first element of an accessor, and its stride in
+// bytes (elementSize is used for tightly packed buffer views)
+const char *get_accessor_data(const GLTFAsset &asset, const Accessor &accessor, int elementSize,
+                              int &stride);
+
+// Reads an element of an index accessor with the given component type
+uint32_t read_index(const char *data, int componentType, size_t i);
+
+// Returns the size in bytes of one component of the given type (e.g. 4 for
+// GL_FLOAT), and of one element of an accessor (without padding)
+int component_type_size(int componentType);
+int accessor_element_size(const Accessor &accessor);
+
+// Returns true if all elements of an accessor are inside its buffer view and
+// the loaded data of its buffer (so not for streamed buffers)
+bool accessor_in_bounds(const GLTFAsset &asset, int index);
+
+// Returns true if the data of all buffers is loaded, rather than streamed to
+// the GPU from files or released after upload (in which case only the GPU has
+// the geometry)
+bool buffers_loaded(const GLTFAsset &asset);
+
+// Computes the transform of a node relative to its parent
+glm::mat4 compute_node_local_matrix(const GLTFAsset &asset, const Node &node);
+
+// Computes the world matrix of every node from the node hierarchy
+std::vector<glm::mat4> compute_node_world_matrices(const GLTFAsset &asset);
+
+// Computes the bounds of the POSITION attribute of the first primitive of
+// each mesh, or takes them from the file if its data is not loaded
+std::vector<Bounds> compute_mesh_bounds(const GLTFAsset &asset);
+
 }  // namespace gltf
@@ -0,0 +1,573 @@
+// Lazy loading of the scenes of multi-scene glTF assets.
+//
+
+#include "gltf_scene_loader.h"
+#include "gltf_io.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace gltf {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Marks an index if it is in range, and returns true if it was not marked
+bool mark(std::vector<uint8_t> &marks, int index)
+{
+    if (index < 0 || index >= int(marks.size()) || marks[index]) return false;
+    marks[index] = 1;
+    return true;
+}
+
+void mark_texture(std::vector<uint8_t> &textures, const MaterialTexture &texture, bool hasTexture)
+{
+    if (hasTexture) mark(textures, texture.index);
+}
+
+std::vector<int> marked_indices(const std::vector<uint8_t> &marks)
+{
+    std::vector<int> indices;
+    for (size_t i = 0; i < marks.size(); ++i) {
+        if (marks[i]) indices.push_back(int(i));
+    }
+    return indices;
+}
+
+// Maps the indices of a resource to their positions in a sorted subset of
+// them, and the others to -1
+std::vector<int> index_map(size_t size, const std::vector<int> &subset)
+{
+    std::vector<int> map(size, -1);
+    for (size_t i = 0; i < subset.size(); ++i) map[subset[i]] = int(i);
+    return map;
+}
+
+int remap(const std::vector<int> &map, int index)
+{
+    return index >= 0 && index < int(map.size()) ? map[index] : -1;
+}
+
+void remap_texture(const std::vector<int> &textureMap, MaterialTexture &texture, bool &hasTexture)
+{
+    if (!hasTexture) return;
+    texture.index = remap(textureMap, texture.index);
+    hasTexture = texture.index >= 0;
+}
+
+int64_t align4(int64_t size)
+{
+    return (size + 3) & ~int64_t(3);
+}
+
+template <typename T>
+size_t release(std::vector<T> &data)
+{
+    size_t bytes = data.size() * sizeof(T);
+    std::vector<T>().swap(data);
+    return bytes;
+}
+
+size_t resident_bytes(const SceneLoader &loader)
+{
+    size_t bytes = 0;
+    for (const std::vector<char> &data : loader.views) bytes += data.size();
+    for (const Image &image : loader.asset.images) bytes += image.data.size();
+    return bytes;
+}
+
+// Returns true if a buffer view is inside its buffer, else reports it
+bool view_in_range(const GLTFAsset &asset, int index)
+{
+    const BufferView &view = asset.bufferViews[index];
+    if (view.buffer < 0 || view.buffer >= int(asset.buffers.size()) ||
+        uint64_t(view.byteOffset) + uint64_t(view.byteLength) >
+            uint64_t(asset.buffers[view.buffer].byteLength)) {
+        std::cerr << "Error: Buffer view " << index << " is out of range" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Returns the file that holds the data of a buffer, and the offset of the
+// data in it (of the BIN chunk, for .glb files)
+std::string buffer_path(const SceneLoader &loader, const Buffer &buffer, int64_t &offset)
+{
+    offset = buffer.uri.empty() ? int64_t(loader.binOffset) : 0;
+    return loader.filedir + (buffer.uri.empty() ? loader.filename : buffer.uri);
+}
+
+// Reads the data of buffer views (that are not loaded yet) from their buffer
+// files or the BIN chunk, in the order of the files
+bool load_buffer_views(SceneLoader &loader, std::vector<int> views)
+{
+    const GLTFAsset &asset = loader.asset;
+    std::sort(views.begin(), views.end(), [&](int a, int b) {
+        const BufferView &va = asset.bufferViews[a], &vb = asset.bufferViews[b];
+        return va.buffer != vb.buffer ? va.buffer < vb.buffer : va.byteOffset < vb.byteOffset;
+    });
+
+    bool ok = true;
+    FILE *stream = nullptr;
+    int streamBuffer = -1;
+    std::string path;
+    int64_t fileOffset = 0;  // Of the data of the buffer
+    for (int index : views) {
+        const BufferView &view = asset.bufferViews[index];
+        std::vector<char> &data = loader.views[index];
+        if (!data.empty() || view.byteLength == 0) continue;
+        if (!view_in_range(asset, index)) {
+            ok = false;
+            continue;
+        }
+        const Buffer &buffer = asset.buffers[view.buffer];
+        if (view.buffer != streamBuffer) {
+            if (stream) std::fclose(stream);
+            streamBuffer = view.buffer;
+            path = buffer_path(loader, buffer, fileOffset);
+            bool missing = buffer.uri.empty() && !loader.binOffset;  // No BIN chunk
+            stream = missing ? nullptr : std::fopen(path.c_str(), "rb");
+            if (!stream)
+                std::cerr << "Error: Could not read buffer " << view.buffer << " from " << path
+                          << std::endl;
+        }
+        if (!stream) {
+            ok = false;
+            continue;
+        }
+        data.resize(size_t(view.byteLength));
+        if (!seek_file(stream, fileOffset + view.byteOffset) ||
+            std::fread(data.data(), 1, data.size(), stream) != data.size()) {
+            std::cerr << "Error: Could not read buffer view " << index << " from " << path
+                      << std::endl;
+            release(data);
+            ok = false;
+            continue;
+        }
+        loader.stats.loadedBytes += data.size();
+        loader.stats.viewsLoaded++;
+    }
+    if (stream) std::fclose(stream);
+    return ok;
+}
+
+// Releases the least recently used data of the other scenes until no more
+// than the budget is loaded
+void release_unused_data(SceneLoader &loader, uint64_t current)
+{
+    size_t resident = resident_bytes(loader);
+    if (resident > loader.budgetBytes) {
+        // Last use, and the index of a buffer view or ~index of an image
+        std::vector<std::pair<uint64_t, int>> unused;
+        for (size_t i = 0; i < loader.views.size(); ++i) {
+            if (!loader.views[i].empty() && loader.viewUses[i] < current)
+                unused.push_back(std::make_pair(loader.viewUses[i], int(i)));
+        }
+        for (size_t i = 0; i < loader.asset.images.size(); ++i) {
+            if (!loader.asset.images[i].data.empty() && loader.imageUses[i] < current)
+                unused.push_back(std::make_pair(loader.imageUses[i], ~int(i)));
+        }
+        std::sort(unused.begin(), unused.end());
+        for (size_t i = 0; i < unused.size() && resident > loader.budgetBytes; ++i) {
+            int index = unused[i].second;
+            size_t bytes = index >= 0 ? release(loader.views[index])
+                                      : release(loader.asset.images[~index].data);
+            resident -= bytes;
+            loader.stats.releasedBytes += bytes;
+        }
+    }
+    loader.stats.residentBytes = resident;
+}
+
+// Adds a range of a file to the ranges of a buffer, merged with the last one
+// if they are adjacent in both
+void add_file_range(Buffer &buffer, const std::string &path, int64_t fileOffset, int64_t byteOffset,
+                    int64_t byteLength)
+{
+    if (!buffer.fileRanges.empty()) {
+        BufferFileRange &last = buffer.fileRanges.back();
+        if (last.path == path && last.fileOffset + last.byteLength == fileOffset &&
+            last.byteOffset + last.byteLength == byteOffset) {
+            last.byteLength += byteLength;
+            return;
+        }
+    }
+    BufferFileRange range = {path, fileOffset, byteOffset, byteLength};
+    buffer.fileRanges.push_back(range);
+}
+
+// Copies a scene of the loader into an asset of its own. The buffer views of
+// accessors are packed into one buffer per original buffer (at 4-byte aligned
+// offsets), and images are copied with their pixels, without their buffer
+// views. Unless keepData is true, the data is moved out of the loader. If
+// stream is true, the buffer views are not loaded, and are all packed into
+// one buffer (since they cannot be deduplicated into one later), which gets
+// the ranges of the files to read them from instead.
+void extract_scene(SceneLoader &loader, int scene, const SceneResources &resources,
+                   GLTFAsset &result, bool keepData, bool stream)
+{
+    GLTFAsset &asset = loader.asset;
+    result = GLTFAsset();
+    result.strings = asset.strings;  // Names keep their offsets
+
+    std::vector<int> views;
+    for (int view : resources.bufferViews) {
+        if (loader.accessorViews[view]) views.push_back(view);
+    }
+    std::vector<int> buffers;
+    for (int view : views) buffers.push_back(asset.bufferViews[view].buffer);
+    std::sort(buffers.begin(), buffers.end());
+    buffers.erase(std::unique(buffers.begin(), buffers.end()), buffers.end());
+
+    const std::vector<int> nodeMap = index_map(asset.nodes.size(), resources.nodes);
+    const std::vector<int> meshMap = index_map(asset.meshes.size(), resources.meshes);
+    const std::vector<int> materialMap = index_map(asset.materials.size(), resources.materials);
+    const std::vector<int> textureMap = index_map(asset.textures.size(), resources.textures);
+    const std::vector<int> imageMap = index_map(asset.images.size(), resources.images);
+    const std::vector<int> samplerMap = index_map(asset.samplers.size(), resources.samplers);
+    const std::vector<int> accessorMap = index_map(asset.accessors.size(), resources.accessors);
+    const std::vector<int> viewMap = index_map(asset.bufferViews.size(), views);
+    std::vector<int> bufferMap = index_map(asset.buffers.size(), buffers);
+    if (stream && !buffers.empty()) {
+        for (int &buffer : bufferMap) buffer = buffer >= 0 ? 0 : -1;
+        buffers.resize(1);
+    }
+
+    result.nodes.reserve(resources.nodes.size());
+    for (int index : resources.nodes) {
+        Node node = asset.nodes[index];
+        node.mesh = remap(meshMap, node.mesh);
+        node.children = Span();
+        node.children.offset = uint32_t(result.nodeIndices.size());
+        for (int child : get_node_children(asset, asset.nodes[index])) {
+            int mapped = remap(nodeMap, child);
+            if (mapped >= 0) result.nodeIndices.push_back(mapped), node.children.count++;
+        }
+        if (node.matrix >= 0) {
+            result.matrices.push_back(asset.matrices[node.matrix]);
+            node.matrix = int(result.matrices.size()) - 1;
+        }
+        result.nodes.push_back(node);
+    }
+    if (scene >= 0) {
+        Scene copy = asset.scenes[scene];
+        copy.nodes = Span();
+        copy.nodes.offset = uint32_t(result.nodeIndices.size());
+        for (int root : get_scene_nodes(asset, asset.scenes[scene])) {
+            int mapped = remap(nodeMap, root);
+            if (mapped >= 0) result.nodeIndices.push_back(mapped), copy.nodes.count++;
+        }
+        result.scenes.push_back(copy);
+        result.scene = 0;
+    }
+
+    for (int index : resources.meshes) {
+        Mesh mesh = asset.meshes[index];
+        std::vector<Primitive> primitives;
+        for (Primitive primitive : get_mesh_primitives(asset, asset.meshes[index])) {
+            std::vector<Attribute> attributes;
+            for (Attribute attribute : get_primitive_attributes(asset, primitive)) {
+                attribute.index = remap(accessorMap, attribute.index);
+                attributes.push_back(attribute);
+            }
+            primitive.attributes =
+                add_span(result.attributes, attributes.data(), attributes.size());
+            primitive.indices = remap(accessorMap, primitive.indices);
+            if (primitive.hasMaterial) {
+                primitive.material = remap(materialMap, primitive.material);
+                primitive.hasMaterial = primitive.material >= 0;
+            }
+            primitives.push_back(primitive);
+        }
+        mesh.primitives = add_span(result.primitives, primitives.data(), primitives.size());
+        result.meshes.push_back(mesh);
+    }
+    for (int index : resources.materials) {
+        Material material = asset.materials[index];
+        PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+        remap_texture(textureMap, pbr.baseColorTexture, pbr.hasBaseColorTexture);
+        remap_texture(textureMap, pbr.metallicRoughnessTexture, pbr.hasMetallicRoughnessTexture);
+        remap_texture(textureMap, material.normalTexture, material.hasNormalTexture);
+        remap_texture(textureMap, material.occlusionTexture, material.hasOcclusionTexture);
+        result.materials.push_back(material);
+    }
+    for (int index : resources.textures) {
+        Texture texture = asset.textures[index];
+        texture.source = remap(imageMap, texture.source);
+        if (texture.hasSampler) {
+            texture.sampler = remap(samplerMap, texture.sampler);
+            texture.hasSampler = texture.sampler >= 0;
+        }
+        result.textures.push_back(texture);
+    }
+    for (int index : resources.images) {
+        Image &image = asset.images[index];
+        result.images.push_back(Image());
+        Image &copy = result.images.back();
+        copy.uri = image.uri;
+        copy.mimeType = image.mimeType;
+        copy.width = image.width;
+        copy.height = image.height;
+        if (keepData) copy.data = image.data;
+        else copy.data.swap(image.data);
+    }
+    for (int index : resources.samplers) result.samplers.push_back(asset.samplers[index]);
+    for (int index : resources.accessors) {
+        Accessor accessor = asset.accessors[index];
+        accessor.bufferView = remap(viewMap, accessor.bufferView);
+        if (accessor.bounds >= 0 && accessor.bounds < int(asset.bounds.size())) {
+            result.bounds.push_back(asset.bounds[accessor.bounds]);
+            accessor.bounds = int(result.bounds.size()) - 1;
+        }
+        result.accessors.push_back(accessor);
+    }
+
+    // The length of each view is that of its loaded data (or 0 if it could
+    // not be loaded), or that of the view itself if it is streamed
+    std::vector<int64_t> lengths;
+    for (int view : views) {
+        bool valid = !stream || view_in_range(asset, view);
+        lengths.push_back(!stream ? int64_t(loader.views[view].size())
+                                  : valid ? asset.bufferViews[view].byteLength : 0);
+    }
+    result.buffers.resize(buffers.size());
+    std::vector<int64_t> bufferSizes(buffers.size(), 0);
+    for (size_t i = 0; i < views.size(); ++i)
+        bufferSizes[bufferMap[asset.bufferViews[views[i]].buffer]] += align4(lengths[i]);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        result.buffers[i].uri = asset.buffers[buffers[i]].uri;
+        result.buffers[i].byteLength = stream ? bufferSizes[i] : 0;
+        if (!stream) result.buffers[i].data.reserve(size_t(bufferSizes[i]));
+    }
+    std::vector<int64_t> offsets(buffers.size(), 0);
+    for (size_t i = 0; i < views.size(); ++i) {
+        BufferView copy = asset.bufferViews[views[i]];
+        const Buffer &source = asset.buffers[copy.buffer];
+        copy.buffer = bufferMap[copy.buffer];
+        copy.byteOffset = offsets[copy.buffer];
+        copy.byteLength = lengths[i];
+        offsets[copy.buffer] += align4(lengths[i]);
+        Buffer &buffer = result.buffers[copy.buffer];
+        if (stream) {
+            int64_t fileOffset;
+            std::string path = buffer_path(loader, source, fileOffset);
+            fileOffset += asset.bufferViews[views[i]].byteOffset;
+            if (copy.byteLength) {
+                add_file_range(buffer, path, fileOffset, copy.byteOffset, copy.byteLength);
+            }
+        } else {
+            std::vector<char> &data = loader.views[views[i]];
+            buffer.data.insert(buffer.data.end(), data.begin(), data.end());
+            buffer.data.resize(size_t(offsets[copy.buffer]));
+            if (!keepData) release(data);
+        }
+        result.bufferViews.push_back(copy);
+    }
+    for (Buffer &buffer : result.buffers) {
+        if (!stream) buffer.byteLength = int64_t(buffer.data.size());
+    }
+}
+
+bool load_scene(SceneLoader &loader, int scene, GLTFAsset &asset, bool keepData)
+{
+    Clock::time_point start = Clock::now();
+    GLTFAsset &source = loader.asset;
+    if (scene < 0) scene = default_scene(source);
+    if (scene >= int(source.scenes.size())) {
+        std::cerr << "Error: " << loader.filename << " has no scene " << scene << std::endl;
+        return false;
+    }
+    SceneResources resources = compute_scene_resources(source, scene);
+    const uint64_t use = ++loader.uses;
+
+    // The buffer views of accessors (unless there are so many that they are
+    // streamed), and of the images that are not decoded yet, which are
+    // released again once they are
+    std::vector<int> views, imageViews;
+    uint64_t geometryBytes = 0;
+    for (int view : resources.bufferViews) {
+        if (!loader.accessorViews[view]) continue;
+        views.push_back(view);
+        geometryBytes += uint64_t(source.bufferViews[view].byteLength);
+    }
+    const bool stream = geometryBytes > loader.streamBytes;
+    if (stream) views.clear();
+    for (int index : resources.images) {
+        int view = source.images[index].bufferView;
+        if (!source.images[index].data.empty() || view < 0 || view >= int(source.bufferViews.size()))
+            continue;
+        views.push_back(view);
+        if (!loader.accessorViews[view]) imageViews.push_back(view);
+    }
+    bool ok = load_buffer_views(loader, views);
+    for (int view : views) loader.viewUses[view] = use;
+
+    for (int index : resources.images) {
+        Image &image = source.images[index];
+        loader.imageUses[index] = use;
+        if (!image.data.empty()) continue;
+        bool decoded = false;
+        if (image.bufferView < 0) {
+            decoded = load_gltf_image(loader.filedir, image);
+        } else if (image.bufferView < int(source.bufferViews.size())) {
+            const std::vector<char> &data = loader.views[image.bufferView];
+            decoded = !data.empty() && decode_gltf_image(data.data(), data.size(), image);
+        }
+        if (decoded) {
+            loader.stats.loadedBytes += image.data.size();
+            loader.stats.imagesDecoded++;
+        }
+    }
+    for (int view : imageViews) release(loader.views[view]);
+
+    if (keepData) release_unused_data(loader, use);
+    extract_scene(loader, scene, resources, asset, keepData, stream);
+    loader.stats.residentBytes = resident_bytes(loader);
+    loader.stats.streamedBytes = stream ? size_t(geometryBytes) : 0;
+    loader.stats.scenesLoaded++;
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    loader.stats.lastLoadMs = elapsed.count();
+    return ok;
+}
+
+}  // namespace
+
+int default_scene(const GLTFAsset &asset)
+{
+    if (asset.scene >= 0 && asset.scene < int(asset.scenes.size())) return asset.scene;
+    return asset.scenes.empty() ? -1 : 0;
+}
+
+SceneResources compute_scene_resources(const GLTFAsset &asset, int scene)
+{
+    std::vector<uint8_t> nodes(asset.nodes.size()), meshes(asset.meshes.size());
+    std::vector<uint8_t> materials(asset.materials.size()), textures(asset.textures.size());
+    std::vector<uint8_t> images(asset.images.size()), samplers(asset.samplers.size());
+    std::vector<uint8_t> accessors(asset.accessors.size()), views(asset.bufferViews.size());
+    std::vector<uint8_t> buffers(asset.buffers.size());
+
+    // The nodes of the scene and their descendants
+    if (scene < 0) {
+        std::fill(nodes.begin(), nodes.end(), 1);
+    } else {
+        std::vector<int> stack;
+        for (int root : get_scene_nodes(asset, asset.scenes[scene])) {
+            if (mark(nodes, root)) stack.push_back(root);
+        }
+        while (!stack.empty()) {
+            const Node &node = asset.nodes[stack.back()];
+            stack.pop_back();
+            for (int child : get_node_children(asset, node)) {
+                if (mark(nodes, child)) stack.push_back(child);
+            }
+        }
+    }
+
+    // Everything that they refer to, one kind of resource after another
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i]) mark(meshes, asset.nodes[i].mesh);
+    }
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        if (!meshes[i]) continue;
+        for (const Primitive &primitive : get_mesh_primitives(asset, asset.meshes[i])) {
+            mark(accessors, primitive.indices);
+            if (primitive.hasMaterial) mark(materials, primitive.material);
+            for (const Attribute &attribute : get_primitive_attributes(asset, primitive))
+                mark(accessors, attribute.index);
+        }
+    }
+    for (size_t i = 0; i < materials.size(); ++i) {
+        if (!materials[i]) continue;
+        const Material &material = asset.materials[i];
+        const PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+        mark_texture(textures, pbr.baseColorTexture, pbr.hasBaseColorTexture);
+        mark_texture(textures, pbr.metallicRoughnessTexture, pbr.hasMetallicRoughnessTexture);
+        mark_texture(textures, material.normalTexture, material.hasNormalTexture);
+        mark_texture(textures, material.occlusionTexture, material.hasOcclusionTexture);
+    }
+    for (size_t i = 0; i < textures.size(); ++i) {
+        if (!textures[i]) continue;
+        mark(images, asset.textures[i].source);
+        if (asset.textures[i].hasSampler) mark(samplers, asset.textures[i].sampler);
+    }
+    for (size_t i = 0; i < accessors.size(); ++i) {
+        if (accessors[i]) mark(views, asset.accessors[i].bufferView);
+    }
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (images[i]) mark(views, asset.images[i].bufferView);
+    }
+    for (size_t i = 0; i < views.size(); ++i) {
+        if (views[i]) mark(buffers, asset.bufferViews[i].buffer);
+    }
+
+    SceneResources resources;
+    resources.nodes = marked_indices(nodes);
+    resources.meshes = marked_indices(meshes);
+    resources.materials = marked_indices(materials);
+    resources.textures = marked_indices(textures);
+    resources.images = marked_indices(images);
+    resources.samplers = marked_indices(samplers);
+    resources.accessors = marked_indices(accessors);
+    resources.bufferViews = marked_indices(views);
+    resources.buffers = marked_indices(buffers);
+    return resources;
+}
+
+bool scene_loader_open(SceneLoader &loader, const std::string &filename, const std::string &filedir)
+{
+    GLTFAsset asset;
+    size_t binOffset;
+    if (!load_gltf_description(filename, filedir, asset, binOffset)) return false;
+
+    loader.filename = filename;
+    loader.filedir = filedir;
+    loader.binOffset = binOffset;
+    loader.asset = std::move(asset);
+    loader.views.assign(loader.asset.bufferViews.size(), std::vector<char>());
+    loader.accessorViews.assign(loader.asset.bufferViews.size(), 0);
+    for (const Accessor &accessor : loader.asset.accessors)
+        mark(loader.accessorViews, accessor.bufferView);
+    loader.viewUses.assign(loader.asset.bufferViews.size(), 0);
+    loader.imageUses.assign(loader.asset.images.size(), 0);
+    loader.stats.residentBytes = 0;
+    return true;
+}
+
+bool scene_loader_load(SceneLoader &loader, int scene, GLTFAsset &asset)
+{
+    return load_scene(loader, scene, asset, true);
+}
+
+void scene_loader_invalidate(SceneLoader &loader, const std::string &path)
+{
+    const GLTFAsset &asset = loader.asset;
+    std::vector<uint8_t> changedViews(asset.bufferViews.size());
+    for (size_t i = 0; i < asset.bufferViews.size(); ++i) {
+        int buffer = asset.bufferViews[i].buffer;
+        if (buffer < 0 || buffer >= int(asset.buffers.size()) ||
+            asset.buffers[buffer].uri.empty() || loader.filedir + asset.buffers[buffer].uri != path)
+            continue;
+        changedViews[i] = 1;
+        release(loader.views[i]);
+    }
+    for (Image &image : loader.asset.images) {
+        bool changed = image.bufferView < 0 ? loader.filedir + image.uri == path
+                                            : image.bufferView < int(changedViews.size()) &&
+                                                  changedViews[image.bufferView];
+        if (changed) release(image.data);
+    }
+    loader.stats.residentBytes = resident_bytes(loader);
+}
+
+bool load_gltf_scene(const std::string &filename, const std::string &filedir, int scene,
+                     GLTFAsset &asset, size_t streamBytes)
+{
+    SceneLoader loader;
+    loader.streamBytes = streamBytes;
+    return scene_loader_open(loader, filename, filedir) && load_scene(loader, scene, asset, false);
+}
+
+}  // namespace gltf
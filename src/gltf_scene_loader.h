@@ -0,0 +1,105 @@
+// Lazy loading of the scenes of multi-scene glTF assets.
+//
+// A glTF file can hold many scenes (e.g. the variants of a product in a
+// configurator) that share some of their meshes, buffers and images. The
+// scene loader reads only the scene description up front. The data that a
+// scene needs is found by following its nodes (and their children) to their
+// meshes, accessors, buffer views, materials, textures and images, and is
+// loaded when the scene is first shown: only the byte ranges of the buffer
+// views that it uses are read from the buffer files (or the BIN chunk of a
+// .glb file), and only its images are decoded. The scene is then copied into
+// an asset of its own, with the used buffer views packed into its buffers,
+// which is drawn like any other asset.
+//
+// Loaded data is kept for the other scenes that use it, up to a budget. Above
+// the budget, the data that was least recently used by a shown scene is
+// released (and loaded again if that scene is shown again), except for the
+// data of the scene that is being shown.
+//
+// The geometry of scenes that are larger than streamBytes is not loaded at
+// all: the buffers of the scene get the ranges of the files to read instead
+// (see BufferFileRange), which are streamed to the GPU in chunks when the
+// buffers are uploaded, so that host memory does not grow with the size of
+// the scene. Such scenes are drawn, but the CPU passes that need their
+// geometry (deduplication, ambient occlusion, occlusion culling) skip them.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gltf {
+
+// Indices of everything that one scene uses, in increasing order
+struct SceneResources {
+    std::vector<int> nodes;
+    std::vector<int> meshes;
+    std::vector<int> materials;
+    std::vector<int> textures;
+    std::vector<int> images;
+    std::vector<int> samplers;
+    std::vector<int> accessors;
+    std::vector<int> bufferViews;  // Of accessors and embedded images
+    std::vector<int> buffers;
+};
+
+struct SceneLoaderStats {
+    size_t residentBytes = 0;  // Buffer view data and image pixels in memory
+    size_t loadedBytes = 0;    // In total, including data that was loaded again
+    size_t releasedBytes = 0;
+    int viewsLoaded = 0;
+    int imagesDecoded = 0;
+    int scenesLoaded = 0;
+    double lastLoadMs = 0.0;  // Loading and copying of the last scene
+    size_t streamedBytes = 0;  // Geometry of the last scene, if it is streamed from files
+};
+
+struct SceneLoader {
+    size_t budgetBytes = size_t(512) << 20;  // Data of other scenes is released above this
+    size_t streamBytes = size_t(1) << 30;    // Geometry of larger scenes is streamed
+    std::string filename;
+    std::string filedir;
+    size_t binOffset = 0;  // Of the BIN chunk data in a .glb file, or 0
+    GLTFAsset asset;       // Description of all scenes, and the pixels of the decoded images
+    std::vector<std::vector<char>> views;  // Loaded data of each buffer view (or empty)
+    std::vector<uint8_t> accessorViews;    // Buffer views that accessors use (others hold images)
+    std::vector<uint64_t> viewUses;        // When each buffer view and image was last used by a
+    std::vector<uint64_t> imageUses;       // loaded scene
+    uint64_t uses = 0;
+    SceneLoaderStats stats;
+};
+
+// Returns the scene that is shown by default: the one named by the file, or
+// else the first one, or -1 (all nodes) if the asset has no scenes
+int default_scene(const GLTFAsset &asset);
+
+// Returns the resources of a scene, or of all nodes if scene is -1. Indices
+// that are out of range are left out.
+SceneResources compute_scene_resources(const GLTFAsset &asset, int scene);
+
+// Loads the scene description of a .gltf or .glb file. What was loaded before
+// is kept if the file cannot be read.
+bool scene_loader_open(SceneLoader &loader, const std::string &filename,
+                       const std::string &filedir);
+
+// Loads the buffer views and images of a scene (or of the default scene, if
+// scene is -1) that are not loaded yet, releases data of other scenes if more
+// than the budget is loaded, and copies the scene into asset. Missing images
+// are reported but do not fail the load, as in load_gltf_asset().
+bool scene_loader_load(SceneLoader &loader, int scene, GLTFAsset &asset);
+
+// Releases the data loaded from a file that has changed on disk (a buffer or
+// an image), so that it is loaded again for the next scene
+void scene_loader_invalidate(SceneLoader &loader, const std::string &path);
+
+// Loads one scene (or the default scene, if scene is -1) of a file. Its
+// geometry is streamed if it is larger than streamBytes.
+bool load_gltf_scene(const std::string &filename, const std::string &filedir, int scene,
+                     GLTFAsset &asset, size_t streamBytes = SIZE_MAX);
+
+}  // namespace gltf
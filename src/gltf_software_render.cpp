@@ -0,0 +1,598 @@
+// Multithreaded tile-based software rasterizer for glTF assets.
+//
+// The pipeline has four stages, each of which runs on all threads:
+//
+// 1. Vertex shading, as in mesh.vert.
+// 2. Near-plane clipping, triangle setup and binning into 64x64 tiles. Each
+//    thread bins a contiguous range of triangles, so reading the bins of all
+//    threads in order visits the triangles of a tile in submission order.
+// 3. Rasterization of one tile bin at a time per worker. Edge functions are
+//    evaluated four pixels at a time, and 8x8 blocks whose farthest depth is
+//    nearer than the triangle are rejected without evaluating any pixels.
+//    Only the nearest triangle per pixel is recorded (a visibility buffer).
+// 4. Shading of the visible triangles, as in outline.frag and mesh.frag.
+//
+
+#include "gltf_software_render.h"
+#include "cg_parallel.h"
+
+#include <glm/gtc/constants.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace gltf {
+
+static const int TILE_SIZE = 64;
+static const int BLOCK_SIZE = 8;
+static const double SUBPIXEL_SCALE = 256.0;  // Vertices are snapped to 1/256 pixel
+
+struct SoftwareTriangle {
+    // Edge functions e_i(x, y) = a[i] * x + b[i] * y + c[i] for the edge
+    // opposite of vertex i, normalized so that they are positive inside
+    double a[3], b[3], c[3];
+    bool topLeft[3];  // Tie-breaking rule for samples exactly on an edge
+    double area;      // Twice the area in pixels
+    double za, zb, zc;  // Plane equation of NDC depth
+    float minZ;
+    int x0, y0, x1, y1;  // Pixel bounding box, clamped to the viewport
+    float invW[3];
+    glm::vec3 N[3], L[3], V[3];
+    float occlusion[3];
+};
+
+namespace {
+
+struct ShadedVertex {
+    glm::vec4 clip;
+    glm::vec3 N, L, V;
+    float occlusion;  // 1 if ambient occlusion is disabled
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+uint8_t to_unorm8(float value)
+{
+    if (!(value > 0.0f)) return 0;  // Also handles NaN
+    if (value >= 1.0f) return 255;
+    return uint8_t(value * 255.0f + 0.5f);
+}
+
+// Reads the first component of an accessor element, like a vertex attribute
+// fetch of a float attribute
+float read_component(const char *data, int componentType, bool normalized)
+{
+    switch (componentType) {
+    case 5121 /*GL_UNSIGNED_BYTE*/: {
+        uint8_t value = *(const uint8_t *)data;
+        return normalized ? value / 255.0f : float(value);
+    }
+    case 5123 /*GL_UNSIGNED_SHORT*/: {
+        uint16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return normalized ? value / 65535.0f : float(value);
+    }
+    case 5126 /*GL_FLOAT*/: {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    }
+    return 1.0f;
+}
+
+ShadedVertex lerp_vertex(const ShadedVertex &v0, const ShadedVertex &v1, float t)
+{
+    ShadedVertex v;
+    v.clip = glm::mix(v0.clip, v1.clip, t);
+    v.N = glm::mix(v0.N, v1.N, t);
+    v.L = glm::mix(v0.L, v1.L, t);
+    v.V = glm::mix(v0.V, v1.V, t);
+    v.occlusion = v0.occlusion + (v1.occlusion - v0.occlusion) * t;
+    return v;
+}
+
+// Clip a triangle against the near plane (z >= -w). Returns the number of
+// vertices in the resulting polygon (0, 3 or 4).
+int clip_near(const ShadedVertex in[3], ShadedVertex out[4])
+{
+    int count = 0;
+    for (int i = 0; i < 3; ++i) {
+        const ShadedVertex &v0 = in[i], &v1 = in[(i + 1) % 3];
+        float d0 = v0.clip.z + v0.clip.w, d1 = v1.clip.z + v1.clip.w;
+        if (d0 >= 0.0f) out[count++] = v0;
+        if ((d0 >= 0.0f) != (d1 >= 0.0f)) out[count++] = lerp_vertex(v0, v1, d0 / (d0 - d1));
+    }
+    return count;
+}
+
+bool outside_frustum(const ShadedVertex &v0, const ShadedVertex &v1, const ShadedVertex &v2)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        if (v0.clip[axis] > v0.clip.w && v1.clip[axis] > v1.clip.w && v2.clip[axis] > v2.clip.w)
+            return true;
+        if (v0.clip[axis] < -v0.clip.w && v1.clip[axis] < -v1.clip.w &&
+            v2.clip[axis] < -v2.clip.w)
+            return true;
+    }
+    return false;
+}
+
+bool setup_triangle(const ShadedVertex *v[3], int width, int height, SoftwareTriangle &tri)
+{
+    double x[3], y[3];
+    float z[3];
+    for (int i = 0; i < 3; ++i) {
+        float invW = 1.0f / v[i]->clip.w;
+        double sx = (double(v[i]->clip.x) * invW * 0.5 + 0.5) * width;
+        double sy = (double(v[i]->clip.y) * invW * 0.5 + 0.5) * height;
+        x[i] = std::floor(sx * SUBPIXEL_SCALE + 0.5) / SUBPIXEL_SCALE;
+        y[i] = std::floor(sy * SUBPIXEL_SCALE + 0.5) / SUBPIXEL_SCALE;
+        z[i] = v[i]->clip.z * invW;
+        tri.invW[i] = invW;
+    }
+
+    // No face culling (like the viewer), so make the winding counter-clockwise
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0) return false;
+    int order[3] = {0, 1, 2};
+    if (area < 0.0) {
+        std::swap(order[1], order[2]);
+        area = -area;
+    }
+
+    double minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30;
+    for (int i = 0; i < 3; ++i) {
+        int i0 = order[(i + 1) % 3], i1 = order[(i + 2) % 3];
+        tri.a[i] = y[i0] - y[i1];
+        tri.b[i] = x[i1] - x[i0];
+        tri.c[i] = -(tri.a[i] * x[i0] + tri.b[i] * y[i0]);
+        tri.topLeft[i] = (tri.a[i] > 0.0) || (tri.a[i] == 0.0 && tri.b[i] < 0.0);
+
+        int j = order[i];
+        minX = std::min(minX, x[j]), maxX = std::max(maxX, x[j]);
+        minY = std::min(minY, y[j]), maxY = std::max(maxY, y[j]);
+    }
+    tri.area = area;
+
+    // Pixel centers are at half-integer coordinates
+    tri.x0 = std::max(0, int(std::ceil(std::max(minX, -1.0) - 0.5)));
+    tri.y0 = std::max(0, int(std::ceil(std::max(minY, -1.0) - 0.5)));
+    tri.x1 = std::min(width, int(std::floor(std::min(maxX, double(width) + 1.0) - 0.5)) + 1);
+    tri.y1 = std::min(height, int(std::floor(std::min(maxY, double(height) + 1.0) - 0.5)) + 1);
+    if (tri.x0 >= tri.x1 || tri.y0 >= tri.y1) return false;
+
+    tri.za = tri.zb = tri.zc = 0.0;
+    tri.minZ = 1.0f;
+    for (int i = 0; i < 3; ++i) {
+        int j = order[i];
+        tri.za += tri.a[i] * z[j] / area;
+        tri.zb += tri.b[i] * z[j] / area;
+        tri.zc += tri.c[i] * z[j] / area;
+        tri.minZ = std::min(tri.minZ, z[j]);
+        tri.N[i] = v[j]->N;
+        tri.L[i] = v[j]->L;
+        tri.V[i] = v[j]->V;
+        tri.occlusion[i] = v[j]->occlusion;
+    }
+    float invW[3] = {tri.invW[order[0]], tri.invW[order[1]], tri.invW[order[2]]};
+    std::copy(invW, invW + 3, tri.invW);
+    return true;
+}
+
+// Perspective-correct barycentric weights at a pixel center
+void barycentric_weights(const SoftwareTriangle &tri, int x, int y, float weights[3])
+{
+    double px = x + 0.5, py = y + 0.5, sum = 0.0, w[3];
+    for (int i = 0; i < 3; ++i) {
+        w[i] = (tri.a[i] * px + tri.b[i] * py + tri.c[i]) / tri.area * tri.invW[i];
+        sum += w[i];
+    }
+    for (int i = 0; i < 3; ++i) weights[i] = float(w[i] / sum);
+}
+
+template <typename T>
+T interpolate(const T values[3], const float weights[3])
+{
+    return values[0] * weights[0] + values[1] * weights[1] + values[2] * weights[2];
+}
+
+struct Bins {
+    std::vector<SoftwareTriangle> triangles;
+    std::vector<std::vector<uint32_t>> tiles;  // Indices into triangles, per tile
+};
+
+struct RasterCounters {
+    size_t fragments = 0;
+    size_t blocksRejected = 0;
+};
+
+// Rasterize the part of a triangle that overlaps an 8x8 block
+bool rasterize_block(const SoftwareTriangle &tri, int bx, int by, SoftwareFramebuffer &fb,
+                     RasterCounters &counters)
+{
+    int x0 = std::max(tri.x0, bx), x1 = std::min(tri.x1, bx + BLOCK_SIZE);
+    int y0 = std::max(tri.y0, by), y1 = std::min(tri.y1, by + BLOCK_SIZE);
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    // Edge functions and depth relative to the block origin, in single
+    // precision. Negating an edge negates every value exactly, so edges
+    // shared by two triangles never produce gaps or double coverage.
+    double cx = bx + 0.5, cy = by + 0.5;
+    float e0[3], ea[3], eb[3];
+    for (int i = 0; i < 3; ++i) {
+        e0[i] = float(tri.a[i] * cx + tri.b[i] * cy + tri.c[i]);
+        ea[i] = float(tri.a[i]);
+        eb[i] = float(tri.b[i]);
+    }
+    float z0 = float(tri.za * cx + tri.zb * cy + tri.zc);
+    float za = float(tri.za), zb = float(tri.zb);
+
+    bool written = false;
+    for (int y = y0; y < y1; ++y) {
+        float dy = float(y - by);
+        float rowE[3];
+        for (int i = 0; i < 3; ++i) rowE[i] = e0[i] + eb[i] * dy;
+        float rowZ = z0 + zb * dy;
+        float *depthRow = &fb.depth[size_t(y) * fb.width];
+        const SoftwareTriangle **visibilityRow = &fb.visibility[size_t(y) * fb.width];
+
+        for (int x = bx; x < bx + BLOCK_SIZE; x += 4) {
+            int mask = 0;
+            float z[4];
+#ifdef __SSE2__
+            __m128 dx = _mm_setr_ps(float(x - bx), float(x - bx + 1), float(x - bx + 2),
+                                    float(x - bx + 3));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i = 0; i < 3; ++i) {
+                __m128 e = _mm_add_ps(_mm_set1_ps(rowE[i]), _mm_mul_ps(_mm_set1_ps(ea[i]), dx));
+                __m128 test = tri.topLeft[i] ? _mm_cmpge_ps(e, _mm_setzero_ps())
+                                             : _mm_cmpgt_ps(e, _mm_setzero_ps());
+                inside = _mm_and_ps(inside, test);
+            }
+            mask = _mm_movemask_ps(inside);
+            _mm_storeu_ps(z, _mm_add_ps(_mm_set1_ps(rowZ), _mm_mul_ps(_mm_set1_ps(za), dx)));
+#else
+            for (int k = 0; k < 4; ++k) {
+                float dx = float(x - bx + k);
+                bool inside = true;
+                for (int i = 0; i < 3; ++i) {
+                    float e = rowE[i] + ea[i] * dx;
+                    inside = inside && (tri.topLeft[i] ? e >= 0.0f : e > 0.0f);
+                }
+                mask |= inside ? (1 << k) : 0;
+                z[k] = rowZ + za * dx;
+            }
+#endif
+            if (!mask) continue;
+            for (int k = 0; k < 4; ++k) {
+                int px = x + k;
+                if (!(mask & (1 << k)) || px < x0 || px >= x1) continue;
+                counters.fragments++;
+                float depth = z[k] * 0.5f + 0.5f;
+                if (z[k] < -1.0f || z[k] > 1.0f || !(depth < depthRow[px])) continue;
+                depthRow[px] = depth;
+                visibilityRow[px] = &tri;
+                written = true;
+            }
+        }
+    }
+    return written;
+}
+
+void update_block_max_depth(SoftwareFramebuffer &fb, int bx, int by)
+{
+    float maxDepth = 0.0f;
+    for (int y = by; y < std::min(by + BLOCK_SIZE, fb.height); ++y) {
+        for (int x = bx; x < std::min(bx + BLOCK_SIZE, fb.width); ++x) {
+            maxDepth = std::max(maxDepth, fb.depth[size_t(y) * fb.width + x]);
+        }
+    }
+    int blocksX = (fb.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    fb.blockMaxDepth[(by / BLOCK_SIZE) * blocksX + bx / BLOCK_SIZE] = maxDepth;
+}
+
+void rasterize_tile(const std::vector<Bins> &bins, int tile, int tilesX, SoftwareFramebuffer &fb,
+                    RasterCounters &counters)
+{
+    int tx = (tile % tilesX) * TILE_SIZE, ty = (tile / tilesX) * TILE_SIZE;
+    int blocksX = (fb.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (const Bins &threadBins : bins) {
+        for (uint32_t index : threadBins.tiles[tile]) {
+            const SoftwareTriangle &tri = threadBins.triangles[index];
+            int bx0 = std::max(tri.x0, tx) / BLOCK_SIZE * BLOCK_SIZE;
+            int by0 = std::max(tri.y0, ty) / BLOCK_SIZE * BLOCK_SIZE;
+            int bx1 = std::min(tri.x1, tx + TILE_SIZE), by1 = std::min(tri.y1, ty + TILE_SIZE);
+            for (int by = by0; by < by1; by += BLOCK_SIZE) {
+                for (int bx = bx0; bx < bx1; bx += BLOCK_SIZE) {
+                    // Hierarchical depth test against the farthest depth in the block
+                    float blockMaxDepth =
+                        fb.blockMaxDepth[(by / BLOCK_SIZE) * blocksX + bx / BLOCK_SIZE];
+                    if (tri.minZ * 0.5f + 0.5f >= blockMaxDepth) {
+                        counters.blocksRejected++;
+                        continue;
+                    }
+                    if (rasterize_block(tri, bx, by, fb, counters)) {
+                        update_block_max_depth(fb, bx, by);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Emulates texture() with GL_NEAREST filtering and GL_CLAMP_TO_EDGE wrapping
+int texel_index(float texcoord, int size)
+{
+    return std::min(size - 1, std::max(0, int(std::floor(texcoord * size))));
+}
+
+// Same as sobelFilter() in mesh.frag, for the depth texture (which is
+// sampled as (d, 0, 0, 1) with 24-bit precision) or the normal texture
+float sobel_filter(const SoftwareFramebuffer &fb, glm::vec2 texcoord, bool depth)
+{
+    const float dx = 1.0f / 300.0f, dy = 1.0f / 200.0f;
+    glm::vec3 samples[3][3];
+    for (int j = -1; j <= 1; ++j) {
+        for (int i = -1; i <= 1; ++i) {
+            int x = texel_index(texcoord.x + i * dx, fb.width);
+            int y = texel_index(texcoord.y + j * dy, fb.height);
+            size_t index = size_t(y) * fb.width + x;
+            if (depth) {
+                const double scale = double((1 << 24) - 1);
+                float d = float(std::floor(fb.depth[index] * scale + 0.5) / scale);
+                samples[j + 1][i + 1] = glm::vec3(d, 0.0f, 0.0f);
+            } else {
+                const uint8_t *n = &fb.normal[index * 3];
+                samples[j + 1][i + 1] = glm::vec3(n[0], n[1], n[2]) / 255.0f;
+            }
+        }
+    }
+    // Rows of samples are bottom (j = -1) to top (j = 1)
+    const glm::vec3 &topLeft = samples[2][0], &top = samples[2][1], &topRight = samples[2][2];
+    const glm::vec3 &left = samples[1][0], &right = samples[1][2];
+    const glm::vec3 &bottomLeft = samples[0][0], &bottom = samples[0][1],
+                    &bottomRight = samples[0][2];
+    glm::vec3 sx = -topLeft - 2.0f * left - bottomLeft + topRight + 2.0f * right + bottomRight;
+    glm::vec3 sy = -topLeft - 2.0f * top - topRight + bottomLeft + 2.0f * bottom + bottomRight;
+    glm::vec3 sobel = glm::sqrt(sx * sx + sy * sy);
+    return (sobel.r + sobel.g + sobel.b) / 3.0f;
+}
+
+glm::vec3 gamma_correct(const SoftwareShading &shading, glm::vec3 color)
+{
+    if (shading.gamma) return glm::pow(color, glm::vec3(1.0f / 2.2f));
+    return color;
+}
+
+// Same as main() in mesh.frag, for the supported subset of modes
+glm::vec3 shade_pixel(const SoftwareShading &shading, const SoftwareFramebuffer &fb,
+                      const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &V,
+                      float occlusion, glm::vec2 outlineTexcoord)
+{
+    float lambertian = std::max(glm::dot(L, N), 0.0f);
+    glm::vec3 H = glm::normalize(L + V);
+    float specAngle = std::max(glm::dot(H, N), 0.0f);
+    float specular = std::pow(specAngle, shading.specularPower);
+    specular = ((shading.specularPower + 8.0f) / 8.0f) * specular;
+
+    glm::vec3 color(0.0f);
+    glm::vec3 ambientColor = shading.diffuseColor * glm::vec3(0.4f);
+    glm::vec3 diffuseColor = shading.diffuseColor;
+    glm::vec3 specularColor(0.1f);
+    if (shading.ambientEnabled) color = color + ambientColor * occlusion;
+    if (shading.diffuseEnabled) color = color + diffuseColor * L * lambertian * occlusion;
+    if (shading.specularEnabled) color = color + specularColor * L * specular;
+
+    if (!shading.quantizationEnabled) return gamma_correct(shading, color);
+
+    // 1D texture with 8 texels, GL_NEAREST filtering and GL_REPEAT wrapping
+    int texel = int(std::floor(lambertian * 8.0f)) & 7;
+    glm::vec3 toonColor = color * shading.qmap[texel];
+    if (shading.viewOutline) {
+        float depthSobel = sobel_filter(fb, outlineTexcoord, true);
+        float normalSobel = sobel_filter(fb, outlineTexcoord, false);
+        float sobelIntensity = depthSobel + normalSobel / 2.0f;
+        if (sobelIntensity > shading.outlineIntensity) toonColor = glm::vec3(0.0f);
+    }
+    return gamma_correct(shading, toonColor);
+}
+
+}  // namespace
+
+void software_render(const GLTFAsset &asset, const SoftwareShading &shading, int width,
+                     int height, int numThreads, SoftwareFramebuffer &fb,
+                     SoftwareRenderStats *stats)
+{
+    Clock::time_point start = Clock::now();
+    if (numThreads <= 0) numThreads = cg::hardware_threads();
+    SoftwareRenderStats result;
+    result.threads = numThreads;
+
+    // Clear framebuffer (normals are cleared to the background color, like
+    // the outline framebuffer in the viewer)
+    const size_t numPixels = size_t(width) * height;
+    fb.width = width, fb.height = height;
+    fb.color.resize(numPixels * 4);
+    fb.depth.assign(numPixels, 1.0f);
+    fb.normal.resize(numPixels * 3);
+    fb.visibility.assign(numPixels, nullptr);
+    int blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    fb.blockMaxDepth.assign(size_t(blocksX) * blocksY, 1.0f);
+
+    // 1. Vertex shading (same as mesh.vert, for the first primitive of each node)
+    Clock::time_point t = Clock::now();
+    std::vector<ShadedVertex> vertices;
+    std::vector<uint32_t> indices;
+    for (unsigned i = 0; i < asset.nodes.size(); ++i) {
+        const Mesh &mesh = asset.meshes[asset.nodes[i].mesh];
+        const Primitive &primitive = get_mesh_primitives(asset, mesh)[0];
+        const Accessor *position = nullptr, *normal = nullptr, *color = nullptr;
+        for (const auto &it : get_primitive_attributes(asset, primitive)) {
+            if (!accessor_in_bounds(asset, it.index)) continue;  // E.g. streamed from a file
+            if (it.semantic == ATTRIBUTE_POSITION) position = &asset.accessors[it.index];
+            if (it.semantic == ATTRIBUTE_NORMAL) normal = &asset.accessors[it.index];
+            if (it.semantic == ATTRIBUTE_COLOR_0) color = &asset.accessors[it.index];
+        }
+        if (!position || !accessor_in_bounds(asset, primitive.indices)) continue;
+
+        const Accessor &indexAccessor = asset.accessors[primitive.indices];
+        int stride;
+        const char *indexData = get_accessor_data(asset, indexAccessor, 0, stride);
+        uint32_t base = uint32_t(vertices.size());
+        for (int64_t j = 0; j < indexAccessor.count; ++j) {
+            uint32_t index = read_index(indexData, indexAccessor.componentType, size_t(j));
+            if (index < uint32_t(position->count)) indices.push_back(base + index);
+        }
+        indices.resize(indices.size() / 3 * 3);
+
+        glm::mat4 model = (i < shading.modelMatrices.size()) ? shading.modelMatrices[i]
+                                                              : glm::mat4(1.0f);
+        glm::mat4 mv = shading.view * model;
+        glm::mat4 mvp = shading.projection * shading.view * model;
+        glm::mat3 normalMatrix = glm::mat3(mv);
+        int positionStride, normalStride = 0;
+        const char *positionData = get_accessor_data(asset, *position, 12, positionStride);
+        const char *normalData = normal ? get_accessor_data(asset, *normal, 12, normalStride) : nullptr;
+        int colorStride = 0;
+        const char *colorData = nullptr;
+        if (shading.aoEnabled && color && color->count >= position->count) {
+            int colorSize = accessor_element_size(*color);
+            colorData = get_accessor_data(asset, *color, colorSize, colorStride);
+        }
+
+        vertices.resize(base + position->count);
+        cg::parallel_for(numThreads, size_t(position->count), [&](size_t begin, size_t end, int) {
+            for (size_t j = begin; j < end; ++j) {
+                glm::vec3 p = *(const glm::vec3 *)(positionData + j * positionStride);
+                glm::vec3 n(0.0f);
+                if (normalData) n = *(const glm::vec3 *)(normalData + j * normalStride);
+                ShadedVertex &v = vertices[base + j];
+                glm::vec3 positionEye = glm::normalize(glm::vec3(mv * glm::vec4(p, 1.0f)));
+                v.N = glm::normalize(normalMatrix * n);
+                v.L = glm::normalize(shading.lightPosition - positionEye);
+                v.V = glm::normalize(-positionEye);
+                v.clip = mvp * glm::vec4(p, 1.0f);
+                v.occlusion = colorData ? read_component(colorData + j * colorStride,
+                                                         color->componentType, color->normalized)
+                                        : 1.0f;
+            }
+        });
+    }
+    result.triangles = indices.size() / 3;
+    result.vertexSeconds = seconds_since(t);
+
+    // 2. Clipping, triangle setup and binning
+    t = Clock::now();
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<Bins> bins(numThreads);
+    cg::parallel_for(numThreads, result.triangles, [&](size_t begin, size_t end, int thread) {
+        Bins &threadBins = bins[thread];
+        threadBins.tiles.assign(tilesX * tilesY, std::vector<uint32_t>());
+        for (size_t i = begin; i < end; ++i) {
+            const ShadedVertex in[3] = {vertices[indices[3 * i + 0]],
+                                        vertices[indices[3 * i + 1]],
+                                        vertices[indices[3 * i + 2]]};
+            if (outside_frustum(in[0], in[1], in[2])) continue;
+            ShadedVertex polygon[4];
+            int count = clip_near(in, polygon);
+            for (int j = 1; j + 1 < count; ++j) {
+                const ShadedVertex *v[3] = {&polygon[0], &polygon[j], &polygon[j + 1]};
+                SoftwareTriangle tri;
+                if (!setup_triangle(v, width, height, tri)) continue;
+                uint32_t index = uint32_t(threadBins.triangles.size());
+                threadBins.triangles.push_back(tri);
+                for (int ty = tri.y0 / TILE_SIZE; ty <= (tri.y1 - 1) / TILE_SIZE; ++ty) {
+                    for (int tx = tri.x0 / TILE_SIZE; tx <= (tri.x1 - 1) / TILE_SIZE; ++tx) {
+                        threadBins.tiles[ty * tilesX + tx].push_back(index);
+                    }
+                }
+            }
+        }
+    });
+    for (const Bins &threadBins : bins) result.setupTriangles += threadBins.triangles.size();
+    result.setupSeconds = seconds_since(t);
+
+    // 3. Rasterization, with one worker per tile bin at a time
+    t = Clock::now();
+    std::atomic<int> nextTile(0);
+    std::vector<RasterCounters> counters(numThreads);
+    cg::parallel_for(numThreads, numThreads, [&](size_t, size_t, int thread) {
+        for (int tile = nextTile++; tile < tilesX * tilesY; tile = nextTile++) {
+            rasterize_tile(bins, tile, tilesX, fb, counters[thread]);
+        }
+    });
+    for (const RasterCounters &c : counters) {
+        result.fragments += c.fragments;
+        result.blocksRejected += c.blocksRejected;
+    }
+    result.rasterSeconds = seconds_since(t);
+
+    // 4. Shading: first the normals of the outline pass, then the final color
+    t = Clock::now();
+    cg::parallel_for(numThreads, height, [&](size_t begin, size_t end, int) {
+        for (size_t y = begin; y < end; ++y) {
+            for (int x = 0; x < width; ++x) {
+                size_t index = y * width + x;
+                glm::vec3 color = shading.bgColor;
+                if (const SoftwareTriangle *tri = fb.visibility[index]) {
+                    float weights[3];
+                    barycentric_weights(*tri, x, int(y), weights);
+                    color = interpolate(tri->N, weights) * 0.5f + 0.5f;
+                }
+                for (int c = 0; c < 3; ++c) fb.normal[index * 3 + c] = to_unorm8(color[c]);
+            }
+        }
+    });
+    std::vector<size_t> pixels(numThreads, 0);
+    cg::parallel_for(numThreads, height, [&](size_t begin, size_t end, int thread) {
+        for (size_t y = begin; y < end; ++y) {
+            for (int x = 0; x < width; ++x) {
+                size_t index = y * width + x;
+                uint8_t *rgba = &fb.color[index * 4];
+                const SoftwareTriangle *tri = fb.visibility[index];
+                if (!tri) {
+                    for (int c = 0; c < 3; ++c) rgba[c] = to_unorm8(shading.bgColor[c]);
+                    rgba[3] = 0;
+                    continue;
+                }
+                float weights[3];
+                barycentric_weights(*tri, x, int(y), weights);
+                glm::vec2 outlineTexcoord((x + 0.5f) / width, (y + 0.5f) / height);
+                glm::vec3 color = shade_pixel(shading, fb, interpolate(tri->N, weights),
+                                              interpolate(tri->L, weights),
+                                              interpolate(tri->V, weights),
+                                              interpolate(tri->occlusion, weights),
+                                              outlineTexcoord);
+                for (int c = 0; c < 3; ++c) rgba[c] = to_unorm8(color[c]);
+                rgba[3] = 255;
+                pixels[thread]++;
+            }
+        }
+    });
+    for (size_t count : pixels) result.pixels += count;
+    result.shadeSeconds = seconds_since(t);
+
+    // Triangles are referenced by the visibility buffer, which must not
+    // outlive them
+    std::fill(fb.visibility.begin(), fb.visibility.end(), nullptr);
+    result.totalSeconds = seconds_since(start);
+    if (stats) *stats = result;
+}
+
+}  // namespace gltf
@@ -0,0 +1,72 @@
+// Multithreaded tile-based software rasterizer for glTF assets.
+//
+// Renders the same Blinn-Phong and toon-quantization output as mesh.frag,
+// including the Sobel outlines computed from the outline pass, without any
+// GPU. Output is deterministic and does not depend on the number of threads.
+//
+
+#pragma once
+
+#include "gltf_scene.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gltf {
+
+// Struct for the subset of the viewer's shading state that the software
+// renderer supports (environment and texture mapping are not supported)
+struct SoftwareShading {
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::mat4 view = glm::mat4(1.0f);
+    std::vector<glm::mat4> modelMatrices;  // One per node
+    glm::vec3 diffuseColor = glm::vec3(0.5f, 0.0f, 0.5f);
+    bool ambientEnabled = true;
+    bool diffuseEnabled = true;
+    bool specularEnabled = false;
+    bool aoEnabled = false;  // Use baked ambient occlusion from COLOR_0
+    float specularPower = 16.0f;
+    glm::vec3 lightPosition = glm::vec3(1.0f);
+    bool gamma = true;
+    bool quantizationEnabled = true;
+    float qmap[8] = {0.3f, 0.3f, 0.5f, 0.5f, 0.5f, 0.7f, 0.7f, 0.9f};
+    bool viewOutline = true;
+    float outlineIntensity = 0.55f;
+    glm::vec3 bgColor = glm::vec3(0.3f);
+};
+
+struct SoftwareTriangle;
+
+struct SoftwareFramebuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> color;  // RGBA8, bottom row first (like glReadPixels)
+    std::vector<float> depth;    // Window-space depth
+    std::vector<uint8_t> normal; // RGB8 view-space normals (like the outline pass)
+    std::vector<float> blockMaxDepth;  // Hierarchical depth (max per 8x8 block)
+    std::vector<const SoftwareTriangle *> visibility;  // Nearest triangle per pixel
+};
+
+struct SoftwareRenderStats {
+    int threads = 0;
+    size_t triangles = 0;           // Input triangles
+    size_t setupTriangles = 0;      // Triangles left after clipping and culling
+    size_t fragments = 0;           // Covered samples that were depth tested
+    size_t pixels = 0;              // Shaded pixels
+    size_t blocksRejected = 0;      // 8x8 blocks rejected by the hierarchical test
+    double vertexSeconds = 0.0;
+    double setupSeconds = 0.0;      // Clipping, triangle setup and binning
+    double rasterSeconds = 0.0;
+    double shadeSeconds = 0.0;
+    double totalSeconds = 0.0;
+};
+
+// Render all nodes of the asset into the framebuffer, which is resized if
+// necessary. A thread count of zero uses all hardware threads.
+void software_render(const GLTFAsset &asset, const SoftwareShading &shading, int width,
+                     int height, int numThreads, SoftwareFramebuffer &framebuffer,
+                     SoftwareRenderStats *stats = nullptr);
+
+}  // namespace gltf
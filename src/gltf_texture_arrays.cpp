@@ -0,0 +1,241 @@
+// Packing of the textures of a glTF asset into 2D texture arrays.
+//
+
+#include "gltf_texture_arrays.h"
+#include "cg_memory.h"
+#include "cg_parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+namespace gltf {
+
+namespace {
+
+const int REPEAT = 10497;           // GL_REPEAT
+const int MIRRORED_REPEAT = 33648;  // GL_MIRRORED_REPEAT
+
+int next_power_of_two(int x)
+{
+    int p = 1;
+    while (p < x) p *= 2;
+    return p;
+}
+
+Sampler texture_sampler(const GLTFAsset &asset, const Texture &texture)
+{
+    if (texture.hasSampler) return asset.samplers[texture.sampler];
+    Sampler sampler;
+    sampler.wrapS = 33071;      // GL_CLAMP_TO_EDGE
+    sampler.wrapT = 33071;
+    sampler.minFilter = 9987;   // GL_LINEAR_MIPMAP_LINEAR
+    sampler.magFilter = 9729;   // GL_LINEAR
+    return sampler;
+}
+
+std::tuple<int, int, int, int> sampler_key(const Sampler &s)
+{
+    return std::make_tuple(s.wrapS, s.wrapT, s.minFilter, s.magFilter);
+}
+
+}  // namespace
+
+std::vector<bool> srgb_images(const GLTFAsset &asset)
+{
+    std::vector<bool> srgb(asset.images.size(), false);
+    for (const Material &material : asset.materials) {
+        const PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
+        int index = pbr.baseColorTexture.index;
+        if (!pbr.hasBaseColorTexture || index < 0 || index >= int(asset.textures.size())) continue;
+        int source = asset.textures[index].source;
+        if (source >= 0 && source < int(srgb.size())) srgb[source] = true;
+    }
+    return srgb;
+}
+
+void generate_image_mipmaps(GLTFAsset &asset, const cg::MipSettings &settings)
+{
+    std::vector<bool> srgb = srgb_images(asset);
+    std::vector<cg::MipChain> chains;
+    std::vector<Image *> images;
+    for (unsigned i = 0; i < asset.images.size(); ++i) {
+        Image &image = asset.images[i];
+        if (image.data.empty() || image.width <= 0 || image.height <= 0) continue;
+        cg::MipChain chain;
+        chain.rgba = reinterpret_cast<const uint8_t *>(image.data.data());
+        chain.width = image.width;
+        chain.height = image.height;
+        chain.srgb = srgb[i];
+        chains.push_back(chain);
+        images.push_back(&image);
+    }
+    cg::generate_mip_chains(chains, settings);
+    for (size_t i = 0; i < chains.size(); ++i) images[i]->levels = std::move(chains[i].levels);
+}
+
+TexturePacking pack_textures(const GLTFAsset &asset, bool shareArrays, int maxLayers)
+{
+    TexturePacking packing;
+    packing.slots.resize(asset.textures.size());
+
+    std::vector<bool> normalMaps(asset.textures.size(), false), srgb = srgb_images(asset);
+    for (const Material &material : asset.materials) {
+        int index = material.normalTexture.index;
+        if (material.hasNormalTexture && index >= 0 && index < int(normalMaps.size())) normalMaps[index] = true;
+    }
+
+    // Textures of each array, by power-of-two size, sampler and usage
+    typedef std::tuple<int, int, std::tuple<int, int, int, int>, bool, bool> BucketKey;
+    std::map<BucketKey, std::vector<int>> buckets;  // Textures of each bucket
+    std::map<std::pair<int, std::tuple<int, int, int, int>>, int> firstUse;  // Image and sampler
+    for (unsigned i = 0; i < asset.textures.size(); ++i) {
+        const Texture &texture = asset.textures[i];
+        if (texture.source < 0 || texture.source >= int(asset.images.size())) continue;
+        const Image &image = asset.images[texture.source];
+        if (image.data.empty() || image.width <= 0 || image.height <= 0) continue;
+        Sampler sampler = texture_sampler(asset, texture);
+        auto use = std::make_pair(texture.source, sampler_key(sampler));
+        if (firstUse.count(use)) continue;  // Shares the layer of an earlier texture
+        firstUse[use] = int(i);
+        BucketKey key(next_power_of_two(image.width), next_power_of_two(image.height), sampler_key(sampler),
+                      normalMaps[i], srgb[texture.source]);
+        if (!shareArrays) key = BucketKey(int(i), 0, sampler_key(sampler), normalMaps[i], srgb[texture.source]);
+        buckets[key].push_back(int(i));
+    }
+
+    for (const auto &bucket : buckets) {
+        const std::vector<int> &textures = bucket.second;
+        for (size_t first = 0; first < textures.size(); first += size_t(maxLayers)) {
+            size_t last = std::min(textures.size(), first + size_t(maxLayers));
+            PackedArray array;
+            array.sampler = texture_sampler(asset, asset.textures[textures[first]]);
+            array.normalMap = std::get<3>(bucket.first);
+            array.srgb = std::get<4>(bucket.first);
+            for (size_t j = first; j < last; ++j) {
+                const Image &image = asset.images[asset.textures[textures[j]].source];
+                array.width = std::max(array.width, image.width);
+                array.height = std::max(array.height, image.height);
+            }
+            for (size_t j = first; j < last; ++j) {
+                const Image &image = asset.images[asset.textures[textures[j]].source];
+                TextureSlot &slot = packing.slots[textures[j]];
+                slot.array = int(packing.arrays.size());
+                slot.layer = int(array.images.size());
+                slot.scale = glm::vec2(float(image.width) / array.width, float(image.height) / array.height);
+                slot.repeat = array.sampler.wrapS == REPEAT || array.sampler.wrapS == MIRRORED_REPEAT;
+                array.images.push_back(asset.textures[textures[j]].source);
+                packing.imageBytes += size_t(image.width) * image.height * 4;
+                packing.layerBytes += size_t(array.width) * array.height * 4;
+            }
+            packing.arrays.push_back(array);
+        }
+    }
+
+    // Textures that reuse the image and sampler of an earlier texture
+    for (unsigned i = 0; i < asset.textures.size(); ++i) {
+        const Texture &texture = asset.textures[i];
+        if (packing.slots[i].array >= 0 || texture.source < 0 || texture.source >= int(asset.images.size()))
+            continue;
+        auto it = firstUse.find(std::make_pair(texture.source, sampler_key(texture_sampler(asset, texture))));
+        if (it != firstUse.end()) packing.slots[i] = packing.slots[it->second];
+    }
+    return packing;
+}
+
+std::vector<uint8_t> pad_image(const Image &image, int width, int height)
+{
+    std::vector<uint8_t> layer(size_t(width) * height * 4);
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(image.data.data());
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = src + size_t(std::min(y, image.height - 1)) * image.width * 4;
+        uint8_t *dst = &layer[size_t(y) * width * 4];
+        std::memcpy(dst, row, size_t(image.width) * 4);
+        for (int x = image.width; x < width; ++x) std::memcpy(dst + x * 4, row + (image.width - 1) * 4, 4);
+    }
+    return layer;
+}
+
+ArrayLevels compute_array_levels(const GLTFAsset &asset, const PackedArray &array, cg::MipFilter filter)
+{
+    const int levels = cg::mip_level_count(array.width, array.height);
+    const int layers = int(array.images.size());
+    cg::MipSettings settings;
+    settings.filter = filter;
+
+    // Levels of the layers that are padded or whose images have none, in
+    // parallel across layers (level 0 is left empty if it is the image)
+    std::vector<std::vector<std::vector<uint8_t>>> computed(layers);
+    int threads = std::min(layers, cg::hardware_threads());
+    cg::parallel_for(threads, size_t(layers), [&](size_t begin, size_t end, int) {
+        cg::MipSettings single = settings;
+        single.threads = threads > 1 ? 1 : 0;  // Split rows instead if there is a single layer
+        for (size_t layer = begin; layer < end; ++layer) {
+            const Image &src = asset.images[array.images[layer]];
+            bool padded = src.width != array.width || src.height != array.height;
+            if (!padded && int(src.levels.size()) == levels - 1) continue;
+            std::vector<std::vector<uint8_t>> &chain = computed[layer];
+            chain.push_back(padded ? pad_image(src, array.width, array.height) : std::vector<uint8_t>());
+            const uint8_t *base = padded ? chain[0].data() : reinterpret_cast<const uint8_t *>(src.data.data());
+            std::vector<std::vector<uint8_t>> mips =
+                cg::generate_mip_chain(base, array.width, array.height, array.srgb, single);
+            for (std::vector<uint8_t> &mip : mips) chain.push_back(std::move(mip));
+        }
+    });
+
+    ArrayLevels result;
+    result.levels.resize(levels);
+    for (int layer = 0; layer < layers; ++layer) {
+        const Image &src = asset.images[array.images[layer]];
+        const std::vector<std::vector<uint8_t>> &chain = computed[layer];
+        for (int level = 0; level < levels; ++level) {
+            std::vector<uint8_t> &dst = result.levels[level];
+            if (level > 0) {
+                const std::vector<uint8_t> &data = chain.empty() ? src.levels[level - 1] : chain[level];
+                dst.insert(dst.end(), data.begin(), data.end());
+            } else if (!chain.empty() && !chain[0].empty()) {
+                dst.insert(dst.end(), chain[0].begin(), chain[0].end());
+            } else if (layers > 1) {  // A single unpadded layer is read from the asset
+                const uint8_t *pixels = reinterpret_cast<const uint8_t *>(src.data.data());
+                dst.insert(dst.end(), pixels, pixels + src.data.size());
+            }
+        }
+    }
+    return result;
+}
+
+const uint8_t *array_level_data(const GLTFAsset &asset, const PackedArray &array, const ArrayLevels &levels,
+                                int level)
+{
+    if (levels.levels[level].empty()) return reinterpret_cast<const uint8_t *>(asset.images[array.images[0]].data.data());
+    return levels.levels[level].data();
+}
+
+void create_texture_arrays(TextureList &textures, const GLTFAsset &asset, const TexturePacking &packing)
+{
+    destroy_textures(textures);
+    textures.resize(packing.arrays.size());
+    for (unsigned i = 0; i < packing.arrays.size(); ++i) {
+        const PackedArray &array = packing.arrays[i];
+        ArrayLevels levels = compute_array_levels(asset, array, packing.mipFilter);
+
+        glGenTextures(1, &textures[i]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, array.sampler.wrapS);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, array.sampler.wrapT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.sampler.minFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, array.sampler.magFilter);
+        for (int level = 0; level < int(levels.levels.size()); ++level) {
+            int width = std::max(1, array.width >> level), height = std::max(1, array.height >> level);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, GLsizei(array.images.size()), 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, array_level_data(asset, array, levels, level));
+        }
+        cg::memory_track_gl(GL_TEXTURE, textures[i], cg::MEMORY_GL_TEXTURES,
+                            cg::gl_mip_chain_bytes(GL_RGBA8, array.width, array.height,
+                                                   int(array.images.size()), int(levels.levels.size())));
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+}  // namespace gltf
@@ -0,0 +1,88 @@
+// Packing of the textures of a glTF asset into 2D texture arrays.
+//
+// Textures with the same sampler whose sizes round up to the same power of
+// two share an array, with one layer each, so that nodes with different
+// materials can be drawn without rebinding textures. Images smaller than
+// their array are padded by repeating their last row and column, and are
+// addressed with scaled texture coordinates. Normal maps never share an
+// array with color textures, since they are compressed differently.
+//
+
+#pragma once
+
+#include "gltf_render.h"
+#include "cg_mipmap.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gltf {
+
+// Location of an asset texture in the packed arrays
+struct TextureSlot {
+    int array = -1;                     // -1 if the texture has no image
+    int layer = 0;
+    glm::vec2 scale = glm::vec2(1.0f);  // Of texture coordinates (below 1 if padded)
+    bool repeat = false;                // Texture coordinates wrap around
+};
+
+struct PackedArray {
+    int width = 0;              // Of level 0 of every layer
+    int height = 0;
+    std::vector<int> images;    // Image of each layer
+    Sampler sampler;
+    bool normalMap = false;     // Holds the normal textures of materials
+    bool srgb = false;          // Holds base color textures, filtered in linear space
+};
+
+struct TexturePacking {
+    std::vector<PackedArray> arrays;
+    std::vector<TextureSlot> slots;  // Per asset texture
+    size_t imageBytes = 0;           // Level 0 of all packed images
+    size_t layerBytes = 0;           // Level 0 of all layers, including padding
+    cg::MipFilter mipFilter = cg::MIP_FILTER_BOX;  // For the levels of padded layers
+};
+
+// CPU copy of all levels of a packed array, ready for upload
+struct ArrayLevels {
+    GLenum format = GL_RGBA8;  // Internal format (compressed levels are uploaded as they are)
+    std::vector<std::vector<uint8_t>> levels;  // All layers of each level, one after another
+};
+
+// Returns true for images that hold sRGB colors (those of base color textures)
+std::vector<bool> srgb_images(const GLTFAsset &asset);
+
+// Compute the mip levels of all images of an asset on the CPU, in parallel
+// across images, and store them with the images (see Image::levels)
+void generate_image_mipmaps(GLTFAsset &asset, const cg::MipSettings &settings = cg::MipSettings());
+
+// Pack the textures of an asset. Textures that use the same image and sampler
+// share a layer. If shareArrays is false, every image gets an array of its
+// own (with a single layer and no padding).
+TexturePacking pack_textures(const GLTFAsset &asset, bool shareArrays = true, int maxLayers = 256);
+
+// Copy an RGBA8 image into a larger layer, repeating its last row and column
+// into the padding so that filtering does not bleed in black
+std::vector<uint8_t> pad_image(const Image &image, int width, int height);
+
+// Compute the RGBA8 mip chain of a packed array. The levels of unpadded
+// layers are copied from their images if generate_image_mipmaps() computed
+// them, and those of other layers are computed with the filter. Level 0 is
+// left empty if the array is a single unpadded image, which should then be
+// read from the asset instead (see array_level_data).
+ArrayLevels compute_array_levels(const GLTFAsset &asset, const PackedArray &array,
+                                 cg::MipFilter filter = cg::MIP_FILTER_BOX);
+
+// Returns the data of a level of an array, from the asset if it was left out
+const uint8_t *array_level_data(const GLTFAsset &asset, const PackedArray &array, const ArrayLevels &levels,
+                                int level);
+
+// Create a texture array object for every array of the packing (replacing any
+// existing ones in the list), with all levels resident. Use TextureStreamer
+// instead to upload the levels on demand.
+void create_texture_arrays(TextureList &textures, const GLTFAsset &asset, const TexturePacking &packing);
+
+}  // namespace gltf
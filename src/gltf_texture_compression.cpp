@@ -0,0 +1,824 @@
+// Block compression of packed texture arrays (BC1, BC3, BC5 and BC7).
+//
+
+#include "gltf_texture_compression.h"
+#include "gltf_cache.h"
+#include "cg_parallel.h"
+#include "cg_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace gltf {
+
+namespace {
+
+// S3TC formats are not part of core OpenGL (RGTC and BPTC are)
+const GLenum COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+const GLenum COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+
+const uint32_t CACHE_VERSION = 2;  // Of the payload layout, the encoders and the mip filters
+
+// Interpolation weights of 4-bit BC7 indices (out of 64)
+const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+int clamp_int(int x, int lo, int hi) { return std::min(std::max(x, lo), hi); }
+
+size_t block_bytes(TextureFormat format) { return format == TEXTURE_BC1 ? 8 : 16; }
+
+// Copy a 4x4 block of an image, repeating the last row and column at the edges
+void load_block(const uint8_t *rgba, int width, int height, int bx, int by, uint8_t block[16][4])
+{
+    for (int y = 0; y < 4; ++y) {
+        const uint8_t *row = rgba + size_t(std::min(4 * by + y, height - 1)) * width * 4;
+        for (int x = 0; x < 4; ++x)
+            std::memcpy(block[4 * y + x], row + std::min(4 * bx + x, width - 1) * 4, 4);
+    }
+}
+
+void store_block(const uint8_t block[16][4], int width, int height, int bx, int by, uint8_t *rgba)
+{
+    for (int y = 0; y < 4 && 4 * by + y < height; ++y) {
+        for (int x = 0; x < 4 && 4 * bx + x < width; ++x)
+            std::memcpy(rgba + (size_t(4 * by + y) * width + 4 * bx + x) * 4, block[4 * y + x], 4);
+    }
+}
+
+// Endpoints of the first n channels of a block from its bounding box. The
+// diagonal of the box is chosen by the sign of the covariance of each channel
+// with the channel of largest range.
+void bounding_box_endpoints(const uint8_t block[16][4], int n, float e0[4], float e1[4])
+{
+    float mean[4] = {0.0f}, lo[4], hi[4];
+    for (int c = 0; c < n; ++c) {
+        lo[c] = hi[c] = block[0][c];
+        for (int i = 0; i < 16; ++i) {
+            mean[c] += block[i][c] / 16.0f;
+            lo[c] = std::min(lo[c], float(block[i][c]));
+            hi[c] = std::max(hi[c], float(block[i][c]));
+        }
+    }
+    int ref = 0;
+    for (int c = 1; c < n; ++c) ref = (hi[c] - lo[c] > hi[ref] - lo[ref]) ? c : ref;
+    for (int c = 0; c < n; ++c) {
+        float covariance = 0.0f;
+        for (int i = 0; i < 16; ++i)
+            covariance += (block[i][ref] - mean[ref]) * (block[i][c] - mean[c]);
+        e0[c] = covariance < 0.0f ? hi[c] : lo[c];
+        e1[c] = covariance < 0.0f ? lo[c] : hi[c];
+    }
+}
+
+// Endpoints of the first n channels of a block at the extremes of its
+// projection onto the principal axis (from power iteration)
+void principal_axis_endpoints(const uint8_t block[16][4], int n, float e0[4], float e1[4])
+{
+    float mean[4] = {0.0f}, cov[4][4] = {{0.0f}};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < n; ++c) mean[c] += block[i][c] / 16.0f;
+    for (int i = 0; i < 16; ++i) {
+        for (int a = 0; a < n; ++a)
+            for (int b = 0; b < n; ++b)
+                cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+    }
+    float lo[4], hi[4];
+    bounding_box_endpoints(block, n, lo, hi);
+    float axis[4] = {0.0f};
+    for (int c = 0; c < n; ++c) axis[c] = hi[c] - lo[c];
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = {0.0f}, length = 0.0f;
+        for (int a = 0; a < n; ++a) {
+            for (int b = 0; b < n; ++b) next[a] += cov[a][b] * axis[b];
+            length = std::max(length, std::fabs(next[a]));
+        }
+        if (length < 1e-6f) break;
+        for (int c = 0; c < n; ++c) axis[c] = next[c] / length;
+    }
+    float norm = 0.0f;
+    for (int c = 0; c < n; ++c) norm += axis[c] * axis[c];
+    if (norm < 1e-12f) {  // Constant block
+        std::copy(mean, mean + n, e0), std::copy(mean, mean + n, e1);
+        return;
+    }
+    float tMin = 1e30f, tMax = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < n; ++c) t += (block[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t), tMax = std::max(tMax, t);
+    }
+    for (int c = 0; c < n; ++c) {
+        e0[c] = std::min(std::max(mean[c] + tMin * axis[c] / norm, 0.0f), 255.0f);
+        e1[c] = std::min(std::max(mean[c] + tMax * axis[c] / norm, 0.0f), 255.0f);
+    }
+}
+
+// Least-squares endpoints of the first n channels for pixels that lie at the
+// given fractions between them. Returns false if the system is singular.
+bool refine_endpoints(const uint8_t block[16][4], int n, const float weights[16], float e0[4],
+                      float e1[4])
+{
+    float a = 0.0f, b = 0.0f, c = 0.0f, r0[4] = {0.0f}, r1[4] = {0.0f};
+    for (int i = 0; i < 16; ++i) {
+        float w = weights[i];
+        a += (1.0f - w) * (1.0f - w), b += (1.0f - w) * w, c += w * w;
+        for (int k = 0; k < n; ++k) r0[k] += (1.0f - w) * block[i][k], r1[k] += w * block[i][k];
+    }
+    float det = a * c - b * b;
+    if (std::fabs(det) < 1e-6f) return false;
+    for (int k = 0; k < n; ++k) {
+        e0[k] = std::min(std::max((c * r0[k] - b * r1[k]) / det, 0.0f), 255.0f);
+        e1[k] = std::min(std::max((a * r1[k] - b * r0[k]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+// BC1 color blocks (also the color part of BC3)
+
+uint16_t pack_565(const float color[4])
+{
+    int r = clamp_int(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+    int g = clamp_int(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+    int b = clamp_int(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+void unpack_565(uint16_t v, int color[3])
+{
+    int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+    color[0] = (r << 3) | (r >> 2), color[1] = (g << 2) | (g >> 4), color[2] = (b << 3) | (b >> 2);
+}
+
+// Four-color palette (BC1 with c0 > c1, and always in BC3)
+void color_palette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+// Pick the palette entry for each pixel from its projection onto the line
+// between the endpoints (on which the palette lies), and return the total
+// error
+int color_indices(const uint8_t block[16][4], uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+    int palette[4][3], total = 0;
+    color_palette(c0, c1, palette);
+    const int order[4] = {0, 2, 3, 1};  // Palette entries from c0 to c1
+    int axis[3] = {palette[1][0] - palette[0][0], palette[1][1] - palette[0][1],
+                   palette[1][2] - palette[0][2]};
+    int length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    for (int i = 0; i < 16; ++i) {
+        int dot = (block[i][0] - palette[0][0]) * axis[0] +
+                  (block[i][1] - palette[0][1]) * axis[1] +
+                  (block[i][2] - palette[0][2]) * axis[2];
+        int step = length > 0 ? clamp_int((6 * dot + length) / (2 * length), 0, 3) : 0;
+        int index = order[dot < 0 ? 0 : step];
+        int dr = block[i][0] - palette[index][0], dg = block[i][1] - palette[index][1],
+            db = block[i][2] - palette[index][2];
+        indices[i] = uint8_t(index);
+        total += dr * dr + dg * dg + db * db;
+    }
+    return total;
+}
+
+void encode_color_block(const uint8_t block[16][4], CompressionQuality quality, uint8_t *out)
+{
+    float e0[4], e1[4];
+    if (quality == COMPRESSION_FAST) bounding_box_endpoints(block, 3, e0, e1);
+    else principal_axis_endpoints(block, 3, e0, e1);
+    uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+    uint8_t indices[16];
+    int error = color_indices(block, c0, c1, indices);
+
+    const float fractions[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};  // Of each index toward c1
+    const int iterations = quality == COMPRESSION_HIGH ? 2 : 0;
+    for (int iteration = 0; iteration < iterations && error > 0; ++iteration) {
+        float weights[16];
+        for (int i = 0; i < 16; ++i) weights[i] = fractions[indices[i]];
+        if (!refine_endpoints(block, 3, weights, e0, e1)) break;
+        uint16_t r0 = pack_565(e0), r1 = pack_565(e1);
+        uint8_t refined[16];
+        int refinedError = color_indices(block, r0, r1, refined);
+        if (refinedError >= error) break;
+        c0 = r0, c1 = r1, error = refinedError;
+        std::memcpy(indices, refined, 16);
+    }
+
+    // BC1 uses the four-color palette only if c0 > c1
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        const uint8_t swapped[4] = {1, 0, 3, 2};
+        for (int i = 0; i < 16; ++i) indices[i] = swapped[indices[i]];
+    } else if (c0 == c1) {
+        std::memset(indices, 0, 16);
+    }
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i) bits |= uint32_t(indices[i]) << (2 * i);
+    out[0] = uint8_t(c0), out[1] = uint8_t(c0 >> 8);
+    out[2] = uint8_t(c1), out[3] = uint8_t(c1 >> 8);
+    for (int i = 0; i < 4; ++i) out[4 + i] = uint8_t(bits >> (8 * i));
+}
+
+void decode_color_block(const uint8_t *in, bool alwaysFourColors, uint8_t block[16][4])
+{
+    uint16_t c0 = uint16_t(in[0] | (in[1] << 8)), c1 = uint16_t(in[2] | (in[3] << 8));
+    int palette[4][3];
+    color_palette(c0, c1, palette);
+    bool transparent = !alwaysFourColors && c0 <= c1;
+    if (transparent) {
+        for (int c = 0; c < 3; ++c)
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2, palette[3][c] = 0;
+    }
+    uint32_t bits = uint32_t(in[4]) | (uint32_t(in[5]) << 8) | (uint32_t(in[6]) << 16) |
+                    (uint32_t(in[7]) << 24);
+    for (int i = 0; i < 16; ++i) {
+        int index = (bits >> (2 * i)) & 3;
+        for (int c = 0; c < 3; ++c) block[i][c] = uint8_t(palette[index][c]);
+        block[i][3] = (transparent && index == 3) ? 0 : 255;
+    }
+}
+
+// BC4 single-channel blocks (the alpha of BC3 and both channels of BC5)
+
+void channel_palette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0, palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 2; i < 8; ++i) palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    } else {
+        for (int i = 2; i < 6; ++i) palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+        palette[6] = 0, palette[7] = 255;
+    }
+}
+
+// Pick the nearest palette entry for each value and return the total error
+#ifdef __SSE2__
+int channel_indices(const uint8_t values[16], int a0, int a1, uint8_t indices[16])
+{
+    int palette[8];
+    channel_palette(a0, a1, palette);
+    // All 16 values at once: track the smallest absolute difference and the
+    // palette entry it came from in each byte lane
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+    __m128i best = _mm_set1_epi8(char(255)), bestIndex = _mm_setzero_si128();
+    for (int j = 0; j < 8; ++j) {
+        __m128i entry = _mm_set1_epi8(char(palette[j]));
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(v, entry), _mm_subs_epu8(entry, v));
+        __m128i nearer = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_min_epu8(difference, best), best),
+                                          _mm_set1_epi8(-1));  // difference < best
+        best = _mm_min_epu8(difference, best);
+        bestIndex = _mm_or_si128(_mm_and_si128(nearer, _mm_set1_epi8(char(j))),
+                                 _mm_andnot_si128(nearer, bestIndex));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), bestIndex);
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(best, zero), hi = _mm_unpackhi_epi8(best, zero);
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#else
+int channel_indices(const uint8_t values[16], int a0, int a1, uint8_t indices[16])
+{
+    int palette[8], total = 0;
+    channel_palette(a0, a1, palette);
+    for (int i = 0; i < 16; ++i) {
+        int best = 0, bestError = 1 << 30;
+        for (int j = 0; j < 8; ++j) {
+            int error = (values[i] - palette[j]) * (values[i] - palette[j]);
+            if (error < bestError) best = j, bestError = error;
+        }
+        indices[i] = uint8_t(best);
+        total += bestError;
+    }
+    return total;
+}
+#endif
+
+void encode_channel_block(const uint8_t block[16][4], int channel, CompressionQuality quality,
+                          uint8_t *out)
+{
+    uint8_t values[16];
+    for (int i = 0; i < 16; ++i) values[i] = block[i][channel];
+    int lo = *std::min_element(values, values + 16), hi = *std::max_element(values, values + 16);
+    int a0 = hi, a1 = lo;
+    uint8_t indices[16] = {0};
+    if (hi > lo) {
+        int error = channel_indices(values, a0, a1, indices);
+        const float fractions[8] = {0.0f,     1.0f,     1 / 7.0f, 2 / 7.0f,
+                                    3 / 7.0f, 4 / 7.0f, 5 / 7.0f, 6 / 7.0f};
+        const int iterations = quality == COMPRESSION_HIGH ? 2 : 0;
+        for (int iteration = 0; iteration < iterations && error > 0; ++iteration) {
+            float weights[16], e0[4], e1[4];
+            for (int i = 0; i < 16; ++i) weights[i] = fractions[indices[i]];
+            if (!refine_endpoints(block, 4, weights, e0, e1)) break;
+            int b0 = int(e0[channel] + 0.5f), b1 = int(e1[channel] + 0.5f);
+            if (b0 <= b1) break;  // Would switch to the six-value palette
+            uint8_t refined[16];
+            int refinedError = channel_indices(values, b0, b1, refined);
+            if (refinedError >= error) break;
+            error = refinedError, a0 = b0, a1 = b1;
+            std::memcpy(indices, refined, 16);
+        }
+    }
+    out[0] = uint8_t(a0), out[1] = uint8_t(a1);
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; ++i) bits |= uint64_t(indices[i]) << (3 * i);
+    for (int i = 0; i < 6; ++i) out[2 + i] = uint8_t(bits >> (8 * i));
+}
+
+void decode_channel_block(const uint8_t *in, int channel, uint8_t block[16][4])
+{
+    int palette[8];
+    channel_palette(in[0], in[1], palette);
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i) bits |= uint64_t(in[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; ++i) block[i][channel] = uint8_t(palette[(bits >> (3 * i)) & 7]);
+}
+
+// BC7 blocks, in mode 6 only: one subset, RGBA endpoints of 7 bits plus a
+// shared low bit each, and 4-bit indices
+
+struct BitWriter {
+    uint8_t *out;
+    int position;
+    void write(uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; ++i, ++position)
+            if ((value >> i) & 1) out[position >> 3] |= uint8_t(1 << (position & 7));
+    }
+};
+
+struct BitReader {
+    const uint8_t *in;
+    int position;
+    uint32_t read(int bits)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < bits; ++i, ++position)
+            value |= uint32_t((in[position >> 3] >> (position & 7)) & 1) << i;
+        return value;
+    }
+};
+
+// Quantize an endpoint to 7 bits per channel and a shared low bit
+void quantize_bc7_endpoint(const float e[4], int q[4], int &p)
+{
+    float bestError = 1e30f;
+    for (int bit = 0; bit < 2; ++bit) {
+        int candidate[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c) {
+            candidate[c] = clamp_int(int(std::floor((e[c] - bit) / 2.0f + 0.5f)), 0, 127);
+            float d = float((candidate[c] << 1) | bit) - e[c];
+            error += d * d;
+        }
+        if (error < bestError) bestError = error, p = bit, std::copy(candidate, candidate + 4, q);
+    }
+}
+
+void bc7_palette(const int q0[4], int p0, const int q1[4], int p1, int palette[16][4])
+{
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            int v0 = (q0[c] << 1) | p0, v1 = (q1[c] << 1) | p1;
+            palette[i][c] = ((64 - BC7_WEIGHTS[i]) * v0 + BC7_WEIGHTS[i] * v1 + 32) >> 6;
+        }
+    }
+}
+
+// Pick the palette entry for each pixel from its projection onto the line
+// between the endpoints, checking the neighbors of the nearest weight (the
+// weights are not evenly spaced), and return the total error
+int bc7_indices(const uint8_t block[16][4], const int palette[16][4], uint8_t indices[16])
+{
+    int axis[4], length = 0, total = 0;
+    for (int c = 0; c < 4; ++c)
+        axis[c] = palette[15][c] - palette[0][c], length += axis[c] * axis[c];
+    for (int i = 0; i < 16; ++i) {
+        int dot = 0;
+        for (int c = 0; c < 4; ++c) dot += (block[i][c] - palette[0][c]) * axis[c];
+        int guess = length > 0 ? clamp_int((30 * dot + length) / (2 * length), 0, 15) : 0;
+        int best = guess, bestError = 1 << 30;
+        for (int j = std::max(guess - 1, 0); j <= std::min(guess + 1, 15); ++j) {
+            int error = 0;
+            for (int c = 0; c < 4; ++c)
+                error += (block[i][c] - palette[j][c]) * (block[i][c] - palette[j][c]);
+            if (error < bestError) best = j, bestError = error;
+        }
+        indices[i] = uint8_t(best);
+        total += bestError;
+    }
+    return total;
+}
+
+void encode_bc7_block(const uint8_t block[16][4], CompressionQuality quality, uint8_t *out)
+{
+    float e0[4], e1[4];
+    if (quality == COMPRESSION_FAST) bounding_box_endpoints(block, 4, e0, e1);
+    else principal_axis_endpoints(block, 4, e0, e1);
+    int q0[4], q1[4], p0 = 0, p1 = 0, palette[16][4];
+    quantize_bc7_endpoint(e0, q0, p0);
+    quantize_bc7_endpoint(e1, q1, p1);
+    bc7_palette(q0, p0, q1, p1, palette);
+    uint8_t indices[16];
+    int error = bc7_indices(block, palette, indices);
+
+    const int iterations = quality == COMPRESSION_HIGH ? 2 : 0;
+    for (int iteration = 0; iteration < iterations && error > 0; ++iteration) {
+        float weights[16];
+        for (int i = 0; i < 16; ++i) weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+        if (!refine_endpoints(block, 4, weights, e0, e1)) break;
+        int r0[4], r1[4], rp0 = 0, rp1 = 0;
+        quantize_bc7_endpoint(e0, r0, rp0);
+        quantize_bc7_endpoint(e1, r1, rp1);
+        bc7_palette(r0, rp0, r1, rp1, palette);
+        uint8_t refined[16];
+        int refinedError = bc7_indices(block, palette, refined);
+        if (refinedError >= error) break;
+        std::copy(r0, r0 + 4, q0), std::copy(r1, r1 + 4, q1);
+        p0 = rp0, p1 = rp1, error = refinedError;
+        std::memcpy(indices, refined, 16);
+    }
+
+    // The high bit of the first index is implied to be zero
+    if (indices[0] >= 8) {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (int i = 0; i < 16; ++i) indices[i] = uint8_t(15 - indices[i]);
+    }
+    std::memset(out, 0, 16);
+    BitWriter writer = {out, 0};
+    writer.write(1 << 6, 7);  // Mode 6
+    for (int c = 0; c < 4; ++c) writer.write(uint32_t(q0[c]), 7), writer.write(uint32_t(q1[c]), 7);
+    writer.write(uint32_t(p0), 1), writer.write(uint32_t(p1), 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; ++i) writer.write(indices[i], 4);
+}
+
+void decode_bc7_block(const uint8_t *in, uint8_t block[16][4])
+{
+    BitReader reader = {in, 0};
+    if (reader.read(7) != (1 << 6)) {  // Other modes are not decoded
+        for (int i = 0; i < 16; ++i)
+            block[i][0] = 255, block[i][1] = 0, block[i][2] = 255, block[i][3] = 255;
+        return;
+    }
+    int q0[4], q1[4], palette[16][4];
+    for (int c = 0; c < 4; ++c) q0[c] = int(reader.read(7)), q1[c] = int(reader.read(7));
+    int p0 = int(reader.read(1)), p1 = int(reader.read(1));
+    bc7_palette(q0, p0, q1, p1, palette);
+    for (int i = 0; i < 16; ++i) {
+        int index = int(reader.read(i == 0 ? 3 : 4));
+        for (int c = 0; c < 4; ++c) block[i][c] = uint8_t(palette[index][c]);
+    }
+}
+
+bool has_alpha(const GLTFAsset &asset, const PackedArray &array)
+{
+    for (int image : array.images) {
+        const std::vector<char> &data = asset.images[image].data;
+        for (size_t i = 3; i < data.size(); i += 4)
+            if (uint8_t(data[i]) != 255) return true;
+    }
+    return false;
+}
+
+TextureFormat choose_format(const GLTFAsset &asset, const PackedArray &array,
+                            const TextureCompressionSettings &settings)
+{
+    TextureFormat format = TEXTURE_BC1;
+    if (array.normalMap) format = TEXTURE_BC5;
+    else if (settings.useBC7) format = TEXTURE_BC7;
+    else if (has_alpha(asset, array)) format = TEXTURE_BC3;
+    return texture_format_supported(format) ? format : TEXTURE_RGBA8;
+}
+
+void append_bytes(std::vector<char> &payload, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    payload.insert(payload.end(), bytes, bytes + size);
+}
+
+// Payload of the cache file: the format, level count and levels of each
+// array. Levels of RGBA8 arrays are not stored, since they are cheap to
+// recompute.
+std::vector<char> serialize_levels(const std::vector<ArrayLevels> &arrays,
+                                   const std::vector<TextureFormat> &formats)
+{
+    std::vector<char> payload;
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        uint32_t format = formats[i];
+        uint32_t count = format == TEXTURE_RGBA8 ? 0 : uint32_t(arrays[i].levels.size());
+        append_bytes(payload, &format, sizeof(format));
+        append_bytes(payload, &count, sizeof(count));
+        for (uint32_t level = 0; level < count; ++level) {
+            uint64_t size = arrays[i].levels[level].size();
+            append_bytes(payload, &size, sizeof(size));
+            append_bytes(payload, arrays[i].levels[level].data(), size);
+        }
+    }
+    return payload;
+}
+
+bool deserialize_levels(const std::vector<char> &payload, const GLTFAsset &asset,
+                        const TexturePacking &packing, const std::vector<TextureFormat> &formats,
+                        std::vector<ArrayLevels> &arrays)
+{
+    size_t offset = 0;
+    auto read = [&](void *data, size_t size) {
+        if (offset + size > payload.size()) return false;
+        std::memcpy(data, payload.data() + offset, size);
+        offset += size;
+        return true;
+    };
+    arrays.assign(packing.arrays.size(), ArrayLevels());
+    for (size_t i = 0; i < packing.arrays.size(); ++i) {
+        uint32_t format = 0, count = 0;
+        if (!read(&format, sizeof(format)) || !read(&count, sizeof(count))) return false;
+        if (format != uint32_t(formats[i])) return false;
+        if (format == TEXTURE_RGBA8) {
+            arrays[i] = compute_array_levels(asset, packing.arrays[i], packing.mipFilter);
+            continue;
+        }
+        arrays[i].format = texture_format_internal_format(formats[i]);
+        arrays[i].levels.resize(count);
+        for (uint32_t level = 0; level < count; ++level) {
+            uint64_t size = 0;
+            if (!read(&size, sizeof(size)) || offset + size > payload.size()) return false;
+            const char *data = payload.data() + offset;
+            arrays[i].levels[level].assign(data, data + size);
+            offset += size;
+        }
+    }
+    return offset == payload.size();
+}
+
+}  // namespace
+
+size_t texture_level_size(TextureFormat format, int width, int height)
+{
+    if (format == TEXTURE_RGBA8) return size_t(width) * height * 4;
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+GLenum texture_format_internal_format(TextureFormat format)
+{
+    switch (format) {
+    case TEXTURE_BC1: return COMPRESSED_RGB_S3TC_DXT1;
+    case TEXTURE_BC3: return COMPRESSED_RGBA_S3TC_DXT5;
+    case TEXTURE_BC5: return GL_COMPRESSED_RG_RGTC2;
+    case TEXTURE_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default: return GL_RGBA8;
+    }
+}
+
+const char *texture_format_name(TextureFormat format)
+{
+    const char *names[] = {"RGBA8", "BC1", "BC3", "BC5", "BC7"};
+    return names[format];
+}
+
+bool texture_format_supported(TextureFormat format)
+{
+    // Queried once, so that later calls (e.g. from loader threads) need no context
+    static const bool s3tc = cg::has_gl_extension("GL_EXT_texture_compression_s3tc");
+    static const bool bptc =
+        gl3wIsSupported(4, 2) || cg::has_gl_extension("GL_ARB_texture_compression_bptc");
+    switch (format) {
+    case TEXTURE_BC1:
+    case TEXTURE_BC3: return s3tc;
+    case TEXTURE_BC5: return true;  // Core since OpenGL 3.0
+    case TEXTURE_BC7: return bptc;
+    default: return true;
+    }
+}
+
+void encode_texture_blocks(TextureFormat format, const uint8_t *rgba, int width, int height,
+                           CompressionQuality quality, uint8_t *blocks, int threads)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    const size_t bytes = block_bytes(format);
+    if (threads <= 0) threads = cg::hardware_threads();
+    if (blocksX * blocksY < 256) threads = 1;  // Not worth starting threads for
+    threads = std::min(threads, blocksY);
+    cg::parallel_for(threads, size_t(blocksY), [&](size_t begin, size_t end, int) {
+        uint8_t block[16][4];
+        for (size_t by = begin; by < end; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                load_block(rgba, width, height, bx, int(by), block);
+                uint8_t *out = blocks + (by * blocksX + bx) * bytes;
+                switch (format) {
+                case TEXTURE_BC1: encode_color_block(block, quality, out); break;
+                case TEXTURE_BC3:
+                    encode_channel_block(block, 3, quality, out);
+                    encode_color_block(block, quality, out + 8);
+                    break;
+                case TEXTURE_BC5:
+                    encode_channel_block(block, 0, quality, out);
+                    encode_channel_block(block, 1, quality, out + 8);
+                    break;
+                case TEXTURE_BC7: encode_bc7_block(block, quality, out); break;
+                default: break;
+                }
+            }
+        }
+    });
+}
+
+void decode_texture_blocks(TextureFormat format, const uint8_t *blocks, int width, int height,
+                           uint8_t *rgba)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    const size_t bytes = block_bytes(format);
+    uint8_t block[16][4];
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            const uint8_t *in = blocks + (size_t(by) * blocksX + bx) * bytes;
+            switch (format) {
+            case TEXTURE_BC1: decode_color_block(in, false, block); break;
+            case TEXTURE_BC3:
+                decode_color_block(in + 8, true, block);
+                decode_channel_block(in, 3, block);
+                break;
+            case TEXTURE_BC5:
+                for (int i = 0; i < 16; ++i) block[i][2] = 0, block[i][3] = 255;
+                decode_channel_block(in, 0, block);
+                decode_channel_block(in + 8, 1, block);
+                break;
+            case TEXTURE_BC7: decode_bc7_block(in, block); break;
+            default: break;
+            }
+            store_block(block, width, height, bx, by, rgba);
+        }
+    }
+}
+
+double texture_psnr(TextureFormat format, const uint8_t *original, const uint8_t *decoded,
+                    int width, int height)
+{
+    const int channels = format == TEXTURE_BC5 ? 2 : 3;
+    double squaredError = 0.0;
+    for (size_t i = 0; i < size_t(width) * height; ++i) {
+        for (int c = 0; c < channels; ++c) {
+            double d = double(original[4 * i + c]) - double(decoded[4 * i + c]);
+            squaredError += d * d;
+        }
+    }
+    double mse = squaredError / std::max<size_t>(1, size_t(width) * height * channels);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+std::vector<ArrayLevels> compress_texture_arrays(const GLTFAsset &asset,
+                                                 const TexturePacking &packing,
+                                                 const TextureCompressionSettings &settings,
+                                                 const std::string &cacheFilename,
+                                                 TextureCompressionStats *stats)
+{
+    TextureCompressionStats localStats;
+    if (!stats) stats = &localStats;
+    *stats = TextureCompressionStats();
+
+    // The cache key covers the settings, the chosen formats and all images
+    std::vector<TextureFormat> formats;
+    uint64_t key = hash_bytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+    key = hash_bytes(&settings.quality, sizeof(settings.quality), key);
+    key = hash_bytes(&packing.mipFilter, sizeof(packing.mipFilter), key);
+    for (const PackedArray &array : packing.arrays) {
+        formats.push_back(settings.enabled ? choose_format(asset, array, settings) : TEXTURE_RGBA8);
+        int header[4] = {formats.back(), array.width, array.height, array.srgb};
+        key = hash_bytes(header, sizeof(header), key);
+        for (int image : array.images) {
+            const Image &src = asset.images[image];
+            key = hash_bytes(&src.width, sizeof(src.width), key);
+            key = hash_bytes(src.data.data(), src.data.size(), key);
+        }
+    }
+
+    std::vector<ArrayLevels> arrays;
+    std::vector<char> payload;
+    if (!cacheFilename.empty() && read_cache_file(cacheFilename, key, payload) &&
+        deserialize_levels(payload, asset, packing, formats, arrays)) {
+        stats->fromCache = true;
+    } else {
+        arrays.clear();
+        for (size_t i = 0; i < packing.arrays.size(); ++i) {
+            const PackedArray &array = packing.arrays[i];
+            arrays.push_back(compute_array_levels(asset, array, packing.mipFilter));
+            if (formats[i] == TEXTURE_RGBA8) continue;
+            Clock::time_point start = Clock::now();
+            ArrayLevels compressed;
+            compressed.format = texture_format_internal_format(formats[i]);
+            const int layers = int(array.images.size());
+            for (int level = 0; level < int(arrays.back().levels.size()); ++level) {
+                int width = std::max(1, array.width >> level);
+                int height = std::max(1, array.height >> level);
+                const uint8_t *data = array_level_data(asset, array, arrays.back(), level);
+                size_t layerSize = texture_level_size(formats[i], width, height);
+                compressed.levels.emplace_back(layerSize * layers);
+                for (int layer = 0; layer < layers; ++layer) {
+                    const uint8_t *src = data + size_t(width) * height * 4 * layer;
+                    uint8_t *dst = compressed.levels.back().data() + layerSize * layer;
+                    encode_texture_blocks(formats[i], src, width, height, settings.quality, dst,
+                                          settings.threads);
+                }
+                stats->encodedPixels += size_t(width) * height * layers;
+            }
+            stats->encodeSeconds += seconds_since(start);
+            arrays.back() = std::move(compressed);
+        }
+        if (!cacheFilename.empty() &&
+            !write_cache_file(cacheFilename, key, serialize_levels(arrays, formats)))
+            std::cerr << "Warning: could not write " << cacheFilename << std::endl;
+    }
+
+    // Sizes and the error of level 0 (against the padded layers)
+    double squaredError = 0.0;
+    size_t samples = 0;
+    for (size_t i = 0; i < packing.arrays.size(); ++i) {
+        const PackedArray &array = packing.arrays[i];
+        const int layers = int(array.images.size());
+        for (int level = 0; level < int(arrays[i].levels.size()); ++level) {
+            int width = std::max(1, array.width >> level);
+            int height = std::max(1, array.height >> level);
+            stats->uncompressedBytes += texture_level_size(TEXTURE_RGBA8, width, height) * layers;
+            stats->compressedBytes += texture_level_size(formats[i], width, height) * layers;
+        }
+        if (formats[i] == TEXTURE_RGBA8) continue;
+        stats->compressedArrays++;
+        size_t layerSize = texture_level_size(formats[i], array.width, array.height);
+        std::vector<uint8_t> decoded(size_t(array.width) * array.height * 4);
+        for (int layer = 0; layer < layers; ++layer) {
+            const Image &image = asset.images[array.images[layer]];
+            std::vector<uint8_t> original = pad_image(image, array.width, array.height);
+            decode_texture_blocks(formats[i], arrays[i].levels[0].data() + layerSize * layer,
+                                  array.width, array.height, decoded.data());
+            double psnr = texture_psnr(formats[i], original.data(), decoded.data(), array.width,
+                                       array.height);
+            size_t count = size_t(array.width) * array.height * (formats[i] == TEXTURE_BC5 ? 2 : 3);
+            squaredError += count * 255.0 * 255.0 / std::pow(10.0, psnr / 10.0);
+            samples += count;
+        }
+    }
+    double mse = squaredError / std::max<size_t>(1, samples);
+    stats->psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    return arrays;
+}
+
+ArrayLevels compute_layer_levels(const Image &image, const PackedArray &array, GLenum format,
+                                 CompressionQuality quality, cg::MipFilter filter, int threads)
+{
+    cg::MipSettings settings;
+    settings.filter = filter;
+    settings.threads = threads;
+    const int levels = cg::mip_level_count(array.width, array.height);
+    const bool padded = image.width != array.width || image.height != array.height;
+    std::vector<std::vector<uint8_t>> chain;
+    if (padded) chain.push_back(pad_image(image, array.width, array.height));
+    else chain.push_back(std::vector<uint8_t>(image.data.begin(), image.data.end()));
+    if (!padded && int(image.levels.size()) == levels - 1) {
+        chain.insert(chain.end(), image.levels.begin(), image.levels.end());
+    } else {
+        std::vector<std::vector<uint8_t>> mips =
+            cg::generate_mip_chain(chain[0].data(), array.width, array.height, array.srgb, settings);
+        for (std::vector<uint8_t> &mip : mips) chain.push_back(std::move(mip));
+    }
+
+    ArrayLevels result;
+    result.format = format;
+    TextureFormat blockFormat = TEXTURE_RGBA8;
+    for (int i = TEXTURE_BC1; i <= TEXTURE_BC7; ++i) {
+        if (texture_format_internal_format(TextureFormat(i)) == format) blockFormat = TextureFormat(i);
+    }
+    if (blockFormat == TEXTURE_RGBA8) {
+        result.levels.swap(chain);
+        return result;
+    }
+    for (int level = 0; level < levels; ++level) {
+        int width = std::max(1, array.width >> level), height = std::max(1, array.height >> level);
+        result.levels.emplace_back(texture_level_size(blockFormat, width, height));
+        encode_texture_blocks(blockFormat, chain[level].data(), width, height, quality,
+                              result.levels.back().data(), threads);
+    }
+    return result;
+}
+
+}  // namespace gltf
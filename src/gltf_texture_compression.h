@@ -0,0 +1,90 @@
+// Block compression of packed texture arrays (BC1, BC3, BC5 and BC7).
+//
+// Color textures are encoded as BC1 (opaque) or BC3 (with alpha), or as BC7
+// if requested, and normal maps as BC5 (their X and Y components). The
+// encoder runs on all hardware threads, one row of blocks at a time. The
+// encoded levels of an asset are stored in its cache file, so they are only
+// computed once. Formats that the OpenGL implementation does not support
+// are left as RGBA8.
+//
+
+#pragma once
+
+#include "gltf_texture_arrays.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gltf {
+
+enum TextureFormat { TEXTURE_RGBA8 = 0, TEXTURE_BC1, TEXTURE_BC3, TEXTURE_BC5, TEXTURE_BC7 };
+
+enum CompressionQuality {
+    COMPRESSION_FAST = 0,  // Endpoints from the bounding box of each block
+    COMPRESSION_HIGH = 1   // Endpoints along the principal axis, refined by least squares
+};
+
+struct TextureCompressionSettings {
+    bool enabled = false;  // Lossy, so only used when asked for
+    CompressionQuality quality = COMPRESSION_HIGH;
+    bool useBC7 = false;  // Encode color textures as BC7 (16 bytes per block) instead of BC1/BC3
+    int threads = 0;      // 0 for all hardware threads
+};
+
+struct TextureCompressionStats {
+    int compressedArrays = 0;
+    size_t uncompressedBytes = 0;  // Of all levels of all arrays as RGBA8
+    size_t compressedBytes = 0;    // Of all levels of all arrays as uploaded
+    size_t encodedPixels = 0;      // Zero if all levels were read from the cache
+    double encodeSeconds = 0.0;
+    double psnr = 0.0;             // Of level 0 of the compressed arrays, in dB
+    bool fromCache = false;
+};
+
+// Bytes of one level of one layer in the format
+size_t texture_level_size(TextureFormat format, int width, int height);
+
+GLenum texture_format_internal_format(TextureFormat format);
+
+const char *texture_format_name(TextureFormat format);
+
+// Returns true if the current OpenGL context can sample 2D arrays of the
+// format. The first call queries the context, and later calls return the
+// same results from any thread.
+bool texture_format_supported(TextureFormat format);
+
+// Encode an RGBA8 image into blocks of the format. Partial blocks at the
+// right and bottom edges repeat the last column and row.
+void encode_texture_blocks(TextureFormat format, const uint8_t *rgba, int width, int height,
+                           CompressionQuality quality, uint8_t *blocks, int threads = 0);
+
+// Decode blocks of the format into an RGBA8 image. BC7 blocks are only
+// decoded in the mode that encode_texture_blocks writes (mode 6).
+void decode_texture_blocks(TextureFormat format, const uint8_t *blocks, int width, int height,
+                           uint8_t *rgba);
+
+// Returns the PSNR (in dB) of the channels that a format stores: RGB, or RG
+// for BC5
+double texture_psnr(TextureFormat format, const uint8_t *original, const uint8_t *decoded,
+                    int width, int height);
+
+// Compute the levels of all arrays of a packing, block compressed in the
+// format chosen for each array. The levels are read from the cache file if
+// it holds the same images and settings, and written to it otherwise (unless
+// the filename is empty).
+std::vector<ArrayLevels> compress_texture_arrays(const GLTFAsset &asset,
+                                                 const TexturePacking &packing,
+                                                 const TextureCompressionSettings &settings,
+                                                 const std::string &cacheFilename,
+                                                 TextureCompressionStats *stats = nullptr);
+
+// Compute all levels of one layer of a packed array from its image, in the
+// internal format of the array's levels (see ArrayLevels::format), e.g. to
+// replace the layer after the image has changed. The image must still fit
+// the array.
+ArrayLevels compute_layer_levels(const Image &image, const PackedArray &array, GLenum format,
+                                 CompressionQuality quality, cg::MipFilter filter, int threads = 0);
+
+}  // namespace gltf
@@ -0,0 +1,416 @@
+// Streaming of texture mip levels under a GPU memory budget.
+//
+
+#include "gltf_texture_streaming.h"
+#include "cg_gl_state.h"
+#include "cg_memory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace gltf {
+
+namespace {
+
+const int FLOAT = 5126;  // GL_FLOAT
+
+int level_width(const StreamedTexture &texture, int level) { return std::max(1, texture.width >> level); }
+
+int level_height(const StreamedTexture &texture, int level) { return std::max(1, texture.height >> level); }
+
+// Size of a level of all layers of an array, as it is uploaded
+size_t level_bytes(const TextureStreamer &streamer, int index, int level)
+{
+    const StreamedTexture &texture = streamer.textures[index];
+    const std::vector<uint8_t> &data = streamer.arrayLevels[index].levels[level];
+    if (!data.empty()) return data.size();
+    return size_t(level_width(texture, level)) * level_height(texture, level) * 4 * texture.layers;
+}
+
+const uint8_t *level_data(const TextureStreamer &streamer, const GLTFAsset &asset, int index, int level)
+{
+    return array_level_data(asset, streamer.packing.arrays[index], streamer.arrayLevels[index], level);
+}
+
+// Specify a level of an array, from the bound pixel-unpack buffer if data is
+// null
+void upload_level(const TextureStreamer &streamer, int index, int level, const void *data)
+{
+    const StreamedTexture &texture = streamer.textures[index];
+    GLenum format = streamer.arrayLevels[index].format;
+    int width = level_width(texture, level), height = level_height(texture, level);
+    if (format == GL_RGBA8) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, texture.layers, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, data);
+    } else {
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, width, height, texture.layers, 0,
+                               GLsizei(level_bytes(streamer, index, level)), data);
+    }
+}
+
+// Computes the ratio of texture coordinate units to model units of the first
+// primitive of a mesh, from the total triangle areas in both spaces. Returns
+// zero if the mesh has no float texture coordinates.
+float compute_texel_density(const GLTFAsset &asset, const Mesh &mesh)
+{
+    if (mesh.primitives.count == 0) return 0.0f;
+    const Primitive &primitive = get_mesh_primitives(asset, mesh)[0];
+    const Accessor *positions = nullptr, *texcoords = nullptr;
+    for (const Attribute &attribute : get_primitive_attributes(asset, primitive)) {
+        const Accessor *accessor = &asset.accessors[attribute.index];
+        if (attribute.semantic == ATTRIBUTE_POSITION) positions = accessor;
+        if (attribute.semantic == ATTRIBUTE_TEXCOORD_0) texcoords = accessor;
+    }
+    if (!positions || !texcoords || texcoords->componentType != FLOAT) return 0.0f;
+    if (!buffers_loaded(asset)) return 0.0f;  // The geometry is streamed from files
+
+    int positionStride, texcoordStride, indexStride = 0;
+    const char *positionData = get_accessor_data(asset, *positions, 12, positionStride);
+    const char *texcoordData = get_accessor_data(asset, *texcoords, 8, texcoordStride);
+    const char *indexData = nullptr;
+    int componentType = 0;
+    size_t count = size_t(positions->count);
+    if (primitive.indices >= 0) {
+        const Accessor &indices = asset.accessors[primitive.indices];
+        componentType = indices.componentType;
+        indexData = get_accessor_data(asset, indices, 0, indexStride);
+        count = size_t(indices.count);
+    }
+
+    double area = 0.0, texcoordArea = 0.0;
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        glm::vec3 p[3];
+        glm::vec2 t[3];
+        for (int j = 0; j < 3; ++j) {
+            size_t index = indexData ? read_index(indexData, componentType, i + j) : i + j;
+            std::memcpy(&p[j], positionData + index * positionStride, sizeof(p[j]));
+            std::memcpy(&t[j], texcoordData + index * texcoordStride, sizeof(t[j]));
+        }
+        area += glm::length(glm::cross(p[1] - p[0], p[2] - p[0]));
+        glm::vec2 e1 = t[1] - t[0], e2 = t[2] - t[0];
+        texcoordArea += std::fabs(e1.x * e2.y - e1.y * e2.x);
+    }
+    return area > 0.0 ? float(std::sqrt(texcoordArea / area)) : 0.0f;
+}
+
+// Evict the finest level of the least recently requested texture that has
+// evictable levels, other than the given one. Returns false if there is none.
+bool evict_one(TextureStreamer &streamer, const TextureList &textures, int keep)
+{
+    int victim = -1;
+    for (int i = 0; i < int(streamer.textures.size()); ++i) {
+        const StreamedTexture &texture = streamer.textures[i];
+        if (i == keep || texture.residentLevel >= texture.coarseLevel) continue;
+        // Prefer textures that have more levels than they need right now
+        bool surplus = texture.lastRequested != streamer.frame || texture.residentLevel < texture.requestedLevel;
+        if (!surplus) continue;
+        if (victim < 0 || texture.lastRequested < streamer.textures[victim].lastRequested) victim = i;
+    }
+    if (victim < 0) return false;
+
+    StreamedTexture &texture = streamer.textures[victim];
+    int level = texture.residentLevel;
+    size_t bytes = level_bytes(streamer, victim, level);
+    cg::gl_state_bind_texture(GL_TEXTURE_2D_ARRAY, textures[victim]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level + 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);  // Free it
+    texture.residentLevel = level + 1;
+    texture.residentBytes -= bytes;
+    streamer.residentBytes -= bytes;
+    streamer.evictedLevels++;
+    cg::memory_track_gl(GL_TEXTURE, textures[victim], cg::MEMORY_GL_TEXTURES, texture.residentBytes);
+    return true;
+}
+
+// Upload the next finer level of a texture through the next buffer of the
+// ring. Returns false if that buffer is still in use.
+bool upload_next_level(TextureStreamer &streamer, const TextureList &textures, const GLTFAsset &asset,
+                       int index)
+{
+    int slot = streamer.uploadsIssued % TextureStreamer::UPLOAD_RING_SIZE;
+    GLsync &fence = streamer.uploadFences[slot];
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    StreamedTexture &texture = streamer.textures[index];
+    int level = texture.residentLevel - 1;
+    size_t bytes = level_bytes(streamer, index, level);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer.uploadBuffers[slot]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bytes), nullptr, GL_STREAM_DRAW);
+    cg::memory_track_gl(GL_BUFFER, streamer.uploadBuffers[slot], cg::MEMORY_GL_STREAMING, bytes);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(bytes),
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!dst) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+    std::memcpy(dst, level_data(streamer, asset, index, level), bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // The copy from the buffer to the texture runs asynchronously, but is
+    // ordered before any draw call that samples the new level
+    cg::gl_state_bind_texture(GL_TEXTURE_2D_ARRAY, textures[index]);
+    upload_level(streamer, index, level, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    streamer.uploadsIssued++;
+
+    texture.residentLevel = level;
+    texture.residentBytes += bytes;
+    streamer.residentBytes += bytes;
+    streamer.uploadedBytes += bytes;
+    streamer.uploadedLevels++;
+    cg::memory_track_gl(GL_TEXTURE, textures[index], cg::MEMORY_GL_TEXTURES, texture.residentBytes);
+    return true;
+}
+
+}  // namespace
+
+void texture_streaming_init(TextureStreamer &streamer, TextureList &textures, const GLTFAsset &asset,
+                            const TexturePacking &packing, std::vector<ArrayLevels> levels)
+{
+    TextureStreamingSettings settings = streamer.settings;
+    texture_streaming_destroy(streamer, textures);
+    streamer.settings = settings;
+    streamer.packing = packing;
+
+    texture_streaming_update_meshes(streamer, asset);
+
+    // Create the arrays with only their coarse levels, after computing the
+    // mip chains of all layers on the CPU (unless they were given)
+    glGenBuffers(TextureStreamer::UPLOAD_RING_SIZE, streamer.uploadBuffers);
+    textures.resize(packing.arrays.size());
+    streamer.textures.resize(packing.arrays.size());
+    streamer.arrayLevels.swap(levels);
+    if (streamer.arrayLevels.size() != packing.arrays.size()) {
+        streamer.arrayLevels.clear();
+        for (const PackedArray &array : packing.arrays)
+            streamer.arrayLevels.push_back(compute_array_levels(asset, array, packing.mipFilter));
+    }
+    for (unsigned i = 0; i < packing.arrays.size(); ++i) {
+        const PackedArray &array = packing.arrays[i];
+        StreamedTexture &texture = streamer.textures[i];
+        texture.width = array.width;
+        texture.height = array.height;
+        texture.layers = int(array.images.size());
+        texture.levels = int(streamer.arrayLevels[i].levels.size());
+        texture.coarseLevel = 0;
+        while (std::max(level_width(texture, texture.coarseLevel), level_height(texture, texture.coarseLevel)) >
+               settings.residentSize) {
+            texture.coarseLevel++;
+        }
+        texture.residentLevel = texture.coarseLevel;
+        texture.requestedLevel = texture.levels;  // No request yet
+
+        glGenTextures(1, &textures[i]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, array.sampler.wrapS);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, array.sampler.wrapT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.sampler.minFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, array.sampler.magFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, texture.residentLevel);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+        for (int level = texture.residentLevel; level < texture.levels; ++level) {
+            upload_level(streamer, i, level, level_data(streamer, asset, i, level));
+            texture.residentBytes += level_bytes(streamer, i, level);
+        }
+        streamer.residentBytes += texture.residentBytes;
+        cg::memory_track_gl(GL_TEXTURE, textures[i], cg::MEMORY_GL_TEXTURES, texture.residentBytes);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void texture_streaming_update_meshes(TextureStreamer &streamer, const GLTFAsset &asset)
+{
+    streamer.meshTexelDensity.clear();
+    streamer.meshSpheres.clear();
+    std::vector<Bounds> bounds = compute_mesh_bounds(asset);
+    for (unsigned i = 0; i < asset.meshes.size(); ++i) {
+        streamer.meshTexelDensity.push_back(compute_texel_density(asset, asset.meshes[i]));
+        glm::vec3 center = 0.5f * (bounds[i].min + bounds[i].max);
+        streamer.meshSpheres.push_back(glm::vec4(center, glm::length(bounds[i].max - center)));
+    }
+}
+
+size_t texture_streaming_release_images(const TextureStreamer &streamer, GLTFAsset &asset)
+{
+    std::vector<bool> keep(asset.images.size(), false);
+    for (size_t i = 0; i < streamer.arrayLevels.size(); ++i) {
+        const std::vector<int> &images = streamer.packing.arrays[i].images;
+        const std::vector<std::vector<uint8_t>> &levels = streamer.arrayLevels[i].levels;
+        if (!images.empty() && images[0] < int(keep.size()) && !levels.empty() && levels[0].empty())
+            keep[images[0]] = true;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < asset.images.size(); ++i) {
+        Image &image = asset.images[i];
+        for (const std::vector<uint8_t> &level : image.levels) bytes += level.capacity();
+        std::vector<std::vector<uint8_t>>().swap(image.levels);
+        if (keep[i]) continue;
+        bytes += image.data.capacity();
+        std::vector<char>().swap(image.data);
+    }
+    return bytes;
+}
+
+void texture_streaming_replace_layer(TextureStreamer &streamer, const TextureList &textures, int index,
+                                     int layer, const ArrayLevels &levels)
+{
+    StreamedTexture &texture = streamer.textures[index];
+    ArrayLevels &arrayLevels = streamer.arrayLevels[index];
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textures[index]);
+    for (int level = 0; level < texture.levels; ++level) {
+        const std::vector<uint8_t> &data = levels.levels[level];
+        std::vector<uint8_t> &dst = arrayLevels.levels[level];
+        if (!dst.empty()) std::copy(data.begin(), data.end(), dst.begin() + data.size() * layer);
+        if (level < texture.residentLevel) continue;
+
+        // Resident levels are updated in place, with the other layers kept
+        int width = level_width(texture, level), height = level_height(texture, level);
+        if (arrayLevels.format == GL_RGBA8) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, GL_RGBA,
+                            GL_UNSIGNED_BYTE, data.data());
+        } else {
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1,
+                                      arrayLevels.format, GLsizei(data.size()), data.data());
+        }
+        streamer.uploadedBytes += data.size();
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void texture_streaming_destroy(TextureStreamer &streamer, TextureList &textures)
+{
+    destroy_textures(textures);
+    for (int i = 0; i < TextureStreamer::UPLOAD_RING_SIZE; ++i) {
+        if (streamer.uploadFences[i]) glDeleteSync(streamer.uploadFences[i]);
+    }
+    if (streamer.uploadBuffers[0]) {
+        cg::memory_release_gl(GL_BUFFER, TextureStreamer::UPLOAD_RING_SIZE, streamer.uploadBuffers);
+        glDeleteBuffers(TextureStreamer::UPLOAD_RING_SIZE, streamer.uploadBuffers);
+    }
+    TextureStreamingSettings settings = streamer.settings;
+    streamer = TextureStreamer();
+    streamer.settings = settings;
+}
+
+int texture_streaming_select_level(const TextureStreamer &streamer, const GLTFAsset &asset, int mesh,
+                                   const glm::mat4 &modelView, const glm::mat4 &projection,
+                                   int viewportHeight, int &array)
+{
+    array = -1;
+    if (streamer.textures.empty() || mesh < 0 || mesh >= int(streamer.meshSpheres.size())) return -1;
+
+    // Screen pixels per unit of mesh size at the point of the bounding sphere
+    // nearest to the camera
+    const glm::vec4 &sphere = streamer.meshSpheres[mesh];
+    float scale = std::max(glm::length(glm::vec3(modelView[0])),
+                           std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+    float pixelsPerUnit = 0.5f * viewportHeight * projection[1][1] * scale;
+    if (projection[3][3] == 0.0f) {  // Perspective projection
+        float depth = -(modelView * glm::vec4(glm::vec3(sphere), 1.0f)).z - sphere.w * scale;
+        pixelsPerUnit /= std::max(depth, 1e-3f);
+    }
+
+    for (const Primitive &primitive : get_mesh_primitives(asset, asset.meshes[mesh])) {
+        if (!primitive.hasMaterial) continue;
+        const PBRMetallicRoughness &pbr = asset.materials[primitive.material].pbrMetallicRoughness;
+        if (!pbr.hasBaseColorTexture) continue;
+        const TextureSlot &slot = streamer.packing.slots[pbr.baseColorTexture.index];
+        if (slot.array < 0) continue;
+        const StreamedTexture &texture = streamer.textures[slot.array];
+
+        // Meshes without a known texel density get the finest level. Padded
+        // layers only cover part of the array, so the density is scaled too.
+        int level = 0;
+        float texelsPerUnit = streamer.meshTexelDensity[mesh] *
+                              std::max(slot.scale.x * texture.width, slot.scale.y * texture.height);
+        if (texelsPerUnit > 0.0f && pixelsPerUnit > 0.0f) {
+            float lod = std::log2(std::max(texelsPerUnit / pixelsPerUnit, 1.0f)) + streamer.settings.lodBias;
+            level = std::min(std::max(int(std::floor(lod)), 0), texture.levels - 1);
+        }
+        array = slot.array;
+        return level;
+    }
+    return -1;
+}
+
+void texture_streaming_request_level(TextureStreamer &streamer, int array, int level)
+{
+    if (array < 0 || array >= int(streamer.textures.size()) || level < 0) return;
+    StreamedTexture &texture = streamer.textures[array];
+    if (texture.lastRequested != streamer.frame) texture.requestedLevel = texture.levels;
+    texture.requestedLevel = std::min(texture.requestedLevel, level);
+    texture.lastRequested = streamer.frame;
+}
+
+void texture_streaming_request(TextureStreamer &streamer, const GLTFAsset &asset, int mesh,
+                               const glm::mat4 &modelView, const glm::mat4 &projection,
+                               int viewportHeight)
+{
+    int array;
+    int level = texture_streaming_select_level(streamer, asset, mesh, modelView, projection,
+                                               viewportHeight, array);
+    texture_streaming_request_level(streamer, array, level);
+}
+
+void texture_streaming_update(TextureStreamer &streamer, const TextureList &textures, const GLTFAsset &asset)
+{
+    if (streamer.textures.empty()) return;
+
+    // The budget may have been lowered
+    while (streamer.residentBytes > streamer.settings.budgetBytes && evict_one(streamer, textures, -1)) {}
+
+    // Upload the textures that are furthest from their requested level first
+    std::vector<int> order;
+    for (int i = 0; i < int(streamer.textures.size()); ++i) {
+        StreamedTexture &texture = streamer.textures[i];
+        texture.overBudget = false;
+        if (texture.lastRequested == streamer.frame && texture.residentLevel > texture.requestedLevel) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        const StreamedTexture &ta = streamer.textures[a], &tb = streamer.textures[b];
+        return ta.residentLevel - ta.requestedLevel > tb.residentLevel - tb.requestedLevel;
+    });
+
+    size_t uploaded = 0;
+    streamer.pending = false;
+    for (int index : order) {
+        StreamedTexture &texture = streamer.textures[index];
+        while (texture.residentLevel > texture.requestedLevel) {
+            size_t bytes = level_bytes(streamer, index, texture.residentLevel - 1);
+            if (uploaded > 0 && uploaded + bytes > streamer.settings.uploadBytesPerFrame) {
+                streamer.pending = true;
+                break;
+            }
+            while (streamer.residentBytes + bytes > streamer.settings.budgetBytes &&
+                   evict_one(streamer, textures, index)) {}
+            if (streamer.residentBytes + bytes > streamer.settings.budgetBytes) {
+                texture.overBudget = true;
+                break;
+            }
+            if (!upload_next_level(streamer, textures, asset, index)) {
+                streamer.pending = true;  // All upload buffers are in flight
+                break;
+            }
+            uploaded += bytes;
+        }
+    }
+    cg::gl_state_bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+    streamer.frame++;
+}
+
+bool texture_streaming_pending(const TextureStreamer &streamer)
+{
+    return streamer.pending;
+}
+
+}  // namespace gltf
@@ -0,0 +1,121 @@
+// Streaming of texture mip levels under a GPU memory budget.
+//
+// Textures start with only their coarse levels resident. Every frame, each
+// drawn node requests the finest level it needs, estimated from the texel
+// density of its mesh's texture coordinates and its projected size on
+// screen. Finer levels are then uploaded one at a time through a ring of
+// pixel-unpack buffers, limited to a number of bytes per frame. When the
+// resident levels exceed the budget, the finest levels of the least recently
+// used textures are evicted. Textures are streamed as the texture arrays of
+// a TexturePacking, with all layers of an array sharing their residency.
+//
+
+#pragma once
+
+#include "gltf_render.h"
+#include "gltf_texture_arrays.h"
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gltf {
+
+struct TextureStreamingSettings {
+    size_t budgetBytes = size_t(256) << 20;       // GPU memory for all textures
+    size_t uploadBytesPerFrame = size_t(4) << 20; // At least one level is uploaded per frame
+    int residentSize = 64;                        // Levels up to this size are never evicted
+    float lodBias = 0.0f;                         // Added to the requested level
+};
+
+// Residency of one texture array. Levels are numbered as in OpenGL, so 0 is
+// the finest and levels - 1 the coarsest (1x1) level.
+struct StreamedTexture {
+    int width = 0;              // Of level 0
+    int height = 0;
+    int layers = 1;
+    int levels = 0;
+    int coarseLevel = 0;        // Finest level that is never evicted
+    int residentLevel = 0;      // Finest level resident on the GPU
+    int requestedLevel = 0;     // Finest level requested in the current frame
+    unsigned lastRequested = 0; // Frame of the last request
+    size_t residentBytes = 0;
+    bool overBudget = false;    // The requested level did not fit in the budget
+};
+
+struct TextureStreamer {
+    static const int UPLOAD_RING_SIZE = 4;
+    TextureStreamingSettings settings;
+    TexturePacking packing;
+    std::vector<StreamedTexture> textures;  // Per packed array
+    std::vector<ArrayLevels> arrayLevels;   // Per packed array, in its upload format
+    std::vector<float> meshTexelDensity;  // Texture coordinate units per unit of mesh size
+    std::vector<glm::vec4> meshSpheres;   // Bounding sphere of each mesh (center and radius)
+    GLuint uploadBuffers[UPLOAD_RING_SIZE] = {0};
+    GLsync uploadFences[UPLOAD_RING_SIZE] = {0};
+    unsigned uploadsIssued = 0;
+    unsigned frame = 1;
+    size_t residentBytes = 0;       // Of all textures
+    size_t uploadedBytes = 0;       // Totals since the textures were created
+    unsigned uploadedLevels = 0;
+    unsigned evictedLevels = 0;
+    bool pending = false;           // More levels are waiting for upload
+};
+
+// Create a texture array object for every array of the packing (replacing any
+// existing ones in the list), with only the coarse levels uploaded. The levels
+// of all arrays are kept for later uploads: either the given ones (e.g. block
+// compressed) or, if none are given, RGBA8 levels computed on the CPU. The
+// images of the asset must not change while streaming, other than by
+// texture_streaming_release_images().
+void texture_streaming_init(TextureStreamer &streamer, TextureList &textures, const GLTFAsset &asset,
+                            const TexturePacking &packing,
+                            std::vector<ArrayLevels> levels = std::vector<ArrayLevels>());
+
+void texture_streaming_destroy(TextureStreamer &streamer, TextureList &textures);
+
+// Recompute the bounds and texel densities of the meshes, after the vertex
+// data of the asset has changed
+void texture_streaming_update_meshes(TextureStreamer &streamer, const GLTFAsset &asset);
+
+// Free the pixels and mip levels of the images of the asset, which the arrays
+// keep their own levels of, except for the images that level 0 of an array is
+// read from (see array_level_data). Returns the number of bytes freed.
+size_t texture_streaming_release_images(const TextureStreamer &streamer, GLTFAsset &asset);
+
+// Replace one layer of an array with new levels (of a single layer, in the
+// format of the array), e.g. after its image has changed. Resident levels are
+// updated in place, and the others when they are streamed in. If level 0 of
+// the array is read from the asset, its image must already be updated.
+void texture_streaming_replace_layer(TextureStreamer &streamer, const TextureList &textures, int index,
+                                     int layer, const ArrayLevels &levels);
+
+// Returns the finest level of the base color texture of a mesh that is drawn
+// with the given model-view and projection matrices into a viewport of the
+// given height, and its array (or -1 if the mesh has no streamed texture).
+// Only reads the streamer, so nodes can be handled on several threads.
+int texture_streaming_select_level(const TextureStreamer &streamer, const GLTFAsset &asset, int mesh,
+                                   const glm::mat4 &modelView, const glm::mat4 &projection,
+                                   int viewportHeight, int &array);
+
+// Request a level of an array for the current frame (ignored if array is -1)
+void texture_streaming_request_level(TextureStreamer &streamer, int array, int level);
+
+// Request the level of the texture of a mesh that is drawn with the given
+// matrices (see texture_streaming_select_level)
+void texture_streaming_request(TextureStreamer &streamer, const GLTFAsset &asset, int mesh,
+                               const glm::mat4 &modelView, const glm::mat4 &projection,
+                               int viewportHeight);
+
+// Evict levels above the budget and upload requested levels. Call once per
+// frame, after all requests and before drawing.
+void texture_streaming_update(TextureStreamer &streamer, const TextureList &textures,
+                              const GLTFAsset &asset);
+
+// Returns true if requested levels are still waiting for upload
+bool texture_streaming_pending(const TextureStreamer &streamer);
+
+}  // namespace gltf
@@ -8,6 +8,30 @@
 #include "gltf_render.h"
 #include "cg_utils.h"
 #include "cg_trackball.h"
+#include "cg_dynamic_resolution.h"
+#include "cg_gl_state.h"
+#include "cg_headless.h"
+#include "cg_readback.h"
+#include "cg_capture.h"
+#include "cg_profiler.h"
+#include "cg_stream_buffer.h"
+#include "cg_upload.h"
+#include "cg_memory.h"
+#include "cg_input_recording.h"
+#include "cg_file_watcher.h"
+#include "cg_jobs.h"
+#include "gltf_software_render.h"
+#include "gltf_occlusion.h"
+#include "gltf_cache.h"
+#include "gltf_dedup.h"
+#include "gltf_scene_loader.h"
+#include "gltf_ambient_occlusion.h"
+#include "gltf_texture_arrays.h"
+#include "gltf_texture_compression.h"
+#include "gltf_texture_streaming.h"
+#include "gltf_frame_prep.h"
+#include "gltf_multi_draw.h"
+#include "gltf_lod.h"
 
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
@@ -19,18 +43,131 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <thread>
+
+// Average CPU and GPU load over the last second
+struct Utilization {
+    double wallStart = -1.0;  // Start of the current measurement (in seconds)
+    double cpuStart = 0.0;
+    double gpuMs = 0.0;       // GPU time of the frames drawn since the start
+    int frames = 0;
+    float cpuPercent = 0.0f;  // Of one core, so more than 100% with worker threads
+    float gpuPercent = 0.0f;
+    float framesPerSecond = 0.0f;
+};
+
+// Uniform buffer binding points of the blocks declared in the shaders
+enum UniformBlockBinding {
+    FRAME_BLOCK_BINDING = 0,
+};
+
+// std140 layout of FrameBlock in mesh.vert and mesh.frag (outline.vert only
+// declares the first two matrices). Flags are 0 or 1.
+struct FrameUniforms {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 lightPosition;
+    float time;
+    glm::vec3 diffuseColor;
+    float specularPower;
+    glm::vec2 viewportScale;
+    float gamma;
+    float envMapping;
+    float ambientEnabled;
+    float diffuseEnabled;
+    float specularEnabled;
+    float viewTextureCoords;
+    float lighting;
+    float quantizationEnabled;
+    float viewDepth;
+    float viewNormals;
+    float viewOutline;
+    float outlineIntensity;
+    float aoEnabled;
+    float padding;
+};
+
+// Layout of the per-draw data, which the shaders read as six RGBA32F texels
+// of u_drawData. The draws of a frame are stored back to back in the uniform
+// stream, which is also the storage of that buffer texture, so each draw only
+// sets its index (rebinding a buffer for every draw makes some drivers
+// revalidate the state of all shader stages), and a multi-draw can read any
+// number of draws.
+struct DrawUniforms {
+    glm::mat4 model;
+    glm::vec4 texTransform;  // Texture coordinate scale, array layer and wrap mode (1 for repeat)
+    float texMapping;  // Texture mapping is enabled and the material has a texture
+    float padding[3];
+};
+
+// Range of a buffer that the buffer texture of the per-draw data is attached
+// to (size 0 for the whole buffer). The allocation tells apart buffers that
+// reuse the name of a deleted one.
+struct DrawTextureRange {
+    GLuint buffer = 0;
+    unsigned allocation = 0;
+    GLintptr offset = 0;
+    GLsizeiptr size = 0;
+};
+
+// Locations of the per-draw uniforms of a program, looked up after linking
+struct DrawLocations {
+    GLint drawOffset = -1;
+    GLint drawIndex = -1;
+};
+
+// Asset files that changed on disk, or another scene of the asset, loaded on
+// a worker thread. Only what changed is loaded: the whole scene if the glTF
+// file changed (or an image changed size, or another scene is shown), else its
+// buffers and changed images.
+struct AssetReload {
+    std::vector<cg::FileChange> changes;
+    bool ok = true;
+    bool full = false;             // The whole scene was loaded again
+    bool buffers = false;          // The buffers were loaded again, into the asset (without images)
+    int scene = -1;                // Scene of the asset that is shown
+    gltf::GLTFAsset asset;
+    std::vector<std::string> sceneNames;
+    gltf::SceneLoaderStats sceneStats;
+    bool aoAvailable = false;      // The asset has ambient occlusion from its cache file
+    gltf::LodStats lodStats;       // Of the levels of detail of the asset
+    gltf::TexturePacking packing;  // Of a full reload, with its levels (if compressed)
+    std::vector<gltf::ArrayLevels> arrayLevels;
+    std::vector<int> images;                     // Indices of the reloaded images
+    std::vector<gltf::Image> imageData;
+    std::vector<glm::ivec2> layers;              // Array and layer that use each reloaded image,
+    std::vector<gltf::ArrayLevels> layerLevels;  // and their new levels
+};
+
+// A reload whose result has not been displayed yet
+struct ReloadTiming {
+    std::string files;
+    int64_t changeTime = 0;   // First change of the files on disk (see cg::profiler_now())
+    int64_t appliedTime = 0;  // When the GPU resources were updated
+    GLsync fence = 0;         // After the first frame that shows the result
+};
 
 // Struct for our application context
 struct Context {
     int width = 1024;
     int height = 512;
     GLFWwindow *window;
-    gltf::GLTFAsset asset;
+    gltf::GLTFAsset asset;  // The shown scene of the asset (see gltf_scene_loader.h)
     gltf::DrawableList drawables;
     cg::Trackball trackball;
     GLuint program;
+    DrawLocations meshLocations;  // Of program
     GLuint emptyVAO;
     float elapsedTime;
     std::string gltfFilename = "bunny.gltf";
@@ -50,8 +187,21 @@ struct Context {
     int textureIndex = 4;
     int sceneIndex = 2;
     GLuint cubemap;
-
-    gltf::TextureList textures;
+    glm::ivec2 cubemapSelection = glm::ivec2(-1);  // Scene and texture index of the loaded cubemap
+
+    gltf::TextureList textures;  // One texture array per packed array
+    gltf::TexturePacking texturePacking;  // Array and layer of each texture
+    bool shareTextureArrays = true;  // Otherwise every texture gets an array of its own
+    bool deduplicate = true;  // Merge duplicate vertices, meshes and images at load time
+    gltf::SceneLoader sceneLoader;  // Only used by the thread that loads the asset
+    int assetScene = -1;      // Scene of the asset that is shown
+    int nextScene = -1;       // Scene to show (-1 for the default scene)
+    std::vector<std::string> sceneNames;
+    gltf::SceneLoaderStats sceneStats;
+    cg::MipSettings mipmaps;  // Of the texture levels, which are generated on the CPU
+    gltf::TextureCompressionSettings textureCompression;
+    gltf::TextureCompressionStats textureCompressionStats;
+    gltf::TextureStreamer textureStreamer;  // Mip residency of the textures (not used headless)
     bool texMapping;
     bool textureCoordinates;
     bool lighting;
@@ -63,58 +213,443 @@ struct Context {
         {0.3, 0.3, 0.3, 0.6, 0.6, 0.6, 0.8, 0.8},
     };
     int qmapIndex = 0;
+    int uploadedQmapIndex = -1;  // Map currently stored in quantizationTexture
     GLuint quantizationTexture;
 
     GLuint outlineProgram;
+    DrawLocations outlineLocations;
     GLuint outlineFBO;
     bool viewDepth;
     GLuint depthTexture;
     bool viewNormals;
     GLuint normalTexture;
+    int outlineWidth;
+    int outlineHeight;
     bool viewOutline = true;
     float outlineIntensity = 0.55f;
+
+    cg::DynamicResolution dynres;
+    GLuint upscaleProgram;
+    float viewportScale[2] = {1.0f, 1.0f};  // Rendered part of the outline textures
+
+    gltf::OcclusionCuller occlusion;
+
+    cg::StreamBuffer uniforms;  // Uniform blocks of the frames in flight
+    cg::StagingPool staging;    // Vertex buffers are uploaded through it in chunks
+    bool bufferStorage = true;  // Map it persistently if ARB_buffer_storage is available
+    GLintptr frameUniformsOffset = -1;
+    GLintptr drawUniformsOffset = -1;  // Of the DrawUniforms array of this frame
+    GLuint drawTexture = 0;            // Buffer texture of the uniform stream
+    DrawTextureRange drawTextureRange; // What drawTexture is attached to
+    GLint maxDrawTexels = 65536;       // GL_MAX_TEXTURE_BUFFER_SIZE
+    bool drawTextureRanges = false;    // glTexBufferRange() is available
+    GLint drawTextureAlignment = 16;   // GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT (and at least a texel)
+    int windowDraws = 0;               // Draws per window of this frame (see bind_draw_window()), or 0
+    GLuint drawCopyBuffer = 0;         // Holds the draws of one window, without glTexBufferRange()
+    GLsizeiptr drawCopyBytes = 0;
+    bool multiDraw = true;             // Submit each pass with multi-draw-indirect, if available
+    bool multiDrawAvailable = false;
+    gltf::MultiDrawList multiDraws;    // Commands and runs of this frame
+    GLintptr drawCommandsOffset = -1;  // Of the commands of this frame, or -1 to draw one by one
+
+    cg::JobSystem jobs;
+    gltf::FramePrep framePrep;  // Draw packets of this frame, in the order of the DrawUniforms
+    gltf::LodSettings lodSettings;  // Of the levels of detail generated at load time
+    gltf::LodStats lodStats;
+    float lodPixelError = 1.0f;  // Largest error of the drawn levels on screen (0 for full meshes)
+
+    bool aoAvailable = false;  // Baked ambient occlusion is stored in COLOR_0
+    bool aoEnabled = true;
+    gltf::AOBakeSettings aoSettings;
+    gltf::AOBakeStats aoStats;
+    std::future<gltf::VertexOcclusion> aoBake;
+
+    cg::FrameCapture capture;
+    char capturePath[256] = "capture.y4m";
+    int captureFormat = cg::CAPTURE_Y4M;
+
+    bool showProfiler = false;
+
+    bool releaseCpuData = false;  // Free the CPU copies of buffers and images once uploaded
+    char memoryReportPath[256] = "memory.json";
+    cg::MemoryTag geometryMemory{cg::MEMORY_CPU_GEOMETRY};  // Of the asset (see update_memory_tags())
+    cg::MemoryTag imageMemory{cg::MEMORY_CPU_IMAGES};
+    cg::MemoryTag textureLevelMemory{cg::MEMORY_CPU_TEXTURE_LEVELS};
+    cg::MemoryTag sceneMemory{cg::MEMORY_CPU_SCENE};
+    cg::MemoryTag sceneCacheMemory{cg::MEMORY_CPU_SCENE_CACHE};
+
+    static const int REDRAW_FRAMES = 3;  // ImGui needs a few frames to settle after input
+    bool renderOnDemand = true;  // Wait for events instead of redrawing unchanged frames
+    int redrawFrames = REDRAW_FRAMES;  // Frames left to draw before waiting again
+    int frameRateCap = 0;        // Maximum frames per second (0 = unlimited)
+    double nextFrameTime = 0.0;
+    Utilization utilization;
+
+    cg::InputRecording input;       // Input being recorded or replayed
+    bool recordingInput = false;
+    bool replayingInput = false;
+    std::vector<cg::InputEvent> pendingInput;  // Events of the current frame
+    std::vector<double> recordedState;         // Last recorded GUI state
+    size_t replayFrame = 0;
+    double frameStartTime = -1.0;
+    std::vector<double> replayFrameTimes;      // In milliseconds
+
+    bool headless = false;  // Render offscreen only (no window or GUI)
+
+    bool hotReload = true;         // Reload shaders and asset files when they change on disk
+    cg::FileWatcher fileWatcher;
+    std::vector<cg::FileChange> assetChanges;  // Waiting for the current reload to finish
+    std::future<AssetReload> assetReload;
+    std::vector<ReloadTiming> reloadTimings;
+    std::string lastReload;        // Files and latency of the last displayed reload
 };
 
-// Returns the absolute path to the src/shader directory
-std::string shader_dir(void)
+// Struct for command line options
+struct Options {
+    bool headless = false;
+    bool allowEGL = true;
+    int views = 1;                      // Number of orbit views per asset
+    std::vector<glm::vec3> cameras;     // Presets: yaw, pitch (degrees) and field of view
+    std::vector<std::string> filenames;
+    std::string outputDir = ".";
+    bool software = false;          // Use the software rasterizer instead of OpenGL
+    bool compareSoftware = false;   // Diff OpenGL images against the software rasterizer
+    std::vector<int> threads;       // Thread counts for the software rasterizer
+    std::string capturePath;        // Record the window from the first frame
+    int captureFrames = 0;          // Quit after capturing this many frames (0 = never)
+    std::string tracePath;          // Write a Chrome trace of the session on exit
+    std::string recordPath;         // Record input and GUI state to this file
+    std::string replayPath;         // Replay a recording with vsync off, then quit
+    std::string summaryPath;        // Write frame-time statistics of the replay as JSON
+    std::string memoryReportPath;   // Write the memory of each resource category as JSON on exit
+    int warmupFrames = 10;          // Replayed frames left out of the statistics
+    bool continuous = false;        // Redraw every frame, not only after changes
+    int frameRateCap = 0;           // Maximum frames per second (0 = unlimited)
+};
+
+// Returns the absolute path to the root directory. MODEL_VIEWER_ROOT takes
+// precedence over the source directory known at build time.
+std::string root_dir(void)
 {
     std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
+#ifdef MODEL_VIEWER_DEFAULT_ROOT
+    if (rootDir.empty()) rootDir = MODEL_VIEWER_DEFAULT_ROOT;
+#endif
     if (rootDir.empty()) {
         std::cout << "Error: MODEL_VIEWER_ROOT is not set." << std::endl;
         std::exit(EXIT_FAILURE);
     }
-    return rootDir + "/src/shaders/";
+    return rootDir;
+}
+
+// Returns the absolute path to the src/shader directory
+std::string shader_dir(void)
+{
+    return root_dir() + "/src/shaders/";
 }
 
 std::string cubemap_dir(void)
 {
-    std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
-    if (rootDir.empty()) {
-        std::cout << "Error: MODEL_VIEWER_ROOT is not set." << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-    return rootDir + "/assets/cubemaps/";
+    return root_dir() + "/assets/cubemaps/";
 }
 
 // Returns the absolute path to the assets/gltf directory
 std::string gltf_dir(void)
 {
-    std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
-    if (rootDir.empty()) {
-        std::cout << "Error: MODEL_VIEWER_ROOT is not set." << std::endl;
-        std::exit(EXIT_FAILURE);
+    return root_dir() + "/assets/gltf/";
+}
+
+// Splits a glTF path into directory and filename. Plain filenames are looked
+// up in the assets/gltf directory.
+void split_gltf_path(const std::string &path, std::string &dir, std::string &filename)
+{
+    size_t separator = path.find_last_of("/\\");
+    if (separator == std::string::npos) {
+        dir = gltf_dir();
+        filename = path;
+    } else {
+        dir = path.substr(0, separator + 1);
+        filename = path.substr(separator + 1);
     }
-    return rootDir + "/assets/gltf/";
 }
 
-void do_initialization(Context &ctx)
+// Apply ambient occlusion from the cache file of an asset, if it has been
+// baked. Returns true if it was applied.
+bool apply_cached_ambient_occlusion(const std::string &gltfFilename, gltf::GLTFAsset &asset)
+{
+    if (!gltf::buffers_loaded(asset)) return false;  // Streamed geometry is not baked
+    std::string dir, filename;
+    split_gltf_path(gltfFilename, dir, filename);
+    std::vector<char> payload;
+    gltf::VertexOcclusion occlusion;
+    if (!gltf::read_cache_file(gltf::cache_filename(dir, filename, "ao"), gltf::hash_asset_buffers(asset),
+                               payload) ||
+        !gltf::deserialize_ambient_occlusion(payload, asset, occlusion))
+        return false;
+    gltf::apply_ambient_occlusion(asset, occlusion);
+    return true;
+}
+
+// Apply ambient occlusion from the asset's cache file, if it has been baked
+void load_cached_ambient_occlusion(Context &ctx)
+{
+    ctx.aoAvailable = apply_cached_ambient_occlusion(ctx.gltfFilename, ctx.asset);
+}
+
+// Start baking ambient occlusion for the current asset in the background
+void start_ambient_occlusion_bake(Context &ctx)
+{
+    if (ctx.aoBake.valid()) return;
+    const gltf::GLTFAsset *asset = &ctx.asset;
+    gltf::AOBakeSettings settings = ctx.aoSettings;
+    gltf::AOBakeStats *stats = &ctx.aoStats;
+    ctx.aoBake = std::async(std::launch::async, [=] {
+        gltf::VertexOcclusion occlusion;
+        gltf::bake_ambient_occlusion(*asset, settings, occlusion, stats);
+        return occlusion;
+    });
+}
+
+// Apply a finished bake, write it to the cache and recreate the drawables.
+// Must be called when no other thread reads the asset.
+// Returns true if a bake has completed and the drawables were updated
+bool finish_ambient_occlusion_bake(Context &ctx)
+{
+    if (!ctx.aoBake.valid() ||
+        ctx.aoBake.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+    gltf::VertexOcclusion occlusion = ctx.aoBake.get();
+    gltf::apply_ambient_occlusion(ctx.asset, occlusion);
+    ctx.aoAvailable = true;
+
+    std::string dir, filename;
+    split_gltf_path(ctx.gltfFilename, dir, filename);
+    std::vector<char> payload;
+    gltf::serialize_ambient_occlusion(occlusion, payload);
+    std::string cacheFilename = gltf::cache_filename(dir, filename, "ao");
+    if (!gltf::write_cache_file(cacheFilename, gltf::hash_asset_buffers(ctx.asset), payload))
+        std::cerr << "Warning: could not write " << cacheFilename << std::endl;
+    gltf::create_drawables_from_gltf_asset(ctx.drawables, ctx.asset, &ctx.staging);
+    return true;
+}
+
+// Record the memory of the outline textures (see cg_memory.h)
+void track_outline_textures(const Context &ctx)
+{
+    cg::memory_track_gl(GL_TEXTURE, ctx.normalTexture, cg::MEMORY_GL_RENDER_TARGETS,
+                        cg::gl_image_bytes(GL_RGB8, ctx.width, ctx.height));
+    cg::memory_track_gl(GL_TEXTURE, ctx.depthTexture, cg::MEMORY_GL_RENDER_TARGETS,
+                        cg::gl_image_bytes(GL_DEPTH_COMPONENT24, ctx.width, ctx.height));
+}
+
+// Reallocate the outline textures if the framebuffer size has changed
+void resize_outline_textures(Context &ctx)
+{
+    if (ctx.outlineWidth == ctx.width && ctx.outlineHeight == ctx.height) return;
+    ctx.outlineWidth = ctx.width;
+    ctx.outlineHeight = ctx.height;
+
+    cg::gl_state_bind_texture(GL_TEXTURE_2D, ctx.normalTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, ctx.width, ctx.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    cg::gl_state_bind_texture(GL_TEXTURE_2D, ctx.depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, ctx.width, ctx.height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    cg::gl_state_bind_texture(GL_TEXTURE_2D, 0);
+    track_outline_textures(ctx);
+}
+
+// Assign the uniform blocks and texture units of a program, and return the
+// locations of its per-draw uniforms. These never change, so they are only
+// set and looked up once after linking.
+DrawLocations bind_program_resources(GLuint program)
+{
+    GLuint frameBlock = glGetUniformBlockIndex(program, "FrameBlock");
+    if (frameBlock != GL_INVALID_INDEX) glUniformBlockBinding(program, frameBlock, FRAME_BLOCK_BINDING);
+
+    // Samplers of different types must never share a unit, so the material
+    // texture gets its own unit even when no node has a texture
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "u_cubemap"), 0);
+    glUniform1i(glGetUniformLocation(program, "u_quantization"), 1);
+    glUniform1i(glGetUniformLocation(program, "u_depthTexture"), 2);
+    glUniform1i(glGetUniformLocation(program, "u_normalTexture"), 3);
+    glUniform1i(glGetUniformLocation(program, "u_texture"), 4);
+    glUniform1i(glGetUniformLocation(program, "u_drawData"), 5);
+    glUseProgram(0);
+
+    DrawLocations locations;
+    locations.drawOffset = glGetUniformLocation(program, "u_drawOffset");
+    locations.drawIndex = glGetUniformLocation(program, "u_drawIndex");
+    return locations;
+}
+
+void load_shader_programs(Context &ctx)
 {
     ctx.program = cg::load_shader_program(shader_dir() + "mesh.vert", shader_dir() + "mesh.frag");
     ctx.outlineProgram = cg::load_shader_program(shader_dir() + "outline.vert", shader_dir() + "outline.frag");
+    ctx.upscaleProgram = cg::load_shader_program(shader_dir() + "upscale.vert", shader_dir() + "upscale.frag");
+    ctx.meshLocations = bind_program_resources(ctx.program);
+    ctx.outlineLocations = bind_program_resources(ctx.outlineProgram);
+}
+
+void print_texture_compression_stats(const gltf::TextureCompressionStats &stats)
+{
+    if (!stats.compressedArrays) return;
+    std::cout << "Compressed " << stats.compressedArrays << " texture arrays: "
+              << stats.uncompressedBytes / (1024.0 * 1024.0) << " MB as RGBA8, "
+              << stats.compressedBytes / (1024.0 * 1024.0) << " MB compressed, PSNR " << stats.psnr << " dB";
+    if (stats.fromCache) std::cout << " (from cache)" << std::endl;
+    else std::cout << ", encoded at " << stats.encodedPixels / std::max(stats.encodeSeconds, 1e-9) * 1e-6
+                   << " Mpixels/s" << std::endl;
+}
+
+void print_dedup_stats(const gltf::DedupStats &stats)
+{
+    const double MB = 1024.0 * 1024.0;
+    if (stats.bufferBytesBefore == stats.bufferBytesAfter && !stats.imagesMerged) return;
+    std::cout << "Deduplicated the asset: " << stats.verticesBefore - stats.verticesAfter << " of "
+              << stats.verticesBefore << " vertices welded (" << stats.vertexBytesSaved / MB << " MB), "
+              << stats.meshesMerged << " meshes merged (" << stats.meshBytesSaved / MB << " MB), "
+              << stats.bufferBytesSaved / MB << " MB of identical buffer data, " << stats.imagesMerged
+              << " images merged (" << stats.imageBytesSaved / MB << " MB), " << stats.unreferencedBytes / MB
+              << " MB unreferenced; buffers " << stats.bufferBytesBefore / MB << " MB -> "
+              << stats.bufferBytesAfter / MB << " MB" << std::endl;
+}
 
-    gltf::load_gltf_asset(ctx.gltfFilename, gltf_dir(), ctx.asset);
-    gltf::create_drawables_from_gltf_asset(ctx.drawables, ctx.asset);
-    gltf::create_textures_from_gltf_asset(ctx.textures, ctx.asset);
+// Returns the names of the scenes of an asset, for the GUI
+std::vector<std::string> scene_names(const gltf::GLTFAsset &asset)
+{
+    std::vector<std::string> names;
+    for (size_t i = 0; i < asset.scenes.size(); ++i) {
+        const char *name = gltf::get_string(asset, asset.scenes[i].name);
+        names.push_back(*name ? name : "Scene " + std::to_string(i));
+    }
+    return names;
+}
+
+// Load the scene description of an asset and one of its scenes. The default
+// scene is shown if scene is -1 or out of range, and scene is set to the
+// scene that is shown.
+bool load_asset_scene(gltf::SceneLoader &loader, const std::string &filename, const std::string &dir,
+                      int &scene, gltf::GLTFAsset &asset)
+{
+    if (!gltf::scene_loader_open(loader, filename, dir)) return false;
+    if (scene >= int(loader.asset.scenes.size())) {
+        std::cerr << "Warning: " << filename << " has no scene " << scene << ", showing the default scene"
+                  << std::endl;
+        scene = -1;
+    }
+    if (scene < 0) scene = gltf::default_scene(loader.asset);
+    return gltf::scene_loader_load(loader, scene, asset);
+}
+
+// Prints how much geometry of the asset is streamed from its files, if any
+void print_streamed_geometry(const gltf::GLTFAsset &asset)
+{
+    if (gltf::buffers_loaded(asset)) return;
+    int64_t bytes = 0;
+    for (const gltf::Buffer &buffer : asset.buffers) bytes += buffer.byteLength;
+    std::cout << "Streaming " << bytes / (1024.0 * 1024.0) << " MB of geometry from disk" << std::endl;
+}
+
+// Set the CPU memory tags of the shown asset, and of a reload that is about to
+// replace it (both are in memory until the reload is applied)
+void update_memory_tags(Context &ctx, const AssetReload *reload = nullptr)
+{
+    auto levels_memory = [](const std::vector<gltf::ArrayLevels> &arrays) {
+        size_t bytes = 0;
+        for (const gltf::ArrayLevels &array : arrays) {
+            for (const std::vector<uint8_t> &level : array.levels) bytes += level.capacity();
+        }
+        return bytes;
+    };
+    size_t geometry = gltf::compute_buffer_memory(ctx.asset);
+    size_t images = gltf::compute_image_memory(ctx.asset);
+    size_t levels = levels_memory(ctx.textureStreamer.arrayLevels);
+    size_t scene = gltf::compute_scene_memory(ctx.asset);
+    if (reload) {
+        geometry += gltf::compute_buffer_memory(reload->asset);
+        images += gltf::compute_image_memory(reload->asset);
+        levels += levels_memory(reload->arrayLevels) + levels_memory(reload->layerLevels);
+        scene += gltf::compute_scene_memory(reload->asset);
+    }
+    cg::memory_tag_set(ctx.geometryMemory, geometry);
+    cg::memory_tag_set(ctx.imageMemory, images);
+    cg::memory_tag_set(ctx.textureLevelMemory, levels);
+    cg::memory_tag_set(ctx.sceneMemory, scene);
+    cg::memory_tag_set(ctx.sceneCacheMemory, ctx.sceneStats.residentBytes);
+}
+
+void print_lod_stats(const gltf::LodStats &stats)
+{
+    if (!stats.meshes) return;
+    std::cout << "Generated " << stats.levels << " levels of detail of " << stats.meshes << " meshes ("
+              << stats.triangles << " triangles, " << stats.lodTriangles << " in the levels, "
+              << stats.indexBytes / (1024.0 * 1024.0) << " MB of indices) in " << stats.seconds * 1000.0
+              << " ms" << std::endl;
+}
+
+// Free the CPU copies of the buffers and images of the shown asset that have
+// been uploaded (see --release-cpu-data). Only the GPU has the geometry then,
+// so ambient occlusion cannot be baked and the occlusion culler has no
+// occluders. Must be called when no other thread reads the asset.
+void release_uploaded_data(Context &ctx)
+{
+    update_memory_tags(ctx);  // So that the peaks include the data
+    size_t bytes = gltf::release_buffer_data(ctx.asset) +
+                   gltf::texture_streaming_release_images(ctx.textureStreamer, ctx.asset);
+    if (bytes) std::cout << "Released " << bytes / (1024.0 * 1024.0) << " MB of uploaded data" << std::endl;
+}
+
+void do_initialization(Context &ctx)
+{
+    load_shader_programs(ctx);
+    cg::stream_buffer_init(ctx.uniforms, GL_UNIFORM_BUFFER, 64 * 1024, ctx.bufferStorage);
+    glGenTextures(1, &ctx.drawTexture);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &ctx.maxDrawTexels);
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    ctx.drawTextureRanges = glTexBufferRange && (major > 4 || (major == 4 && minor >= 3) ||
+                                                 cg::has_gl_extension("GL_ARB_texture_buffer_range"));
+    if (ctx.drawTextureRanges) glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &ctx.drawTextureAlignment);
+    ctx.drawTextureAlignment = std::max(ctx.drawTextureAlignment, GLint(sizeof(glm::vec4)));
+    ctx.multiDrawAvailable = gltf::multi_draw_supported();
+    cg::staging_pool_init(ctx.staging);
+
+    if (!ctx.gltfFilename.empty()) {
+        std::string dir, filename;
+        split_gltf_path(ctx.gltfFilename, dir, filename);
+        load_asset_scene(ctx.sceneLoader, filename, dir, ctx.nextScene, ctx.asset);
+        ctx.assetScene = ctx.nextScene;
+        ctx.sceneNames = scene_names(ctx.sceneLoader.asset);
+        ctx.sceneStats = ctx.sceneLoader.stats;
+        gltf::DedupStats dedupStats;
+        if (ctx.deduplicate && gltf::deduplicate_gltf_asset(ctx.asset, dedupStats)) print_dedup_stats(dedupStats);
+        load_cached_ambient_occlusion(ctx);
+        if (gltf::generate_mesh_lods(ctx.asset, ctx.lodSettings, &ctx.lodStats)) print_lod_stats(ctx.lodStats);
+        print_streamed_geometry(ctx.asset);
+        gltf::create_drawables_from_gltf_asset(ctx.drawables, ctx.asset, &ctx.staging);
+        auto start = std::chrono::steady_clock::now();
+        gltf::generate_image_mipmaps(ctx.asset, ctx.mipmaps);
+        if (!ctx.asset.images.empty()) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "Generated the mip levels of " << ctx.asset.images.size() << " images in "
+                      << elapsed.count() << " ms" << std::endl;
+        }
+        ctx.texturePacking = gltf::pack_textures(ctx.asset, ctx.shareTextureArrays);
+        ctx.texturePacking.mipFilter = ctx.mipmaps.filter;
+        std::vector<gltf::ArrayLevels> levels;
+        if (ctx.textureCompression.enabled) {
+            levels = gltf::compress_texture_arrays(ctx.asset, ctx.texturePacking, ctx.textureCompression,
+                                                   gltf::cache_filename(dir, filename, "textures"),
+                                                   &ctx.textureCompressionStats);
+            print_texture_compression_stats(ctx.textureCompressionStats);
+        }
+        gltf::texture_streaming_init(ctx.textureStreamer, ctx.textures, ctx.asset, ctx.texturePacking,
+                                     std::move(levels));
+        gltf::occlusion_init(ctx.occlusion, ctx.asset);
+        gltf::frame_prep_init(ctx.framePrep, ctx.asset);
+    }
 
     // quantization initialization
     glGenTextures(1, &ctx.quantizationTexture);
@@ -157,65 +692,18 @@ void do_initialization(Context &ctx)
         std::cout << "Framebuffer not complete" << std::endl;
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void defineUniforms(Context &ctx) {
-    glUniform1f(glGetUniformLocation(ctx.program, "u_time"), ctx.elapsedTime);
-
-    if (ctx.ambientEnabled) glUniform1f(glGetUniformLocation(ctx.program, "u_ambientEnabled"), 1.0);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_ambientEnabled"), 0.0);
-
-    if (ctx.diffuseEnabled) glUniform1f(glGetUniformLocation(ctx.program, "u_diffuseEnabled"), 1.0);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_diffuseEnabled"), 0.0);
-
-    if (ctx.specularEnabled) glUniform1f(glGetUniformLocation(ctx.program, "u_specularEnabled"), 1.0);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_specularEnabled"), 0.0);
-
-    glUniform3f(glGetUniformLocation(ctx.program, "u_diffuseColor"), ctx.diffuseColor[0], ctx.diffuseColor[1], ctx.diffuseColor[2]);
-
-    glUniform1f(glGetUniformLocation(ctx.program, "u_specularPower"), ctx.specularPower);
-    glUniform3f(glGetUniformLocation(ctx.program, "u_lightPosition"), ctx.lightPosition[0], ctx.lightPosition[1], ctx.lightPosition[2]);
-
-    if (ctx.gamma) glUniform1f(glGetUniformLocation(ctx.program, "u_gamma"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_gamma"), 0.0f);
-
-    if (ctx.textureCoordinates) glUniform1f(glGetUniformLocation(ctx.program, "u_viewTextureCoords"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_viewTextureCoords"), 0.0f);
-
-    if (ctx.envMapping) glUniform1f(glGetUniformLocation(ctx.program, "u_envMapping"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_envMapping"), 0.0f);
+    ctx.outlineWidth = ctx.width;
+    ctx.outlineHeight = ctx.height;
+    track_outline_textures(ctx);
 
-    if (ctx.texMapping) glUniform1f(glGetUniformLocation(ctx.program, "u_texMapping"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_texMapping"), 0.0f);
-
-    if (ctx.lighting) glUniform1f(glGetUniformLocation(ctx.program, "u_lighting"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_lighting"), 0.0f);
-
-    if (ctx.quantizationEnabled) glUniform1f(glGetUniformLocation(ctx.program, "u_quantizationEnabled"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_quantizationEnabled"), 0.0f);
-    
-    if (ctx.viewDepth) glUniform1f(glGetUniformLocation(ctx.program, "u_viewDepth"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_viewDepth"), 0.0f);
-
-    if (ctx.viewNormals) glUniform1f(glGetUniformLocation(ctx.program, "u_viewNormals"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_viewNormals"), 0.0f);
-
-    if (ctx.viewOutline) glUniform1f(glGetUniformLocation(ctx.program, "u_viewOutline"), 1.0f);
-    else glUniform1f(glGetUniformLocation(ctx.program, "u_viewOutline"), 0.0f);
-
-    glUniform1f(glGetUniformLocation(ctx.program, "u_outlineIntensity"), ctx.outlineIntensity);
+    // dynamic resolution render target and GPU timer
+    cg::gpu_timer_init(ctx.dynres.timer);
+    cg::dynamic_resolution_resize(ctx.dynres, ctx.width, ctx.height);
 }
 
-void draw_scene(Context &ctx, GLuint program)
+// Computes the projection and camera matrices for the current view
+void compute_camera_matrices(const Context &ctx, glm::mat4 &Projection, glm::mat4 &View)
 {
-    // Set render state
-    glUseProgram(program);
-    glEnable(GL_DEPTH_TEST);  // Enable Z-buffering
-
-    glm::mat4 Projection = glm::mat4(1.0f);
-    glm::mat4 View = glm::mat4(1.0f);
-    glm::mat4 Model = glm::mat4(1.0f);
-
     // Projection Matrix
     if (ctx.ortho) Projection = glm::ortho(
        -float(ctx.width / ctx.height),  // left
@@ -234,106 +722,1055 @@ void draw_scene(Context &ctx, GLuint program)
         glm::vec3(0, 0, 0),  // looks at the origin
         glm::vec3(0, 1, 0)   // Head is up
         ) * glm::mat4(-ctx.trackball.orient);
-    
-    // Define per-scene uniforms
-    glUniformMatrix4fv(glGetUniformLocation(program, "u_projection"), 1, GL_FALSE, &Projection[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(program, "u_view"), 1, GL_FALSE, &View[0][0]);
-
-    defineUniforms(ctx);
-    // Cubemapping
-    std::vector<std::string> selectedCubemap{"0.125/", "0.5/", "2/", "8/", "32/", "128/", "512/", "2048/"};
-    std::vector<std::string> selectedScene{"Forrest/", "LarnacaCastle/", "RomeChurch/"};
-    ctx.cubemap = cg::load_cubemap(cubemap_dir() + selectedScene[ctx.sceneIndex] + "prefiltered/" + selectedCubemap[ctx.textureIndex]);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, ctx.cubemap);
-    glUniform1i(glGetUniformLocation(ctx.program, "u_cubemap"), 0);
-
-    // Toon shading Quantization
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_1D, ctx.quantizationTexture);
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RED, 8, 0, GL_RED, GL_FLOAT, &ctx.qmap[ctx.qmapIndex]);
-    glUniform1i(glGetUniformLocation(ctx.program, "u_quantization"), 1);
+}
 
-    // depth texture
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, ctx.depthTexture);
-    glUniform1i(glGetUniformLocation(ctx.program, "u_depthTexture"), 2);
+// Computes the model matrix of the scene, which is applied on top of the
+// world matrices of the node hierarchy
+glm::mat4 compute_model_matrix(const Context &/*ctx*/)
+{
+    // Model matrix : an identity matrix (model will be at the origin)
+    glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(0.75f));  // scale by 0.5
+    // Turned about the up axis (the bundled models are rotated to Y-up by
+    // their nodes)
+    glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(45.0f), glm::vec3(0, 1, 0));
+    glm::mat4 translationMatrix = glm::mat4(1.0f);
+    return translationMatrix * rotationMatrix * scaleMatrix;
+}
 
-    // normal texture
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, ctx.normalTexture);
-    glUniform1i(glGetUniformLocation(ctx.program, "u_normalTexture"), 3);
+// Attach the buffer texture of the per-draw data to a range of a buffer (or
+// to the whole buffer, if size is 0), unless it already is
+void attach_draw_texture(Context &ctx, GLuint buffer, unsigned allocation, GLintptr offset, GLsizeiptr size)
+{
+    DrawTextureRange &range = ctx.drawTextureRange;
+    if (range.buffer == buffer && range.allocation == allocation && range.offset == offset && range.size == size)
+        return;
+    cg::gl_state_bind_texture(5, GL_TEXTURE_BUFFER, ctx.drawTexture);
+    cg::gl_state_active_texture(5);
+    if (size) glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer, offset, size);
+    else glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    range.buffer = buffer, range.allocation = allocation, range.offset = offset, range.size = size;
+}
 
-    // Draw scene
-    for (unsigned i = 0; i < ctx.asset.nodes.size(); ++i) {
-        const gltf::Node &node = ctx.asset.nodes[i];
-        const gltf::Drawable &drawable = ctx.drawables[node.mesh];
+// Write the per-frame and per-draw uniform blocks of this frame to the
+// stream buffer, from which both passes read them. The draws are prepared
+// (culled, sorted and their texture levels requested) on the job system.
+void upload_uniforms(Context &ctx)
+{
+    FrameUniforms frame;
+    compute_camera_matrices(ctx, frame.projection, frame.view);
+    {
+        CG_PROFILE_SCOPE("Prepare Draws");
+        gltf::FramePrepInput input;
+        input.view = frame.view;
+        input.projection = frame.projection;
+        input.rootMatrix = compute_model_matrix(ctx);
+        input.occlusion = &ctx.occlusion;
+        input.packing = &ctx.texturePacking;
+        input.streamer = ctx.texMapping ? &ctx.textureStreamer : nullptr;
+        input.viewportHeight = cg::dynamic_resolution_render_height(ctx.dynres);
+        input.lodPixelError = ctx.lodPixelError;
+        gltf::frame_prep_run(ctx.framePrep, ctx.jobs, ctx.asset, input);
+        // Nothing is drawn if the geometry could not be allocated
+        if (ctx.drawables.size() != ctx.asset.meshes.size()) ctx.framePrep.packets.clear();
+    }
+
+    // Define per-object uniforms
+    const std::vector<gltf::DrawPacket> &packets = ctx.framePrep.packets;
+    std::vector<DrawUniforms> draws(packets.size());
+    const float texMapping = ctx.texMapping;
+    cg::JobCounter filled;
+    cg::job_parallel_for(ctx.jobs, packets.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            DrawUniforms &draw = draws[i];
+            draw.model = packets[i].model;
+            draw.texTransform = packets[i].texTransform;
+            draw.texMapping = packets[i].textured ? texMapping : 0.0f;  // No texture is available
+            std::fill(draw.padding, draw.padding + 3, 0.0f);
+        }
+    }, &filled);
+    cg::job_wait(ctx.jobs, filled);
+
+    // Multi-draw commands are streamed after the draws
+    const bool multiDraw = ctx.multiDraw && ctx.multiDrawAvailable && !packets.empty();
+    const GLsizeiptr commandBytes =
+        multiDraw ? GLsizeiptr(packets.size() * sizeof(gltf::DrawElementsIndirectCommand)) : 0;
+
+    ctx.frameUniformsOffset = -1;
+    ctx.drawCommandsOffset = -1;
+    GLsizeiptr drawBytes = GLsizeiptr(draws.size() * sizeof(DrawUniforms));
+    GLsizeiptr size = cg::stream_buffer_aligned_size(ctx.uniforms, sizeof(FrameUniforms)) +
+                      cg::stream_buffer_aligned_size(ctx.uniforms, drawBytes) +
+                      cg::stream_buffer_aligned_size(ctx.uniforms, commandBytes);
+    if (!cg::stream_buffer_begin_frame(ctx.uniforms, size)) return;
+
+    frame.lightPosition = ctx.lightPosition;
+    frame.time = ctx.elapsedTime;
+    frame.diffuseColor = ctx.diffuseColor;
+    frame.specularPower = ctx.specularPower;
+    frame.viewportScale = glm::vec2(ctx.viewportScale[0], ctx.viewportScale[1]);
+    frame.gamma = ctx.gamma;
+    frame.envMapping = ctx.envMapping;
+    frame.ambientEnabled = ctx.ambientEnabled;
+    frame.diffuseEnabled = ctx.diffuseEnabled;
+    frame.specularEnabled = ctx.specularEnabled;
+    frame.viewTextureCoords = ctx.textureCoordinates;
+    frame.lighting = ctx.lighting;
+    frame.quantizationEnabled = ctx.quantizationEnabled;
+    frame.viewDepth = ctx.viewDepth;
+    frame.viewNormals = ctx.viewNormals;
+    frame.viewOutline = ctx.viewOutline;
+    frame.outlineIntensity = ctx.outlineIntensity;
+    frame.aoEnabled = ctx.aoEnabled && ctx.aoAvailable;
+    frame.padding = 0.0f;
+    ctx.frameUniformsOffset = cg::stream_buffer_write(ctx.uniforms, &frame, sizeof(frame));
+    if (!draws.empty()) ctx.drawUniformsOffset = cg::stream_buffer_write(ctx.uniforms, draws.data(), drawBytes);
+
+    // The buffer texture covers the whole stream buffer from its start, as on
+    // plain 3.3, and is only attached again when the buffer is recreated. A
+    // buffer texture can only address GL_MAX_TEXTURE_BUFFER_SIZE texels
+    // though (65536 on some 3.3 implementations), so if the draws of this
+    // frame end beyond that, they are drawn in windows of draws that fit.
+    ctx.windowDraws = 0;
+    if (!draws.empty() && (ctx.drawUniformsOffset + drawBytes) / GLintptr(sizeof(glm::vec4)) > ctx.maxDrawTexels) {
+        const GLintptr windowBytes = GLintptr(ctx.maxDrawTexels) * GLintptr(sizeof(glm::vec4)) -
+                                     (ctx.drawTextureAlignment - GLintptr(sizeof(glm::vec4)));
+        ctx.windowDraws = int(std::min(windowBytes / GLintptr(sizeof(DrawUniforms)), GLintptr(draws.size())));
+    } else {
+        attach_draw_texture(ctx, ctx.uniforms.buffer, ctx.uniforms.allocations, 0, 0);
+    }
+    if (multiDraw) {
+        gltf::multi_draw_build(ctx.multiDraws, packets, ctx.drawables, ctx.windowDraws);
+        ctx.drawCommandsOffset =
+            cg::stream_buffer_write(ctx.uniforms, ctx.multiDraws.commands.data(), commandBytes);
+    }
+    cg::stream_buffer_flush(ctx.uniforms);
+}
+
+// Make the per-draw data of the window of draws that starts at draw first
+// readable through the buffer texture (see upload_uniforms()), and return the
+// texel of draw 0 in it for u_drawOffset. With glTexBufferRange(), the
+// texture is attached to the range of the window in the stream buffer;
+// otherwise the window is copied to the start of a buffer of its own on the
+// GPU (which is ordered after the draws of the previous window).
+GLint bind_draw_window(Context &ctx, int first)
+{
+    const GLsizeiptr drawSize = GLsizeiptr(sizeof(DrawUniforms));
+    const int count = std::min(ctx.windowDraws, int(ctx.framePrep.packets.size()) - first);
+    const GLintptr begin = ctx.drawUniformsOffset + first * drawSize;
+    const GLsizeiptr bytes = count * drawSize;
+    GLintptr drawZero;  // Byte of draw 0 relative to the attached range
+    if (ctx.drawTextureRanges) {
+        const GLintptr offset = begin / ctx.drawTextureAlignment * ctx.drawTextureAlignment;
+        attach_draw_texture(ctx, ctx.uniforms.buffer, ctx.uniforms.allocations, offset, begin + bytes - offset);
+        drawZero = ctx.drawUniformsOffset - offset;
+    } else {
+        if (bytes > ctx.drawCopyBytes) {
+            cg::memory_release_gl(GL_BUFFER, 1, &ctx.drawCopyBuffer);
+            glDeleteBuffers(1, &ctx.drawCopyBuffer);
+            glGenBuffers(1, &ctx.drawCopyBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ctx.drawCopyBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STREAM_COPY);
+            cg::memory_track_gl(GL_BUFFER, ctx.drawCopyBuffer, cg::MEMORY_GL_STREAMING, uint64_t(bytes));
+            ctx.drawCopyBytes = bytes;
+            ctx.drawTextureRange = DrawTextureRange();  // The name may be reused
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, ctx.uniforms.buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ctx.drawCopyBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, begin, 0, bytes);
+        attach_draw_texture(ctx, ctx.drawCopyBuffer, 0, 0, 0);
+        drawZero = -first * drawSize;
+    }
+    return GLint(drawZero / GLintptr(sizeof(glm::vec4)));
+}
+
+// Issue the draw packets of this frame one by one, setting the index of
+// each draw in the per-draw data (and its offset at the start of each window)
+void submit_draws(Context &ctx, const DrawLocations &locations)
+{
+    const std::vector<gltf::DrawPacket> &packets = ctx.framePrep.packets;
+    for (int drawIndex = 0; drawIndex < int(packets.size()); ++drawIndex) {
+        const gltf::DrawPacket &packet = packets[drawIndex];
+        const gltf::Drawable &drawable = ctx.drawables[packet.mesh];
 
         // Define per-object uniforms
-        // Model matrix : an identity matrix (model will be at the origin)
-        glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(0.75f));  // scale by 0.5
-        glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1, 0, 0));
-        rotationMatrix = rotationMatrix * glm::rotate(glm::mat4(1.0f), glm::radians(-45.0f), glm::vec3(0, 0, 1));
-        glm::mat4 translationMatrix = glm::mat4(1.0f);
-        Model = translationMatrix * rotationMatrix * scaleMatrix;
-        glUniformMatrix4fv(glGetUniformLocation(program, "u_model"), 1, GL_FALSE, &Model[0][0]);
+        if (ctx.windowDraws && drawIndex % ctx.windowDraws == 0)
+            glUniform1i(locations.drawOffset, bind_draw_window(ctx, drawIndex));
+        glUniform1i(locations.drawIndex, drawIndex);
 
         // texture mapping (ASSIGNMENT 3 PART 3)
-        const gltf::Mesh &mesh = ctx.asset.meshes[node.mesh];
-        if (mesh.primitives[0].hasMaterial) {
-            const gltf::Primitive &primitive = mesh.primitives[0];
-            const gltf::Material &material = ctx.asset.materials[primitive.material];
-            const gltf::PBRMetallicRoughness &pbr = material.pbrMetallicRoughness;
-
-            // Define material textures and uniforms
-            if (pbr.hasBaseColorTexture) {
-                GLuint texture_id = ctx.textures[pbr.baseColorTexture.index];
-                // Bind texture and define uniforms...
-                glActiveTexture(GL_TEXTURE4);
-                glBindTexture(GL_TEXTURE_2D, texture_id);
-                glUniform1i(glGetUniformLocation(ctx.program, "u_texture"), 4);
-            } else {
-                // Need to handle this case as well, by telling
-                // the shader that no texture is available
-                ctx.texMapping = false;
-            }
+        // Define material textures (the layer is part of the per-draw
+        // uniforms, and draws are sorted by array, so the array is only bound
+        // when it changes)
+        if (packet.array >= 0 &&
+            cg::gl_state_bind_texture(4, GL_TEXTURE_2D_ARRAY, ctx.textures[packet.array])) {
+            cg::profiler_count(cg::COUNTER_STATE_CHANGES);
+            cg::profiler_count(cg::COUNTER_TEXTURE_BINDS);
         }
 
-        // Draw object
-        glBindVertexArray(drawable.vao);
-        glDrawElements(GL_TRIANGLES, drawable.indexCount, drawable.indexType, 
-            (GLvoid *)(intptr_t)drawable.indexByteOffset);
-        glBindVertexArray(0);
+        // Draw object (draws of the same mesh are adjacent, and share the
+        // vertex array binding)
+        if (cg::gl_state_bind_vertex_array(drawable.vao)) {
+            cg::profiler_count(cg::COUNTER_STATE_CHANGES);
+        }
+        const gltf::IndexRange indices = gltf::get_drawable_indices(drawable, packet.lod);
+        glDrawElements(GL_TRIANGLES, indices.count, drawable.indexType,
+            (GLvoid *)(intptr_t)indices.byteOffset);
+        cg::profiler_count(cg::COUNTER_DRAW_CALLS);
+        cg::profiler_count(cg::COUNTER_TRIANGLES, indices.count / 3);
     }
+}
+
+// Issue the draw packets of this frame with one multi-draw per run (see
+// gltf_multi_draw.h), from the commands in the uniform stream. Runs do not
+// cross windows of draws.
+void submit_multi_draws(Context &ctx, const DrawLocations &locations)
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ctx.uniforms.buffer);
+    int window = -1;
+    for (const gltf::MultiDrawRun &run : ctx.multiDraws.runs) {
+        // Define per-object uniforms (of the first draw of the run)
+        if (ctx.windowDraws && run.first / ctx.windowDraws != window) {
+            window = run.first / ctx.windowDraws;
+            glUniform1i(locations.drawOffset, bind_draw_window(ctx, window * ctx.windowDraws));
+        }
+        glUniform1i(locations.drawIndex, run.first);
+
+        if (run.array >= 0 && cg::gl_state_bind_texture(4, GL_TEXTURE_2D_ARRAY, ctx.textures[run.array])) {
+            cg::profiler_count(cg::COUNTER_STATE_CHANGES);
+            cg::profiler_count(cg::COUNTER_TEXTURE_BINDS);
+        }
+        if (cg::gl_state_bind_vertex_array(run.vao)) cg::profiler_count(cg::COUNTER_STATE_CHANGES);
+        gltf::multi_draw_submit(run, ctx.drawCommandsOffset);
+        cg::profiler_count(cg::COUNTER_DRAW_CALLS);
+        cg::profiler_count(cg::COUNTER_TRIANGLES, run.triangles);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// Replace the cubemap with the prefiltered one of the selected scene and
+// texture index
+void load_selected_cubemap(Context &ctx)
+{
+    static const char *const cubemaps[] = {"0.125/", "0.5/", "2/", "8/", "32/", "128/", "512/", "2048/"};
+    static const char *const scenes[] = {"Forrest/", "LarnacaCastle/", "RomeChurch/"};
+    cg::memory_release_gl(GL_TEXTURE, 1, &ctx.cubemap);
+    glDeleteTextures(1, &ctx.cubemap);
+    ctx.cubemap = cg::load_cubemap(cubemap_dir() + scenes[ctx.sceneIndex] + "prefiltered/" +
+                                   cubemaps[ctx.textureIndex]);
+    ctx.cubemapSelection = glm::ivec2(ctx.sceneIndex, ctx.textureIndex);
+    cg::gl_state_invalidate();  // The old name may be reused, and the loader binds directly
+}
+
+void draw_scene(Context &ctx, GLuint program, const DrawLocations &locations)
+{
+    if (ctx.frameUniformsOffset < 0) return;  // Uniforms could not be uploaded
 
-    // Clean up
+    // Set render state (through the state cache, so that the second pass only
+    // issues what differs from the first)
+    int stateChanges = cg::gl_state_use_program(program);
+    stateChanges += cg::gl_state_enable(GL_DEPTH_TEST);  // Enable Z-buffering
+
+    // Define per-scene uniforms
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, ctx.uniforms.buffer, ctx.frameUniformsOffset,
+                      sizeof(FrameUniforms));
+
+    // Cubemapping (only reloaded when the selection changes)
+    if (ctx.cubemapSelection != glm::ivec2(ctx.sceneIndex, ctx.textureIndex)) load_selected_cubemap(ctx);
+    stateChanges += cg::gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, ctx.cubemap);
+
+    // Toon shading Quantization (only uploaded when another map is selected)
+    stateChanges += cg::gl_state_bind_texture(1, GL_TEXTURE_1D, ctx.quantizationTexture);
+    if (ctx.uploadedQmapIndex != ctx.qmapIndex) {
+        glTexImage1D(GL_TEXTURE_1D, 0, GL_RED, 8, 0, GL_RED, GL_FLOAT, &ctx.qmap[ctx.qmapIndex]);
+        cg::memory_track_gl(GL_TEXTURE, ctx.quantizationTexture, cg::MEMORY_GL_ENVIRONMENT,
+                            cg::gl_image_bytes(GL_RED, 8, 1));
+        ctx.uploadedQmapIndex = ctx.qmapIndex;
+    }
+
+    // depth texture
+    stateChanges += cg::gl_state_bind_texture(2, GL_TEXTURE_2D, ctx.depthTexture);
+
+    // normal texture
+    stateChanges += cg::gl_state_bind_texture(3, GL_TEXTURE_2D, ctx.normalTexture);
+
+    // per-draw data (whose offset is set by each window, if it is drawn in
+    // windows)
+    stateChanges += cg::gl_state_bind_texture(5, GL_TEXTURE_BUFFER, ctx.drawTexture);
+    if (!ctx.windowDraws)
+        glUniform1i(locations.drawOffset, GLint(ctx.drawUniformsOffset / GLintptr(sizeof(glm::vec4))));
+    cg::profiler_count(cg::COUNTER_STATE_CHANGES, stateChanges + 1);  // And the uniform block
+
+    // Draw scene
+    if (ctx.drawCommandsOffset >= 0) submit_multi_draws(ctx, locations);
+    else submit_draws(ctx, locations);
+
+    // Clean up (the vertex array is unbound so that no later buffer binding
+    // changes it)
+    cg::gl_state_bind_vertex_array(0);
     cg::reset_gl_render_state();
-    glUseProgram(0);
+    cg::gl_state_use_program(0);
+}
+
+// Start occlusion culling for the current view on a worker thread. This
+// should be called as early in the frame as possible, so that it overlaps
+// with the GPU finishing the previous frame.
+void begin_occlusion_culling(Context &ctx)
+{
+    if (!ctx.occlusion.enabled || ctx.asset.nodes.empty()) return;
+
+    // The world matrices of the last frame, which include the model matrix
+    // and only change when the asset does. Frame preparation writes them
+    // after waiting for the culler (and clears them for a new asset, whose
+    // first frame is not culled).
+    const std::vector<glm::mat4> &worldMatrices = ctx.framePrep.worldMatrices;
+    if (worldMatrices.size() != ctx.asset.nodes.size()) return;
+
+    glm::mat4 Projection, View;
+    compute_camera_matrices(ctx, Projection, View);
+    gltf::occlusion_begin(ctx.occlusion, ctx.asset, Projection * View, glm::mat4(1.0f), &worldMatrices);
 }
 
 void do_rendering(Context &ctx)
 {
+    // Loading, hot reload and ImGui change state directly between frames
+    cg::gl_state_invalidate();
     cg::reset_gl_render_state();
+    {
+        CG_PROFILE_SCOPE("Wait for Occlusion");
+        gltf::occlusion_end(ctx.occlusion);
+    }
+
+    // 0. pick render size from the GPU time measured in earlier frames
+    resize_outline_textures(ctx);
+    cg::dynamic_resolution_resize(ctx.dynres, ctx.width, ctx.height);
+    cg::dynamic_resolution_update(ctx.dynres);
+    int renderWidth = cg::dynamic_resolution_render_width(ctx.dynres);
+    int renderHeight = cg::dynamic_resolution_render_height(ctx.dynres);
+    ctx.viewportScale[0] = float(renderWidth) / ctx.outlineWidth;
+    ctx.viewportScale[1] = float(renderHeight) / ctx.outlineHeight;
+    cg::gl_state_viewport(0, 0, renderWidth, renderHeight);
+    {
+        CG_PROFILE_SCOPE("Upload Uniforms");
+        upload_uniforms(ctx);
+    }
+    {
+        CG_PROFILE_SCOPE("Stream Textures");
+        gltf::texture_streaming_update(ctx.textureStreamer, ctx.textures, ctx.asset);
+    }
+    cg::gpu_timer_begin(ctx.dynres.timer);
 
     // 1. first render to outline framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, ctx.outlineFBO);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    draw_scene(ctx, ctx.outlineProgram);
+    {
+        CG_PROFILE_SCOPE("Outline Pass");
+        cg::profiler_gpu_begin("Outline Pass");
+        int binds = cg::gl_state_bind_framebuffer(GL_FRAMEBUFFER, ctx.outlineFBO);
+        cg::profiler_count(cg::COUNTER_STATE_CHANGES, binds);
+        glClearColor(ctx.bgColor[0], ctx.bgColor[1], ctx.bgColor[2], 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw_scene(ctx, ctx.outlineProgram, ctx.outlineLocations);
+        cg::profiler_gpu_end();
+    }
 
-    // 2. then render scene as normal
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClearColor(ctx.bgColor[0], ctx.bgColor[1], ctx.bgColor[2], 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    draw_scene(ctx, ctx.program);
+    // 2. then render scene as normal (offscreen if dynamic resolution is on)
+    {
+        CG_PROFILE_SCOPE("Main Pass");
+        cg::profiler_gpu_begin("Main Pass");
+        bool offscreen = ctx.dynres.enabled || ctx.headless;
+        int binds = cg::gl_state_bind_framebuffer(GL_FRAMEBUFFER, offscreen ? ctx.dynres.fbo : 0);
+        cg::profiler_count(cg::COUNTER_STATE_CHANGES, binds);
+        glClearColor(ctx.bgColor[0], ctx.bgColor[1], ctx.bgColor[2], 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw_scene(ctx, ctx.program, ctx.meshLocations);
+        cg::profiler_gpu_end();
+    }
+    cg::gpu_timer_end(ctx.dynres.timer);
+    cg::stream_buffer_end_frame(ctx.uniforms);
+
+    // 3. upscale the offscreen result to the backbuffer
+    cg::profiler_count(cg::COUNTER_STATE_CHANGES, cg::gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0));
+    if (ctx.dynres.enabled && !ctx.headless) {
+        CG_PROFILE_SCOPE("Upscale");
+        cg::profiler_gpu_begin("Upscale");
+        cg::dynamic_resolution_upscale(ctx.dynres, ctx.upscaleProgram, ctx.emptyVAO, ctx.width,
+                                       ctx.height);
+        cg::profiler_gpu_end();
+    }
+    cg::gl_state_viewport(0, 0, ctx.width, ctx.height);
+}
+
+// Settings of the state cache, and the effective and redundant state changes
+// of the last frame when they are counted
+void draw_gl_state_counts()
+{
+    bool caching = cg::gl_state_caching(), debug = cg::gl_state_debug();
+    if (ImGui::Checkbox("State Cache", &caching)) cg::gl_state_set_caching(caching);
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Count State Changes", &debug)) cg::gl_state_set_debug(debug);
+    if (!debug) return;
+
+    const cg::GLStateCounts &counts = cg::gl_state_last_frame();
+    uint64_t effective = 0, redundant = 0;
+    for (int i = 0; i < cg::NUM_STATE_CALLS; ++i) {
+        effective += counts.effective[i];
+        redundant += counts.redundant[i];
+    }
+    ImGui::SameLine();
+    ImGui::Text("%llu effective, %llu redundant (%s)", (unsigned long long)effective,
+                (unsigned long long)redundant, caching ? "skipped" : "issued");
+    if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        for (int i = 0; i < cg::NUM_STATE_CALLS; ++i) {
+            ImGui::Text("%-16s %5llu effective, %5llu redundant", cg::gl_state_call_name(cg::GLStateCall(i)),
+                        (unsigned long long)counts.effective[i], (unsigned long long)counts.redundant[i]);
+        }
+        ImGui::EndTooltip();
+    }
+}
+
+// Show the latest profiled frame as a timeline with one row per thread and
+// one for the GPU, followed by the duration of each top-level scope
+void draw_profiler_window(Context &ctx)
+{
+    ImGui::SetNextWindowSize(ImVec2(600.0f, 320.0f), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &ctx.showProfiler)) {
+        ImGui::End();
+        return;
+    }
+    const cg::ProfilerFrame &frame = cg::profiler_latest_frame();
+    const double frameMs = (frame.end - frame.start) * 1e-6;
+    ImGui::Text("Frame %llu: %.2f ms", (unsigned long long)frame.index, frameMs);
+    ImGui::Text("Draw calls: %llu, triangles: %llu, state changes: %llu, texture binds: %llu",
+                (unsigned long long)frame.counters[cg::COUNTER_DRAW_CALLS],
+                (unsigned long long)frame.counters[cg::COUNTER_TRIANGLES],
+                (unsigned long long)frame.counters[cg::COUNTER_STATE_CHANGES],
+                (unsigned long long)frame.counters[cg::COUNTER_TEXTURE_BINDS]);
+    ImGui::Text("Uniform stream: %s mapping, %.0f KiB per frame, %u waits, %u orphans",
+                ctx.uniforms.persistent ? "persistent" : "unsynchronized", ctx.uniforms.frameSize / 1024.0,
+                ctx.uniforms.waits, ctx.uniforms.orphans);
+    draw_gl_state_counts();
+
+    std::vector<std::string> threadNames = cg::profiler_thread_names();
+    const float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+    const float labelWidth = 90.0f;
+    int maxDepth[2] = {0, 0};  // CPU and GPU
+    for (const cg::ProfilerEvent &event : frame.cpuEvents) maxDepth[0] = std::max(maxDepth[0], event.depth);
+    for (const cg::ProfilerEvent &event : frame.gpuEvents) maxDepth[1] = std::max(maxDepth[1], event.depth);
+
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    const float width = std::max(ImGui::GetContentRegionAvail().x - labelWidth, 1.0f);
+    const double scale = frame.end > frame.start ? width / double(frame.end - frame.start) : 0.0;
+    ImVec2 mouse = ImGui::GetIO().MousePos;
+    const cg::ProfilerEvent *hovered = nullptr;
+
+    // Draw a row group for one thread (or the GPU) and return its height
+    auto draw_row = [&](const char *label, const std::vector<cg::ProfilerEvent> &events, int thread,
+                        int depth, float y) {
+        drawList->AddText(ImVec2(origin.x, y + 2.0f), ImGui::GetColorU32(ImGuiCol_Text), label);
+        for (const cg::ProfilerEvent &event : events) {
+            if (event.thread != thread) continue;
+            float x0 = origin.x + labelWidth + float((event.start - frame.start) * scale);
+            float x1 = origin.x + labelWidth + float((event.end - frame.start) * scale);
+            float y0 = y + event.depth * rowHeight;
+            ImVec2 min(std::max(x0, origin.x + labelWidth), y0);
+            ImVec2 max(std::max(x1, min.x + 1.0f), y0 + rowHeight - 1.0f);
+            uint32_t hash = 2166136261u;
+            for (const char *c = event.name; *c; ++c) hash = (hash ^ uint8_t(*c)) * 16777619u;
+            ImU32 color = IM_COL32(80 + hash % 128, 80 + (hash >> 8) % 128, 80 + (hash >> 16) % 128, 255);
+            drawList->AddRectFilled(min, max, color);
+            if (max.x - min.x > ImGui::CalcTextSize(event.name).x + 4.0f) {
+                drawList->AddText(ImVec2(min.x + 2.0f, min.y + 2.0f), IM_COL32_WHITE, event.name);
+            }
+            if (mouse.x >= min.x && mouse.x < max.x && mouse.y >= min.y && mouse.y < max.y)
+                hovered = &event;
+        }
+        return (depth + 1) * rowHeight + 4.0f;
+    };
+
+    float y = origin.y;
+    for (size_t i = 0; i < threadNames.size(); ++i) {
+        bool used = false;
+        for (const cg::ProfilerEvent &event : frame.cpuEvents) used |= event.thread == int(i);
+        if (used) y += draw_row(threadNames[i].c_str(), frame.cpuEvents, int(i), maxDepth[0], y);
+    }
+    if (!frame.gpuEvents.empty()) y += draw_row("GPU", frame.gpuEvents, -1, maxDepth[1], y);
+    ImGui::Dummy(ImVec2(labelWidth + width, y - origin.y));
+    if (hovered && ImGui::IsWindowHovered()) {
+        ImGui::SetTooltip("%s: %.3f ms", hovered->name, (hovered->end - hovered->start) * 1e-6);
+    }
+
+    // Top-level scopes of the main thread and the GPU
+    ImGui::Columns(2, "ProfilerScopes", false);
+    for (const cg::ProfilerEvent &event : frame.cpuEvents) {
+        if (event.thread == 0 && event.depth == 0)
+            ImGui::Text("%-18s %7.3f ms", event.name, (event.end - event.start) * 1e-6);
+    }
+    ImGui::NextColumn();
+    for (const cg::ProfilerEvent &event : frame.gpuEvents) {
+        if (event.depth == 0)
+            ImGui::Text("GPU %-14s %7.3f ms", event.name, (event.end - event.start) * 1e-6);
+    }
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+// Settings of the texture streaming and the residency of each texture
+void draw_texture_streaming_gui(Context &ctx)
+{
+    gltf::TextureStreamer &streamer = ctx.textureStreamer;
+    gltf::TextureStreamingSettings &settings = streamer.settings;
+    int budgetMB = int(settings.budgetBytes >> 20), uploadMB = int(settings.uploadBytesPerFrame >> 20);
+    if (ImGui::SliderInt("Budget (MB)", &budgetMB, 1, 2048)) settings.budgetBytes = size_t(budgetMB) << 20;
+    if (ImGui::SliderInt("Upload per Frame (MB)", &uploadMB, 1, 64))
+        settings.uploadBytesPerFrame = size_t(uploadMB) << 20;
+    ImGui::SliderFloat("LOD Bias", &settings.lodBias, -2.0f, 4.0f);
+    ImGui::Text("%.1f MB resident, %u levels uploaded (%.1f MB), %u evicted",
+                streamer.residentBytes / (1024.0 * 1024.0), streamer.uploadedLevels,
+                streamer.uploadedBytes / (1024.0 * 1024.0), streamer.evictedLevels);
+    const gltf::TexturePacking &packing = ctx.texturePacking;
+    ImGui::Text("%d textures in %d arrays, padding %.1f%% (%.1f MB at level 0)", int(packing.slots.size()),
+                int(packing.arrays.size()),
+                packing.imageBytes ? 100.0 * (packing.layerBytes - packing.imageBytes) / packing.imageBytes : 0.0,
+                (packing.layerBytes - packing.imageBytes) / (1024.0 * 1024.0));
+    const gltf::TextureCompressionStats &compression = ctx.textureCompressionStats;
+    if (compression.compressedArrays) {
+        ImGui::Text("%d arrays block compressed: %.1f MB instead of %.1f MB, PSNR %.1f dB",
+                    compression.compressedArrays, compression.compressedBytes / (1024.0 * 1024.0),
+                    compression.uncompressedBytes / (1024.0 * 1024.0), compression.psnr);
+    }
+    if (!ctx.texMapping) ImGui::Text("Textures are only requested with texture mapping on");
+
+    ImGui::Columns(5, "TextureResidency");
+    ImGui::Text("Array"), ImGui::NextColumn();
+    ImGui::Text("Size"), ImGui::NextColumn();
+    ImGui::Text("Resident"), ImGui::NextColumn();
+    ImGui::Text("Requested"), ImGui::NextColumn();
+    ImGui::Text("KiB"), ImGui::NextColumn();
+    for (size_t i = 0; i < streamer.textures.size(); ++i) {
+        const gltf::StreamedTexture &texture = streamer.textures[i];
+        bool requested = texture.lastRequested + 1 >= streamer.frame;
+        ImGui::Text("%d", int(i)), ImGui::NextColumn();
+        ImGui::Text("%dx%dx%d", texture.width, texture.height, texture.layers), ImGui::NextColumn();
+        ImGui::Text("%dx%d", std::max(1, texture.width >> texture.residentLevel),
+                    std::max(1, texture.height >> texture.residentLevel)), ImGui::NextColumn();
+        if (requested) ImGui::Text("level %d%s", texture.requestedLevel, texture.overBudget ? " (over budget)" : "");
+        else ImGui::Text("-");
+        ImGui::NextColumn();
+        ImGui::Text("%.0f", texture.residentBytes / 1024.0), ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+// Scene selection, and the memory of the loaded scenes. Selecting a scene
+// starts loading it (see update_hot_reload()).
+void draw_scenes_gui(Context &ctx)
+{
+    auto sceneName = [](void *names, int i, const char **text) {
+        *text = (*static_cast<const std::vector<std::string> *>(names))[i].c_str();
+        return true;
+    };
+    ImGui::Combo("Scene", &ctx.nextScene, sceneName, &ctx.sceneNames, int(ctx.sceneNames.size()));
+    if (ctx.nextScene != ctx.assetScene) ImGui::Text("Loading...");
+    const gltf::SceneLoaderStats &stats = ctx.sceneStats;
+    ImGui::Text("Last scene loaded in %.1f ms, %d scenes loaded in total", stats.lastLoadMs,
+                stats.scenesLoaded);
+    ImGui::Text("%.1f MB of buffer and image data in memory (budget %.0f MB)",
+                stats.residentBytes / (1024.0 * 1024.0), ctx.sceneLoader.budgetBytes / (1024.0 * 1024.0));
+    ImGui::Text("%.1f MB loaded (%d buffer views, %d images), %.1f MB released",
+                stats.loadedBytes / (1024.0 * 1024.0), stats.viewsLoaded, stats.imagesDecoded,
+                stats.releasedBytes / (1024.0 * 1024.0));
+}
+
+// Live and peak memory of each resource category (see cg_memory.h)
+void draw_memory_gui(Context &ctx)
+{
+    const double MB = 1024.0 * 1024.0;
+    ImGui::Columns(4, "MemoryCategories");
+    ImGui::Text("Category"), ImGui::NextColumn();
+    ImGui::Text("MB"), ImGui::NextColumn();
+    ImGui::Text("Peak MB"), ImGui::NextColumn();
+    ImGui::Text("Objects"), ImGui::NextColumn();
+    auto row = [&](const char *name, const cg::MemoryUsage &usage) {
+        ImGui::Text("%s", name), ImGui::NextColumn();
+        ImGui::Text("%.1f", usage.bytes / MB), ImGui::NextColumn();
+        ImGui::Text("%.1f", usage.peakBytes / MB), ImGui::NextColumn();
+        ImGui::Text("%d", usage.objects), ImGui::NextColumn();
+    };
+    for (int i = 0; i < cg::NUM_MEMORY_CATEGORIES; ++i)
+        row(cg::memory_category_name(cg::MemoryCategory(i)), cg::memory_usage(cg::MemoryCategory(i)));
+    row("CPU total", cg::memory_total(false));
+    row("GPU total", cg::memory_total(true));
+    ImGui::Columns(1);
+    if (ImGui::Button("Reset Peaks")) cg::memory_reset_peaks();
+    ImGui::Checkbox("Release CPU Data After Upload", &ctx.releaseCpuData);
+    ImGui::InputText("Report", ctx.memoryReportPath, sizeof(ctx.memoryReportPath));
+    if (ImGui::Button("Write Report") && cg::memory_write_json(ctx.memoryReportPath))
+        std::cout << "Wrote memory report to " << ctx.memoryReportPath << std::endl;
 }
 
 void reload_shaders(Context *ctx)
 {
     glDeleteProgram(ctx->program);
     glDeleteProgram(ctx->outlineProgram);
-    ctx->program = cg::load_shader_program(shader_dir() + "mesh.vert", shader_dir() + "mesh.frag");
-    ctx->outlineProgram = cg::load_shader_program(shader_dir() + "outline.vert", shader_dir() + "outline.frag");
+    glDeleteProgram(ctx->upscaleProgram);
+    load_shader_programs(*ctx);
+}
+
+// Returns the files that are watched for hot reloading: the shaders, and the
+// glTF file of the asset with the buffers and images that it refers to
+std::vector<std::string> hot_reload_files(const Context &ctx)
+{
+    std::vector<std::string> files;
+    for (const char *name : {"mesh", "outline", "upscale"}) {
+        files.push_back(shader_dir() + name + ".vert");
+        files.push_back(shader_dir() + name + ".frag");
+    }
+    if (ctx.gltfFilename.empty()) return files;
+    std::string dir, filename;
+    split_gltf_path(ctx.gltfFilename, dir, filename);
+    files.push_back(dir + filename);
+    for (const gltf::Buffer &buffer : ctx.asset.buffers) {
+        if (!buffer.uri.empty()) files.push_back(dir + buffer.uri);
+    }
+    for (const gltf::Image &image : ctx.asset.images) {
+        if (!image.uri.empty()) files.push_back(dir + image.uri);  // Not embedded in a .glb
+    }
+    return files;
+}
+
+// Start (or update) watching the files of the shaders and the asset
+void start_hot_reload(Context &ctx)
+{
+    if (!ctx.hotReload) return;
+    ctx.fileWatcher.onChange = [] { glfwPostEmptyEvent(); };  // Wake up wait_for_redraw()
+    cg::file_watcher_start(ctx.fileWatcher, hot_reload_files(ctx));
+}
+
+// Recompile the program that uses a changed shader file, and only that one.
+// The previous program is kept if the new one fails to compile or link.
+// Returns true if the program was replaced.
+bool reload_shader_program(Context &ctx, const std::string &path)
+{
+    struct {
+        const char *name;
+        GLuint *program;
+        DrawLocations *locations;  // Null for programs without scene resources
+    } programs[] = {{"mesh", &ctx.program, &ctx.meshLocations},
+                    {"outline", &ctx.outlineProgram, &ctx.outlineLocations},
+                    {"upscale", &ctx.upscaleProgram, nullptr}};
+    for (const auto &it : programs) {
+        std::string vertex = shader_dir() + it.name + ".vert", fragment = shader_dir() + it.name + ".frag";
+        if (path != vertex && path != fragment) continue;
+        GLuint program = cg::load_shader_program(vertex, fragment);
+        if (!program) {
+            std::cerr << "Warning: keeping the previous " << it.name << " program" << std::endl;
+            return false;
+        }
+        glDeleteProgram(*it.program);
+        *it.program = program;
+        if (it.locations) *it.locations = bind_program_resources(program);
+        return true;
+    }
+    return false;
+}
+
+// Load the changed files of an asset, or another scene of it (on a worker
+// thread, which has the scene loader to itself). Images that keep their size
+// are loaded on their own, with the new levels of the array layers that use
+// them, and buffers are loaded along with the rest of the scene, whose
+// description has not changed. The whole scene is loaded again otherwise.
+void load_asset_changes(AssetReload &reload, gltf::SceneLoader &loader, const std::string &gltfFilename,
+                        const std::vector<bool> &srgb, const gltf::TexturePacking &packing,
+                        const std::vector<GLenum> &formats, const cg::MipSettings &mipmaps, bool shareArrays,
+                        const gltf::TextureCompressionSettings &compression, bool deduplicate,
+                        const gltf::LodSettings &lodSettings)
+{
+    std::string dir, filename;
+    split_gltf_path(gltfFilename, dir, filename);
+    bool reopen = false;  // The scene description has changed
+    for (const cg::FileChange &change : reload.changes) {
+        if (change.path == dir + filename) reopen = true;
+        else gltf::scene_loader_invalidate(loader, change.path);
+    }
+    for (size_t i = 0; i < reload.images.size() && !reload.full; ++i) {
+        gltf::Image &image = reload.imageData[i];
+        int width = image.width, height = image.height;
+        if (!gltf::load_gltf_image(dir, image)) {
+            reload.ok = false;
+            return;
+        }
+        if (image.width != width || image.height != height) {
+            reload.full = true;  // The textures must be packed again
+            break;
+        }
+        image.levels = cg::generate_mip_chain(reinterpret_cast<const uint8_t *>(image.data.data()), width,
+                                              height, srgb[i], mipmaps);
+        for (size_t index = 0; index < packing.arrays.size(); ++index) {
+            const gltf::PackedArray &array = packing.arrays[index];
+            for (size_t layer = 0; layer < array.images.size(); ++layer) {
+                if (array.images[layer] != reload.images[i]) continue;
+                reload.layers.push_back(glm::ivec2(index, layer));
+                reload.layerLevels.push_back(gltf::compute_layer_levels(image, array, formats[index],
+                                                                        compression.quality, packing.mipFilter));
+            }
+        }
+    }
+
+    if (reload.full) {
+        reload.images.clear(), reload.imageData.clear();
+        reload.layers.clear(), reload.layerLevels.clear();
+        reload.ok = reopen ? load_asset_scene(loader, filename, dir, reload.scene, reload.asset)
+                           : gltf::scene_loader_load(loader, reload.scene, reload.asset);
+        if (!reload.ok) return;
+        gltf::DedupStats dedupStats;
+        if (deduplicate) gltf::deduplicate_gltf_asset(reload.asset, dedupStats);
+        reload.aoAvailable = apply_cached_ambient_occlusion(gltfFilename, reload.asset);
+        gltf::generate_mesh_lods(reload.asset, lodSettings, &reload.lodStats);
+        gltf::generate_image_mipmaps(reload.asset, mipmaps);
+        reload.packing = gltf::pack_textures(reload.asset, shareArrays);
+        reload.packing.mipFilter = mipmaps.filter;
+        if (compression.enabled) {
+            reload.arrayLevels = gltf::compress_texture_arrays(reload.asset, reload.packing, compression,
+                                                               gltf::cache_filename(dir, filename, "textures"));
+        }
+    } else if (reload.buffers) {
+        // Fails if a buffer is still being written (and shorter than its views)
+        reload.ok = gltf::scene_loader_load(loader, reload.scene, reload.asset);
+        gltf::DedupStats dedupStats;
+        if (reload.ok && deduplicate) gltf::deduplicate_gltf_asset(reload.asset, dedupStats);
+        if (reload.ok) reload.aoAvailable = apply_cached_ambient_occlusion(gltfFilename, reload.asset);
+        if (reload.ok) gltf::generate_mesh_lods(reload.asset, lodSettings, &reload.lodStats);
+    }
+    reload.sceneNames = scene_names(loader.asset);
+    reload.sceneStats = loader.stats;
+}
+
+// Start loading the changed asset files (or the next scene) on a worker
+// thread. Everything that it needs is copied, since the asset may change while
+// it runs, except for the scene loader, which only the worker uses meanwhile.
+void start_asset_reload(Context &ctx)
+{
+    AssetReload reload;
+    reload.changes.swap(ctx.assetChanges);
+    reload.scene = ctx.nextScene;
+    if (ctx.nextScene != ctx.assetScene) reload.full = true;
+    std::string dir, filename;
+    split_gltf_path(ctx.gltfFilename, dir, filename);
+    std::vector<bool> srgbImages = gltf::srgb_images(ctx.asset), srgb;
+    for (const cg::FileChange &change : reload.changes) {
+        if (change.path == dir + filename) reload.full = true;
+        for (const gltf::Buffer &buffer : ctx.asset.buffers) {
+            if (change.path == dir + buffer.uri) reload.buffers = true;
+        }
+        for (unsigned i = 0; i < ctx.asset.images.size(); ++i) {
+            const gltf::Image &image = ctx.asset.images[i];
+            if (change.path != dir + image.uri) continue;
+            if (image.data.empty()) reload.full = true;  // Merged with an identical image, or released
+            gltf::Image reloaded;
+            reloaded.uri = image.uri;
+            reloaded.width = image.width;
+            reloaded.height = image.height;
+            reload.images.push_back(int(i));
+            reload.imageData.push_back(reloaded);
+            srgb.push_back(srgbImages[i]);
+        }
+    }
+    std::vector<GLenum> formats;
+    for (const gltf::ArrayLevels &levels : ctx.textureStreamer.arrayLevels) formats.push_back(levels.format);
+    gltf::texture_format_supported(gltf::TEXTURE_RGBA8);  // Query the formats while the context is current
+
+    std::string gltfFilename = ctx.gltfFilename;
+    gltf::TexturePacking packing = ctx.texturePacking;
+    cg::MipSettings mipmaps = ctx.mipmaps;
+    bool shareArrays = ctx.shareTextureArrays;
+    gltf::TextureCompressionSettings compression = ctx.textureCompression;
+    bool deduplicate = ctx.deduplicate;
+    gltf::LodSettings lodSettings = ctx.lodSettings;
+    gltf::SceneLoader *loader = &ctx.sceneLoader;
+    ctx.assetReload = std::async(std::launch::async, [=] {
+        cg::profiler_set_thread_name("Asset Reload");
+        AssetReload result = reload;
+        load_asset_changes(result, *loader, gltfFilename, srgb, packing, formats, mipmaps, shareArrays,
+                           compression, deduplicate, lodSettings);
+        return result;
+    });
+}
+
+// Replace the changed parts of the asset and update their GPU resources,
+// keeping the unchanged ones. Must be called when no other thread reads the
+// asset (see finish_ambient_occlusion_bake()).
+void apply_asset_reload(Context &ctx, AssetReload &reload)
+{
+    ctx.sceneNames = reload.sceneNames;
+    ctx.sceneStats = reload.sceneStats;
+    if (reload.scene != ctx.assetScene && reload.scene >= 0 && reload.scene < int(ctx.sceneNames.size())) {
+        std::cout << "Loaded scene \"" << ctx.sceneNames[reload.scene] << "\" in "
+                  << reload.sceneStats.lastLoadMs << " ms (" << reload.sceneStats.residentBytes / (1024.0 * 1024.0)
+                  << " MB of buffer and image data in memory)" << std::endl;
+    }
+    ctx.assetScene = ctx.nextScene = reload.scene;
+    if (reload.full) {
+        ctx.asset = std::move(reload.asset);
+        ctx.aoAvailable = reload.aoAvailable;
+        ctx.lodStats = reload.lodStats;
+        print_streamed_geometry(ctx.asset);
+        gltf::create_drawables_from_gltf_asset(ctx.drawables, ctx.asset, &ctx.staging);
+        ctx.texturePacking = reload.packing;
+        gltf::texture_streaming_init(ctx.textureStreamer, ctx.textures, ctx.asset, ctx.texturePacking,
+                                     std::move(reload.arrayLevels));
+        gltf::occlusion_init(ctx.occlusion, ctx.asset);
+        gltf::frame_prep_init(ctx.framePrep, ctx.asset);
+        start_hot_reload(ctx);  // The asset may refer to other files now
+        return;
+    }
+    if (reload.buffers) {
+        // The images (and the rest of the scene description) are the same, as
+        // are the textures, whose images were merged when they were loaded
+        reload.asset.images.swap(ctx.asset.images);
+        reload.asset.textures = ctx.asset.textures;
+        if (!gltf::update_drawables_from_gltf_asset(ctx.drawables, reload.asset, ctx.asset, &ctx.staging))
+            gltf::create_drawables_from_gltf_asset(ctx.drawables, reload.asset, &ctx.staging);
+        ctx.asset = std::move(reload.asset);
+        ctx.aoAvailable = reload.aoAvailable;
+        ctx.lodStats = reload.lodStats;
+        gltf::texture_streaming_update_meshes(ctx.textureStreamer, ctx.asset);
+        gltf::occlusion_init(ctx.occlusion, ctx.asset);
+        gltf::frame_prep_init(ctx.framePrep, ctx.asset);
+    }
+    for (size_t i = 0; i < reload.images.size(); ++i) ctx.asset.images[reload.images[i]] = std::move(reload.imageData[i]);
+    for (size_t i = 0; i < reload.layers.size(); ++i) {
+        gltf::texture_streaming_replace_layer(ctx.textureStreamer, ctx.textures, reload.layers[i].x,
+                                              reload.layers[i].y, reload.layerLevels[i]);
+    }
+}
+
+// Measure the latency of a reload until its result is displayed
+void add_reload_timing(Context &ctx, const std::vector<cg::FileChange> &changes)
+{
+    ReloadTiming timing;
+    timing.changeTime = changes[0].time;
+    for (const cg::FileChange &change : changes) {
+        size_t separator = change.path.find_last_of("/\\");
+        if (!timing.files.empty()) timing.files += ", ";
+        timing.files += separator == std::string::npos ? change.path : change.path.substr(separator + 1);
+        timing.changeTime = std::min(timing.changeTime, change.time);
+    }
+    timing.appliedTime = cg::profiler_now();
+    ctx.reloadTimings.push_back(timing);
+    ctx.redrawFrames = Context::REDRAW_FRAMES;
+}
+
+// Apply changes of the watched files. Shaders are compiled right away, while
+// asset files (and scenes that are selected) are loaded on a worker thread,
+// and applied once they are loaded and no ambient occlusion bake reads the
+// asset.
+void update_hot_reload(Context &ctx)
+{
+    for (const cg::FileChange &change : cg::file_watcher_poll(ctx.fileWatcher)) {
+        if (change.path.compare(0, shader_dir().size(), shader_dir()) == 0) {
+            if (reload_shader_program(ctx, change.path)) add_reload_timing(ctx, {change});
+        } else {
+            ctx.assetChanges.push_back(change);
+        }
+    }
+    if (ctx.assetReload.valid() && !ctx.aoBake.valid() &&
+        ctx.assetReload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        AssetReload reload = ctx.assetReload.get();
+        if (reload.ok) {
+            update_memory_tags(ctx, &reload);
+            apply_asset_reload(ctx, reload);
+            if (!reload.changes.empty()) add_reload_timing(ctx, reload.changes);
+            else ctx.redrawFrames = Context::REDRAW_FRAMES;
+        } else if (reload.scene != ctx.assetScene) {
+            std::cerr << "Warning: keeping the previous scene of " << ctx.gltfFilename << std::endl;
+            ctx.nextScene = ctx.assetScene;
+        } else {
+            std::cerr << "Warning: keeping the previous version of " << ctx.gltfFilename << std::endl;
+        }
+    }
+    if (!ctx.assetReload.valid() && (!ctx.assetChanges.empty() || ctx.nextScene != ctx.assetScene)) {
+        start_asset_reload(ctx);
+    }
+}
+
+// Report the latency of reloads from the change on disk until the first frame
+// that shows them has finished on the GPU, without waiting for it
+void finish_reload_timings(Context &ctx)
+{
+    for (size_t i = 0; i < ctx.reloadTimings.size();) {
+        ReloadTiming &timing = ctx.reloadTimings[i];
+        if (!timing.fence) {
+            timing.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            i++;
+            continue;
+        }
+        if (glClientWaitSync(timing.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            i++;
+            continue;
+        }
+        glDeleteSync(timing.fence);
+        char text[512];
+        std::snprintf(text, sizeof(text), "%s in %.1f ms (%.1f ms from save to frame)", timing.files.c_str(),
+                      (timing.appliedTime - timing.changeTime) * 1e-6,
+                      (cg::profiler_now() - timing.changeTime) * 1e-6);
+        ctx.lastReload = text;
+        std::cout << "Reloaded " << text << std::endl;
+        ctx.reloadTimings.erase(ctx.reloadTimings.begin() + i);
+    }
+}
+
+// GUI variables that are recorded and replayed along with the input
+std::vector<cg::StateVariable> gui_state_variables(Context &ctx)
+{
+    std::vector<cg::StateVariable> variables = {
+        {"zoom", cg::STATE_FLOAT, &ctx.zoom},
+        {"diffuseColor", cg::STATE_VEC3, &ctx.diffuseColor},
+        {"diffuseEnabled", cg::STATE_BOOL, &ctx.diffuseEnabled},
+        {"specularEnabled", cg::STATE_BOOL, &ctx.specularEnabled},
+        {"specularPower", cg::STATE_FLOAT, &ctx.specularPower},
+        {"ambientEnabled", cg::STATE_BOOL, &ctx.ambientEnabled},
+        {"lightPosition", cg::STATE_VEC3, &ctx.lightPosition},
+        {"bgColor", cg::STATE_VEC3, &ctx.bgColor},
+        {"envMapping", cg::STATE_BOOL, &ctx.envMapping},
+        {"sceneIndex", cg::STATE_INT, &ctx.sceneIndex},
+        {"textureIndex", cg::STATE_INT, &ctx.textureIndex},
+        {"texMapping", cg::STATE_BOOL, &ctx.texMapping},
+        {"lighting", cg::STATE_BOOL, &ctx.lighting},
+        {"quantizationEnabled", cg::STATE_BOOL, &ctx.quantizationEnabled},
+        {"qmapIndex", cg::STATE_INT, &ctx.qmapIndex},
+        {"viewOutline", cg::STATE_BOOL, &ctx.viewOutline},
+        {"outlineIntensity", cg::STATE_FLOAT, &ctx.outlineIntensity},
+        {"viewDepth", cg::STATE_BOOL, &ctx.viewDepth},
+        {"viewNormals", cg::STATE_BOOL, &ctx.viewNormals},
+        {"aoEnabled", cg::STATE_BOOL, &ctx.aoEnabled},
+        {"ortho", cg::STATE_BOOL, &ctx.ortho},
+        {"gamma", cg::STATE_BOOL, &ctx.gamma},
+        {"textureCoordinates", cg::STATE_BOOL, &ctx.textureCoordinates},
+        {"dynamicResolution", cg::STATE_BOOL, &ctx.dynres.enabled},
+        {"dynamicResolutionTargetMs", cg::STATE_FLOAT, &ctx.dynres.targetMs},
+        {"dynamicResolutionMinScale", cg::STATE_FLOAT, &ctx.dynres.minScale},
+        {"dynamicResolutionFilter", cg::STATE_INT, &ctx.dynres.filter},
+        {"occlusionCulling", cg::STATE_BOOL, &ctx.occlusion.enabled},
+    };
+    return variables;
+}
+
+// Apply a mouse or scroll event to the camera, and record it if recording
+void apply_input_event(Context &ctx, const cg::InputEvent &event)
+{
+    if (ctx.recordingInput) ctx.pendingInput.push_back(event);
+    switch (event.type) {
+    case cg::INPUT_MOUSE_BUTTON:
+        ctx.trackball.center = glm::vec2(event.x, event.y);
+        ctx.trackball.tracking = event.value[0] != 0.0;
+        break;
+    case cg::INPUT_CURSOR_POS: cg::trackball_move(ctx.trackball, float(event.x), float(event.y)); break;
+    case cg::INPUT_SCROLL:
+        ctx.zoom -= float(event.y);
+        if (ctx.zoom <= 1.0f) ctx.zoom = 1.0f;
+        if (ctx.zoom >= 110.0f) ctx.zoom = 110.0f;
+        break;
+    case cg::INPUT_STATE: break;
+    }
+}
+
+// Called after polling events: starts a recorded frame, or applies the input
+// events of the next replayed frame
+void begin_input_frame(Context &ctx)
+{
+    double now = glfwGetTime();
+    if (ctx.recordingInput) {
+        ctx.input.frames.push_back(cg::InputFrame());
+        ctx.input.frames.back().time = now;
+        ctx.input.frames.back().events.swap(ctx.pendingInput);
+    } else if (ctx.replayingInput) {
+        if (ctx.frameStartTime >= 0.0) ctx.replayFrameTimes.push_back((now - ctx.frameStartTime) * 1e3);
+        if (ctx.replayFrame < ctx.input.frames.size()) {
+            const cg::InputFrame &frame = ctx.input.frames[ctx.replayFrame];
+            for (const cg::InputEvent &event : frame.events) {
+                if (event.type != cg::INPUT_STATE) apply_input_event(ctx, event);
+            }
+            // Animation follows the recorded clock, not the replay speed
+            ctx.elapsedTime = float(frame.time - ctx.input.frames[0].time);
+        }
+    }
+    ctx.frameStartTime = now;
+}
+
+// Called after the GUI has been built: records changed GUI state, or
+// overrides it with the replayed state
+void end_input_frame(Context &ctx)
+{
+    if (ctx.recordingInput) {
+        cg::record_state_changes(gui_state_variables(ctx), ctx.recordedState, ctx.input.frames.back());
+    } else if (ctx.replayingInput && ctx.replayFrame < ctx.input.frames.size()) {
+        std::vector<cg::StateVariable> variables = gui_state_variables(ctx);
+        for (const cg::InputEvent &event : ctx.input.frames[ctx.replayFrame].events) {
+            if (event.type == cg::INPUT_STATE && !cg::apply_state_event(variables, event)) {
+                std::cerr << "Warning: Unknown state variable " << event.name << " in replay" << std::endl;
+            }
+        }
+        if (++ctx.replayFrame == ctx.input.frames.size()) glfwSetWindowShouldClose(ctx.window, GLFW_TRUE);
+    }
+}
+
+// Input (including input used by the GUI) invalidates the frame
+void request_redraw(GLFWwindow *window)
+{
+    Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
+    ctx->redrawFrames = Context::REDRAW_FRAMES;
+}
+
+// Returns true if the next frame must be drawn. Nothing in the scene is
+// animated yet, so continuous mode is needed for shaders that use u_time.
+bool needs_redraw(const Context &ctx)
+{
+    return !ctx.renderOnDemand || ctx.redrawFrames > 0 || ctx.capture.recording ||
+           ctx.recordingInput || ctx.replayingInput || ctx.showProfiler ||
+           gltf::texture_streaming_pending(ctx.textureStreamer) || !ctx.reloadTimings.empty();
+}
+
+// Update the CPU and GPU load, once per second
+void update_utilization(Context &ctx, bool drewFrame)
+{
+    Utilization &u = ctx.utilization;
+    double now = glfwGetTime(), cpu = double(std::clock()) / CLOCKS_PER_SEC;
+    if (drewFrame) {
+        u.frames++;
+        u.gpuMs += ctx.dynres.timer.lastMs;
+    }
+    if (u.wallStart < 0.0) {
+        u.wallStart = now, u.cpuStart = cpu;
+    } else if (now - u.wallStart >= 1.0) {
+        double seconds = now - u.wallStart;
+        u.cpuPercent = float(100.0 * (cpu - u.cpuStart) / seconds);
+        u.gpuPercent = float(std::min(100.0, 0.1 * u.gpuMs / seconds));
+        u.framesPerSecond = float(u.frames / seconds);
+        u.wallStart = now, u.cpuStart = cpu, u.gpuMs = 0.0, u.frames = 0;
+    }
+}
+
+// Wait for events while nothing needs to be drawn, and return after a
+// timeout to poll asynchronous work such as AO baking and asset reloads
+void wait_for_redraw(Context &ctx)
+{
+    while (!needs_redraw(ctx) && !glfwWindowShouldClose(ctx.window)) {
+        glfwWaitEventsTimeout(ctx.aoBake.valid() || ctx.assetReload.valid() ? 0.05 : 0.5);
+        if (finish_ambient_occlusion_bake(ctx)) ctx.redrawFrames = Context::REDRAW_FRAMES;
+        update_hot_reload(ctx);
+        update_utilization(ctx, false);
+    }
+}
+
+// Sleep until the next frame is due if the frame rate is capped
+void limit_frame_rate(Context &ctx)
+{
+    if (ctx.frameRateCap <= 0) return;
+    double now = glfwGetTime();
+    ctx.nextFrameTime = std::max(ctx.nextFrameTime + 1.0 / ctx.frameRateCap, now - 1.0 / ctx.frameRateCap);
+    if (ctx.nextFrameTime > now) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(ctx.nextFrameTime - now));
+    }
 }
 
 void error_callback(int /*error*/, const char *description)
@@ -345,6 +1782,7 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 {
     // Forward event to ImGui
     ImGui_ImplGlfw_KeyCallback(window, key, scancode, action, mods);
+    request_redraw(window);
     if (ImGui::GetIO().WantCaptureKeyboard) return;
 
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
@@ -355,6 +1793,7 @@ void char_callback(GLFWwindow *window, unsigned int codepoint)
 {
     // Forward event to ImGui
     ImGui_ImplGlfw_CharCallback(window, codepoint);
+    request_redraw(window);
     if (ImGui::GetIO().WantTextInput) return;
 }
 
@@ -362,37 +1801,49 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 {
     // Forward event to ImGui
     ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+    request_redraw(window);
     if (ImGui::GetIO().WantCaptureMouse) return;
 
     double x, y;
     glfwGetCursorPos(window, &x, &y);
 
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
-    if (button == GLFW_MOUSE_BUTTON_LEFT) {
-        ctx->trackball.center = glm::vec2(x, y);
-        ctx->trackball.tracking = (action == GLFW_PRESS);
+    if (button == GLFW_MOUSE_BUTTON_LEFT && !ctx->replayingInput) {
+        cg::InputEvent event;
+        event.type = cg::INPUT_MOUSE_BUTTON;
+        event.x = x, event.y = y;
+        event.value[0] = (action == GLFW_PRESS);
+        apply_input_event(*ctx, event);
     }
 }
 
 void cursor_pos_callback(GLFWwindow *window, double x, double y)
 {
     // Forward event to ImGui
+    request_redraw(window);
     if (ImGui::GetIO().WantCaptureMouse) return;
 
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
-    cg::trackball_move(ctx->trackball, float(x), float(y));
+    if (ctx->replayingInput) return;
+    cg::InputEvent event;
+    event.type = cg::INPUT_CURSOR_POS;
+    event.x = x, event.y = y;
+    apply_input_event(*ctx, event);
 }
 
 void scroll_callback(GLFWwindow *window, double x, double y)
 {
     // Forward event to ImGui
     ImGui_ImplGlfw_ScrollCallback(window, x, y);
+    request_redraw(window);
     if (ImGui::GetIO().WantCaptureMouse) return;
 
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
-    ctx->zoom -= float(y);
-    if (ctx->zoom <= 1.0f) ctx->zoom = 1.0f;
-    if (ctx->zoom >= 110.0f) ctx->zoom = 110.0f;
+    if (ctx->replayingInput) return;
+    cg::InputEvent event;
+    event.type = cg::INPUT_SCROLL;
+    event.y = y;
+    apply_input_event(*ctx, event);
 }
 
 void resize_callback(GLFWwindow *window, int width, int height)
@@ -401,13 +1852,496 @@ void resize_callback(GLFWwindow *window, int width, int height)
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
     ctx->width = width;
     ctx->height = height;
+    ctx->redrawFrames = Context::REDRAW_FRAMES;
     glViewport(0, 0, width, height);
 }
 
+void print_usage(void)
+{
+    std::cout << "Usage: model_viewer [options] [gltf_filename...]\n"
+              << "  --headless          render the given files offscreen and write PNG images\n"
+              << "  --no-egl            use a hidden GLFW window instead of EGL when headless\n"
+              << "  --size WxH          size of the rendered images (default 1024x512)\n"
+              << "  --views N           number of orbit views per file (default 1)\n"
+              << "  --camera Y,P,F      camera preset: yaw and pitch (degrees) and field of view\n"
+              << "  --out DIR           output directory for rendered images (default .)\n"
+              << "  --software          use the software rasterizer (no OpenGL needed)\n"
+              << "  --threads N[,N...]  thread counts for the software rasterizer (default all)\n"
+              << "  --compare-software  diff OpenGL images against the software rasterizer\n"
+              << "  --capture PATH      record the window to a .y4m, .rgb or .png sequence, or to\n"
+              << "                      a pipe given as \"|command\" (Y4M)\n"
+              << "  --capture-frames N  quit after capturing N frames\n"
+              << "  --trace FILE        write a Chrome trace (chrome://tracing) on exit\n"
+              << "  --record FILE       record mouse input and GUI state to FILE\n"
+              << "  --replay FILE       replay a recording with vsync off and report frame times\n"
+              << "  --summary FILE      write replay frame-time statistics as JSON\n"
+              << "  --warmup N          replayed frames left out of the statistics (default 10)\n"
+              << "  --memory-report FILE\n"
+              << "                      write the live and peak memory of each resource category\n"
+              << "                      as JSON on exit\n"
+              << "  --continuous        redraw every frame instead of only after changes\n"
+              << "  --fps-cap N         limit the frame rate to N frames per second\n"
+              << "  --no-buffer-storage stream uniforms through mapped ranges instead of a\n"
+              << "                      persistently mapped buffer (as on plain OpenGL 3.3)\n"
+              << "  --no-multi-draw     issue one draw call per draw instead of one multi-draw-indirect\n"
+              << "                      call per run of draws\n"
+              << "  --no-gl-state-cache issue every state change, also when the state is already set\n"
+              << "  --gl-state-debug    count effective and redundant state changes per frame, and\n"
+              << "                      check the state cache against the OpenGL state\n"
+              << "  --texture-budget MB GPU memory budget for streamed texture levels (default 256)\n"
+              << "  --no-texture-arrays give every texture an array of its own instead of packing\n"
+              << "                      textures of similar size into shared arrays\n"
+              << "  --no-dedup          do not merge duplicate vertices, meshes and images at load\n"
+              << "                      time\n"
+              << "  --lod-error PIXELS  largest error on screen of the levels of detail of meshes that\n"
+              << "                      are drawn instead of the full meshes (default 1, 0 for none)\n"
+              << "  --scene N           scene of the asset to show (default: the scene that the file\n"
+              << "                      names, or the first)\n"
+              << "  --scene-budget MB   memory for the buffers and images of scenes that are not\n"
+              << "                      shown (default 512)\n"
+              << "  --stream-geometry MB\n"
+              << "                      stream the geometry of larger scenes from disk to the GPU\n"
+              << "                      instead of loading it (default 1024)\n"
+              << "  --release-cpu-data  free the CPU copies of buffers and images once they are\n"
+              << "                      uploaded (ambient occlusion and occlusion culling then\n"
+              << "                      have no geometry)\n"
+              << "  --texture-compression [fast|high|bc7|off]\n"
+              << "                      lossy block compression of textures (default off; high\n"
+              << "                      if no mode is given, which uses BC1/BC3 for color; bc7\n"
+              << "                      uses BC7 instead)\n"
+              << "  --mipmap-filter box|kaiser\n"
+              << "                      filter of the texture levels generated on the CPU\n"
+              << "                      (default box)\n"
+              << "  --no-hot-reload     do not reload shaders and asset files when they change"
+              << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Context &ctx, Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--no-egl") {
+            options.allowEGL = false;
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &ctx.width, &ctx.height) != 2) return false;
+        } else if (arg == "--views" && hasValue) {
+            options.views = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--camera" && hasValue) {
+            glm::vec3 camera(0.0f, 0.0f, ctx.zoom);
+            if (std::sscanf(argv[++i], "%f,%f,%f", &camera.x, &camera.y, &camera.z) < 2) return false;
+            options.cameras.push_back(camera);
+        } else if (arg == "--out" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (arg == "--software") {
+            options.software = true;
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--record" && hasValue) {
+            options.recordPath = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            options.replayPath = argv[++i];
+        } else if (arg == "--summary" && hasValue) {
+            options.summaryPath = argv[++i];
+        } else if (arg == "--memory-report" && hasValue) {
+            options.memoryReportPath = argv[++i];
+        } else if (arg == "--release-cpu-data") {
+            ctx.releaseCpuData = true;
+        } else if (arg == "--warmup" && hasValue) {
+            options.warmupFrames = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--continuous") {
+            options.continuous = true;
+        } else if (arg == "--fps-cap" && hasValue) {
+            options.frameRateCap = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--texture-budget" && hasValue) {
+            ctx.textureStreamer.settings.budgetBytes = size_t(std::max(1, std::atoi(argv[++i]))) << 20;
+        } else if (arg == "--no-texture-arrays") {
+            ctx.shareTextureArrays = false;
+        } else if (arg == "--no-dedup") {
+            ctx.deduplicate = false;
+        } else if (arg == "--lod-error" && hasValue) {
+            ctx.lodPixelError = std::max(0.0f, float(std::atof(argv[++i])));
+        } else if (arg == "--scene" && hasValue) {
+            ctx.nextScene = std::max(-1, std::atoi(argv[++i]));
+        } else if (arg == "--scene-budget" && hasValue) {
+            ctx.sceneLoader.budgetBytes = size_t(std::max(0, std::atoi(argv[++i]))) << 20;
+        } else if (arg == "--stream-geometry" && hasValue) {
+            ctx.sceneLoader.streamBytes = size_t(std::max(0, std::atoi(argv[++i]))) << 20;
+        } else if (arg == "--texture-compression") {
+            // The mode is optional, so that a following filename is not taken as one
+            std::string mode = hasValue ? argv[i + 1] : "";
+            if (mode == "off" || mode == "fast" || mode == "high" || mode == "bc7") ++i;
+            else mode = "high";
+            ctx.textureCompression.enabled = mode != "off";
+            ctx.textureCompression.quality = mode == "fast" ? gltf::COMPRESSION_FAST : gltf::COMPRESSION_HIGH;
+            ctx.textureCompression.useBC7 = mode == "bc7";
+        } else if (arg == "--mipmap-filter" && hasValue) {
+            std::string filter = argv[++i];
+            if (filter != "box" && filter != "kaiser") return false;
+            ctx.mipmaps.filter = filter == "kaiser" ? cg::MIP_FILTER_KAISER : cg::MIP_FILTER_BOX;
+        } else if (arg == "--no-hot-reload") {
+            ctx.hotReload = false;
+        } else if (arg == "--no-buffer-storage") {
+            ctx.bufferStorage = false;
+        } else if (arg == "--no-multi-draw") {
+            ctx.multiDraw = false;
+        } else if (arg == "--no-gl-state-cache") {
+            cg::gl_state_set_caching(false);
+        } else if (arg == "--gl-state-debug") {
+            cg::gl_state_set_debug(true);
+        } else if (arg == "--capture" && hasValue) {
+            options.capturePath = argv[++i];
+        } else if (arg == "--capture-frames" && hasValue) {
+            options.captureFrames = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--compare-software") {
+            options.compareSoftware = true;
+        } else if (arg == "--threads" && hasValue) {
+            for (char *token = std::strtok(argv[++i], ","); token; token = std::strtok(nullptr, ",")) {
+                options.threads.push_back(std::max(0, std::atoi(token)));
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            return false;
+        } else {
+            options.filenames.push_back(arg);
+        }
+    }
+    if (!options.filenames.empty()) ctx.gltfFilename = options.filenames[0];
+    if (options.threads.empty()) options.threads.push_back(0);
+    if (options.cameras.empty()) {
+        for (int i = 0; i < options.views; ++i) {
+            options.cameras.push_back(glm::vec3(360.0f * i / options.views, 0.0f, ctx.zoom));
+        }
+    }
+    return true;
+}
+
+void apply_camera_preset(Context &ctx, const glm::vec3 &camera)
+{
+    glm::quat yaw = glm::angleAxis(glm::radians(camera.x), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::quat pitch = glm::angleAxis(glm::radians(camera.y), glm::vec3(1.0f, 0.0f, 0.0f));
+    ctx.trackball.orient = pitch * yaw;
+    ctx.zoom = camera.z;
+}
+
+struct HeadlessAsset {
+    std::string name;  // Filename without directory and extension
+    gltf::GLTFAsset asset;
+    bool loaded = false;
+    bool aoAvailable = false;  // Ambient occlusion was applied from the cache file
+};
+
+// Only the given scene (or the default one, if scene is -1) is loaded, and
+// its geometry is streamed if it is larger than streamBytes. The asset is
+// deduplicated (see gltf_dedup.h), baked ambient occlusion is applied from the
+// cache file, and the levels of detail of the meshes and the mip levels of the
+// images are generated in the loading thread as well, unless lods or mipmaps
+// is null
+HeadlessAsset load_headless_asset(const std::string &path, const gltf::LodSettings *lods,
+                                  const cg::MipSettings *mipmaps, bool deduplicate, int scene,
+                                  size_t streamBytes)
+{
+    HeadlessAsset result;
+    std::string dir, filename;
+    split_gltf_path(path, dir, filename);
+    result.name = filename.substr(0, filename.find_last_of('.'));
+    result.loaded = gltf::load_gltf_scene(filename, dir, scene, result.asset, streamBytes);
+    gltf::DedupStats dedupStats;
+    if (result.loaded && deduplicate) gltf::deduplicate_gltf_asset(result.asset, dedupStats);
+    if (result.loaded) result.aoAvailable = apply_cached_ambient_occlusion(path, result.asset);
+    if (result.loaded && lods) gltf::generate_mesh_lods(result.asset, *lods);
+    if (result.loaded && mipmaps) gltf::generate_image_mipmaps(result.asset, *mipmaps);
+    return result;
+}
+
+gltf::SoftwareShading software_shading_from_context(const Context &ctx)
+{
+    gltf::SoftwareShading shading;
+    compute_camera_matrices(ctx, shading.projection, shading.view);
+    shading.modelMatrices = gltf::compute_node_world_matrices(ctx.asset);
+    const glm::mat4 model = compute_model_matrix(ctx);
+    for (glm::mat4 &matrix : shading.modelMatrices) matrix = model * matrix;
+    shading.diffuseColor = ctx.diffuseColor;
+    shading.ambientEnabled = ctx.ambientEnabled;
+    shading.diffuseEnabled = ctx.diffuseEnabled;
+    shading.specularEnabled = ctx.specularEnabled;
+    shading.aoEnabled = ctx.aoEnabled && ctx.aoAvailable;
+    shading.specularPower = ctx.specularPower;
+    shading.lightPosition = ctx.lightPosition;
+    shading.gamma = ctx.gamma;
+    shading.quantizationEnabled = ctx.quantizationEnabled;
+    std::copy(ctx.qmap[ctx.qmapIndex], ctx.qmap[ctx.qmapIndex] + 8, shading.qmap);
+    shading.viewOutline = ctx.viewOutline;
+    shading.outlineIntensity = ctx.outlineIntensity;
+    shading.bgColor = ctx.bgColor;
+    return shading;
+}
+
+// Prints how much two RGBA8 images differ
+void print_image_diff(const std::string &name, const std::vector<uint8_t> &a,
+                      const std::vector<uint8_t> &b)
+{
+    size_t differing = 0;
+    int maxDiff = 0;
+    double squaredError = 0.0;
+    for (size_t i = 0; i + 3 < a.size() && i + 3 < b.size(); i += 4) {
+        int pixelDiff = 0;
+        for (int c = 0; c < 3; ++c) {
+            int diff = std::abs(int(a[i + c]) - int(b[i + c]));
+            pixelDiff = std::max(pixelDiff, diff);
+            squaredError += diff * diff;
+        }
+        differing += (pixelDiff > 1) ? 1 : 0;
+        maxDiff = std::max(maxDiff, pixelDiff);
+    }
+    double mse = squaredError / std::max<size_t>(1, a.size() / 4 * 3);
+    double psnr = (mse > 0.0) ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    std::cout << "  " << name << ": " << 100.0 * differing / std::max<size_t>(1, a.size() / 4)
+              << "% pixels differ by more than 1, max difference " << maxDiff << ", PSNR "
+              << psnr << " dB" << std::endl;
+}
+
+// Renders every camera preset of every file with the software rasterizer,
+// once for every requested thread count, and reports the throughput. Images
+// rendered with different thread counts must be identical.
+int run_software(Context &ctx, const Options &options)
+{
+    std::vector<double> seconds(options.threads.size(), 0.0);
+    size_t triangles = 0, pixels = 0;
+    int rendered = 0, failed = 0;
+    for (const std::string &path : options.filenames) {
+        HeadlessAsset current =
+            load_headless_asset(path, nullptr, nullptr, ctx.deduplicate, ctx.nextScene, SIZE_MAX);
+        if (!current.loaded) {
+            failed++;
+            continue;
+        }
+        ctx.asset = std::move(current.asset);
+        ctx.aoAvailable = current.aoAvailable;
+        for (size_t j = 0; j < options.cameras.size(); ++j) {
+            apply_camera_preset(ctx, options.cameras[j]);
+            gltf::SoftwareShading shading = software_shading_from_context(ctx);
+
+            std::vector<uint8_t> reference;
+            for (size_t k = 0; k < options.threads.size(); ++k) {
+                gltf::SoftwareFramebuffer framebuffer;
+                gltf::SoftwareRenderStats stats;
+                gltf::software_render(ctx.asset, shading, ctx.width, ctx.height,
+                                      options.threads[k], framebuffer, &stats);
+                seconds[k] += stats.totalSeconds;
+                if (k == 0) {
+                    triangles += stats.triangles;
+                    pixels += size_t(ctx.width) * ctx.height;
+                    reference = framebuffer.color;
+                } else if (framebuffer.color != reference) {
+                    std::cerr << "Error: output with " << stats.threads
+                              << " threads differs from the first one" << std::endl;
+                    failed++;
+                }
+            }
+            char suffix[16];
+            std::snprintf(suffix, sizeof(suffix), "_%02d.png", int(j));
+            std::string filename = options.outputDir + "/" + current.name + suffix;
+            if (!cg::save_png_image(filename, ctx.width, ctx.height, reference)) failed++;
+            rendered++;
+        }
+    }
+
+    std::cout << "Rendered " << rendered << " images (" << triangles << " triangles) in software"
+              << std::endl;
+    for (size_t k = 0; k < options.threads.size(); ++k) {
+        int threads = options.threads[k] ? options.threads[k]
+                                         : int(std::max(1u, std::thread::hardware_concurrency()));
+        double s = std::max(seconds[k], 1e-9);
+        std::cout << "  " << threads << " threads: " << triangles / s * 1e-6 << " Mtris/s, "
+                  << pixels / s * 1e-6 << " Mpix/s, " << rendered / s << " images/s" << std::endl;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Renders every camera preset of every file to PNG images. Loading of the
+// next asset runs on a separate thread while the current one is rendered,
+// readbacks go through a PBO ring, and PNG encoding runs on worker threads.
+int run_headless(Context &ctx, const Options &options)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto seconds_since = [](Clock::time_point t) {
+        return std::chrono::duration<double>(Clock::now() - t).count();
+    };
+
+    if (options.software) return run_software(ctx, options);
+    if (options.compareSoftware) ctx.lodPixelError = 0.0f;  // The software rasterizer draws full meshes
+
+    cg::HeadlessContext hc;
+    if (!cg::headless_context_create(hc, options.allowEGL)) {
+        std::cerr << "Error: failed to create headless OpenGL context" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (gl3wInit() || !gl3wIsSupported(3, 3) /*check OpenGL version*/) {
+        std::cerr << "Error: failed to initialize OpenGL" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+    ctx.headless = true;
+    ctx.dynres.enabled = false;
+    ctx.gltfFilename.clear();  // Assets are loaded below instead
+    glGenVertexArrays(1, &ctx.emptyVAO);
+    glBindVertexArray(ctx.emptyVAO);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    do_initialization(ctx);
+    cg::profiler_set_thread_name("Main");
+    cg::profiler_gpu_init();
+    if (!options.tracePath.empty()) cg::profiler_start_trace();
+
+    cg::PixelReadback readback;
+    cg::readback_init(readback);
+    std::vector<std::string> outputFilenames;
+    std::vector<std::vector<uint8_t>> softwareImages;  // Only used for --compare-software
+    std::deque<std::future<bool>> writes;
+    const size_t maxWrites = std::max(2u, std::thread::hardware_concurrency());
+    auto write_image = [&](cg::ReadbackImage &image) {
+        if (writes.size() >= maxWrites) {
+            writes.front().get();
+            writes.pop_front();
+        }
+        std::string filename = outputFilenames[image.tag];
+        if (options.compareSoftware) {
+            print_image_diff(filename, image.pixels, softwareImages[image.tag]);
+            softwareImages[image.tag].clear();
+        }
+        auto pixels = std::make_shared<cg::ReadbackImage>();
+        pixels->width = image.width;
+        pixels->height = image.height;
+        pixels->pixels.swap(image.pixels);
+        writes.push_back(std::async(std::launch::async, [filename, pixels]() {
+            return cg::save_png_image(filename, pixels->width, pixels->height, pixels->pixels);
+        }));
+    };
+
+    Clock::time_point start = Clock::now();
+    double loadWait = 0.0, upload = 0.0, readbackWait = 0.0;
+    int failed = 0;
+    std::future<HeadlessAsset> next;
+    if (!options.filenames.empty()) {
+        next = std::async(std::launch::async, load_headless_asset, options.filenames[0], &ctx.lodSettings,
+                          &ctx.mipmaps, ctx.deduplicate, ctx.nextScene, ctx.sceneLoader.streamBytes);
+    }
+    for (size_t i = 0; i < options.filenames.size(); ++i) {
+        Clock::time_point t = Clock::now();
+        HeadlessAsset current = next.get();
+        loadWait += seconds_since(t);
+        if (i + 1 < options.filenames.size()) {
+            next = std::async(std::launch::async, load_headless_asset, options.filenames[i + 1],
+                              &ctx.lodSettings, &ctx.mipmaps, ctx.deduplicate, ctx.nextScene,
+                              ctx.sceneLoader.streamBytes);
+        }
+        if (!current.loaded) {
+            failed++;
+            continue;
+        }
+
+        t = Clock::now();
+        ctx.asset = std::move(current.asset);
+        ctx.aoAvailable = current.aoAvailable;
+        print_streamed_geometry(ctx.asset);
+        gltf::create_drawables_from_gltf_asset(ctx.drawables, ctx.asset, &ctx.staging);
+        ctx.texturePacking = gltf::pack_textures(ctx.asset, ctx.shareTextureArrays);
+        ctx.texturePacking.mipFilter = ctx.mipmaps.filter;
+        gltf::create_texture_arrays(ctx.textures, ctx.asset, ctx.texturePacking);
+        gltf::occlusion_init(ctx.occlusion, ctx.asset);
+        gltf::frame_prep_init(ctx.framePrep, ctx.asset);
+        // All levels of the arrays are uploaded here, so none of the images is
+        // kept (there is no streamer), while the software renderer needs the
+        // geometry
+        if (ctx.releaseCpuData && !options.compareSoftware) release_uploaded_data(ctx);
+        update_memory_tags(ctx);
+        upload += seconds_since(t);
+
+        for (size_t j = 0; j < options.cameras.size(); ++j) {
+            apply_camera_preset(ctx, options.cameras[j]);
+            do_rendering(ctx);
+            cg::profiler_frame_end();
+            cg::gl_state_frame_end();
+
+            cg::ReadbackImage image;
+            t = Clock::now();
+            if (cg::readback_full(readback) && cg::readback_fetch(readback, image, true)) {
+                write_image(image);
+            }
+            readbackWait += seconds_since(t);
+            char suffix[16];
+            std::snprintf(suffix, sizeof(suffix), "_%02d.png", int(j));
+            outputFilenames.push_back(options.outputDir + "/" + current.name + suffix);
+            if (options.compareSoftware) {
+                gltf::SoftwareFramebuffer framebuffer;
+                gltf::software_render(ctx.asset, software_shading_from_context(ctx), ctx.width,
+                                      ctx.height, options.threads[0], framebuffer);
+                softwareImages.push_back(framebuffer.color);
+            }
+            cg::readback_issue(readback, ctx.dynres.fbo, ctx.width, ctx.height,
+                               int(outputFilenames.size()) - 1);
+            while (cg::readback_fetch(readback, image, false)) { write_image(image); }
+        }
+    }
+    cg::ReadbackImage image;
+    while (cg::readback_fetch(readback, image, true)) { write_image(image); }
+    for (auto &write : writes) failed += write.get() ? 0 : 1;
+    double elapsed = seconds_since(start);
+
+    int rendered = int(outputFilenames.size());
+    std::cout << "Rendered " << rendered << " images of " << options.filenames.size()
+              << " assets in " << elapsed << " s (" << rendered / std::max(elapsed, 1e-9)
+              << " images/s)" << std::endl;
+    std::cout << "  waiting for loads: " << loadWait << " s, GPU upload: " << upload
+              << " s, waiting for readbacks: " << readbackWait << " s" << std::endl;
+    if (cg::gl_state_debug()) {
+        const cg::GLStateCounts &counts = cg::gl_state_last_frame();
+        std::cout << "  state changes of the last frame:";
+        for (int i = 0; i < cg::NUM_STATE_CALLS; ++i) {
+            std::cout << (i ? ", " : " ") << cg::gl_state_call_name(cg::GLStateCall(i)) << " "
+                      << counts.effective[i] << "/" << counts.effective[i] + counts.redundant[i];
+        }
+        std::cout << " (effective/total)" << std::endl;
+    }
+
+    if (!options.tracePath.empty() && cg::profiler_write_trace(options.tracePath))
+        std::cout << "Wrote trace to " << options.tracePath << std::endl;
+    if (!options.memoryReportPath.empty() && cg::memory_write_json(options.memoryReportPath))
+        std::cout << "Wrote memory report to " << options.memoryReportPath << std::endl;
+    cg::profiler_gpu_destroy();
+    cg::readback_destroy(readback);
+    cg::stream_buffer_destroy(ctx.uniforms);
+    glDeleteTextures(1, &ctx.drawTexture);
+    cg::memory_release_gl(GL_BUFFER, 1, &ctx.drawCopyBuffer);
+    glDeleteBuffers(1, &ctx.drawCopyBuffer);
+    cg::staging_pool_destroy(ctx.staging);
+    cg::dynamic_resolution_destroy(ctx.dynres);
+    gltf::destroy_drawables(ctx.drawables);
+    gltf::destroy_textures(ctx.textures);
+    cg::headless_context_destroy(hc);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     Context ctx = Context();
-    if (argc > 1) { ctx.gltfFilename = std::string(argv[1]); }
+    Options options;
+    if (!parse_options(argc, argv, ctx, options)) {
+        print_usage();
+        std::exit(EXIT_FAILURE);
+    }
+    cg::job_system_init(ctx.jobs);
+    if (options.headless) std::exit(run_headless(ctx, options));
+    if (!options.replayPath.empty()) {
+        if (!cg::load_input_recording(options.replayPath, ctx.input)) std::exit(EXIT_FAILURE);
+        if (ctx.input.width > 0 && ctx.input.height > 0) {
+            ctx.width = ctx.input.width;
+            ctx.height = ctx.input.height;
+        }
+        ctx.replayingInput = true;
+    }
 
     // Create a GLFW window
     glfwSetErrorCallback(error_callback);
@@ -418,6 +2352,7 @@ int main(int argc, char *argv[])
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     ctx.window = glfwCreateWindow(ctx.width, ctx.height, "Model viewer", nullptr, nullptr);
     glfwMakeContextCurrent(ctx.window);
+    if (ctx.replayingInput) glfwSwapInterval(0);  // Measure frame times without vsync
     glfwSetWindowUserPointer(ctx.window, &ctx);
     glfwSetKeyCallback(ctx.window, key_callback);
     glfwSetCharCallback(ctx.window, char_callback);
@@ -432,6 +2367,9 @@ int main(int argc, char *argv[])
         std::exit(EXIT_FAILURE);
     }
     std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
+    cg::profiler_set_thread_name("Main");
+    cg::profiler_gpu_init();
+    if (!options.tracePath.empty()) cg::profiler_start_trace();
 
     // Initialize ImGui
     ImGui::CreateContext();
@@ -443,12 +2381,36 @@ int main(int argc, char *argv[])
     glBindVertexArray(ctx.emptyVAO);
     glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     do_initialization(ctx);
+    start_hot_reload(ctx);
+    if (!options.recordPath.empty()) {
+        glfwGetFramebufferSize(ctx.window, &ctx.input.width, &ctx.input.height);
+        ctx.recordingInput = true;
+    }
+    if (!options.capturePath.empty()) {
+        cg::capture_start(ctx.capture, options.capturePath,
+                          cg::capture_format_from_path(options.capturePath));
+    }
+
+    ctx.renderOnDemand = !options.continuous;
+    ctx.frameRateCap = options.frameRateCap;
 
     // Start rendering loop
     while (!glfwWindowShouldClose(ctx.window)) {
-        glfwPollEvents();
+        {
+            CG_PROFILE_SCOPE("Poll Events");
+            glfwPollEvents();
+            wait_for_redraw(ctx);
+            if (glfwWindowShouldClose(ctx.window)) break;
+        }
         ctx.elapsedTime = glfwGetTime();
-
+        begin_input_frame(ctx);
+        finish_ambient_occlusion_bake(ctx);
+        update_hot_reload(ctx);
+        if (ctx.releaseCpuData && !ctx.aoBake.valid()) release_uploaded_data(ctx);
+        update_memory_tags(ctx);
+        begin_occlusion_culling(ctx);
+
+        int64_t guiStart = cg::profiler_now();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -475,6 +2437,9 @@ int main(int argc, char *argv[])
                 if (!ctx.envMapping) ImGui::Checkbox("Texture Mapping", &ctx.texMapping);
                 if (ctx.texMapping) ImGui::Checkbox("Blinn-Phong Lighting", &ctx.lighting);
             }
+            if (ImGui::CollapsingHeader("Texture Streaming")) draw_texture_streaming_gui(ctx);
+            if (ctx.sceneNames.size() > 1 && ImGui::CollapsingHeader("Scenes")) draw_scenes_gui(ctx);
+            if (ImGui::CollapsingHeader("Memory")) draw_memory_gui(ctx);
             if (ImGui::CollapsingHeader("Toon Shading")) {
                 ImGui::Checkbox("Quantization", &ctx.quantizationEnabled);
                 if (ctx.quantizationEnabled) ImGui::SliderInt("Q-map", &ctx.qmapIndex, 0, 2);
@@ -483,21 +2448,149 @@ int main(int argc, char *argv[])
                 ImGui::Checkbox("View Depth Texture", &ctx.viewDepth);
                 ImGui::Checkbox("View Normal Texture", &ctx.viewNormals);
             }
+            if (ImGui::CollapsingHeader("Ambient Occlusion")) {
+                if (ctx.aoAvailable) ImGui::Checkbox("Baked AO Enabled", &ctx.aoEnabled);
+                ImGui::SliderInt("Rays per Vertex", &ctx.aoSettings.raysPerVertex, 8, 256);
+                ImGui::SliderFloat("Max Distance", &ctx.aoSettings.maxDistance, 0.01f, 1.0f);
+                if (ctx.aoBake.valid()) {
+                    ImGui::Text("Baking...");
+                } else if (!gltf::buffers_loaded(ctx.asset)) {
+                    ImGui::Text("Not available without the geometry in memory (streamed or released)");
+                } else {
+                    if (ImGui::Button("Bake")) start_ambient_occlusion_bake(ctx);
+                    if (ctx.aoStats.rays) {
+                        ImGui::Text("%d rays in %.2f s (%.2f Mrays/s, %d threads)",
+                                    int(ctx.aoStats.rays), ctx.aoStats.bvhSeconds + ctx.aoStats.traceSeconds,
+                                    ctx.aoStats.rays / std::max(ctx.aoStats.traceSeconds, 1e-9) * 1e-6,
+                                    ctx.aoStats.threads);
+                    }
+                }
+            }
+            if (ImGui::CollapsingHeader("Capture")) {
+                if (!ctx.capture.recording) {
+                    ImGui::InputText("Output", ctx.capturePath, sizeof(ctx.capturePath));
+                    ImGui::Combo("Format", &ctx.captureFormat, "Y4M\0Raw RGB\0PNG Sequence\0");
+                    if (ImGui::Button("Start Recording")) {
+                        cg::capture_start(ctx.capture, ctx.capturePath,
+                                          cg::CaptureFormat(ctx.captureFormat));
+                    }
+                } else {
+                    if (ImGui::Button("Stop Recording")) cg::capture_stop(ctx.capture);
+                    cg::CaptureStats stats = cg::capture_stats(ctx.capture);
+                    ImGui::Text("%u written, %u dropped, %u queued (%.1f MB)", stats.framesWritten,
+                                stats.framesDropped, stats.framesQueued,
+                                stats.bytesWritten / (1024.0 * 1024.0));
+                }
+            }
             if (ImGui::CollapsingHeader("Misc")) {
                 ImGui::Checkbox("Orthographic Projection", &ctx.ortho);
                 ImGui::Checkbox("Gamma Correction", &ctx.gamma);
                 ImGui::Checkbox("Texture Coordinates", &ctx.textureCoordinates);
+                ImGui::Checkbox("Dynamic Resolution", &ctx.dynres.enabled);
+                if (ctx.dynres.enabled) {
+                    ImGui::SliderFloat("Target GPU Time (ms)", &ctx.dynres.targetMs, 2.0f, 33.0f);
+                    ImGui::SliderFloat("Min Scale", &ctx.dynres.minScale, 0.25f, 1.0f);
+                    ImGui::Combo("Upscale Filter", &ctx.dynres.filter, "Bilinear\0Edge-aware\0");
+                }
+                ImGui::Text("Render scale: %.2f (%dx%d)", ctx.dynres.enabled ? ctx.dynres.scale : 1.0f,
+                            cg::dynamic_resolution_render_width(ctx.dynres),
+                            cg::dynamic_resolution_render_height(ctx.dynres));
+                ImGui::Text("GPU time: %.2f ms (avg %.2f ms)", ctx.dynres.timer.lastMs,
+                            ctx.dynres.timer.averageMs);
+                ImGui::Checkbox("Render on Demand", &ctx.renderOnDemand);
+                ImGui::SliderInt("Frame Rate Cap", &ctx.frameRateCap, 0, 240, ctx.frameRateCap ? "%d fps" : "Off");
+                ImGui::Text("Utilization: CPU %.0f%%, GPU %.0f%% (%.0f fps)", ctx.utilization.cpuPercent,
+                            ctx.utilization.gpuPercent, ctx.utilization.framesPerSecond);
+                if (!ctx.lastReload.empty()) ImGui::Text("Last reload: %s", ctx.lastReload.c_str());
+                ImGui::Checkbox("Show Profiler", &ctx.showProfiler);
+                if (ctx.multiDrawAvailable) ImGui::Checkbox("Multi-Draw Indirect", &ctx.multiDraw);
+                else ImGui::Text("Multi-draw indirect: not supported");
+                ImGui::SliderFloat("LOD Error (pixels)", &ctx.lodPixelError, 0.0f, 8.0f);
+                if (ctx.lodStats.meshes) {
+                    ImGui::Text("Levels of detail: %d of %d meshes (%d triangles in the levels)",
+                                ctx.lodStats.meshes, int(ctx.asset.meshes.size()),
+                                int(ctx.lodStats.lodTriangles));
+                }
+                ImGui::Checkbox("Occlusion Culling", &ctx.occlusion.enabled);
+                if (ctx.occlusion.enabled) {
+                    // Of the previous frame, as this frame's test may still be running
+                    const gltf::OcclusionStats &stats = ctx.occlusion.stats;
+                    ImGui::Text("Occluders: %d (%d triangles)", stats.occluders,
+                                int(stats.occluderTriangles));
+                    ImGui::Text("Culled: %d occluded, %d outside view, of %d nodes (%.0f%%)",
+                                stats.occluded, stats.outsideView, stats.tested,
+                                stats.tested ? 100.0 * (stats.occluded + stats.outsideView) / stats.tested : 0.0);
+                    ImGui::Text("Test cost: %.3f ms raster + %.3f ms test", stats.rasterMs,
+                                stats.testMs);
+                }
             }
         }
         ImGui::End();
+        if (ctx.showProfiler) draw_profiler_window(ctx);
+        end_input_frame(ctx);
+        cg::profiler_record("GUI Build", guiStart, cg::profiler_now(), 0);
         do_rendering(ctx);
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-        glfwSwapBuffers(ctx.window);
+        // Capture the rendered frame (without the GUI)
+        {
+            CG_PROFILE_SCOPE("Capture");
+            cg::capture_frame(ctx.capture, 0, ctx.width, ctx.height);
+        }
+        if (options.captureFrames > 0 && ctx.capture.framesIssued >= unsigned(options.captureFrames))
+            glfwSetWindowShouldClose(ctx.window, GLFW_TRUE);
+        {
+            CG_PROFILE_SCOPE("GUI Render");
+            cg::profiler_gpu_begin("GUI Render");
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            cg::profiler_gpu_end();
+        }
+
+        {
+            CG_PROFILE_SCOPE("Swap Buffers");
+            glfwSwapBuffers(ctx.window);
+        }
+        finish_reload_timings(ctx);
+        cg::profiler_frame_end();
+        cg::gl_state_frame_end();
+        ctx.redrawFrames = std::max(0, ctx.redrawFrames - 1);
+        update_utilization(ctx, true);
+        limit_frame_rate(ctx);
     }
 
     // Shutdown
+    if (ctx.recordingInput && cg::save_input_recording(options.recordPath, ctx.input)) {
+        std::cout << "Recorded " << ctx.input.frames.size() << " frames to " << options.recordPath
+                  << std::endl;
+    }
+    if (ctx.replayingInput) {
+        begin_input_frame(ctx);  // Time the last frame
+        std::vector<double> frameTimes(ctx.replayFrameTimes);
+        frameTimes.erase(frameTimes.begin(),
+                         frameTimes.begin() + std::min(frameTimes.size(), size_t(options.warmupFrames)));
+        cg::FrameTimeStats stats = cg::compute_frame_time_stats(frameTimes);
+        cg::print_frame_time_stats(stats);
+        if (!options.summaryPath.empty())
+            cg::write_frame_time_summary(options.summaryPath, stats, frameTimes, options.replayPath);
+    }
+    if (!options.tracePath.empty() && cg::profiler_write_trace(options.tracePath))
+        std::cout << "Wrote trace to " << options.tracePath << std::endl;
+    if (!options.memoryReportPath.empty() && cg::memory_write_json(options.memoryReportPath))
+        std::cout << "Wrote memory report to " << options.memoryReportPath << std::endl;
+    cg::profiler_gpu_destroy();
+    cg::capture_stop(ctx.capture);
+    gltf::occlusion_end(ctx.occlusion);
+    if (ctx.aoBake.valid()) ctx.aoBake.wait();
+    cg::file_watcher_stop(ctx.fileWatcher);
+    if (ctx.assetReload.valid()) ctx.assetReload.wait();
+    cg::job_system_destroy(ctx.jobs);
+    cg::stream_buffer_destroy(ctx.uniforms);
+    glDeleteTextures(1, &ctx.drawTexture);
+    cg::memory_release_gl(GL_BUFFER, 1, &ctx.drawCopyBuffer);
+    glDeleteBuffers(1, &ctx.drawCopyBuffer);
+    cg::staging_pool_destroy(ctx.staging);
+    gltf::texture_streaming_destroy(ctx.textureStreamer, ctx.textures);
+    cg::dynamic_resolution_destroy(ctx.dynres);
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -2,30 +2,35 @@
 #extension GL_ARB_explicit_attrib_location : require
 
 // Uniform constants
-uniform float u_gamma; // enable gamma correction
-uniform float u_envMapping; // enable environment mapping
-
-uniform vec3 u_diffuseColor;
-uniform float u_ambientEnabled;
-uniform float u_diffuseEnabled;
-uniform float u_specularEnabled;
-uniform float u_specularPower;
+// Per-frame constants (FrameUniforms in model_viewer.cpp)
+layout(std140) uniform FrameBlock {
+    mat4 u_projection;
+    mat4 u_view;
+    vec3 u_lightPosition; // position of light source
+    float u_time;
+    vec3 u_diffuseColor;
+    float u_specularPower;
+    vec2 u_viewportScale; // rendered part of the outline textures
+    float u_gamma; // enable gamma correction
+    float u_envMapping; // enable environment mapping
+    float u_ambientEnabled;
+    float u_diffuseEnabled;
+    float u_specularEnabled;
+    float u_viewTextureCoords; // enable visualization of texture coordinates
+    float u_lighting;
+    float u_quantizationEnabled; // enable quantization
+    float u_viewDepth;
+    float u_viewNormals;
+    float u_viewOutline;
+    float u_outlineIntensity;
+    float u_aoEnabled; // use baked ambient occlusion from COLOR_0
+};
 
 uniform samplerCube u_cubemap;
-
-uniform sampler2D u_texture; // texture sampler
-uniform float u_viewTextureCoords; // enable visualization of texture coordinates
-uniform float u_texMapping; // enable texture mapping
-uniform float u_lighting;
-
-uniform float u_quantizationEnabled; // enable quantization
-uniform sampler1D u_quantization; 
+uniform sampler2DArray u_texture; // texture sampler (one layer per material texture)
+uniform sampler1D u_quantization;
 uniform sampler2D u_depthTexture;
-uniform float u_viewDepth;
 uniform sampler2D u_normalTexture;
-uniform float u_viewNormals;
-uniform float u_viewOutline;
-uniform float u_outlineIntensity;
 
 in vec3 N; // view space normal vector
 in vec3 L; // view space light direction vector
@@ -33,6 +38,9 @@ in vec3 V; // view vector
 
 in vec2 texcoord; // interpolated texture coordinate
 in vec2 outlineTexcoord;
+in float occlusion; // baked ambient occlusion
+flat in float texMapping; // enable texture mapping (per draw)
+flat in vec4 texTransform; // texture coordinate scale, array layer and wrap mode
 out vec4 frag_color;
 
 vec3 gammaCorrect(vec3 color) { // gamma correction
@@ -57,6 +65,15 @@ float sobelFilter(sampler2D tex) {
     return average;
 }
 
+vec4 materialTexture() { // sample the layer of the material texture
+    vec3 uvw = vec3(texcoord * texTransform.xy, texTransform.z);
+    if(texTransform.x < 1.0 || texTransform.y < 1.0) { // padded layer: wrap or clamp to the image first
+        vec2 uv = texTransform.w > 0.5 ? fract(texcoord) : clamp(texcoord, 0.0, 1.0);
+        return textureGrad(u_texture, vec3(uv * texTransform.xy, uvw.z), dFdx(uvw.xy), dFdy(uvw.xy));
+    }
+    return texture(u_texture, uvw);
+}
+
 void main() {
     // blinn-phong lighting calculations
     float lambertian = max(dot(L, N), 0.0);
@@ -72,14 +89,14 @@ void main() {
     vec3 diffuseColor = u_diffuseColor;
     vec3 specularColor = vec3(0.1);
 
-    if(u_texMapping > 0.5) { // get diffuse base color if texture mapping is turned on
-        diffuseColor = texture(u_texture, texcoord).rgb; // get diffuse base color
+    if(texMapping > 0.5) { // get diffuse base color if texture mapping is turned on
+        diffuseColor = materialTexture().rgb; // get diffuse base color
         ambientColor = diffuseColor * vec3(0.4);
     }
 
     // make ambient, diffuse and specular lighting toggable from GUI
-    if(u_ambientEnabled > 0.5)  color = color + ambientColor;
-    if(u_diffuseEnabled > 0.5)  color = color + diffuseColor * L * lambertian;
+    if(u_ambientEnabled > 0.5)  color = color + ambientColor * occlusion;
+    if(u_diffuseEnabled > 0.5)  color = color + diffuseColor * L * lambertian * occlusion;
     if(u_specularEnabled > 0.5) color = color + specularColor * L * specular;
 
     if(u_envMapping > 0.5) { // environment mapping
@@ -100,8 +117,8 @@ void main() {
             frag_color = vec4(texcoord, 0.0, 0.0);
         else
             frag_color = vec4(outlineTexcoord, 0.0, 0.0);
-    } else if (u_texMapping > 0.5) { // texture mapping
-        vec4 textureColor = texture(u_texture, texcoord).rgba;
+    } else if (texMapping > 0.5) { // texture mapping
+        vec4 textureColor = materialTexture();
         if(u_lighting > 0.5) textureColor = textureColor * vec4(gammaCorrect(color), 1.0);
         
         frag_color = textureColor;
@@ -1,16 +1,50 @@
 #version 330
 #extension GL_ARB_explicit_attrib_location : require
+#extension GL_ARB_shader_draw_parameters : enable
 
 // Uniform constants
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform mat4 u_projection;
+// Per-frame constants (FrameUniforms in model_viewer.cpp)
+layout(std140) uniform FrameBlock {
+    mat4 u_projection;
+    mat4 u_view;
+    vec3 u_lightPosition; // position of light source
+    float u_time;
+    vec3 u_diffuseColor;
+    float u_specularPower;
+    vec2 u_viewportScale; // rendered part of the outline textures
+    float u_gamma; // enable gamma correction
+    float u_envMapping; // enable environment mapping
+    float u_ambientEnabled;
+    float u_diffuseEnabled;
+    float u_specularEnabled;
+    float u_viewTextureCoords; // enable visualization of texture coordinates
+    float u_lighting;
+    float u_quantizationEnabled; // enable quantization
+    float u_viewDepth;
+    float u_viewNormals;
+    float u_viewOutline;
+    float u_outlineIntensity;
+    float u_aoEnabled; // use baked ambient occlusion from COLOR_0
+};
 
-// uniform float u_specularPower;
-uniform vec3 u_lightPosition; // position of light source
+// Per-draw constants (DrawUniforms in model_viewer.cpp), six texels per draw:
+// the columns of the model matrix, the texture coordinate scale, array layer
+// and wrap mode, and whether texture mapping is enabled
+uniform samplerBuffer u_drawData;
+uniform int u_drawOffset; // first texel of the draws of this frame
+uniform int u_drawIndex; // index of the current draw (the first one of a multi-draw)
+
+// Each command of a multi-draw reads the draw after the previous one (the
+// draw ID is 0 for other draw calls)
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_TEXEL (u_drawOffset + (u_drawIndex + gl_DrawIDARB) * 6)
+#else
+#define DRAW_TEXEL (u_drawOffset + u_drawIndex * 6)
+#endif
 
 // Vertex inputs (attributes from vertex buffers)
 layout(location = 0) in vec4 a_position;
+layout(location = 1) in vec4 a_color; // baked ambient occlusion in RGB
 layout(location = 2) in vec3 a_normal;
 layout(location = 3) in vec2 a_texcoord; // texture coordinate of the current vertex
 
@@ -22,8 +56,15 @@ out vec3 V;
 
 out vec2 texcoord; // interpolated texture coordinate
 out vec2 outlineTexcoord;
+out float occlusion; // 1 if ambient occlusion is disabled
+flat out float texMapping;
+flat out vec4 texTransform;
 
 void main() {
+    int drawTexel = DRAW_TEXEL;
+    mat4 u_model = mat4(texelFetch(u_drawData, drawTexel), texelFetch(u_drawData, drawTexel + 1),
+                        texelFetch(u_drawData, drawTexel + 2), texelFetch(u_drawData, drawTexel + 3));
+
     // Calculate modelview matrix
     mat4 mv = u_view * u_model;
 
@@ -41,9 +82,12 @@ void main() {
     V = normalize(-positionEye);
 
     texcoord = a_texcoord;
+    occlusion = u_aoEnabled > 0.5 ? a_color.r : 1.0;
+    texMapping = texelFetch(u_drawData, drawTexel + 5).x;
+    texTransform = texelFetch(u_drawData, drawTexel + 4);
 
     mat4 MVP = u_projection * u_view * u_model;
     gl_Position = MVP * a_position;
 
-    outlineTexcoord = (gl_Position.xy / gl_Position.w) * 0.5 + 0.5;
+    outlineTexcoord = ((gl_Position.xy / gl_Position.w) * 0.5 + 0.5) * u_viewportScale;
 }
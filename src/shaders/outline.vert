@@ -1,10 +1,28 @@
 #version 330
 #extension GL_ARB_explicit_attrib_location : require
+#extension GL_ARB_shader_draw_parameters : enable
 
-// Uniform constants
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform mat4 u_projection;
+// Uniform constants (FrameBlock only declares the leading members of the
+// block in mesh.vert, which has the same std140 layout)
+layout(std140) uniform FrameBlock {
+    mat4 u_projection;
+    mat4 u_view;
+};
+
+// Per-draw constants (DrawUniforms in model_viewer.cpp), six texels per draw:
+// the columns of the model matrix, the texture coordinate scale, array layer
+// and wrap mode, and whether texture mapping is enabled
+uniform samplerBuffer u_drawData;
+uniform int u_drawOffset; // first texel of the draws of this frame
+uniform int u_drawIndex; // index of the current draw (the first one of a multi-draw)
+
+// Each command of a multi-draw reads the draw after the previous one (the
+// draw ID is 0 for other draw calls)
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_TEXEL (u_drawOffset + (u_drawIndex + gl_DrawIDARB) * 6)
+#else
+#define DRAW_TEXEL (u_drawOffset + u_drawIndex * 6)
+#endif
 
 // Vertex inputs (attributes from vertex buffers)
 layout(location = 0) in vec4 a_position;
@@ -13,6 +31,10 @@ layout(location = 2) in vec3 a_normal;
 out vec3 N;
 
 void main() {
+    int drawTexel = DRAW_TEXEL;
+    mat4 u_model = mat4(texelFetch(u_drawData, drawTexel), texelFetch(u_drawData, drawTexel + 1),
+                        texelFetch(u_drawData, drawTexel + 2), texelFetch(u_drawData, drawTexel + 3));
+
     // Calculate modelview matrix
     mat4 mv = u_view * u_model;
 
@@ -0,0 +1,30 @@
+#version 330
+
+// Uniform constants
+uniform sampler2D u_source;
+uniform vec2 u_sourceScale;
+uniform vec2 u_texelSize; // size of one source texel in texture coordinates
+
+in vec2 texcoord;
+out vec4 frag_color;
+
+void main() {
+    // Bilinear sample, clamped to the rendered part of the source texture
+    vec2 maxTexcoord = u_sourceScale - 0.5 * u_texelSize;
+    vec2 uv = min(texcoord, maxTexcoord);
+    vec3 color = texture(u_source, uv).rgb;
+
+    // Edge-aware sharpening: restore some of the contrast lost by bilinear
+    // filtering, but less so where the local contrast is already high
+    vec3 top    = texture(u_source, min(uv + vec2(0.0, u_texelSize.y), maxTexcoord)).rgb;
+    vec3 bottom = texture(u_source, max(uv - vec2(0.0, u_texelSize.y), vec2(0.0))).rgb;
+    vec3 left   = texture(u_source, max(uv - vec2(u_texelSize.x, 0.0), vec2(0.0))).rgb;
+    vec3 right  = texture(u_source, min(uv + vec2(u_texelSize.x, 0.0), maxTexcoord)).rgb;
+    vec3 minColor = min(color, min(min(top, bottom), min(left, right)));
+    vec3 maxColor = max(color, max(max(top, bottom), max(left, right)));
+    vec3 amount = sqrt(clamp(min(minColor, 1.0 - maxColor) / max(maxColor, 1e-4), 0.0, 1.0));
+    vec3 weight = -amount * 0.125;
+    vec3 sharpened = (color + weight * (top + bottom + left + right)) / (1.0 + 4.0 * weight);
+
+    frag_color = vec4(clamp(sharpened, 0.0, 1.0), 1.0);
+}
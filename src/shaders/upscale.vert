@@ -0,0 +1,14 @@
+#version 330
+
+// Uniform constants
+uniform vec2 u_sourceScale; // part of the source texture covered by the rendered image
+
+// Vertex shader outputs
+out vec2 texcoord;
+
+void main() {
+    // Full-screen triangle generated from the vertex ID (no vertex buffers needed)
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    texcoord = position * u_sourceScale;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,113 @@
+// Offline ambient occlusion baker for glTF assets.
+//
+// Bakes per-vertex ambient occlusion and writes it to the asset's sidecar
+// cache file (<name>.ao.cache), from which the model viewer loads it.
+//
+
+#include "gltf_io.h"
+#include "gltf_scene.h"
+#include "gltf_cache.h"
+#include "gltf_dedup.h"
+#include "gltf_scene_loader.h"
+#include "gltf_ambient_occlusion.h"
+#include "cg_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Splits a glTF path into directory and filename. Plain filenames are looked
+// up in the assets/gltf directory, as in the viewer.
+void split_gltf_path(const std::string &path, std::string &dir, std::string &filename)
+{
+    size_t separator = path.find_last_of("/\\");
+    if (separator == std::string::npos) {
+        std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
+#ifdef MODEL_VIEWER_DEFAULT_ROOT
+        if (rootDir.empty()) rootDir = MODEL_VIEWER_DEFAULT_ROOT;
+#endif
+        dir = rootDir + "/assets/gltf/";
+        filename = path;
+    } else {
+        dir = path.substr(0, separator + 1);
+        filename = path.substr(separator + 1);
+    }
+}
+
+void print_usage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options] file.gltf...\n"
+              << "  --rays N        Rays per vertex (default 64)\n"
+              << "  --distance D    Maximum ray distance, relative to the scene size (default 0.25)\n"
+              << "  --threads N     Number of threads (default: all hardware threads)\n"
+              << "  --no-dedup      Bake for a viewer that runs with --no-dedup\n";
+}
+
+int main(int argc, char *argv[])
+{
+    gltf::AOBakeSettings settings;
+    bool deduplicate = true;  // As the viewer does, so that the cache matches its buffers
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rays" && hasValue) {
+            settings.raysPerVertex = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--distance" && hasValue) {
+            settings.maxDistance = float(std::atof(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            settings.numThreads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--no-dedup") {
+            deduplicate = false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            filenames.push_back(arg);
+        }
+    }
+    if (filenames.empty()) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    for (const std::string &path : filenames) {
+        std::string dir, filename;
+        split_gltf_path(path, dir, filename);
+        gltf::GLTFAsset asset;
+        // The default scene, which the viewer shows (and caches occlusion for)
+        if (!gltf::load_gltf_scene(filename, dir, -1, asset)) {
+            failures++;
+            continue;
+        }
+        gltf::DedupStats dedupStats;
+        if (deduplicate) gltf::deduplicate_gltf_asset(asset, dedupStats);
+
+        gltf::VertexOcclusion occlusion;
+        gltf::AOBakeStats stats;
+        gltf::bake_ambient_occlusion(asset, settings, occlusion, &stats);
+
+        std::vector<char> payload;
+        gltf::serialize_ambient_occlusion(occlusion, payload);
+        std::string cacheFilename = gltf::cache_filename(dir, filename, "ao");
+        if (!gltf::write_cache_file(cacheFilename, gltf::hash_asset_buffers(asset), payload)) {
+            std::cerr << "Error: could not write " << cacheFilename << std::endl;
+            failures++;
+            continue;
+        }
+
+        double seconds = stats.bvhSeconds + stats.traceSeconds;
+        std::printf("%s: %zu triangles, %zu vertices, %zu rays on %d threads\n", filename.c_str(),
+                    stats.triangles, stats.vertices, stats.rays, stats.threads);
+        std::printf("  BVH %.3f s, trace %.3f s (%.2f Mrays/s), total %.3f s -> %s\n",
+                    stats.bvhSeconds, stats.traceSeconds,
+                    stats.traceSeconds > 0.0 ? stats.rays / stats.traceSeconds * 1e-6 : 0.0,
+                    seconds, cacheFilename.c_str());
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+// Offline optimizer that writes render-ready binary glTF (.glb) files.
+//
+// Loads each .gltf or .glb file with the reader of the viewer, optimizes its
+// geometry and images (see gltf_optimize.h) and writes the result as one .glb
+// file. Files are processed in parallel, with one worker thread per file (up
+// to --threads), and the size and load time of each asset are reported
+// before and after.
+//
+
+#include "gltf_io.h"
+#include "gltf_scene.h"
+#include "gltf_optimize.h"
+#include "cg_parallel.h"
+#include "cg_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    gltf::OptimizeSettings settings;
+    std::string outputDir;  // Empty for the directory of each input file
+    int threads = 0;        // Zero uses all hardware threads
+    int loadRuns = 3;       // The fastest load is reported
+};
+
+struct FileResult {
+    bool ok = false;
+    std::string output;
+    size_t bytesBefore = 0, bytesAfter = 0;
+    double loadMsBefore = 0.0, loadMsAfter = 0.0;
+    gltf::OptimizeStats stats;
+};
+
+// Splits a glTF path into directory and filename. Plain filenames are looked
+// up in the assets/gltf directory, as in the viewer.
+void split_gltf_path(const std::string &path, std::string &dir, std::string &filename)
+{
+    size_t separator = path.find_last_of("/\\");
+    if (separator == std::string::npos) {
+        std::string rootDir = cg::get_env_var("MODEL_VIEWER_ROOT");
+#ifdef MODEL_VIEWER_DEFAULT_ROOT
+        if (rootDir.empty()) rootDir = MODEL_VIEWER_DEFAULT_ROOT;
+#endif
+        dir = rootDir + "/assets/gltf/";
+        filename = path;
+    } else {
+        dir = path.substr(0, separator + 1);
+        filename = path.substr(separator + 1);
+    }
+}
+
+size_t file_size(const std::string &filename)
+{
+    FILE *stream = std::fopen(filename.c_str(), "rb");
+    if (!stream) return 0;
+    std::fseek(stream, 0, SEEK_END);
+    long size = std::ftell(stream);
+    std::fclose(stream);
+    return size > 0 ? size_t(size) : 0;
+}
+
+// Returns the size of a glTF file and of the external files that it refers to
+size_t asset_file_size(const std::string &dir, const std::string &filename,
+                       const gltf::GLTFAsset &asset)
+{
+    std::set<std::string> uris;
+    for (const gltf::Buffer &buffer : asset.buffers) {
+        if (!buffer.uri.empty()) uris.insert(buffer.uri);
+    }
+    for (const gltf::Image &image : asset.images) {
+        if (image.bufferView < 0) uris.insert(image.uri);
+    }
+    size_t size = file_size(dir + filename);
+    for (const std::string &uri : uris) size += file_size(dir + uri);
+    return size;
+}
+
+// Loads an asset a number of times, and returns the fastest time (in
+// milliseconds), or a negative time if it could not be loaded
+double time_load(const std::string &dir, const std::string &filename, int runs,
+                 gltf::GLTFAsset &asset)
+{
+    double best = -1.0;
+    for (int i = 0; i < runs; ++i) {
+        Clock::time_point start = Clock::now();
+        if (!gltf::load_gltf_asset(filename, dir, asset)) return -1.0;
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        best = best < 0.0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+FileResult optimize_file(const std::string &path, const Options &options)
+{
+    FileResult result;
+    std::string dir, filename;
+    split_gltf_path(path, dir, filename);
+    gltf::GLTFAsset asset;
+    result.loadMsBefore = time_load(dir, filename, options.loadRuns, asset);
+    if (result.loadMsBefore < 0.0) return result;
+    result.bytesBefore = asset_file_size(dir, filename, asset);
+    if (!gltf::optimize_gltf_asset(asset, dir, options.settings, result.stats)) return result;
+
+    // <name>.glb, unless that would overwrite the input
+    std::string outputDir = options.outputDir.empty() ? dir : options.outputDir;
+    std::string name = filename.substr(0, filename.find_last_of('.'));
+    result.output = outputDir + name + ".glb";
+    if (result.output == dir + filename) result.output = outputDir + name + ".optimized.glb";
+    if (!gltf::write_glb_asset(result.output, asset)) return result;
+    result.bytesAfter = file_size(result.output);
+
+    std::string outputFilename;
+    split_gltf_path(result.output, dir, outputFilename);
+    result.loadMsAfter = time_load(dir, outputFilename, options.loadRuns, asset);
+    result.ok = result.loadMsAfter >= 0.0;
+    return result;
+}
+
+void print_result(const std::string &path, const FileResult &result)
+{
+    const gltf::OptimizeStats &stats = result.stats;
+    std::printf("%s -> %s\n", path.c_str(), result.output.c_str());
+    std::printf("  size %.3f MB -> %.3f MB, load %.2f ms -> %.2f ms\n", result.bytesBefore / 1e6,
+                result.bytesAfter / 1e6, result.loadMsBefore, result.loadMsAfter);
+    std::printf("  vertices %zu -> %zu, index data %.1f KB -> %.1f KB, ACMR %.3f -> %.3f\n",
+                stats.verticesBefore, stats.verticesAfter, stats.indexBytesBefore / 1e3,
+                stats.indexBytesAfter / 1e3, stats.acmrBefore, stats.acmrAfter);
+    std::printf("  buffers %.3f MB -> %.3f MB, images %zu -> %zu, %zu attributes dropped, "
+                "%zu of %zu primitives shared\n",
+                stats.bufferBytesBefore / 1e6, stats.bufferBytesAfter / 1e6, stats.imagesBefore,
+                stats.imagesAfter, stats.droppedAttributes, stats.sharedPrimitives, stats.primitives);
+}
+
+void print_usage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options] file.gltf|file.glb...\n"
+              << "  --out DIR         Output directory (default: next to each input file)\n"
+              << "  --threads N       Number of files processed at once (default: all hardware threads)\n"
+              << "  --runs N          Loads timed before and after, the fastest is reported (default 3)\n"
+              << "  --no-weld         Keep duplicate vertices\n"
+              << "  --no-reorder      Keep the triangle order\n"
+              << "  --keep-attributes Keep attributes that the viewer does not read\n"
+              << "  --keep-indices    Keep the index type\n";
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--out" && hasValue) {
+            options.outputDir = std::string(argv[++i]) + "/";
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--runs" && hasValue) {
+            options.loadRuns = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--no-weld") {
+            options.settings.weldVertices = false;
+        } else if (arg == "--no-reorder") {
+            options.settings.optimizeVertexCache = false;
+        } else if (arg == "--keep-attributes") {
+            options.settings.dropUnusedAttributes = false;
+        } else if (arg == "--keep-indices") {
+            options.settings.narrowIndices = false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            filenames.push_back(arg);
+        }
+    }
+    if (filenames.empty()) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // One worker per file, taking the next file when it is done
+    std::vector<FileResult> results(filenames.size());
+    std::atomic<size_t> next(0);
+    int threads = options.threads ? options.threads : cg::hardware_threads();
+    threads = std::min(threads, int(filenames.size()));
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(std::thread([&] {
+            for (size_t file = next++; file < filenames.size(); file = next++)
+                results[file] = optimize_file(filenames[file], options);
+        }));
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    int failures = 0;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        if (results[i].ok) {
+            print_result(filenames[i], results[i]);
+        } else {
+            std::cerr << "Error: could not optimize " << filenames[i] << std::endl;
+            failures++;
+        }
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}